@@ -0,0 +1,32 @@
+// Call-heavy microbenchmark comparing the TLS and argument instrumented ABIs.
+//
+// Every iteration makes three calls to small non-inlined functions, so the
+// run time is dominated by how argument and return shadows are passed:
+// through __dfsan_arg_tls/__dfsan_retval_tls or as extra arguments and a
+// {value, label} return pair.  Data stays unlabeled so the label table does
+// not run out; only the call overhead is measured.
+//
+//   make run ITERS=50000000
+
+#include <stdio.h>
+#include <stdlib.h>
+
+__attribute__((noinline)) static long leaf(long a, long b, long c) {
+  return a + b - c;
+}
+
+__attribute__((noinline)) static long mid(long a, long b) {
+  return leaf(a, b, 1) + leaf(b, a, 2);
+}
+
+int main(int argc, char **argv) {
+  long iters = argc > 1 ? atol(argv[1]) : 10000000;
+  long seed = argc > 2 ? atol(argv[2]) : 1;
+
+  long acc = 0;
+  for (long i = 0; i < iters; ++i)
+    acc = mid(acc & 0xff, seed);
+
+  printf("%ld\n", acc);
+  return 0;
+}
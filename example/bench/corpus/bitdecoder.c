@@ -0,0 +1,182 @@
+// Bit-level decoder modeled on entropy-coded media and compression formats.
+//
+// The input is a stream of blocks.  Each block starts with a byte giving the
+// Rice parameter k, then a 16-bit value count, then the values Rice coded
+// (unary quotient, k-bit remainder) and zigzag mapped, as deltas from the
+// previous value.  The decoder reads the stream MSB first through a 64-bit
+// bit buffer.
+//
+//   bitdecoder gen <file> <bytes>    write a deterministic input
+//   bitdecoder <file>                decode it and print a summary
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "peak_rss.h"
+
+static uint32_t rng = 4242;
+static uint32_t next_rand(void) {
+  rng = rng * 1103515245 + 12345;
+  return rng >> 8;
+}
+
+struct bit_reader {
+  FILE *f;
+  uint64_t buf;
+  int bits;
+  int eof;
+};
+
+static void refill(struct bit_reader *r) {
+  while (r->bits <= 56) {
+    uint8_t byte;
+    if (fread(&byte, 1, 1, r->f) != 1) {
+      r->eof = 1;
+      return;
+    }
+    r->buf |= (uint64_t)byte << (56 - r->bits);
+    r->bits += 8;
+  }
+}
+
+static uint32_t get_bits(struct bit_reader *r, int n) {
+  if (n == 0)
+    return 0;
+  if (r->bits < n)
+    refill(r);
+  uint32_t v = (uint32_t)(r->buf >> (64 - n));
+  r->buf <<= n;
+  r->bits -= n;
+  return v;
+}
+
+static uint32_t get_unary(struct bit_reader *r) {
+  uint32_t q = 0;
+  for (;;) {
+    if (r->bits == 0) {
+      refill(r);
+      if (r->bits == 0)
+        return q;
+    }
+    int one = (int)(r->buf >> 63);
+    r->buf <<= 1;
+    r->bits--;
+    if (!one)
+      return q;
+    ++q;
+  }
+}
+
+struct bit_writer {
+  FILE *f;
+  uint64_t buf;
+  int bits;
+  size_t bytes;
+};
+
+static void put_bits(struct bit_writer *w, uint32_t v, int n) {
+  for (int i = n - 1; i >= 0; --i) {
+    w->buf = (w->buf << 1) | ((v >> i) & 1);
+    if (++w->bits == 8) {
+      fputc((int)w->buf, w->f);
+      w->buf = 0;
+      w->bits = 0;
+      w->bytes++;
+    }
+  }
+}
+
+static void flush_bits(struct bit_writer *w) {
+  while (w->bits)
+    put_bits(w, 0, 1);
+}
+
+static int gen(const char *path, size_t bytes) {
+  struct bit_writer w = {fopen(path, "wb"), 0, 0, 0};
+  if (!w.f)
+    return 1;
+  while (w.bytes < bytes) {
+    int k = 2 + next_rand() % 5;
+    uint16_t count = 64 + next_rand() % 512;
+    put_bits(&w, k, 8);
+    put_bits(&w, count, 16);
+    int32_t prev = 0;
+    for (uint16_t i = 0; i < count; ++i) {
+      int32_t v = prev + (int32_t)(next_rand() % (8u << k)) - (4 << k);
+      int32_t d = v - prev;
+      uint32_t z = (uint32_t)((d << 1) ^ (d >> 31));
+      uint32_t q = z >> k;
+      if (q > 64) {
+        // Escape: an all-ones run of 65 followed by the raw 32-bit delta.
+        for (int j = 0; j < 65; ++j)
+          put_bits(&w, 1, 1);
+        put_bits(&w, 0, 1);
+        put_bits(&w, z, 32);
+      } else {
+        for (uint32_t j = 0; j < q; ++j)
+          put_bits(&w, 1, 1);
+        put_bits(&w, 0, 1);
+        put_bits(&w, z & ((1u << k) - 1), k);
+      }
+      prev = v;
+    }
+    flush_bits(&w);
+  }
+  fclose(w.f);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc == 4 && !strcmp(argv[1], "gen"))
+    return gen(argv[2], strtoul(argv[3], 0, 0));
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s gen <file> <bytes> | %s <file>\n", argv[0],
+            argv[0]);
+    return 2;
+  }
+
+  struct bit_reader r = {fopen(argv[1], "rb"), 0, 0, 0};
+  if (!r.f)
+    return 1;
+  long blocks = 0, values = 0, escapes = 0, bad = 0;
+  int64_t sum = 0;
+  uint32_t hist[16] = {0};
+  while (!r.eof || r.bits >= 24) {
+    refill(&r);
+    if (r.bits < 24)
+      break;
+    int k = (int)get_bits(&r, 8);
+    uint32_t count = get_bits(&r, 16);
+    if (k > 24) {
+      bad++;
+      break;
+    }
+    int32_t prev = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+      uint32_t q = get_unary(&r), z;
+      if (q == 65) {
+        z = get_bits(&r, 32);
+        escapes++;
+      } else {
+        z = (q << k) | get_bits(&r, k);
+      }
+      int32_t d = (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+      prev += d;
+      sum += prev;
+      hist[(uint32_t)prev >> 28]++;
+      values++;
+    }
+    // Blocks are byte aligned.
+    int pad = r.bits & 7;
+    get_bits(&r, pad);
+    blocks++;
+  }
+  fclose(r.f);
+
+  printf("blocks=%ld values=%ld escapes=%ld sum=%lld bad=%ld hist0=%u\n",
+         blocks, values, escapes, (long long)sum, bad, hist[0]);
+  print_peak_rss();
+  return 0;
+}
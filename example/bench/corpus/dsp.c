@@ -0,0 +1,147 @@
+// Float-heavy signal processing loop modeled on audio and sensor pipelines.
+//
+// The input is 16-bit little endian PCM.  Samples are converted to float,
+// run through a 32-tap FIR low-pass filter, decimated by 4, high-passed by
+// subtracting a 16-sample moving average, and split into 256-sample frames
+// whose RMS level, peak and zero crossings drive a simple voice activity
+// decision.  There are no recursive filters, so a labeled sample affects a
+// bounded window of outputs, as in the block-based codecs this models.
+//
+//   dsp gen <file> <bytes>    write a deterministic input
+//   dsp <file>                process it and print a summary
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "peak_rss.h"
+
+#define TAPS 32
+#define FRAME 256
+#define DECIMATE 4
+#define AVG 16
+
+static uint32_t rng = 99;
+static uint32_t next_rand(void) {
+  rng = rng * 1103515245 + 12345;
+  return rng >> 8;
+}
+
+static float fir_coeffs[TAPS];
+
+static void init_fir(void) {
+  // Windowed sinc with cutoff at a quarter of the sample rate.
+  float sum = 0;
+  for (int i = 0; i < TAPS; ++i) {
+    float x = i - (TAPS - 1) / 2.0f;
+    float sinc = x == 0 ? 0.5f : sinf(0.5f * (float)M_PI * x) / ((float)M_PI * x);
+    float window = 0.54f - 0.46f * cosf(2 * (float)M_PI * i / (TAPS - 1));
+    fir_coeffs[i] = sinc * window;
+    sum += fir_coeffs[i];
+  }
+  for (int i = 0; i < TAPS; ++i)
+    fir_coeffs[i] /= sum;
+}
+
+struct summary {
+  long frames, active, crossings;
+  double energy;
+  float peak;
+};
+
+static void frame_stats(const float *f, struct summary *s) {
+  double sq = 0;
+  float peak = 0;
+  int crossings = 0;
+  for (int i = 0; i < FRAME; ++i) {
+    sq += f[i] * f[i];
+    float a = fabsf(f[i]);
+    if (a > peak)
+      peak = a;
+    if (i && (f[i] < 0) != (f[i - 1] < 0))
+      crossings++;
+  }
+  float rms = sqrtf((float)(sq / FRAME));
+  s->frames++;
+  s->energy += sq;
+  s->crossings += crossings;
+  if (peak > s->peak)
+    s->peak = peak;
+  if (rms > 0.05f && crossings < FRAME / 4)
+    s->active++;
+}
+
+static int gen(const char *path, size_t bytes) {
+  FILE *f = fopen(path, "wb");
+  if (!f)
+    return 1;
+  for (size_t i = 0; i < bytes / 2; ++i) {
+    // A tone that switches on and off, a slow sweep and some noise.
+    float t = i / 16000.0f;
+    float gate = ((i / 8000) & 1) ? 1.0f : 0.1f;
+    float v = gate * 0.4f * sinf(2 * (float)M_PI * 440 * t) +
+              0.2f * sinf(2 * (float)M_PI * (50 + 20 * t) * t) +
+              0.05f * ((int)(next_rand() % 2001) - 1000) / 1000.0f;
+    int16_t s = (int16_t)(v * 32767);
+    uint8_t b[2] = {(uint8_t)s, (uint8_t)(s >> 8)};
+    fwrite(b, 1, 2, f);
+  }
+  fclose(f);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc == 4 && !strcmp(argv[1], "gen"))
+    return gen(argv[2], strtoul(argv[3], 0, 0));
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s gen <file> <bytes> | %s <file>\n", argv[0],
+            argv[0]);
+    return 2;
+  }
+
+  FILE *f = fopen(argv[1], "rb");
+  if (!f)
+    return 1;
+  init_fir();
+  float history[TAPS] = {0};
+  float lowpassed[AVG] = {0};
+  int avg_pos = 0;
+  float frame[FRAME];
+  int pos = 0, hist_pos = 0;
+  long n = 0;
+  struct summary s = {0};
+
+  uint8_t buf[4096];
+  size_t got;
+  while ((got = fread(buf, 1, sizeof(buf), f)) >= 2) {
+    for (size_t i = 0; i + 1 < got; i += 2) {
+      int16_t raw = (int16_t)(buf[i] | (buf[i + 1] << 8));
+      history[hist_pos] = raw / 32768.0f;
+      hist_pos = (hist_pos + 1) % TAPS;
+      if (++n % DECIMATE)
+        continue;
+      float acc = 0;
+      for (int k = 0; k < TAPS; ++k)
+        acc += fir_coeffs[k] * history[(hist_pos + k) % TAPS];
+      lowpassed[avg_pos] = acc;
+      avg_pos = (avg_pos + 1) % AVG;
+      float mean = 0;
+      for (int k = 0; k < AVG; ++k)
+        mean += lowpassed[k];
+      frame[pos++] = acc - mean / AVG;
+      if (pos == FRAME) {
+        frame_stats(frame, &s);
+        pos = 0;
+      }
+    }
+  }
+  fclose(f);
+
+  printf("samples=%ld frames=%ld active=%ld crossings=%ld energy=%.4f "
+         "peak=%.4f\n",
+         n, s.frames, s.active, s.crossings, s.energy, s.peak);
+  print_peak_rss();
+  return 0;
+}
@@ -0,0 +1,24 @@
+// Shared by the corpus programs: reports the peak resident set size of this
+// process on stderr for run_corpus.py.  getrusage() and wait4() would also
+// count the memory of the driver that forked the process, which dwarfs the
+// smaller native runs.
+
+#ifndef PEAK_RSS_H
+#define PEAK_RSS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void print_peak_rss(void) {
+  FILE *f = fopen("/proc/self/status", "r");
+  if (!f)
+    return;
+  char line[256];
+  while (fgets(line, sizeof(line), f))
+    if (!strncmp(line, "VmHWM:", 6))
+      fprintf(stderr, "peak_rss_kb=%ld\n", strtol(line + 6, NULL, 10));
+  fclose(f);
+}
+
+#endif // PEAK_RSS_H
@@ -0,0 +1,182 @@
+// Multi-threaded pipeline modeled on chunked ingest services.
+//
+// A reader thread read()s the input in 16 KB chunks into a bounded queue.
+// Worker threads take chunks, compute a table-driven CRC-32, a byte
+// histogram and the longest run of equal bytes, and merge them into shared
+// totals under a mutex.
+//
+//   pipeline gen <file> <bytes>    write a deterministic input
+//   pipeline <file> [threads]      process it and print a summary
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "peak_rss.h"
+
+#define CHUNK 16384
+#define QUEUE 8
+#define MAX_WORKERS 16
+
+static uint32_t rng = 31337;
+static uint32_t next_rand(void) {
+  rng = rng * 1103515245 + 12345;
+  return rng >> 8;
+}
+
+static uint32_t crc_table[256];
+
+static void init_crc(void) {
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; ++k)
+      c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+    crc_table[i] = c;
+  }
+}
+
+struct chunk {
+  uint8_t data[CHUNK];
+  ssize_t len;
+  long index;
+};
+
+static struct chunk queue[QUEUE];
+static int head, tail, count, done;
+static pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t not_full = PTHREAD_COND_INITIALIZER;
+
+static struct {
+  uint32_t crc_xor;
+  uint64_t hist[256];
+  long longest_run;
+  long chunks;
+} totals;
+
+static int fd;
+
+static void *reader(void *arg) {
+  (void)arg;
+  for (long index = 0;; ++index) {
+    pthread_mutex_lock(&mu);
+    while (count == QUEUE)
+      pthread_cond_wait(&not_full, &mu);
+    struct chunk *c = &queue[tail];
+    pthread_mutex_unlock(&mu);
+
+    // Only the reader writes slots between tail and head.
+    c->len = read(fd, c->data, CHUNK);
+    c->index = index;
+
+    pthread_mutex_lock(&mu);
+    if (c->len <= 0) {
+      done = 1;
+      pthread_cond_broadcast(&not_empty);
+      pthread_mutex_unlock(&mu);
+      return NULL;
+    }
+    tail = (tail + 1) % QUEUE;
+    count++;
+    pthread_cond_signal(&not_empty);
+    pthread_mutex_unlock(&mu);
+  }
+}
+
+static void *worker(void *arg) {
+  (void)arg;
+  struct chunk local;
+  for (;;) {
+    pthread_mutex_lock(&mu);
+    while (count == 0 && !done)
+      pthread_cond_wait(&not_empty, &mu);
+    if (count == 0) {
+      pthread_mutex_unlock(&mu);
+      return NULL;
+    }
+    local = queue[head];
+    head = (head + 1) % QUEUE;
+    count--;
+    pthread_cond_signal(&not_full);
+    pthread_mutex_unlock(&mu);
+
+    uint32_t crc = 0xFFFFFFFFu;
+    uint64_t hist[256] = {0};
+    long run = 1, longest = 1;
+    for (ssize_t i = 0; i < local.len; ++i) {
+      uint8_t b = local.data[i];
+      crc = crc_table[(crc ^ b) & 0xFF] ^ (crc >> 8);
+      hist[b]++;
+      if (i && b == local.data[i - 1]) {
+        if (++run > longest)
+          longest = run;
+      } else {
+        run = 1;
+      }
+    }
+
+    pthread_mutex_lock(&mu);
+    totals.crc_xor ^= ~crc;
+    for (int i = 0; i < 256; ++i)
+      totals.hist[i] += hist[i];
+    if (longest > totals.longest_run)
+      totals.longest_run = longest;
+    totals.chunks++;
+    pthread_mutex_unlock(&mu);
+  }
+}
+
+static int gen(const char *path, size_t bytes) {
+  FILE *f = fopen(path, "wb");
+  if (!f)
+    return 1;
+  // Runs of repeated bytes between stretches of noise.
+  for (size_t i = 0; i < bytes;) {
+    uint8_t b = next_rand();
+    size_t run = next_rand() % 4 ? 1 : 1 + next_rand() % 64;
+    for (size_t j = 0; j < run && i < bytes; ++j, ++i)
+      fputc(b, f);
+  }
+  fclose(f);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc == 4 && !strcmp(argv[1], "gen"))
+    return gen(argv[2], strtoul(argv[3], 0, 0));
+  if (argc != 2 && argc != 3) {
+    fprintf(stderr, "usage: %s gen <file> <bytes> | %s <file> [threads]\n",
+            argv[0], argv[0]);
+    return 2;
+  }
+  int workers = argc == 3 ? atoi(argv[2]) : 4;
+  if (workers < 1 || workers > MAX_WORKERS)
+    workers = 4;
+
+  fd = open(argv[1], O_RDONLY);
+  if (fd < 0)
+    return 1;
+  init_crc();
+
+  pthread_t reader_thread, worker_threads[MAX_WORKERS];
+  pthread_create(&reader_thread, NULL, reader, NULL);
+  for (int i = 0; i < workers; ++i)
+    pthread_create(&worker_threads[i], NULL, worker, NULL);
+  pthread_join(reader_thread, NULL);
+  for (int i = 0; i < workers; ++i)
+    pthread_join(worker_threads[i], NULL);
+  close(fd);
+
+  uint64_t distinct = 0;
+  for (int i = 0; i < 256; ++i)
+    distinct += totals.hist[i] != 0;
+  printf("chunks=%ld crc_xor=%08x distinct=%llu longest_run=%ld\n",
+         totals.chunks, totals.crc_xor, (unsigned long long)distinct,
+         totals.longest_run);
+  print_peak_rss();
+  return 0;
+}
@@ -0,0 +1,177 @@
+// TLV container parser modeled on ELF/PNG-style section walkers.
+//
+// The input is a header ("TLVB", version, record count, section table
+// offset) followed by type-length-value records and a section table.  The
+// parser validates the header, walks the records (recursing into nested
+// containers), and checks every section table entry against the file size.
+//
+//   tlv_parser gen <file> <bytes>    write a deterministic input
+//   tlv_parser <file>                parse it and print a summary
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "peak_rss.h"
+
+enum { kInt = 1, kString = 2, kNested = 3, kBlob = 4 };
+
+static uint32_t rng = 12345;
+static uint32_t next_rand(void) {
+  rng = rng * 1103515245 + 12345;
+  return rng >> 8;
+}
+
+static uint16_t rd16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static uint32_t rd32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+static void wr16(uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static void wr32(uint8_t *p, uint32_t v) {
+  wr16(p, v);
+  wr16(p + 2, v >> 16);
+}
+
+struct summary {
+  long ints, strings, nested, blobs, printable, bad;
+  uint32_t int_sum;
+};
+
+static void parse_records(const uint8_t *p, size_t n, int depth,
+                          struct summary *s) {
+  size_t off = 0;
+  while (off + 3 <= n) {
+    uint8_t type = p[off];
+    uint16_t len = rd16(p + off + 1);
+    off += 3;
+    if (len > n - off) {
+      s->bad++;
+      return;
+    }
+    const uint8_t *v = p + off;
+    switch (type) {
+    case kInt:
+      if (len == 4) {
+        s->ints++;
+        s->int_sum += rd32(v);
+      } else {
+        s->bad++;
+      }
+      break;
+    case kString:
+      s->strings++;
+      for (uint16_t i = 0; i < len; ++i)
+        if (v[i] >= 0x20 && v[i] < 0x7f)
+          s->printable++;
+      break;
+    case kNested:
+      s->nested++;
+      if (depth < 4)
+        parse_records(v, len, depth + 1, s);
+      break;
+    case kBlob:
+      s->blobs++;
+      break;
+    default:
+      s->bad++;
+      break;
+    }
+    off += len;
+  }
+}
+
+static size_t gen_records(uint8_t *p, size_t n, int depth) {
+  size_t off = 0;
+  // Leaves room for the largest record: 51 bytes, or a nested one at the top.
+  while (off + 51 + (depth ? 0 : 259) <= n) {
+    uint8_t type = 1 + next_rand() % 4;
+    if (type == kNested && depth)
+      type = kBlob;
+    uint16_t len = type == kInt ? 4 : 1 + next_rand() % 48;
+    if (type == kNested) {
+      len = gen_records(p + off + 3, 256, depth + 1);
+    } else {
+      for (uint16_t i = 0; i < len; ++i)
+        p[off + 3 + i] = type == kString ? 'a' + next_rand() % 30
+                                         : next_rand();
+    }
+    p[off] = type;
+    wr16(p + off + 1, len);
+    off += 3 + len;
+  }
+  return off;
+}
+
+static int gen(const char *path, size_t bytes) {
+  if (bytes < 4096)
+    bytes = 4096;
+  uint8_t *buf = calloc(bytes, 1);
+  size_t table_entries = 64;
+  size_t table_off = bytes - table_entries * 8;
+  size_t body = gen_records(buf + 16, table_off - 16, 0);
+  memcpy(buf, "TLVB", 4);
+  wr16(buf + 4, 1);
+  wr32(buf + 8, (uint32_t)body);
+  wr32(buf + 12, (uint32_t)table_off);
+  for (size_t i = 0; i < table_entries; ++i) {
+    wr32(buf + table_off + i * 8, next_rand() % bytes);
+    wr32(buf + table_off + i * 8 + 4, next_rand() % 4096);
+  }
+  FILE *f = fopen(path, "wb");
+  if (!f)
+    return 1;
+  fwrite(buf, 1, bytes, f);
+  fclose(f);
+  free(buf);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc == 4 && !strcmp(argv[1], "gen"))
+    return gen(argv[2], strtoul(argv[3], 0, 0));
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s gen <file> <bytes> | %s <file>\n", argv[0],
+            argv[0]);
+    return 2;
+  }
+
+  FILE *f = fopen(argv[1], "rb");
+  if (!f)
+    return 1;
+  size_t cap = 1 << 16, n = 0;
+  uint8_t *buf = malloc(cap);
+  size_t got;
+  while ((got = fread(buf + n, 1, 4096, f)) > 0) {
+    n += got;
+    if (n + 4096 > cap)
+      buf = realloc(buf, cap *= 2);
+  }
+  fclose(f);
+
+  if (n < 16 || memcmp(buf, "TLVB", 4) != 0 || rd16(buf + 4) != 1) {
+    printf("bad header\n");
+    return 1;
+  }
+  uint32_t body = rd32(buf + 8), table_off = rd32(buf + 12);
+  struct summary s = {0};
+  if (body <= n - 16)
+    parse_records(buf + 16, body, 0, &s);
+  else
+    s.bad++;
+
+  long sections_ok = 0;
+  for (uint32_t off = table_off; off + 8 <= n; off += 8) {
+    uint32_t sec_off = rd32(buf + off), sec_size = rd32(buf + off + 4);
+    if (sec_off < n && sec_size <= n - sec_off)
+      sections_ok++;
+  }
+
+  printf("ints=%ld sum=%u strings=%ld printable=%ld nested=%ld blobs=%ld "
+         "bad=%ld sections_ok=%ld\n",
+         s.ints, s.int_sum, s.strings, s.printable, s.nested, s.blobs, s.bad,
+         sections_ok);
+  free(buf);
+  print_peak_rss();
+  return 0;
+}
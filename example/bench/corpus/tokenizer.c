@@ -0,0 +1,199 @@
+// Text tokenizer and number parser modeled on config and source file readers.
+//
+// The input is lines of identifiers, integer and floating point literals,
+// strings and operators.  Every token is classified, numbers are converted by
+// hand (as hand-written parsers do), and identifiers are interned in a hash
+// table.
+//
+//   tokenizer gen <file> <bytes>    write a deterministic input
+//   tokenizer <file>                tokenize it and print a summary
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "peak_rss.h"
+
+static uint32_t rng = 777;
+static uint32_t next_rand(void) {
+  rng = rng * 1103515245 + 12345;
+  return rng >> 8;
+}
+
+#define TABLE_SIZE 32768
+static uint32_t table[TABLE_SIZE];
+
+struct summary {
+  long idents, unique, ints, floats, strings, ops, lines, bad;
+  long long int_sum;
+  double float_sum;
+};
+
+static int is_ident(int c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' ||
+         (c >= '0' && c <= '9');
+}
+
+static void intern(const char *p, size_t n, struct summary *s) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < n; ++i)
+    h = (h ^ (uint8_t)p[i]) * 16777619u;
+  if (!h)
+    h = 1;
+  for (uint32_t i = 0; i < TABLE_SIZE; ++i) {
+    uint32_t *slot = &table[(h + i) & (TABLE_SIZE - 1)];
+    if (*slot == h)
+      return;
+    if (!*slot) {
+      *slot = h;
+      s->unique++;
+      return;
+    }
+  }
+}
+
+// Parses a decimal literal starting at p; returns its length.
+static size_t number(const char *p, size_t n, struct summary *s) {
+  size_t i = 0;
+  long long v = 0;
+  while (i < n && p[i] >= '0' && p[i] <= '9')
+    v = v * 10 + (p[i++] - '0');
+  if (i < n && (p[i] == '.' || p[i] == 'e')) {
+    double d = (double)v, scale = 0.1;
+    if (p[i] == '.') {
+      ++i;
+      while (i < n && p[i] >= '0' && p[i] <= '9') {
+        d += (p[i++] - '0') * scale;
+        scale /= 10;
+      }
+    }
+    if (i < n && p[i] == 'e') {
+      int neg = 0, e = 0;
+      ++i;
+      if (i < n && (p[i] == '-' || p[i] == '+'))
+        neg = p[i++] == '-';
+      while (i < n && p[i] >= '0' && p[i] <= '9')
+        e = e * 10 + (p[i++] - '0');
+      while (e-- > 0)
+        d = neg ? d / 10 : d * 10;
+    }
+    s->floats++;
+    s->float_sum += d;
+  } else {
+    s->ints++;
+    s->int_sum += v;
+  }
+  return i;
+}
+
+static void tokenize(const char *p, size_t n, struct summary *s) {
+  size_t i = 0;
+  while (i < n) {
+    char c = p[i];
+    if (c == '\n') {
+      s->lines++;
+      ++i;
+    } else if (c == ' ' || c == '\t') {
+      ++i;
+    } else if (c >= '0' && c <= '9') {
+      i += number(p + i, n - i, s);
+    } else if (is_ident(c)) {
+      size_t j = i;
+      while (j < n && is_ident(p[j]))
+        ++j;
+      intern(p + i, j - i, s);
+      s->idents++;
+      i = j;
+    } else if (c == '"') {
+      size_t j = i + 1;
+      while (j < n && p[j] != '"' && p[j] != '\n')
+        j += p[j] == '\\' ? 2 : 1;
+      s->strings++;
+      i = j + 1;
+    } else if (strchr("=+-*/;(),<>", c)) {
+      if (i + 1 < n && p[i + 1] == '=' && strchr("=<>", c))
+        ++i;
+      s->ops++;
+      ++i;
+    } else {
+      s->bad++;
+      ++i;
+    }
+  }
+}
+
+static int gen(const char *path, size_t bytes) {
+  static const char *ops[] = {" = ", " + ", " * ", " - ", " / ", " <= ",
+                              " == ", ", "};
+  FILE *f = fopen(path, "wb");
+  if (!f)
+    return 1;
+  size_t written = 0;
+  char line[256];
+  while (written < bytes) {
+    int len = 0;
+    int tokens = 2 + next_rand() % 8;
+    for (int t = 0; t < tokens; ++t) {
+      switch (next_rand() % 4) {
+      case 0:
+        len += sprintf(line + len, "v%u_%c", next_rand() % 500,
+                       'a' + next_rand() % 26);
+        break;
+      case 1:
+        len += sprintf(line + len, "%u", next_rand() % 100000);
+        break;
+      case 2:
+        len += sprintf(line + len, "%u.%ue%d", next_rand() % 1000,
+                       next_rand() % 1000, (int)(next_rand() % 7) - 3);
+        break;
+      default:
+        len += sprintf(line + len, "\"s%u\"", next_rand() % 100);
+        break;
+      }
+      len += sprintf(line + len, "%s", ops[next_rand() % 8]);
+    }
+    len += sprintf(line + len, "end;\n");
+    fwrite(line, 1, len, f);
+    written += len;
+  }
+  fclose(f);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc == 4 && !strcmp(argv[1], "gen"))
+    return gen(argv[2], strtoul(argv[3], 0, 0));
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s gen <file> <bytes> | %s <file>\n", argv[0],
+            argv[0]);
+    return 2;
+  }
+
+  FILE *f = fopen(argv[1], "rb");
+  if (!f)
+    return 1;
+  struct summary s = {0};
+  // Lines are tokenized as they are read; a partial line is carried over.
+  char buf[8192];
+  size_t keep = 0, got;
+  while ((got = fread(buf + keep, 1, sizeof(buf) - keep, f)) > 0) {
+    size_t n = keep + got, end = n;
+    while (end > 0 && buf[end - 1] != '\n')
+      --end;
+    if (end == 0)
+      end = n;
+    tokenize(buf, end, &s);
+    keep = n - end;
+    memmove(buf, buf + end, keep);
+  }
+  tokenize(buf, keep, &s);
+  fclose(f);
+
+  printf("lines=%ld idents=%ld unique=%ld ints=%ld int_sum=%lld floats=%ld "
+         "float_sum=%.3f strings=%ld ops=%ld bad=%ld\n",
+         s.lines, s.idents, s.unique, s.ints, s.int_sum, s.floats,
+         s.float_sum, s.strings, s.ops, s.bad);
+  print_peak_rss();
+  return 0;
+}
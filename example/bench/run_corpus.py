@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+# End-to-end overhead driver for the programs in corpus/.
+#
+# Each program is built natively and with -fsanitize=dataflow, generates its
+# own deterministic input, and is run natively and then instrumented once
+# per FREAD_BYTE_IDX in the sweep ("none" runs without a labeled byte).  One
+# csv row is written per instrumented run:
+#
+#   program,input_bytes,byte_idx,native_s,dfsan_s,slowdown,native_rss_kb,
+#   dfsan_rss_kb,labels,log_bytes,status
+#
+# Times are the minimum over --runs runs, peak RSS is the VmHWM each program
+# reports on exit (see corpus/peak_rss.h), labels is the number of rows in
+# gradient.csv and log_bytes the size of gradient.csv and branches.csv
+# together.  status is "ok", "mismatch" when
+# the instrumented output differs from the native one, or how the run failed.
+# Only the Python standard library and the clang in --llvm-bin are needed.
+#
+#   python3 run_corpus.py --out corpus.csv
+#   python3 run_corpus.py --programs dsp,tokenizer --idx none,100 --runs 5
+
+import argparse
+import csv
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+CORPUS = os.path.join(HERE, 'corpus')
+
+# Input sizes keep the native runs in the tens of milliseconds.
+PROGRAMS = [
+    ('tlv_parser', 4 << 20),
+    ('tokenizer', 2 << 20),
+    ('bitdecoder', 1 << 20),
+    ('dsp', 4 << 20),
+    ('pipeline', 8 << 20),
+]
+
+
+def build(cc, src, out, flags):
+  cmd = [cc, '-O2', '-g', src, '-o', out, '-lm', '-lpthread'] + flags
+  subprocess.check_call(cmd)
+
+
+def run(cmd, env, stdout_path, workdir):
+  """Runs cmd and returns (seconds, peak RSS in KB, status string)."""
+  stderr_path = stdout_path + '.stderr'
+  with open(stdout_path, 'wb') as out, open(stderr_path, 'wb') as err:
+    start = time.monotonic()
+    proc = subprocess.run(cmd, env=env, stdout=out, stderr=err, cwd=workdir)
+    elapsed = time.monotonic() - start
+  rss = 0
+  with open(stderr_path, 'rb') as err:
+    for line in err:
+      if line.startswith(b'peak_rss_kb='):
+        rss = int(line.split(b'=')[1])
+  if proc.returncode < 0:
+    return elapsed, rss, 'signal %d' % -proc.returncode
+  return elapsed, rss, 'ok' if proc.returncode == 0 else 'exit %d' % proc.returncode
+
+
+def count_rows(path):
+  if not os.path.exists(path):
+    return 0
+  with open(path, 'rb') as f:
+    return max(0, sum(1 for _ in f) - 1)
+
+
+def file_size(path):
+  return os.path.getsize(path) if os.path.exists(path) else 0
+
+
+def same_output(a, b):
+  with open(a, 'rb') as fa, open(b, 'rb') as fb:
+    return fa.read() == fb.read()
+
+
+def main():
+  parser = argparse.ArgumentParser(
+      description='Measure dfsan overhead on the benchmark corpus.')
+  parser.add_argument('--llvm-bin', default=os.path.join(HERE, '..', '..',
+                                                         'build', 'bin'))
+  parser.add_argument('--programs', default=','.join(p for p, _ in PROGRAMS))
+  parser.add_argument('--idx', default='none,16,4097,65537',
+                      help='comma separated FREAD_BYTE_IDX values')
+  parser.add_argument('--runs', type=int, default=3)
+  parser.add_argument('--scale', type=float, default=1.0,
+                      help='multiplies every input size')
+  parser.add_argument('--abi', choices=['tls', 'args'], default='tls')
+  parser.add_argument('--out', default='-')
+  args = parser.parse_args()
+
+  cc = os.path.join(args.llvm_bin, 'clang')
+  dfsan_flags = ['-fsanitize=dataflow']
+  if args.abi == 'args':
+    dfsan_flags += ['-mllvm', '-dfsan-args-abi']
+  wanted = args.programs.split(',')
+  sweep = args.idx.split(',')
+
+  out = sys.stdout if args.out == '-' else open(args.out, 'w', newline='')
+  writer = csv.writer(out)
+  writer.writerow(['program', 'input_bytes', 'byte_idx', 'native_s',
+                   'dfsan_s', 'slowdown', 'native_rss_kb', 'dfsan_rss_kb',
+                   'labels', 'log_bytes', 'status'])
+
+  with tempfile.TemporaryDirectory(prefix='dfsan-corpus-') as work:
+    for name, size in PROGRAMS:
+      if name not in wanted:
+        continue
+      size = int(size * args.scale)
+      src = os.path.join(CORPUS, name + '.c')
+      native = os.path.join(work, name + '.native')
+      dfsan = os.path.join(work, name + '.dfsan')
+      build(cc, src, native, [])
+      build(cc, src, dfsan, dfsan_flags)
+
+      data = os.path.join(work, name + '.input')
+      subprocess.check_call([native, 'gen', data, str(size)])
+      input_bytes = os.path.getsize(data)
+
+      native_out = os.path.join(work, name + '.native.out')
+      env = dict(os.environ)
+      env.pop('FREAD_BYTE_IDX', None)
+      env.pop('DFSAN_OPTIONS', None)
+      results = [run([native, data], env, native_out, work)
+                 for _ in range(args.runs)]
+      native_s = min(r[0] for r in results)
+      native_rss = max(r[1] for r in results)
+
+      for idx in sweep:
+        logdir = os.path.join(work, '%s.%s' % (name, idx))
+        os.makedirs(logdir, exist_ok=True)
+        gradient = os.path.join(logdir, 'gradient.csv')
+        branches = os.path.join(logdir, 'branches.csv')
+        denv = dict(env)
+        denv['DFSAN_OPTIONS'] = ':'.join([
+            'gradient_logfile=' + gradient, 'branch_logfile=' + branches,
+            'warn_unimplemented=0'])
+        if idx != 'none':
+          denv['FREAD_BYTE_IDX'] = idx
+        dfsan_out = os.path.join(logdir, 'stdout')
+
+        times, rss, status = [], 0, 'ok'
+        for _ in range(args.runs):
+          t, r, status = run([dfsan, data], denv, dfsan_out, logdir)
+          times.append(t)
+          rss = max(rss, r)
+          if status != 'ok':
+            break
+        if status == 'ok' and not same_output(native_out, dfsan_out):
+          status = 'mismatch'
+        dfsan_s = min(times)
+        writer.writerow([
+            name, input_bytes, idx, '%.4f' % native_s, '%.4f' % dfsan_s,
+            '%.2f' % (dfsan_s / native_s if native_s else 0), native_rss,
+            rss, count_rows(gradient),
+            file_size(gradient) + file_size(branches), status])
+        out.flush()
+
+  if out is not sys.stdout:
+    out.close()
+
+
+if __name__ == '__main__':
+  main()
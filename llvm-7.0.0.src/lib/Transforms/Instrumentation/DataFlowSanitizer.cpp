@@ -54,6 +54,7 @@
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/ADT/Triple.h"
 #include "llvm/Transforms/Utils/Local.h"
@@ -62,6 +63,7 @@
 #include "llvm/IR/Attributes.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/CallSite.h"
+#include "llvm/IR/CallingConv.h"
 #include "llvm/IR/Constant.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DataLayout.h"
@@ -89,9 +91,13 @@
 #include "llvm/Support/Casting.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/MD5.h"
 #include "llvm/Support/SpecialCaseList.h"
 #include "llvm/Transforms/Instrumentation.h"
+#include "llvm/Transforms/Instrumentation/DataFlowSanitizer.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
 //#include "Annotation.h"
 #include <algorithm>
 #include <cassert>
@@ -103,7 +109,6 @@
 #include <string>
 #include <utility>
 #include <vector>
-#include <atomic>
 #include <functional>
 
 using namespace llvm;
@@ -167,6 +172,214 @@ static cl::opt<bool> ClDebugNonzeroLabels(
              "load or return with a nonzero label"),
     cl::Hidden);
 
+// Selects the two-level sparse shadow layout: a directory of pointers to 64K
+// entry shadow chunks which the runtime allocates on first labelled store.
+// The layout constants below must match dfsan_platform.h.
+static cl::opt<bool> ClTwoLevelShadow(
+    "dfsan-two-level-shadow",
+    cl::desc("Use a two-level sparse shadow instead of the flat shadow"),
+    cl::Hidden, cl::init(false));
+
+static const uint64_t kShadowDirAddr = 0x10000;
+static const unsigned kShadowChunkShift = 16;
+static const uint64_t kShadowChunkSize = 1ULL << kShadowChunkShift;
+static const uint64_t kShadowDirSize = (1ULL << (44 - kShadowChunkShift)) * 8;
+static const uint64_t kShadowZeroChunkAddr = kShadowDirAddr + kShadowDirSize;
+static const uint64_t kShadowScratchChunkAddr =
+    kShadowZeroChunkAddr + kShadowChunkSize * 2;
+
+// Number of application bytes sharing one shadow slot (1, 4 or 8).  With
+// coarser granularity a sub-word store that would give part of a word a
+// different label makes the runtime keep that word's labels per byte; the
+// word's slot then holds kMixedShadowLabel, which is defined for the runtime
+// in compiler-rt/lib/dfsan/dfsan.h and must match it.
+static cl::opt<unsigned> ClShadowGranularity(
+    "dfsan-shadow-granularity",
+    cl::desc("Number of application bytes covered by one shadow label"),
+    cl::Hidden, cl::init(1));
+
+static const uint64_t kMixedShadowLabel = 0xFFFE;
+
+// Controls whether calls to common integer and floating point intrinsics get
+// a single call to a runtime derivative kernel instead of a chain of unions
+// that lose the gradient.
+static cl::opt<bool> ClIntrinsicDerivs(
+    "dfsan-intrinsic-derivs",
+    cl::desc("Compute derivatives of bswap, ctpop, sqrt, fma and other "
+             "intrinsics in the runtime"),
+    cl::Hidden, cl::init(true));
+
+// Intrinsics with derivative kernels in the runtime.  The values continue
+// the LLVM opcode numbering that labels record as their provenance and must
+// match IntrinsicKind in dfsan.cc.  Kinds before DI_Fabs take one integer
+// operand, the others up to three floating point operands.
+enum DerivIntrinsic : unsigned {
+  DI_None = 0,
+  DI_Bswap = 65,
+  DI_Ctpop,
+  DI_Ctlz,
+  DI_Cttz,
+  DI_Fabs,
+  DI_Sqrt,
+  DI_Fma,
+  DI_MinNum,
+  DI_MaxNum,
+  DI_CopySign,
+  DI_Floor,
+  DI_Ceil,
+  DI_Trunc,
+  DI_Rint,
+  DI_Round,
+  DI_Exp,
+  DI_Exp2,
+  DI_Log,
+  DI_Log2,
+  DI_Log10,
+  DI_Pow,
+  DI_Sin,
+  DI_Cos,
+};
+
+// Controls whether branch visitors and typed unions take a pointer to a
+// descriptor in a per-module site table instead of their static arguments.
+static cl::opt<bool> ClSiteTables(
+    "dfsan-site-tables",
+    cl::desc("Pass static branch and union arguments through a per-module "
+             "table of site descriptors registered at startup"),
+    cl::Hidden, cl::init(true));
+
+// Controls whether calls to the union, branch visitor and memcpy entry points
+// go through stubs with the preserve_most calling convention.  The caller
+// then keeps its live values in registers across the call and the stub saves
+// the registers the runtime clobbers instead.
+static cl::opt<bool> ClPreserveMost(
+    "dfsan-preserve-most",
+    cl::desc("Call the union, branch visitor and memcpy entry points through "
+             "preserve_most stubs (x86-64 and AArch64 only)"),
+    cl::Hidden, cl::init(false));
+
+// Controls whether functions which can never see data derived from input
+// are instrumented only to keep the labels of their callers and callees
+// correct.  The analysis assumes it sees the whole program, as at LTO time.
+static cl::opt<bool> ClInputReachability(
+    "dfsan-input-reachability",
+    cl::desc("Skip propagation in functions which a whole-module analysis "
+             "finds can never see input-derived data (TLS ABI only)"),
+    cl::Hidden, cl::init(false));
+
+// Kinds of site descriptors.  Must match site_kind in dfsan.h.
+enum SiteKind : uint16_t {
+  SK_Branch = 0,
+  SK_Union = 1,
+};
+
+static DerivIntrinsic getDerivIntrinsic(Intrinsic::ID ID) {
+  switch (ID) {
+  case Intrinsic::bswap: return DI_Bswap;
+  case Intrinsic::ctpop: return DI_Ctpop;
+  case Intrinsic::ctlz: return DI_Ctlz;
+  case Intrinsic::cttz: return DI_Cttz;
+  case Intrinsic::fabs: return DI_Fabs;
+  case Intrinsic::sqrt: return DI_Sqrt;
+  case Intrinsic::fma:
+  case Intrinsic::fmuladd: return DI_Fma;
+  case Intrinsic::minnum: return DI_MinNum;
+  case Intrinsic::maxnum: return DI_MaxNum;
+  case Intrinsic::copysign: return DI_CopySign;
+  case Intrinsic::floor: return DI_Floor;
+  case Intrinsic::ceil: return DI_Ceil;
+  case Intrinsic::trunc: return DI_Trunc;
+  case Intrinsic::rint:
+  case Intrinsic::nearbyint: return DI_Rint;
+  case Intrinsic::round: return DI_Round;
+  case Intrinsic::exp: return DI_Exp;
+  case Intrinsic::exp2: return DI_Exp2;
+  case Intrinsic::log: return DI_Log;
+  case Intrinsic::log2: return DI_Log2;
+  case Intrinsic::log10: return DI_Log10;
+  case Intrinsic::pow: return DI_Pow;
+  case Intrinsic::sin: return DI_Sin;
+  case Intrinsic::cos: return DI_Cos;
+  default: return DI_None;
+  }
+}
+
+// Branch IDs must not depend on which other functions share the module, so
+// that they stay the same however ThinLTO partitions and imports code.  They
+// combine a hash of the function with the branch's ordinal in F.  Functions
+// with local linkage may share their name with a function in another module,
+// so they are hashed together with their module's source file name.  ThinLTO
+// promotes such functions to external linkage under the name
+// <name>.llvm.<module hash>; the suffix is dropped so that a promoted function
+// keeps the ID it has in a regular build.
+static const unsigned kSiteOrdinalBits = 20;
+
+static uint64_t getSiteId(const Function &F, uint64_t Ordinal) {
+  StringRef Name = F.getName();
+  size_t Promoted = Name.find(".llvm.");
+  uint64_t Hash;
+  if (F.hasLocalLinkage() || Promoted != StringRef::npos) {
+    std::string Key = Name.substr(0, Promoted).str();
+    Key += '\0';
+    Key += F.getParent()->getSourceFileName();
+    Hash = MD5Hash(Key);
+  } else {
+    Hash = MD5Hash(Name);
+  }
+  return (Hash << kSiteOrdinalBits) |
+         (Ordinal & ((1ULL << kSiteOrdinalBits) - 1));
+}
+
+// Functions listed as "memoize" in the ABI list get a dispatcher which asks
+// the runtime for a cached summary of the call before running the
+// instrumented body.  The runtime keys summaries on the derivatives of the
+// argument labels, so only leaf functions of scalars that write no memory
+// other than their own stack are memoized.  This must match kMemoMaxArgs in
+// dfsan.cc.
+static const unsigned kMemoMaxArgs = 8;
+
+static const char *getMemoIneligibility(const Function &F) {
+  if (F.isDeclaration())
+    return "no definition";
+  if (F.isVarArg())
+    return "vararg";
+  FunctionType *FT = F.getFunctionType();
+  Type *RetTy = FT->getReturnType();
+  if (!RetTy->isIntegerTy() && !RetTy->isFloatingPointTy())
+    return "return type is not an integer or floating point scalar";
+  if (FT->getNumParams() == 0 || FT->getNumParams() > kMemoMaxArgs)
+    return "unsupported number of arguments";
+  for (Type *T : FT->params())
+    if (!T->isIntegerTy() && !T->isFloatingPointTy())
+      return "argument is not an integer or floating point scalar";
+
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  auto IsLocal = [&](const Value *Ptr) {
+    return isa<AllocaInst>(GetUnderlyingObject(Ptr, DL));
+  };
+  for (const BasicBlock &BB : F) {
+    for (const Instruction &I : BB) {
+      if (const StoreInst *SI = dyn_cast<StoreInst>(&I)) {
+        if (!IsLocal(SI->getPointerOperand()))
+          return "writes non-local memory";
+      } else if (const MemIntrinsic *MI = dyn_cast<MemIntrinsic>(&I)) {
+        if (!IsLocal(MI->getRawDest()))
+          return "writes non-local memory";
+      } else if (const IntrinsicInst *II = dyn_cast<IntrinsicInst>(&I)) {
+        if (II->mayWriteToMemory() &&
+            II->getIntrinsicID() != Intrinsic::lifetime_start &&
+            II->getIntrinsicID() != Intrinsic::lifetime_end)
+          return "calls an intrinsic which writes memory";
+      } else if (isa<CallInst>(I) || isa<InvokeInst>(I)) {
+        return "makes calls";
+      } else if (I.mayWriteToMemory()) {
+        return "writes non-local memory";
+      }
+    }
+  }
+  return nullptr;
+}
+
 static StringRef GetGlobalTypeString(const GlobalValue &G) {
   // Types of GlobalVariables are always pointer types.
   Type *GType = G.getValueType();
@@ -217,6 +430,310 @@ class DFSanABIList {
   }
 };
 
+// Library functions whose results or output buffers hold input.  Functions
+// listed as "input" in the ABI list are treated the same way.
+static const char *const kInputSourceNames[] = {
+    "read",    "pread",   "pread64",   "fread",    "fread_unlocked",
+    "fgets",   "fgetc",   "getc",      "getc_unlocked", "getchar",
+    "getline", "getdelim", "mmap",     "mmap64",   "recv",
+    "recvfrom", "recvmsg", "dfsan_set_label", "dfsan_add_label"};
+
+/// Finds the functions of a module which can see data derived from input,
+/// starting from calls to input sources and following arguments, returns and
+/// memory.  Memory is split into private objects, allocas and globals whose
+/// address is only used by loads, stores and memory intrinsics, which are
+/// tracked one by one, and all other memory, which holds input as soon as
+/// any input reaches memory.  The analysis is flow-insensitive and
+/// conservative: a function it calls input-free never sees a nonzero label.
+class InputReachability {
+  const DFSanABIList &ABIList;
+  const DataLayout &DL;
+  // Whether memory other than private objects may hold input.
+  bool InputMemory = false;
+  // Whether code outside the module may call its functions or hold input.
+  bool Open = false;
+  bool AnyAddressTakenRetTainted = false;
+  bool Changed = false;
+  DenseMap<const Function *, std::vector<bool>> TaintedArgs;
+  SmallPtrSet<const Function *, 16> TaintedRet;
+  SmallPtrSet<const Function *, 16> SeesInput;
+  SmallPtrSet<const Value *, 16> TaintedObjects;
+  DenseMap<const Value *, bool> PrivateObjects;
+  std::vector<const Function *> AddressTaken;
+
+  bool isSource(const Function &F) const {
+    for (const char *Name : kInputSourceNames)
+      if (F.getName() == Name)
+        return true;
+    return ABIList.isIn(F, "input");
+  }
+
+  bool isPrivate(const Value *Obj);
+  void markInputMemory() {
+    if (!InputMemory)
+      InputMemory = Changed = true;
+  }
+  void taintArg(const Function &F, unsigned Idx) {
+    std::vector<bool> &Args = TaintedArgs[&F];
+    if (Idx < Args.size() && !Args[Idx])
+      Args[Idx] = Changed = true;
+  }
+  void taintRet(const Function &F) {
+    if (TaintedRet.insert(&F).second) {
+      Changed = true;
+      if (F.hasAddressTaken())
+        AnyAddressTakenRetTainted = true;
+    }
+  }
+  void taintMemory(const Value *Ptr, bool &LocalChanged);
+  bool mayHoldInput(const Value *Ptr);
+  bool visitCall(ImmutableCallSite CS, const DenseSet<const Value *> &Tainted);
+  void analyze(const Function &F);
+
+ public:
+  InputReachability(Module &M, const DFSanABIList &ABIList);
+
+  /// Returns whether F was analyzed and can never see a nonzero label.
+  bool isInputFree(const Function &F) const {
+    return TaintedArgs.count(&F) && !SeesInput.count(&F);
+  }
+
+  /// Returns the private object Ptr points into, or null.
+  const Value *getPrivateObject(const Value *Ptr) {
+    const Value *Obj = GetUnderlyingObject(Ptr, DL);
+    return isPrivate(Obj) ? Obj : nullptr;
+  }
+
+  /// Returns whether Ptr points into a private object which never holds
+  /// input, whose shadow therefore stays zero without being written.
+  bool hasZeroShadow(const Value *Ptr) {
+    const Value *Obj = getPrivateObject(Ptr);
+    return Obj && !TaintedObjects.count(Obj);
+  }
+};
+
+InputReachability::InputReachability(Module &M, const DFSanABIList &ABIList)
+    : ABIList(ABIList), DL(M.getDataLayout()) {
+  // Without main, or with calls to instrumented functions defined elsewhere,
+  // input may enter through code the analysis cannot see.
+  Function *Main = M.getFunction("main");
+  Open = !Main || Main->isDeclaration();
+  for (Function &F : M)
+    if (F.isDeclaration() && !F.isIntrinsic() &&
+        !ABIList.isIn(F, "uninstrumented"))
+      Open = true;
+  InputMemory = Open;
+
+  for (Function &F : M) {
+    if (F.isDeclaration())
+      continue;
+    TaintedArgs[&F].assign(F.arg_size(), false);
+    if (F.hasAddressTaken())
+      AddressTaken.push_back(&F);
+    if (Open && !F.hasLocalLinkage() && &F != Main)
+      TaintedArgs[&F].assign(F.arg_size(), true);
+    if (isSource(F)) {
+      SeesInput.insert(&F);
+      taintRet(F);
+      InputMemory = true;
+    }
+  }
+
+  do {
+    Changed = false;
+    // Address-taken functions may be called back by library code with
+    // pointers into input.
+    if (InputMemory)
+      for (const Function *F : AddressTaken)
+        for (unsigned i = 0, n = F->arg_size(); i != n; ++i)
+          taintArg(*F, i);
+    for (Function &F : M)
+      if (!F.isDeclaration())
+        analyze(F);
+  } while (Changed);
+}
+
+bool InputReachability::isPrivate(const Value *Obj) {
+  auto It = PrivateObjects.find(Obj);
+  if (It != PrivateObjects.end())
+    return It->second;
+  bool Private = isa<AllocaInst>(Obj);
+  if (auto *GV = dyn_cast<GlobalVariable>(Obj))
+    Private = GV->hasDefinitiveInitializer() && !GV->isThreadLocal() &&
+              (GV->hasLocalLinkage() || !Open);
+  SmallVector<const Value *, 8> Worklist(1, Obj);
+  while (Private && !Worklist.empty()) {
+    const Value *V = Worklist.pop_back_val();
+    for (const User *U : V->users()) {
+      if (isa<LoadInst>(U))
+        continue;
+      if (auto *SI = dyn_cast<StoreInst>(U)) {
+        if (SI->getValueOperand() == V)
+          Private = false;
+      } else if (auto *MI = dyn_cast<MemIntrinsic>(U)) {
+        if (MI->getLength() == V)
+          Private = false;
+      } else if (auto *II = dyn_cast<IntrinsicInst>(U)) {
+        if (II->getIntrinsicID() != Intrinsic::lifetime_start &&
+            II->getIntrinsicID() != Intrinsic::lifetime_end)
+          Private = false;
+      } else if (isa<GetElementPtrInst>(U) || isa<BitCastInst>(U)) {
+        Worklist.push_back(U);
+      } else if (auto *CE = dyn_cast<ConstantExpr>(U)) {
+        if (CE->getOpcode() == Instruction::GetElementPtr ||
+            CE->getOpcode() == Instruction::BitCast)
+          Worklist.push_back(U);
+        else
+          Private = false;
+      } else {
+        Private = false;
+      }
+      if (!Private)
+        break;
+    }
+  }
+  return PrivateObjects[Obj] = Private;
+}
+
+void InputReachability::taintMemory(const Value *Ptr, bool &LocalChanged) {
+  if (const Value *Obj = getPrivateObject(Ptr)) {
+    if (TaintedObjects.insert(Obj).second)
+      LocalChanged = Changed = true;
+  } else if (!InputMemory) {
+    markInputMemory();
+    LocalChanged = true;
+  }
+}
+
+bool InputReachability::mayHoldInput(const Value *Ptr) {
+  if (const Value *Obj = getPrivateObject(Ptr))
+    return TaintedObjects.count(Obj);
+  if (auto *GV = dyn_cast<GlobalVariable>(GetUnderlyingObject(Ptr, DL)))
+    if (GV->isConstant())
+      return false;
+  return InputMemory;
+}
+
+// Returns whether the result of the call may be derived from input, and
+// passes tainted arguments on to the functions it may call.
+bool InputReachability::visitCall(ImmutableCallSite CS,
+                                  const DenseSet<const Value *> &Tainted) {
+  const Function *Callee =
+      dyn_cast<Function>(CS.getCalledValue()->stripPointerCasts());
+  if (Callee && isSource(*Callee)) {
+    markInputMemory();
+    return true;
+  }
+
+  bool AnyArgTainted = false, AnyPointerArg = false;
+  for (unsigned i = 0, n = CS.arg_size(); i != n; ++i) {
+    const Value *Arg = CS.getArgument(i);
+    if (Tainted.count(Arg)) {
+      AnyArgTainted = true;
+      if (Callee && !Callee->isDeclaration())
+        taintArg(*Callee, i);
+      else if (!Callee)
+        for (const Function *F : AddressTaken)
+          taintArg(*F, i);
+    }
+    if (Arg->getType()->isPointerTy())
+      AnyPointerArg = true;
+  }
+
+  if (Callee && !Callee->isDeclaration()) {
+    // Variadic arguments are read back from memory.
+    if (AnyArgTainted && Callee->isVarArg())
+      markInputMemory();
+    return TaintedRet.count(Callee);
+  }
+  // Library code, or a function defined elsewhere, may keep tainted
+  // arguments in memory and derive its result from anything it can reach.
+  if (AnyArgTainted)
+    markInputMemory();
+  if (!Callee && (AnyAddressTakenRetTainted || Open))
+    return true;
+  return AnyArgTainted || (InputMemory && AnyPointerArg);
+}
+
+void InputReachability::analyze(const Function &F) {
+  DenseSet<const Value *> Tainted;
+  std::vector<bool> Args = TaintedArgs[&F];
+  for (const Argument &A : F.args())
+    if (Args[A.getArgNo()])
+      Tainted.insert(&A);
+
+  auto AnyOperandTainted = [&](const User &U) {
+    for (const Use &Op : U.operands())
+      if (Tainted.count(Op.get()))
+        return true;
+    return false;
+  };
+
+  // Custom wrappers are only called from fully instrumented call sites, and
+  // they do more than propagate labels (closing input fds, trace-cmp and
+  // output sink hooks), so their callers are never input-free.
+  bool CallsCustom = false, CopiesInput = false, LocalChanged;
+  do {
+    LocalChanged = false;
+    for (const BasicBlock &BB : F) {
+      for (const Instruction &I : BB) {
+        bool T = false;
+        if (auto *LI = dyn_cast<LoadInst>(&I)) {
+          const Value *Ptr = LI->getPointerOperand();
+          T = mayHoldInput(Ptr) ||
+              (ClCombinePointerLabelsOnLoad && Tainted.count(Ptr));
+        } else if (auto *SI = dyn_cast<StoreInst>(&I)) {
+          const Value *Ptr = SI->getPointerOperand();
+          if (Tainted.count(SI->getValueOperand()) ||
+              (ClCombinePointerLabelsOnStore && Tainted.count(Ptr)))
+            taintMemory(Ptr, LocalChanged);
+        } else if (auto *MTI = dyn_cast<MemTransferInst>(&I)) {
+          if (mayHoldInput(MTI->getSource())) {
+            CopiesInput = true;
+            taintMemory(MTI->getDest(), LocalChanged);
+          }
+        } else if (auto *MSI = dyn_cast<MemSetInst>(&I)) {
+          if (Tainted.count(MSI->getValue()))
+            taintMemory(MSI->getDest(), LocalChanged);
+        } else if (isa<AtomicRMWInst>(I) || isa<AtomicCmpXchgInst>(I)) {
+          const Value *Ptr = I.getOperand(0);
+          T = mayHoldInput(Ptr) || AnyOperandTainted(I);
+          if (AnyOperandTainted(I))
+            taintMemory(Ptr, LocalChanged);
+        } else if (isa<VAArgInst>(I) || I.isEHPad()) {
+          T = InputMemory;
+        } else if (auto *RI = dyn_cast<ReturnInst>(&I)) {
+          if (RI->getReturnValue() && Tainted.count(RI->getReturnValue()))
+            taintRet(F);
+        } else if (isa<DbgInfoIntrinsic>(I)) {
+          continue;
+        } else if (ImmutableCallSite CS = ImmutableCallSite(&I)) {
+          if (isa<IntrinsicInst>(I)) {
+            T = AnyOperandTainted(I);
+          } else if (CS.isInlineAsm()) {
+            T = InputMemory || AnyOperandTainted(I);
+            if (AnyOperandTainted(I))
+              markInputMemory();
+          } else {
+            const Function *Callee = dyn_cast<Function>(
+                CS.getCalledValue()->stripPointerCasts());
+            if (Callee && ABIList.isIn(*Callee, "custom"))
+              CallsCustom = true;
+            T = visitCall(CS, Tainted);
+          }
+        } else {
+          T = AnyOperandTainted(I);
+        }
+        if (T && Tainted.insert(&I).second)
+          LocalChanged = true;
+      }
+    }
+  } while (LocalChanged);
+
+  if (!Tainted.empty() || CopiesInput || CallsCustom)
+    SeesInput.insert(&F);
+}
+
 /// TransformedFunction is used to express the result of transforming one
 /// function type into another.  This struct is immutable.  It holds metadata
 /// useful for updating calls of the old function to the new type.
@@ -343,6 +860,7 @@ class DataFlowSanitizer : public ModulePass {
   ConstantInt *ZeroShadow;
   ConstantInt *ShadowPtrMask;
   ConstantInt *ShadowPtrMul;
+  unsigned ShadowGranularityShift = 0;
   PointerType *VoidPtrTy;
   Constant *ArgTLS;
   Constant *RetvalTLS;
@@ -371,8 +889,13 @@ class DataFlowSanitizer : public ModulePass {
   FunctionType *DFSanUnionLoadFnTy;
   FunctionType *DFSanUnimplementedFnTy;
   FunctionType *DFSanSetLabelFnTy;
+  FunctionType *DFSanLoadMixedLabelFnTy;
   FunctionType *DFSanNonzeroLabelFnTy;
   FunctionType *DFSanVarargWrapperFnTy;
+  FunctionType *DFSanMemoLookupFnTy;
+  FunctionType *DFSanMemoStoreFnTy;
+  FunctionType *DFSanIntrinsicIntFnTy;
+  FunctionType *DFSanIntrinsicFPFnTy;
     Constant *MemCpyFn;
     Constant *BasicBlockFn;
   Constant *BranchVisitorCharFn;
@@ -392,8 +915,29 @@ class DataFlowSanitizer : public ModulePass {
   Constant *DFSanUnionLoadFn;
   Constant *DFSanUnimplementedFn;
   Constant *DFSanSetLabelFn;
+  Constant *DFSanLoadMixedLabelFn;
   Constant *DFSanNonzeroLabelFn;
   Constant *DFSanVarargWrapperFn;
+  Constant *DFSanMemoLookupFn;
+  Constant *DFSanMemoStoreFn;
+  Constant *DFSanIntrinsicIntFn;
+  Constant *DFSanIntrinsicFPFn;
+  // Site table state.  SiteTable is a placeholder that calls address until
+  // runOnModule replaces it with the table built from Sites.
+  StructType *SiteTy;
+  PointerType *SitePtrTy;
+  GlobalVariable *SiteTable = nullptr;
+  std::vector<Constant *> Sites;
+  StringMap<Constant *> SiteLocations;
+  DenseMap<Constant *, Constant *> SiteFns;
+  SmallPtrSet<Constant *, 16> SiteFnDecls;
+  // Whether the target supports the preserve_most calling convention, and
+  // the stubs built for each entry point.
+  bool HasPreserveMost = false;
+  bool HasComdat = false;
+  DenseMap<Constant *, Function *> PreserveMostStubs;
+  // Set with -dfsan-input-reachability.
+  std::unique_ptr<InputReachability> InputReach;
   MDNode *ColdCallWeights;
   DFSanABIList ABIList;
   DenseMap<Value *, Function *> UnwrappedFnMap;
@@ -401,6 +945,7 @@ class DataFlowSanitizer : public ModulePass {
   bool DFSanRuntimeShadowMask = false;
 
   Value *getShadowAddress(Value *Addr, Instruction *Pos);
+  Value *getShadowChunk(Value *Addr, IRBuilder<> &IRB, Value *&ChunkOffset);
   bool isInstrumented(const Function *F);
   bool isInstrumented(const GlobalAlias *GA);
   FunctionType *getArgsFunctionType(FunctionType *T);
@@ -413,9 +958,16 @@ class DataFlowSanitizer : public ModulePass {
                                  GlobalValue::LinkageTypes NewFLink,
                                  FunctionType *NewFT);
   Constant *getOrBuildTrampolineFunction(FunctionType *FT, StringRef FName);
-
-    std::atomic<uint64_t> branch_id;
-    std::atomic<uint64_t> bb_id;
+  void instrumentFunction(Function &F, bool IsNativeABI);
+  void instrumentInputFreeFunction(Function &F, bool IsNativeABI);
+  void buildMemoDispatcher(Function &F, Function *Native, StringRef Name);
+  void addSiteFunction(Constant *Fn, unsigned NumArgs);
+  Constant *getSite(uint64_t FileId, uint64_t InstId, StringRef Location,
+                    uint16_t Kind, uint16_t Op, uint16_t Flags);
+  void emitSiteTable(Module &M);
+  Function *getPreserveMostStub(Constant *Fn);
+  CallInst *createRuntimeCall(IRBuilder<> &IRB, Constant *Fn,
+                              ArrayRef<Value *> Args);
 
 public:
   static char ID;
@@ -437,6 +989,7 @@ struct DFSanFunction {
   Value *ArgTLSPtr = nullptr;
   Value *RetvalTLSPtr = nullptr;
   AllocaInst *LabelReturnAlloca = nullptr;
+  uint64_t NextBranchOrdinal = 0;
   DenseMap<Value *, Value *> ValShadowMap;
   DenseMap<AllocaInst *, AllocaInst *> AllocaShadowMap;
   std::vector<std::pair<PHINode *, PHINode *>> PHIFixups;
@@ -497,6 +1050,7 @@ public:
   void visitStoreInst(StoreInst &SI);
   void visitReturnInst(ReturnInst &RI);
   void visitCallSite(CallSite CS);
+  bool visitDerivIntrinsic(IntrinsicInst &II);
   void visitPHINode(PHINode &PN);
   void visitExtractElementInst(ExtractElementInst &I);
   void visitInsertElementInst(InsertElementInst &I);
@@ -519,6 +1073,15 @@ char DataFlowSanitizer::ID;
 INITIALIZE_PASS(DataFlowSanitizer, "dfsan",
                 "DataFlowSanitizer: dynamic data flow analysis.", false, false)
 
+PreservedAnalyses DataFlowSanitizerPass::run(Module &M,
+                                             ModuleAnalysisManager &AM) {
+  DataFlowSanitizer DFSan(ABIListFiles);
+  DFSan.doInitialization(M);
+  if (!DFSan.runOnModule(M))
+    return PreservedAnalyses::all();
+  return PreservedAnalyses::none();
+}
+
 ModulePass *
 llvm::createDataFlowSanitizerPass(const std::vector<std::string> &ABIListFiles,
                                   void *(*getArgTLS)(),
@@ -602,6 +1165,9 @@ bool DataFlowSanitizer::doInitialization(Module &M) {
 
   const DataLayout &DL = M.getDataLayout();
 
+  HasPreserveMost = IsX86_64 || IsAArch64;
+  HasComdat = TargetTriple.supportsCOMDAT();
+
   Mod = &M;
   Ctx = &M.getContext();
   CharPtrTy = Type::getInt8PtrTy(*Ctx);
@@ -628,6 +1194,13 @@ bool DataFlowSanitizer::doInitialization(Module &M) {
   else
     report_fatal_error("unsupported triple");
 
+  if (ClShadowGranularity == 4)
+    ShadowGranularityShift = 2;
+  else if (ClShadowGranularity == 8)
+    ShadowGranularityShift = 3;
+  else if (ClShadowGranularity != 1)
+    report_fatal_error("unsupported shadow granularity");
+
   MemCpyFnTy =
           FunctionType::get(Type::getVoidTy(*Ctx),
                             { PointerType::getUnqual(IntegerType::get(*Ctx, 8)),
@@ -709,12 +1282,34 @@ bool DataFlowSanitizer::doInitialization(Module &M) {
   DFSanUnimplementedFnTy = FunctionType::get(
       Type::getVoidTy(*Ctx), Type::getInt8PtrTy(*Ctx), /*isVarArg=*/false);
   Type *DFSanSetLabelArgs[3] = { ShadowTy, Type::getInt8PtrTy(*Ctx), IntptrTy };
+  DFSanLoadMixedLabelFnTy =
+      FunctionType::get(ShadowTy, Type::getInt8PtrTy(*Ctx), /*isVarArg=*/false);
   DFSanSetLabelFnTy = FunctionType::get(Type::getVoidTy(*Ctx),
                                         DFSanSetLabelArgs, /*isVarArg=*/false);
   DFSanNonzeroLabelFnTy = FunctionType::get(
       Type::getVoidTy(*Ctx), None, /*isVarArg=*/false);
   DFSanVarargWrapperFnTy = FunctionType::get(
       Type::getVoidTy(*Ctx), Type::getInt8PtrTy(*Ctx), /*isVarArg=*/false);
+  Type *DFSanMemoLookupArgs[4] = { Int64Ty, Type::getInt8PtrTy(*Ctx),
+                                   ShadowPtrTy, Int32Ty };
+  DFSanMemoLookupFnTy =
+      FunctionType::get(Int32Ty, DFSanMemoLookupArgs, /*isVarArg=*/false);
+  Type *DFSanMemoStoreArgs[4] = { Int64Ty, ShadowPtrTy, Int32Ty, ShadowTy };
+  DFSanMemoStoreFnTy = FunctionType::get(
+      Type::getVoidTy(*Ctx), DFSanMemoStoreArgs, /*isVarArg=*/false);
+  Type *DFSanIntrinsicIntArgs[5] = { ShadowTy, Int64Ty, Int32Ty, OpCodeTy,
+                                     CharPtrTy };
+  DFSanIntrinsicIntFnTy =
+      FunctionType::get(ShadowTy, DFSanIntrinsicIntArgs, /*isVarArg=*/false);
+  Type *DoubleTy = Type::getDoubleTy(*Ctx);
+  Type *DFSanIntrinsicFPArgs[8] = { ShadowTy, ShadowTy, ShadowTy, DoubleTy,
+                                    DoubleTy, DoubleTy, OpCodeTy, CharPtrTy };
+  DFSanIntrinsicFPFnTy =
+      FunctionType::get(ShadowTy, DFSanIntrinsicFPArgs, /*isVarArg=*/false);
+  // Must match struct dfsan_site in dfsan.h.
+  SiteTy = StructType::get(*Ctx, {Int64Ty, Int64Ty, CharPtrTy, Int32Ty,
+                                  Int16Ty, Int16Ty, Int16Ty});
+  SitePtrTy = PointerType::getUnqual(SiteTy);
 
   if (GetArgTLSPtr) {
     Type *ArgTLSTy = ArrayType::get(ShadowTy, 64);
@@ -734,7 +1329,6 @@ bool DataFlowSanitizer::doInitialization(Module &M) {
 
   ColdCallWeights = MDBuilder(*Ctx).createBranchWeights(1, 1000);
 
-  branch_id = 0;
   return true;
 }
 
@@ -857,6 +1451,11 @@ bool DataFlowSanitizer::runOnModule(Module &M) {
   if (ABIList.isIn(M, "skip"))
     return false;
 
+  // Runs before the runtime functions are declared, which the analysis would
+  // take for functions defined in other modules.
+  if (ClInputReachability && getInstrumentedABI() == IA_TLS)
+    InputReach.reset(new InputReachability(M, ABIList));
+
   if (!GetArgTLSPtr) {
     Type *ArgTLSTy = ArrayType::get(ShadowTy, 64);
     ArgTLS = Mod->getOrInsertGlobal("__dfsan_arg_tls", ArgTLSTy);
@@ -872,6 +1471,31 @@ bool DataFlowSanitizer::runOnModule(Module &M) {
   ExternalShadowMask =
       Mod->getOrInsertGlobal(kDFSanExternShadowPtrMask, IntptrTy);
 
+  // Lets the runtime reject programs linking modules built with different
+  // instrumented ABIs.
+  StringRef ABIMarker = getInstrumentedABI() == IA_Args ? "__dfsan_abi_args"
+                                                         : "__dfsan_abi_tls";
+  if (!Mod->getGlobalVariable(ABIMarker))
+    new GlobalVariable(M, Int32Ty, true, GlobalValue::WeakODRLinkage,
+                       ConstantInt::get(Int32Ty, 1), ABIMarker);
+
+  if (ClTwoLevelShadow) {
+    if (DFSanRuntimeShadowMask)
+      report_fatal_error("two-level shadow is not supported on this target");
+    if (!Mod->getGlobalVariable("__dfsan_shadow_mode"))
+      new GlobalVariable(M, Int32Ty, true, GlobalValue::WeakODRLinkage,
+                         ConstantInt::get(Int32Ty, 1), "__dfsan_shadow_mode");
+  }
+
+  if (ShadowGranularityShift) {
+    if (ClTwoLevelShadow)
+      report_fatal_error("word-granular shadow requires the flat shadow");
+    if (!Mod->getGlobalVariable("__dfsan_shadow_granularity"))
+      new GlobalVariable(M, Int32Ty, true, GlobalValue::WeakODRLinkage,
+                         ConstantInt::get(Int32Ty, ClShadowGranularity),
+                         "__dfsan_shadow_granularity");
+  }
+
   MemCpyFn = Mod->getOrInsertFunction("__memcpy", MemCpyFnTy);
   if (Function *F = dyn_cast<Function>(MemCpyFn)) {
     F->addParamAttr(2, Attribute::ZExt);
@@ -998,10 +1622,83 @@ bool DataFlowSanitizer::runOnModule(Module &M) {
   if (Function *F = dyn_cast<Function>(DFSanSetLabelFn)) {
     F->addParamAttr(0, Attribute::ZExt);
   }
+  DFSanLoadMixedLabelFn = Mod->getOrInsertFunction("__dfsan_load_mixed_label",
+                                                   DFSanLoadMixedLabelFnTy);
+  if (Function *F = dyn_cast<Function>(DFSanLoadMixedLabelFn)) {
+    F->addAttribute(AttributeList::ReturnIndex, Attribute::ZExt);
+  }
   DFSanNonzeroLabelFn =
       Mod->getOrInsertFunction("__dfsan_nonzero_label", DFSanNonzeroLabelFnTy);
   DFSanVarargWrapperFn = Mod->getOrInsertFunction("__dfsan_vararg_wrapper",
                                                   DFSanVarargWrapperFnTy);
+  DFSanMemoLookupFn =
+      Mod->getOrInsertFunction("__dfsan_memo_lookup", DFSanMemoLookupFnTy);
+  if (Function *F = dyn_cast<Function>(DFSanMemoLookupFn)) {
+    F->addAttribute(AttributeList::FunctionIndex, Attribute::NoUnwind);
+  }
+  DFSanMemoStoreFn =
+      Mod->getOrInsertFunction("__dfsan_memo_store", DFSanMemoStoreFnTy);
+  if (Function *F = dyn_cast<Function>(DFSanMemoStoreFn)) {
+    F->addAttribute(AttributeList::FunctionIndex, Attribute::NoUnwind);
+    F->addParamAttr(3, Attribute::ZExt);
+  }
+  DFSanIntrinsicIntFn =
+      Mod->getOrInsertFunction("__dfsan_intrinsic_int", DFSanIntrinsicIntFnTy);
+  if (Function *F = dyn_cast<Function>(DFSanIntrinsicIntFn)) {
+    F->addAttribute(AttributeList::FunctionIndex, Attribute::NoUnwind);
+    F->addAttribute(AttributeList::FunctionIndex, Attribute::ReadNone);
+    F->addAttribute(AttributeList::ReturnIndex, Attribute::ZExt);
+    F->addParamAttr(0, Attribute::ZExt);
+  }
+  DFSanIntrinsicFPFn =
+      Mod->getOrInsertFunction("__dfsan_intrinsic_fp", DFSanIntrinsicFPFnTy);
+  if (Function *F = dyn_cast<Function>(DFSanIntrinsicFPFn)) {
+    F->addAttribute(AttributeList::FunctionIndex, Attribute::NoUnwind);
+    F->addAttribute(AttributeList::FunctionIndex, Attribute::ReadNone);
+    F->addAttribute(AttributeList::ReturnIndex, Attribute::ZExt);
+    F->addParamAttr(0, Attribute::ZExt);
+    F->addParamAttr(1, Attribute::ZExt);
+    F->addParamAttr(2, Attribute::ZExt);
+  }
+
+  if (ClSiteTables) {
+    SiteTable = new GlobalVariable(M, ArrayType::get(SiteTy, 0), false,
+                                   GlobalValue::ExternalLinkage, nullptr,
+                                   "dfsan.sites.placeholder");
+    for (Constant *Fn : {BranchVisitorCharFn, BranchVisitorShortFn,
+                         BranchVisitorIntFn, BranchVisitorLongFn,
+                         BranchVisitorLongLongFn, BranchVisitorFloatFn,
+                         BranchVisitorDoubleFn})
+      addSiteFunction(Fn, 5);
+    for (Constant *Fn : {DFSanUnionFn, DFSanUnionLongFn, DFSanUnionByteFn,
+                         DFSanUnionShortFn, DFSanUnionFloatFn,
+                         DFSanUnionDoubleFn})
+      addSiteFunction(Fn, 4);
+  }
+
+  // Memoized functions keep an uninstrumented clone, which their dispatcher
+  // calls when the arguments are unlabeled or the runtime has a summary.  The
+  // dispatcher addresses the TLS globals directly, so JIT users go without.
+  std::vector<std::pair<std::string, Function *>> MemoFns;
+  SmallPtrSet<Function *, 4> MemoNatives;
+  if (!GetArgTLSPtr && !GetRetvalTLSPtr) {
+    std::vector<Function *> MemoCandidates;
+    for (Function &i : M)
+      if (ABIList.isIn(i, "memoize") && isInstrumented(&i))
+        MemoCandidates.push_back(&i);
+    for (Function *i : MemoCandidates) {
+      if (const char *Why = getMemoIneligibility(*i)) {
+        errs() << "not memoizing " << i->getName() << ": " << Why << "\n";
+        continue;
+      }
+      ValueToValueMapTy VMap;
+      Function *Native = CloneFunction(i, VMap);
+      Native->setName("dfsan.native." + i->getName());
+      Native->setLinkage(GlobalValue::InternalLinkage);
+      MemoNatives.insert(Native);
+      MemoFns.push_back(std::make_pair(std::string(i->getName()), Native));
+    }
+  }
 
   std::vector<Function *> FnsToInstrument;
   SmallPtrSet<Function *, 2> FnsWithNativeABI;
@@ -1026,8 +1723,15 @@ bool DataFlowSanitizer::runOnModule(Module &M) {
         &i != DFSanUnionLoadFn &&
         &i != DFSanUnimplementedFn &&
         &i != DFSanSetLabelFn &&
+        &i != DFSanLoadMixedLabelFn &&
         &i != DFSanNonzeroLabelFn &&
-        &i != DFSanVarargWrapperFn)
+        &i != DFSanVarargWrapperFn &&
+        &i != DFSanMemoLookupFn &&
+        &i != DFSanMemoStoreFn &&
+        &i != DFSanIntrinsicIntFn &&
+        &i != DFSanIntrinsicFPFn &&
+        !SiteFnDecls.count(&i) &&
+        !MemoNatives.count(&i))
       FnsToInstrument.push_back(&i);
   }
 
@@ -1173,74 +1877,367 @@ bool DataFlowSanitizer::runOnModule(Module &M) {
   for (Function *i : FnsToInstrument) {
     if (!i || i->isDeclaration())
       continue;
+    if (InputReach && InputReach->isInputFree(*i))
+      instrumentInputFreeFunction(*i, FnsWithNativeABI.count(i));
+    else
+      instrumentFunction(*i, FnsWithNativeABI.count(i));
+  }
+  InputReach.reset();
 
-    removeUnreachableBlocks(*i);
-
-    DFSanFunction DFSF(*this, i, FnsWithNativeABI.count(i));
-
-    // DFSanVisitor may create new basic blocks, which confuses df_iterator.
-    // Build a copy of the list before iterating over it.
-    SmallVector<BasicBlock *, 4> BBList(depth_first(&i->getEntryBlock()));
-
-    for (BasicBlock *i : BBList) {
-
-        DFSF.recordBasicBlock(i);
-      Instruction *Inst = &i->front();
-      while (true) {
-        // DFSanVisitor may split the current basic block, changing the current
-        // instruction's next pointer and moving the next instruction to the
-        // tail block from which we should continue.
-        Instruction *Next = Inst->getNextNode();
-        // DFSanVisitor may delete Inst, so keep track of whether it was a
-        // terminator.
-        bool IsTerminator = isa<TerminatorInst>(Inst);
-        if (!DFSF.SkipInsts.count(Inst))
-          DFSanVisitor(DFSF).visit(Inst);
-        if (IsTerminator)
-          break;
-        Inst = Next;
-      }
+  for (auto &MF : MemoFns)
+    if (Function *F = M.getFunction("dfs$" + MF.first))
+      buildMemoDispatcher(*F, MF.second, MF.first);
+
+  if (SiteTable)
+    emitSiteTable(M);
+
+  return true;
+}
+
+// Declares Fn_site, which takes the first NumArgs arguments of Fn followed
+// by a pointer to the call's site descriptor.
+void DataFlowSanitizer::addSiteFunction(Constant *Fn, unsigned NumArgs) {
+  auto *FT = cast<FunctionType>(
+      cast<PointerType>(Fn->getType())->getElementType());
+  SmallVector<Type *, 6> Params(FT->param_begin(),
+                                FT->param_begin() + NumArgs);
+  Params.push_back(SitePtrTy);
+  StringRef Name = cast<GlobalValue>(Fn->stripPointerCasts())->getName();
+  Constant *SiteFn = Mod->getOrInsertFunction(
+      (Name + "_site").str(),
+      FunctionType::get(FT->getReturnType(), Params, /*isVarArg=*/false));
+  if (Function *F = dyn_cast<Function>(SiteFn)) {
+    F->addParamAttr(0, Attribute::ZExt);
+    F->addParamAttr(1, Attribute::ZExt);
+    if (!FT->getReturnType()->isVoidTy()) {
+      F->addAttribute(AttributeList::FunctionIndex, Attribute::NoUnwind);
+      F->addAttribute(AttributeList::FunctionIndex, Attribute::ReadOnly);
+      F->addAttribute(AttributeList::ReturnIndex, Attribute::ZExt);
     }
+  }
+  SiteFns[Fn] = SiteFn;
+  SiteFnDecls.insert(SiteFn);
+}
 
-    // We will not necessarily be able to compute the shadow for every phi node
-    // until we have visited every block.  Therefore, the code that handles phi
-    // nodes adds them to the PHIFixups list so that they can be properly
-    // handled here.
-    for (std::vector<std::pair<PHINode *, PHINode *>>::iterator
-             i = DFSF.PHIFixups.begin(),
-             e = DFSF.PHIFixups.end();
-         i != e; ++i) {
-      for (unsigned val = 0, n = i->first->getNumIncomingValues(); val != n;
-           ++val) {
-        i->second->setIncomingValue(
-            val, DFSF.getShadow(i->first->getIncomingValue(val)));
-      }
+// Returns a stub with the preserve_most calling convention which calls Fn.
+// Modules share one copy of each stub.  The stub must not be inlined, or
+// its callers would call Fn with the C convention again.  The runtime would
+// see the stub as its caller, so the stub calls Fn_pc instead, which takes
+// the stub's own return address, the instrumented call site, as an extra
+// argument.
+Function *DataFlowSanitizer::getPreserveMostStub(Constant *Fn) {
+  Function *&Stub = PreserveMostStubs[Fn];
+  if (Stub)
+    return Stub;
+  auto *FT = cast<FunctionType>(
+      cast<PointerType>(Fn->getType())->getElementType());
+  StringRef Name = cast<GlobalValue>(Fn->stripPointerCasts())->getName();
+  SmallVector<Type *, 11> PCParams(FT->param_begin(), FT->param_end());
+  PCParams.push_back(IntptrTy);
+  Constant *PCFn = Mod->getOrInsertFunction(
+      (Name + "_pc").str(),
+      FunctionType::get(FT->getReturnType(), PCParams, /*isVarArg=*/false));
+  Stub = Function::Create(FT, GlobalValue::LinkOnceODRLinkage,
+                          "dfsan.pm." + Name, Mod);
+  Stub->setVisibility(GlobalValue::HiddenVisibility);
+  Stub->setCallingConv(CallingConv::PreserveMost);
+  if (HasComdat)
+    Stub->setComdat(Mod->getOrInsertComdat(Stub->getName()));
+  AttributeList Attrs;
+  if (Function *F = dyn_cast<Function>(Fn->stripPointerCasts()))
+    Attrs = F->getAttributes();
+  Stub->setAttributes(Attrs);
+  Stub->addFnAttr(Attribute::NoInline);
+  if (Function *F = dyn_cast<Function>(PCFn->stripPointerCasts()))
+    F->setAttributes(Attrs);
+
+  IRBuilder<> IRB(BasicBlock::Create(*Ctx, "entry", Stub));
+  SmallVector<Value *, 11> Args;
+  for (Argument &Arg : Stub->args())
+    Args.push_back(&Arg);
+  Value *RetAddr = IRB.CreateCall(
+      Intrinsic::getDeclaration(Mod, Intrinsic::returnaddress),
+      IRB.getInt32(0));
+  Args.push_back(IRB.CreatePtrToInt(RetAddr, IntptrTy));
+  CallInst *CI = IRB.CreateCall(PCFn, Args);
+  CI->setAttributes(Attrs);
+  if (FT->getReturnType()->isVoidTy())
+    IRB.CreateRetVoid();
+  else
+    IRB.CreateRet(CI);
+  return Stub;
+}
+
+// Calls the runtime entry point Fn, through its preserve_most stub when
+// -dfsan-preserve-most is set.
+CallInst *DataFlowSanitizer::createRuntimeCall(IRBuilder<> &IRB, Constant *Fn,
+                                               ArrayRef<Value *> Args) {
+  if (!ClPreserveMost || !HasPreserveMost)
+    return IRB.CreateCall(Fn, Args);
+  CallInst *CI = IRB.CreateCall(getPreserveMostStub(Fn), Args);
+  CI->setCallingConv(CallingConv::PreserveMost);
+  return CI;
+}
+
+// Adds a descriptor to the module's site table and returns its address.
+// Sites with the same location share one string.
+Constant *DataFlowSanitizer::getSite(uint64_t FileId, uint64_t InstId,
+                                     StringRef Location, uint16_t Kind,
+                                     uint16_t Op, uint16_t Flags) {
+  Constant *&Loc = SiteLocations[Location];
+  if (!Loc) {
+    Constant *Str = ConstantDataArray::getString(*Ctx, Location);
+    auto *GV = new GlobalVariable(*Mod, Str->getType(), true,
+                                  GlobalValue::PrivateLinkage, Str,
+                                  "dfsan.site.loc");
+    GV->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+    Loc = ConstantExpr::getPointerCast(GV, CharPtrTy);
+  }
+  Constant *Fields[] = {ConstantInt::get(Int64Ty, FileId),
+                        ConstantInt::get(Int64Ty, InstId),
+                        Loc,
+                        ConstantInt::get(Int32Ty, 0),
+                        ConstantInt::get(Int16Ty, Kind),
+                        ConstantInt::get(Int16Ty, Op),
+                        ConstantInt::get(Int16Ty, Flags)};
+  Sites.push_back(ConstantStruct::get(SiteTy, Fields));
+  Constant *Idx[] = {ConstantInt::get(Int64Ty, 0),
+                     ConstantInt::get(Int64Ty, Sites.size() - 1)};
+  return ConstantExpr::getGetElementPtr(SiteTable->getValueType(), SiteTable,
+                                        Idx);
+}
+
+// Replaces the placeholder with the module's site table and registers the
+// table from a constructor.  The runtime writes each site's slot, so the
+// table is not constant.
+void DataFlowSanitizer::emitSiteTable(Module &M) {
+  if (!Sites.empty()) {
+    ArrayType *TableTy = ArrayType::get(SiteTy, Sites.size());
+    auto *Table = new GlobalVariable(M, TableTy, false,
+                                     GlobalValue::PrivateLinkage,
+                                     ConstantArray::get(TableTy, Sites),
+                                     "dfsan.sites");
+    SiteTable->replaceAllUsesWith(
+        ConstantExpr::getBitCast(Table, SiteTable->getType()));
+    Constant *Zero = ConstantInt::get(Int64Ty, 0);
+    Constant *Begin[] = {Zero, Zero};
+    Constant *End[] = {Zero, ConstantInt::get(Int64Ty, Sites.size())};
+    Value *Bounds[] = {
+        ConstantExpr::getInBoundsGetElementPtr(TableTy, Table, Begin),
+        ConstantExpr::getInBoundsGetElementPtr(TableTy, Table, End)};
+    Function *Ctor = createSanitizerCtorAndInitFunctions(
+                         M, "dfsan.site_ctor", "__dfsan_register_sites",
+                         {SitePtrTy, SitePtrTy}, Bounds)
+                         .first;
+    appendToGlobalCtors(M, Ctor, 0);
+  }
+  SiteTable->eraseFromParent();
+  SiteTable = nullptr;
+  Sites.clear();
+  SiteLocations.clear();
+}
+
+// Moves the instrumented body of F into F.slow and gives F a body which
+// returns the result of Native with a zero or cached return label when it
+// can, and otherwise calls F.slow and stores a summary of the call.
+void DataFlowSanitizer::buildMemoDispatcher(Function &F, Function *Native,
+                                            StringRef Name) {
+  FunctionType *FT = F.getFunctionType();
+  Function *Slow = Function::Create(FT, GlobalValue::InternalLinkage,
+                                    F.getName() + ".slow", Mod);
+  Slow->copyAttributesFrom(&F);
+  Slow->setLinkage(GlobalValue::InternalLinkage);
+  for (Function::arg_iterator FArg = F.arg_begin(), SArg = Slow->arg_begin(),
+                              FArgEnd = F.arg_end();
+       FArg != FArgEnd; ++FArg, ++SArg) {
+    FArg->replaceAllUsesWith(&*SArg);
+    SArg->takeName(&*FArg);
+  }
+  Slow->getBasicBlockList().splice(Slow->begin(), F.getBasicBlockList());
+  // The debug locations in the body belong to F's subprogram.
+  Slow->setSubprogram(F.getSubprogram());
+  F.setSubprogram(nullptr);
+
+  bool ArgsABI = getInstrumentedABI() == IA_Args;
+  unsigned NumArgs = Native->arg_size();
+  SmallVector<Value *, 16> Args;
+  for (Argument &A : F.args())
+    Args.push_back(&A);
+
+  BasicBlock *Entry = BasicBlock::Create(*Ctx, "entry", &F);
+  BasicBlock *Lookup = BasicBlock::Create(*Ctx, "memo.lookup", &F);
+  BasicBlock *Fast = BasicBlock::Create(*Ctx, "memo.native", &F);
+  BasicBlock *Miss = BasicBlock::Create(*Ctx, "memo.miss", &F);
+
+  IRBuilder<> IRB(Entry);
+  ArrayType *SigTy = ArrayType::get(ShadowTy, NumArgs);
+  Value *Sig = IRB.CreateAlloca(SigTy);
+  SmallVector<Value *, 8> Shadows;
+  Value *AnyShadow = nullptr;
+  for (unsigned i = 0; i != NumArgs; ++i) {
+    Value *S = ArgsABI ? Args[NumArgs + i]
+                       : IRB.CreateLoad(IRB.CreateConstGEP2_64(ArgTLS, 0, i));
+    Shadows.push_back(S);
+    AnyShadow = AnyShadow ? IRB.CreateOr(AnyShadow, S) : S;
+  }
+  IRB.CreateCondBr(IRB.CreateICmpEQ(AnyShadow, ZeroShadow), Fast, Lookup);
+
+  IRB.SetInsertPoint(Lookup);
+  for (unsigned i = 0; i != NumArgs; ++i)
+    IRB.CreateStore(Shadows[i], IRB.CreateConstGEP2_32(SigTy, Sig, 0, i));
+  Value *SigPtr = IRB.CreateConstGEP2_32(SigTy, Sig, 0, 0);
+  // Summaries are shared by the whole process, so functions with local
+  // linkage, which other modules may define under the same name, are keyed
+  // on their module as well.
+  std::string Key = F.hasLocalLinkage()
+                        ? (Mod->getModuleIdentifier() + ":" + Name).str()
+                        : Name.str();
+  Value *FnId = ConstantInt::get(Int64Ty, MD5Hash(Key));
+  Value *NumArgsVal = ConstantInt::get(Int32Ty, NumArgs);
+  Value *Cached = IRB.CreateCall(
+      DFSanMemoLookupFn,
+      {FnId, IRB.CreateGlobalStringPtr(Name), SigPtr, NumArgsVal});
+  Value *CachedShadow = IRB.CreateTrunc(Cached, ShadowTy);
+  IRB.CreateCondBr(IRB.CreateICmpSLT(Cached, ConstantInt::get(Int32Ty, 0)),
+                   Miss, Fast);
+
+  IRB.SetInsertPoint(Fast);
+  PHINode *RetShadow = IRB.CreatePHI(ShadowTy, 2);
+  RetShadow->addIncoming(ZeroShadow, Entry);
+  RetShadow->addIncoming(CachedShadow, Lookup);
+  Value *V = IRB.CreateCall(Native, makeArrayRef(Args).slice(0, NumArgs));
+  if (ArgsABI) {
+    Value *R = UndefValue::get(FT->getReturnType());
+    R = IRB.CreateInsertValue(R, V, 0);
+    IRB.CreateRet(IRB.CreateInsertValue(R, RetShadow, 1));
+  } else {
+    IRB.CreateStore(RetShadow, RetvalTLS);
+    IRB.CreateRet(V);
+  }
+
+  // The lookup does not touch the argument TLS, so the body still finds the
+  // shadows the caller stored there.
+  IRB.SetInsertPoint(Miss);
+  Value *R = IRB.CreateCall(Slow, Args);
+  Value *S = ArgsABI ? IRB.CreateExtractValue(R, 1)
+                     : static_cast<Value *>(IRB.CreateLoad(RetvalTLS));
+  IRB.CreateCall(DFSanMemoStoreFn, {FnId, SigPtr, NumArgsVal, S});
+  IRB.CreateRet(R);
+}
+
+// Instruments the body of F.  Only F itself is modified; the module-level
+// ABI rewriting in runOnModule must already have been done.
+void DataFlowSanitizer::instrumentFunction(Function &F, bool IsNativeABI) {
+  removeUnreachableBlocks(F);
+
+  DFSanFunction DFSF(*this, &F, IsNativeABI);
+
+  // DFSanVisitor may create new basic blocks, which confuses df_iterator.
+  // Build a copy of the list before iterating over it.
+  SmallVector<BasicBlock *, 4> BBList(depth_first(&F.getEntryBlock()));
+
+  for (BasicBlock *i : BBList) {
+    DFSF.recordBasicBlock(i);
+    Instruction *Inst = &i->front();
+    while (true) {
+      // DFSanVisitor may split the current basic block, changing the current
+      // instruction's next pointer and moving the next instruction to the
+      // tail block from which we should continue.
+      Instruction *Next = Inst->getNextNode();
+      // DFSanVisitor may delete Inst, so keep track of whether it was a
+      // terminator.
+      bool IsTerminator = isa<TerminatorInst>(Inst);
+      if (!DFSF.SkipInsts.count(Inst))
+        DFSanVisitor(DFSF).visit(Inst);
+      if (IsTerminator)
+        break;
+      Inst = Next;
     }
+  }
 
-    // -dfsan-debug-nonzero-labels will split the CFG in all kinds of crazy
-    // places (i.e. instructions in basic blocks we haven't even begun visiting
-    // yet).  To make our life easier, do this work in a pass after the main
-    // instrumentation.
-    if (ClDebugNonzeroLabels) {
-      for (Value *V : DFSF.NonZeroChecks) {
-        Instruction *Pos;
-        if (Instruction *I = dyn_cast<Instruction>(V))
-          Pos = I->getNextNode();
-        else
-          Pos = &DFSF.F->getEntryBlock().front();
-        while (isa<PHINode>(Pos) || isa<AllocaInst>(Pos))
-          Pos = Pos->getNextNode();
-        IRBuilder<> IRB(Pos);
-        Value *Ne = IRB.CreateICmpNE(V, DFSF.DFS.ZeroShadow);
-        BranchInst *BI = cast<BranchInst>(SplitBlockAndInsertIfThen(
-            Ne, Pos, /*Unreachable=*/false, ColdCallWeights));
-        IRBuilder<> ThenIRB(BI);
-        ThenIRB.CreateCall(DFSF.DFS.DFSanNonzeroLabelFn, {});
-      }
+  // We will not necessarily be able to compute the shadow for every phi node
+  // until we have visited every block.  Therefore, the code that handles phi
+  // nodes adds them to the PHIFixups list so that they can be properly
+  // handled here.
+  for (std::vector<std::pair<PHINode *, PHINode *>>::iterator
+           i = DFSF.PHIFixups.begin(),
+           e = DFSF.PHIFixups.end();
+       i != e; ++i) {
+    for (unsigned val = 0, n = i->first->getNumIncomingValues(); val != n;
+         ++val) {
+      i->second->setIncomingValue(
+          val, DFSF.getShadow(i->first->getIncomingValue(val)));
     }
   }
 
-  return false;
+  // -dfsan-debug-nonzero-labels will split the CFG in all kinds of crazy
+  // places (i.e. instructions in basic blocks we haven't even begun visiting
+  // yet).  To make our life easier, do this work in a pass after the main
+  // instrumentation.
+  if (ClDebugNonzeroLabels) {
+    for (Value *V : DFSF.NonZeroChecks) {
+      Instruction *Pos;
+      if (Instruction *I = dyn_cast<Instruction>(V))
+        Pos = I->getNextNode();
+      else
+        Pos = &DFSF.F->getEntryBlock().front();
+      while (isa<PHINode>(Pos) || isa<AllocaInst>(Pos))
+        Pos = Pos->getNextNode();
+      IRBuilder<> IRB(Pos);
+      Value *Ne = IRB.CreateICmpNE(V, DFSF.DFS.ZeroShadow);
+      BranchInst *BI = cast<BranchInst>(SplitBlockAndInsertIfThen(
+          Ne, Pos, /*Unreachable=*/false, ColdCallWeights));
+      IRBuilder<> ThenIRB(BI);
+      ThenIRB.CreateCall(DFSF.DFS.DFSanNonzeroLabelFn, {});
+    }
+  }
+}
+
+// Instruments a function which can never see a nonzero label.  Its values
+// all have label 0, so it only clears the shadow of memory other functions
+// may read and passes label 0 to its callees and callers.  Calls to
+// discard and functional wrappers go to the original function.
+void DataFlowSanitizer::instrumentInputFreeFunction(Function &F,
+                                                    bool IsNativeABI) {
+  DFSanFunction DFSF(*this, &F, IsNativeABI);
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  std::vector<Instruction *> Insts;
+  for (BasicBlock &BB : F)
+    for (Instruction &I : BB)
+      Insts.push_back(&I);
+
+  for (Instruction *I : Insts) {
+    IRBuilder<> IRB(I);
+    if (auto *SI = dyn_cast<StoreInst>(I)) {
+      uint64_t Size = DL.getTypeStoreSize(SI->getValueOperand()->getType());
+      if (Size && !InputReach->hasZeroShadow(SI->getPointerOperand()))
+        DFSF.storeShadow(SI->getPointerOperand(), Size, 1, ZeroShadow, SI);
+    } else if (auto *MI = dyn_cast<MemIntrinsic>(I)) {
+      if (!InputReach->hasZeroShadow(MI->getDest()))
+        IRB.CreateCall(DFSanSetLabelFn,
+                       {ZeroShadow, IRB.CreateBitCast(MI->getDest(), CharPtrTy),
+                        IRB.CreateZExtOrTrunc(MI->getLength(), IntptrTy)});
+    } else if (auto *RI = dyn_cast<ReturnInst>(I)) {
+      if (!IsNativeABI && RI->getReturnValue())
+        IRB.CreateStore(ZeroShadow, DFSF.getRetvalTLS());
+    } else if (CallSite CS = CallSite(I)) {
+      Function *Callee = CS.getCalledFunction();
+      if ((Callee && Callee->isIntrinsic()) || CS.isInlineAsm())
+        continue;
+      auto Unwrapped = UnwrappedFnMap.find(CS.getCalledValue());
+      if (Unwrapped != UnwrappedFnMap.end()) {
+        WrapperKind Kind = getWrapperKind(Unwrapped->second);
+        if (Kind == WK_Discard || Kind == WK_Functional) {
+          CS.setCalledFunction(Unwrapped->second);
+          continue;
+        }
+      }
+      FunctionType *FT = cast<FunctionType>(
+          CS.getCalledValue()->getType()->getPointerElementType());
+      for (unsigned i = 0, n = FT->getNumParams(); i != n; ++i)
+        IRB.CreateStore(ZeroShadow, DFSF.getArgTLS(i, I));
+    }
+  }
 }
 
 Value *DFSanFunction::getArgTLSPtr() {
@@ -1319,12 +2316,29 @@ Value *DataFlowSanitizer::getShadowAddress(Value *Addr, Instruction *Pos) {
     ShadowPtrMaskValue = IRB.CreateLoad(IntptrTy, ExternalShadowMask);
   else
     ShadowPtrMaskValue = ShadowPtrMask;
-  return IRB.CreateIntToPtr(
-      IRB.CreateMul(
-          IRB.CreateAnd(IRB.CreatePtrToInt(Addr, IntptrTy),
-                        IRB.CreatePtrToInt(ShadowPtrMaskValue, IntptrTy)),
-          ShadowPtrMul),
-      ShadowPtrTy);
+  Value *ShadowOffset =
+      IRB.CreateAnd(IRB.CreatePtrToInt(Addr, IntptrTy),
+                    IRB.CreatePtrToInt(ShadowPtrMaskValue, IntptrTy));
+  if (ShadowGranularityShift)
+    ShadowOffset = IRB.CreateLShr(ShadowOffset, ShadowGranularityShift);
+  return IRB.CreateIntToPtr(IRB.CreateMul(ShadowOffset, ShadowPtrMul),
+                            ShadowPtrTy);
+}
+
+// Loads the directory entry covering Addr.  The result is null when no chunk
+// has been allocated yet; ChunkOffset receives the index of Addr's label
+// within the chunk.
+Value *DataFlowSanitizer::getShadowChunk(Value *Addr, IRBuilder<> &IRB,
+                                         Value *&ChunkOffset) {
+  Value *AddrInt = IRB.CreateAnd(IRB.CreatePtrToInt(Addr, IntptrTy),
+                                 ShadowPtrMask);
+  ChunkOffset = IRB.CreateAnd(AddrInt,
+                              ConstantInt::get(IntptrTy, kShadowChunkSize - 1));
+  Value *Index = IRB.CreateLShr(AddrInt, kShadowChunkShift);
+  Value *Dir = ConstantExpr::getIntToPtr(
+      ConstantInt::get(IntptrTy, kShadowDirAddr),
+      PointerType::getUnqual(ShadowPtrTy));
+  return IRB.CreateLoad(IRB.CreateGEP(ShadowPtrTy, Dir, Index));
 }
 
 
@@ -1337,7 +2351,7 @@ void DFSanFunction::recordBranchInst(BranchInst &I, Value* lhs_shadow,
   Constant* visitorFunction;
 
   Value* cond = I.getCondition();
-  Value* isPointer = ConstantInt::get(DFS.InstIdTy, 0);
+  uint16_t isPointer = 0;
   IntegerType* ctype = dyn_cast<IntegerType>(cond->getType());
   assert(ctype);
   assert(ctype->getBitWidth() == 1);
@@ -1381,20 +2395,26 @@ void DFSanFunction::recordBranchInst(BranchInst &I, Value* lhs_shadow,
   }
 
   // now know branch is valid: get branch id and instrument branch
-  uint64_t br_id = DFS.branch_id.fetch_add(1, std::memory_order_relaxed);
+  uint64_t br_id = getSiteId(*F, NextBranchOrdinal++);
 
   // get file id:
   std::hash<std::string> str_hash;
   size_t file_id = str_hash(I.getModule()->getSourceFileName());
 
-  Value *args[10] = {lhs_shadow, rhs_shadow, lhs, rhs, cond,
-                     ConstantInt::get(DFS.Int32Ty, pred),
-                     ConstantInt::get(DFS.SizeTy, file_id),
-                     ConstantInt::get(DFS.SizeTy, br_id),
-                     isPointer,
-                     IRB.CreateGlobalStringPtr(StringRef(location))};
-
-  Call = IRB.CreateCall(visitorFunction, args);
+  if (DFS.SiteTable) {
+    Constant *site = DFS.getSite(file_id, br_id, location, SK_Branch, pred,
+                                 isPointer);
+    Call = DFS.createRuntimeCall(IRB, DFS.SiteFns[visitorFunction],
+                                 {lhs_shadow, rhs_shadow, lhs, rhs, cond, site});
+  } else {
+    Value *args[10] = {lhs_shadow, rhs_shadow, lhs, rhs, cond,
+                       ConstantInt::get(DFS.Int32Ty, pred),
+                       ConstantInt::get(DFS.SizeTy, file_id),
+                       ConstantInt::get(DFS.SizeTy, br_id),
+                       ConstantInt::get(DFS.InstIdTy, isPointer),
+                       IRB.CreateGlobalStringPtr(StringRef(location))};
+    Call = DFS.createRuntimeCall(IRB, visitorFunction, args);
+  }
   Call->addParamAttr(0, Attribute::ZExt);
   Call->addParamAttr(1, Attribute::ZExt);
 }
@@ -1430,23 +2450,34 @@ Value *DFSanFunction::combineDerivShadows(Value *V1, Value *V2, Instruction *Pos
   }
 
 
+  Constant *unionFunction = nullptr;
   if (x1_is_byte && x2_is_byte) {
-    Call = IRB.CreateCall(DFS.DFSanUnionByteFn, {V1, V2, UV1, UV2, instructionID, opcode, IRB.CreateGlobalStringPtr(StringRef(location))});
+    unionFunction = DFS.DFSanUnionByteFn;
   }
   else if (x1_is_short && x2_is_short) {
-    Call = IRB.CreateCall(DFS.DFSanUnionShortFn, {V1, V2, UV1, UV2, instructionID, opcode, IRB.CreateGlobalStringPtr(StringRef(location))});
+    unionFunction = DFS.DFSanUnionShortFn;
   }
   else if (x1_is_int && x2_is_int) {
-    Call = IRB.CreateCall(DFS.DFSanUnionFn, {V1, V2, UV1, UV2, instructionID, opcode, IRB.CreateGlobalStringPtr(StringRef(location))});
+    unionFunction = DFS.DFSanUnionFn;
   }
   else if (x1_is_long && x2_is_long) {
-    Call = IRB.CreateCall(DFS.DFSanUnionLongFn, {V1, V2, UV1, UV2, instructionID, opcode, IRB.CreateGlobalStringPtr(StringRef(location))});
+    unionFunction = DFS.DFSanUnionLongFn;
   }
   else if (x1_is_float && x2_is_float) {
-    Call = IRB.CreateCall(DFS.DFSanUnionFloatFn, {V1, V2, UV1, UV2, instructionID, opcode, IRB.CreateGlobalStringPtr(StringRef(location))});
+    unionFunction = DFS.DFSanUnionFloatFn;
   }
   else if (x1_is_double && x2_is_double) {
-    Call = IRB.CreateCall(DFS.DFSanUnionDoubleFn, {V1, V2, UV1, UV2, instructionID, opcode, IRB.CreateGlobalStringPtr(StringRef(location))});
+    unionFunction = DFS.DFSanUnionDoubleFn;
+  }
+
+  if (unionFunction && DFS.SiteTable) {
+    std::hash<std::string> str_hash;
+    Constant *site = DFS.getSite(str_hash(DFS.Mod->getSourceFileName()), 0,
+                                 location, SK_Union, Pos->getOpcode(), 0);
+    Call = DFS.createRuntimeCall(IRB, DFS.SiteFns[unionFunction], {V1, V2, UV1, UV2, site});
+  }
+  else if (unionFunction) {
+    Call = DFS.createRuntimeCall(IRB, unionFunction, {V1, V2, UV1, UV2, instructionID, opcode, IRB.CreateGlobalStringPtr(StringRef(location))});
   }
   else {
     // set derivOp = 0 for unsupported type combination
@@ -1525,7 +2556,9 @@ Value *DFSanFunction::loadShadow(Value *Addr, uint64_t Size, uint64_t Align,
     }
   }
 
-  uint64_t ShadowAlign = Align * DFS.ShadowWidth / 8;
+  uint64_t ShadowAlign = DFS.ShadowGranularityShift
+                             ? DFS.ShadowWidth / 8
+                             : Align * DFS.ShadowWidth / 8;
   SmallVector<Value *, 2> Objs;
   GetUnderlyingObjects(Addr, Objs, Pos->getModule()->getDataLayout());
   bool AllConstants = true;
@@ -1541,7 +2574,19 @@ Value *DFSanFunction::loadShadow(Value *Addr, uint64_t Size, uint64_t Align,
   if (AllConstants)
     return DFS.ZeroShadow;
 
-  Value *ShadowAddr = DFS.getShadowAddress(Addr, Pos);
+  Value *ShadowAddr;
+  if (ClTwoLevelShadow) {
+    // Unallocated chunks read from the shared zero chunk.
+    IRBuilder<> IRB(Pos);
+    Value *Offset;
+    Value *Chunk = DFS.getShadowChunk(Addr, IRB, Offset);
+    Value *ZeroChunk = ConstantExpr::getIntToPtr(
+        ConstantInt::get(DFS.IntptrTy, kShadowZeroChunkAddr), DFS.ShadowPtrTy);
+    Chunk = IRB.CreateSelect(IRB.CreateIsNull(Chunk), ZeroChunk, Chunk);
+    ShadowAddr = IRB.CreateGEP(DFS.ShadowTy, Chunk, Offset);
+  } else {
+    ShadowAddr = DFS.getShadowAddress(Addr, Pos);
+  }
 
   // for load Inst gradient take gradient of shadow at base
   // eventually may need to combine gradients of multiple shadows
@@ -1550,7 +2595,25 @@ Value *DFSanFunction::loadShadow(Value *Addr, uint64_t Size, uint64_t Align,
   } else {
     LoadInst *LI = new LoadInst(ShadowAddr, "", Pos);
     LI->setAlignment(ShadowAlign);
-    return LI;
+    if (!DFS.ShadowGranularityShift)
+      return LI;
+
+    // A word whose bytes carry different labels is resolved by the runtime.
+    IRBuilder<> IRB(Pos);
+    Value *Mixed = IRB.CreateICmpEQ(
+        LI, ConstantInt::get(DFS.ShadowTy, kMixedShadowLabel));
+    BasicBlock *Head = LI->getParent();
+    TerminatorInst *MixedTerm = SplitBlockAndInsertIfThen(
+        Mixed, Pos, /*Unreachable=*/false, DFS.ColdCallWeights, &DT);
+    IRBuilder<> MixedIRB(MixedTerm);
+    Value *ByteShadow = MixedIRB.CreateCall(
+        DFS.DFSanLoadMixedLabelFn,
+        MixedIRB.CreateBitCast(Addr, Type::getInt8PtrTy(*DFS.Ctx)));
+    IRB.SetInsertPoint(Pos);
+    PHINode *Shadow = IRB.CreatePHI(DFS.ShadowTy, 2);
+    Shadow->addIncoming(LI, Head);
+    Shadow->addIncoming(ByteShadow, MixedTerm->getParent());
+    return Shadow;
   }
 
 }
@@ -1592,7 +2655,88 @@ void DFSanFunction::storeShadow(Value *Addr, uint64_t Size, uint64_t Align,
 
   uint64_t ShadowAlign = Align * DFS.ShadowWidth / 8;
   IRBuilder<> IRB(Pos);
-  Value *ShadowAddr = DFS.getShadowAddress(Addr, Pos);
+  const uint64_t StoreSize = Size;
+  auto CreateSetLabel = [&](IRBuilder<> &B) {
+    B.CreateCall(DFS.DFSanSetLabelFn,
+                 {Shadow, B.CreateBitCast(Addr, Type::getInt8PtrTy(*DFS.Ctx)),
+                  ConstantInt::get(DFS.IntptrTy, StoreSize)});
+  };
+  Value *ShadowAddr;
+  if (ClTwoLevelShadow) {
+    if (Size > kShadowChunkSize) {
+      CreateSetLabel(IRB);
+      return;
+    }
+
+    // The runtime allocates the chunk for a labelled store to an unbacked
+    // chunk and splits stores straddling two chunks.  Everything else is
+    // stored inline, with zero stores to unbacked chunks (and the inline
+    // store shadowing a runtime call) landing in the scratch chunk.
+    Value *Offset;
+    Value *Chunk = DFS.getShadowChunk(Addr, IRB, Offset);
+    Value *Unbacked = IRB.CreateIsNull(Chunk);
+    Value *Slow = IRB.CreateICmpUGT(
+        Offset, ConstantInt::get(DFS.IntptrTy, kShadowChunkSize - Size));
+    if (Shadow != DFS.ZeroShadow)
+      Slow = IRB.CreateOr(
+          Slow, IRB.CreateAnd(Unbacked, IRB.CreateICmpNE(Shadow, DFS.ZeroShadow)));
+    TerminatorInst *SlowTerm = SplitBlockAndInsertIfThen(
+        Slow, Pos, /*Unreachable=*/false, DFS.ColdCallWeights, &DT);
+    IRBuilder<> SlowIRB(SlowTerm);
+    CreateSetLabel(SlowIRB);
+
+    IRB.SetInsertPoint(Pos);
+    Value *Scratch = ConstantExpr::getIntToPtr(
+        ConstantInt::get(DFS.IntptrTy, kShadowScratchChunkAddr),
+        DFS.ShadowPtrTy);
+    Value *Discard = IRB.CreateOr(Unbacked, Slow);
+    ShadowAddr = IRB.CreateSelect(
+        Discard, Scratch, IRB.CreateGEP(DFS.ShadowTy, Chunk, Offset));
+  } else if (DFS.ShadowGranularityShift) {
+    uint64_t Granularity = 1ULL << DFS.ShadowGranularityShift;
+    if (Size > Granularity && Size % Granularity != 0) {
+      CreateSetLabel(IRB);
+      return;
+    }
+
+    ShadowAddr = DFS.getShadowAddress(Addr, Pos);
+    ShadowAlign = DFS.ShadowWidth / 8;
+    Value *WordOffset =
+        IRB.CreateAnd(IRB.CreatePtrToInt(Addr, DFS.IntptrTy), Granularity - 1);
+    if (Size < Granularity) {
+      // A sub-word store is a no-op when its word already carries the label;
+      // otherwise the runtime splits the word into per-byte labels.
+      Value *Slot = IRB.CreateAlignedLoad(ShadowAddr, ShadowAlign);
+      Value *InWord = IRB.CreateICmpULE(
+          WordOffset, ConstantInt::get(DFS.IntptrTy, Granularity - Size));
+      Value *Slow = IRB.CreateNot(
+          IRB.CreateAnd(InWord, IRB.CreateICmpEQ(Slot, Shadow)));
+      TerminatorInst *SlowTerm = SplitBlockAndInsertIfThen(
+          Slow, Pos, /*Unreachable=*/false, nullptr, &DT);
+      IRBuilder<> SlowIRB(SlowTerm);
+      CreateSetLabel(SlowIRB);
+      return;
+    }
+
+    // Whole words are stored inline, one slot per word, unless the address
+    // turns out not to be word aligned.
+    if (Align % Granularity != 0) {
+      Value *Misaligned =
+          IRB.CreateICmpNE(WordOffset, ConstantInt::get(DFS.IntptrTy, 0));
+      TerminatorInst *SlowTerm = SplitBlockAndInsertIfThen(
+          Misaligned, Pos, /*Unreachable=*/false, DFS.ColdCallWeights, &DT);
+      IRBuilder<> SlowIRB(SlowTerm);
+      CreateSetLabel(SlowIRB);
+
+      IRB.SetInsertPoint(Pos);
+      TerminatorInst *FastTerm = SplitBlockAndInsertIfThen(
+          IRB.CreateNot(Misaligned), Pos, /*Unreachable=*/false, nullptr, &DT);
+      IRB.SetInsertPoint(FastTerm);
+    }
+    Size >>= DFS.ShadowGranularityShift;
+  } else {
+    ShadowAddr = DFS.getShadowAddress(Addr, Pos);
+  }
   if (Shadow == DFS.ZeroShadow) {
     IntegerType *ShadowTy = IntegerType::get(*DFS.Ctx, Size * DFS.ShadowWidth);
     Value *ExtZeroShadow = ConstantInt::get(ShadowTy, 0);
@@ -1809,7 +2953,7 @@ void DFSanFunction::memCpy(MemTransferInst &I, Value* src, Value* dst, Value* n,
   }
 
 
-  CallInst *CustomCI = IRB.CreateCall(DFS.MemCpyFn, {dstCast, srcCast, n, srcShadow, dstShadow, nShadow,
+  CallInst *CustomCI = DFS.createRuntimeCall(IRB, DFS.MemCpyFn, {dstCast, srcCast, n, srcShadow, dstShadow, nShadow,
                                                      IRB.CreateGlobalStringPtr(StringRef(location))});
 
   I.replaceAllUsesWith(CustomCI);
@@ -1854,11 +2998,73 @@ void DFSanVisitor::visitReturnInst(ReturnInst &RI) {
   }
 }
 
+// Computes the label of an intrinsic with a derivative kernel in the runtime
+// with one call taking all operand labels.  Returns false for other
+// intrinsics and for vector operands, which take the generic path.
+bool DFSanVisitor::visitDerivIntrinsic(IntrinsicInst &II) {
+  DerivIntrinsic Kind = getDerivIntrinsic(II.getIntrinsicID());
+  if (Kind == DI_None)
+    return false;
+  Type *Ty = II.getType();
+  bool IsInt = Kind < DI_Fabs;
+  if (IsInt ? !Ty->isIntegerTy() || Ty->getIntegerBitWidth() > 64
+            : !Ty->isFloatTy() && !Ty->isDoubleTy())
+    return false;
+
+  // ctlz and cttz take an unlabeled flag after the integer operand.
+  unsigned NumOps = IsInt ? 1 : II.getNumArgOperands();
+  assert(NumOps <= 3);
+  Value *Shadows[3] = {DFSF.DFS.ZeroShadow, DFSF.DFS.ZeroShadow,
+                       DFSF.DFS.ZeroShadow};
+  bool AnyLabeled = false;
+  for (unsigned i = 0; i < NumOps; ++i) {
+    Shadows[i] = DFSF.getShadow(II.getArgOperand(i));
+    AnyLabeled |= Shadows[i] != DFSF.DFS.ZeroShadow;
+  }
+  if (!AnyLabeled) {
+    DFSF.setShadow(&II, DFSF.DFS.ZeroShadow);
+    return true;
+  }
+
+  std::string location = "UNKNOWN";
+  if (DILocation *Loc = II.getDebugLoc().get())
+    location = Loc->getFilename().str() + ":" + std::to_string(Loc->getLine());
+
+  IRBuilder<> IRB(&II);
+  Value *KindArg = ConstantInt::get(DFSF.DFS.OpCodeTy, Kind);
+  Value *LocStr = IRB.CreateGlobalStringPtr(location);
+  CallInst *Call;
+  if (IsInt) {
+    Call = IRB.CreateCall(
+        DFSF.DFS.DFSanIntrinsicIntFn,
+        {Shadows[0], IRB.CreateZExt(II.getArgOperand(0), DFSF.DFS.Int64Ty),
+         ConstantInt::get(DFSF.DFS.Int32Ty, Ty->getIntegerBitWidth()),
+         KindArg, LocStr});
+  } else {
+    Type *DoubleTy = IRB.getDoubleTy();
+    Value *Vals[3];
+    for (unsigned i = 0; i < 3; ++i)
+      Vals[i] = i < NumOps ? IRB.CreateFPExt(II.getArgOperand(i), DoubleTy)
+                           : ConstantFP::get(DoubleTy, 0);
+    Call = IRB.CreateCall(DFSF.DFS.DFSanIntrinsicFPFn,
+                          {Shadows[0], Shadows[1], Shadows[2], Vals[0],
+                           Vals[1], Vals[2], KindArg, LocStr});
+    Call->addParamAttr(1, Attribute::ZExt);
+    Call->addParamAttr(2, Attribute::ZExt);
+  }
+  Call->addAttribute(AttributeList::ReturnIndex, Attribute::ZExt);
+  Call->addParamAttr(0, Attribute::ZExt);
+  DFSF.setShadow(&II, Call);
+  return true;
+}
+
 void DFSanVisitor::visitCallSite(CallSite CS) {
   Function *F = CS.getCalledFunction();
 
   if ((F && F->isIntrinsic()) || isa<InlineAsm>(CS.getCalledValue())) {
-    visitOperandShadowInst(*CS.getInstruction());
+    auto *II = dyn_cast<IntrinsicInst>(CS.getInstruction());
+    if (!II || !ClIntrinsicDerivs || !visitDerivIntrinsic(*II))
+      visitOperandShadowInst(*CS.getInstruction());
     return;
   }
 
@@ -64,6 +64,14 @@ dfsan_label dfsan_create_label(const char *desc);
 /// Sets the label for each address in [addr,addr+size) to \c label.
 void dfsan_set_label(dfsan_label label, void *addr, size_t size);
 
+/// Labels the \c width byte integer field at \c addr (1 to 8 bytes) as a
+/// single input variable and returns its base label.  Each byte gets a label
+/// derived from the base label whose derivatives are the change in that byte
+/// when the field's integer value steps by one, so the assembled integer has
+/// derivative 1.
+dfsan_label dfsan_label_field(void *addr, size_t width, int big_endian,
+                              int is_signed, const char *desc);
+
 /// Sets the label for each address in [addr,addr+size) to the union of the
 /// current label for that address and \c label.
 void dfsan_add_label(dfsan_label label, void *addr, size_t size);
@@ -80,6 +88,8 @@ dfsan_label dfsan_get_label(long data);
 dfsan_label dfsan_read_label(const void *addr, size_t size);
 
 /// Retrieves a pointer to the dfsan_label_info struct for the given label.
+/// The struct is a snapshot of the label's state at the time of the call;
+/// call again to observe later updates (e.g. from branch barriers).
 const struct dfsan_label_info *dfsan_get_label_info(dfsan_label label);
 
 /// Returns whether the given label label contains the label elem.
@@ -0,0 +1,54 @@
+#!/usr/bin/env python3
+#===- lib/dfsan/benchmarks/compare_bench.py --------------------------------===#
+#
+#                     The LLVM Compiler Infrastructure
+#
+# This file is distributed under the University of Illinois Open Source
+# License. See LICENSE.TXT for details.
+#
+#===------------------------------------------------------------------------===#
+# Compares two csv files written by dfsan_bench.  Runs are matched on kernel,
+# type, op, density, threads and options, and the ratio of the median
+# ns_per_op (new / base) is printed for each, slowest first.  The exit status
+# is 1 when any run is slower than --threshold.
+
+import argparse
+import csv
+import sys
+
+KEY = ('kernel', 'type', 'op', 'density', 'threads', 'options')
+
+
+def load(path):
+  with open(path) as f:
+    return {tuple(row[k] for k in KEY): row for row in csv.DictReader(f)}
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__)
+  parser.add_argument('base')
+  parser.add_argument('new')
+  parser.add_argument('--threshold', type=float, default=1.10,
+                      help='ratio above which a run counts as a regression')
+  args = parser.parse_args()
+
+  base, new = load(args.base), load(args.new)
+  rows = []
+  for key in sorted(set(base) & set(new)):
+    b = float(base[key]['ns_per_op'])
+    n = float(new[key]['ns_per_op'])
+    rows.append((n / b if b else float('inf'), key, b, n))
+  rows.sort(reverse=True)
+
+  print('ratio,base_ns,new_ns,' + ','.join(KEY))
+  for ratio, key, b, n in rows:
+    print('%.3f,%.2f,%.2f,%s' % (ratio, b, n, ','.join(key)))
+
+  missing = len(set(base) ^ set(new))
+  if missing:
+    sys.stderr.write('%d runs appear in only one file\n' % missing)
+  return 1 if any(r[0] > args.threshold for r in rows) else 0
+
+
+if __name__ == '__main__':
+  sys.exit(main())
@@ -0,0 +1,531 @@
+//===-- dfsan_bench.cc ----------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of DataFlowSanitizer.
+//
+// Microbenchmarks for the runtime entry points the instrumentation calls:
+// __dfsan_union* per opcode and type, the branch visitors (which also write
+// branch records), __dfsan_set_label and __memcpy.  The harness itself is not
+// instrumented; it is linked against the runtime and calls the entry points
+// directly, so only the runtime is measured.  The regs kernels instead
+// measure the cost of a union call to a loop that keeps many values live,
+// called directly and through a preserve_most stub like those
+// -dfsan-preserve-most emits, and the table kernel spreads its unions over
+// most of the label table to measure how much of it stays in cache.
+//
+// Runs are parameterized over kernel, label density (the fraction of calls
+// whose operands are labeled) and thread count.  Runtime flags such as
+// samples, branch_barriers and lazy_gradients are set with DFSAN_OPTIONS and
+// echoed in the options column.  Results are written to stdout as csv, one row per run:
+//
+//   kernel,type,op,density,threads,options,ops,ns_per_op,min_ns_per_op
+//
+// Labels run out after 64K unions and branch records after 1M, so each run
+// is split into batches and the runtime is flushed between batches, outside
+// the timed region.
+//===----------------------------------------------------------------------===//
+
+#include <sanitizer/dfsan_interface.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+typedef uintptr_t uptr;
+
+extern "C" {
+dfsan_label __dfsan_union_byte(dfsan_label, dfsan_label, uint8_t, uint8_t,
+                               uptr, uint16_t, char *);
+dfsan_label __dfsan_union_short(dfsan_label, dfsan_label, uint16_t, uint16_t,
+                                uptr, uint16_t, char *);
+dfsan_label __dfsan_union(dfsan_label, dfsan_label, int, int, uptr, uint16_t,
+                          char *);
+dfsan_label __dfsan_union_pc(dfsan_label, dfsan_label, int, int, uptr,
+                             uint16_t, char *, uptr);
+dfsan_label __dfsan_union_long(dfsan_label, dfsan_label, long, long, uptr,
+                               uint16_t, char *);
+dfsan_label __dfsan_union_float(dfsan_label, dfsan_label, float, float, uptr,
+                                uptr, char *);
+dfsan_label __dfsan_union_double(dfsan_label, dfsan_label, double, double,
+                                 uptr, uptr, char *);
+void __branch_visitor_int(dfsan_label, dfsan_label, uint32_t, uint32_t, bool,
+                          uint32_t, uint64_t, uint64_t, uint16_t,
+                          const char *);
+void __branch_visitor_long(dfsan_label, dfsan_label, uint64_t, uint64_t, bool,
+                           uint32_t, uint64_t, uint64_t, uint16_t,
+                           const char *);
+void __branch_visitor_double(dfsan_label, dfsan_label, double, double, bool,
+                             uint32_t, uint64_t, uint64_t, uint16_t,
+                             const char *);
+void __dfsan_set_label(dfsan_label, void *, uptr);
+void __memcpy(void *, const void *, unsigned long, dfsan_label, dfsan_label,
+              dfsan_label, const char *);
+}
+
+// Opcode and predicate numbers from include/llvm/IR/Instruction.def and
+// InstrTypes.h, as the pass passes them.
+enum {
+  kAdd = 11, kFAdd = 12, kSub = 13, kFSub = 14, kMul = 15, kFMul = 16,
+  kUDiv = 17, kSDiv = 18, kFDiv = 19, kURem = 20, kSRem = 21, kFRem = 22,
+  kShl = 23, kLShr = 24, kAShr = 25, kAnd = 26, kOr = 27, kXor = 28
+};
+static const uint32_t kFCmpOLT = 4, kICmpSLT = 40;
+
+static char kLocation[] = "dfsan_bench";
+
+// Operands are read round-robin from these tables, which are rebuilt after
+// every flush.  Values are small and nonzero so that division and shifts stay
+// defined for every type.
+static const size_t kTableSize = 4096;
+static dfsan_label label_table[kTableSize];
+static uint8_t value_table[kTableSize];
+static double fvalue_table[kTableSize];
+
+// The table kernel reads its operands from this many distinct labels instead,
+// so that the label table it touches does not fit in the L2 cache.
+static const size_t kSpreadLabels = 49152;
+static dfsan_label spread_table[kSpreadLabels];
+
+struct Run;
+
+struct Worker {
+  Run *run;
+  pthread_t thread;
+  unsigned index;
+  size_t bytes;
+  char *src, *dst;
+};
+
+struct Kernel {
+  const char *name;
+  const char *type;
+  const char *op;
+  // Runs ops calls (or, for the memory kernels, ops calls of w.bytes bytes).
+  void (*run)(Worker &w, size_t ops, uint16_t op);
+  uint16_t opcode;
+  // Whether each call may create a label, which bounds the batch size.
+  bool creates_labels;
+  // Whether each call writes a branch record.
+  bool writes_records;
+  size_t bytes;
+};
+
+template <typename T>
+using UnionFn = dfsan_label (*)(dfsan_label, dfsan_label, T, T, uptr, uint16_t,
+                                char *);
+template <typename T>
+using FloatUnionFn = dfsan_label (*)(dfsan_label, dfsan_label, T, T, uptr,
+                                     uptr, char *);
+
+template <typename T, UnionFn<T> Fn>
+static void RunIntUnion(Worker &w, size_t ops, uint16_t op) {
+  size_t j = w.index * 97;
+  for (size_t i = 0; i < ops; ++i, ++j) {
+    size_t a = j & (kTableSize - 1), b = (j * 7 + 3) & (kTableSize - 1);
+    Fn(label_table[a], label_table[b], (T) value_table[a],
+       (T) (value_table[b] & 7), i, op, kLocation);
+  }
+}
+
+template <typename T, FloatUnionFn<T> Fn>
+static void RunFloatUnion(Worker &w, size_t ops, uint16_t op) {
+  size_t j = w.index * 97;
+  for (size_t i = 0; i < ops; ++i, ++j) {
+    size_t a = j & (kTableSize - 1), b = (j * 7 + 3) & (kTableSize - 1);
+    Fn(label_table[a], label_table[b], (T) fvalue_table[a],
+       (T) fvalue_table[b], i, op, kLocation);
+  }
+}
+
+// Adds a constant to a label picked at random from spread_table.  The sum has
+// the derivatives of its operand, so with reuse_labels the union returns the
+// operand label and the kernel measures reads of the label table.
+static void RunLabelTable(Worker &w, size_t ops, uint16_t op) {
+  uint32_t s = w.index * 2654435761u + 1;
+  for (size_t i = 0; i < ops; ++i) {
+    s = s * 1664525 + 1013904223;
+    __dfsan_union(spread_table[(s >> 8) % kSpreadLabels], 0, (int) i, 3, i,
+                  op, kLocation);
+  }
+}
+
+static void RunBranchInt(Worker &w, size_t ops, uint16_t) {
+  size_t j = w.index * 97;
+  for (size_t i = 0; i < ops; ++i, ++j) {
+    size_t a = j & (kTableSize - 1), b = (j * 7 + 3) & (kTableSize - 1);
+    uint32_t x = value_table[a], y = value_table[b];
+    __branch_visitor_int(label_table[a], label_table[b], x, y,
+                         (int32_t) x < (int32_t) y, kICmpSLT, 1, i & 255, 0,
+                         kLocation);
+  }
+}
+
+static void RunBranchLong(Worker &w, size_t ops, uint16_t) {
+  size_t j = w.index * 97;
+  for (size_t i = 0; i < ops; ++i, ++j) {
+    size_t a = j & (kTableSize - 1), b = (j * 7 + 3) & (kTableSize - 1);
+    uint64_t x = value_table[a], y = value_table[b];
+    __branch_visitor_long(label_table[a], label_table[b], x, y,
+                          (int64_t) x < (int64_t) y, kICmpSLT, 1, i & 255, 0,
+                          kLocation);
+  }
+}
+
+static void RunBranchDouble(Worker &w, size_t ops, uint16_t) {
+  size_t j = w.index * 97;
+  for (size_t i = 0; i < ops; ++i, ++j) {
+    size_t a = j & (kTableSize - 1), b = (j * 7 + 3) & (kTableSize - 1);
+    double x = fvalue_table[a], y = fvalue_table[b];
+    __branch_visitor_double(label_table[a], label_table[b], x, y, x < y,
+                            kFCmpOLT, 1, i & 255, 0, kLocation);
+  }
+}
+
+// The stub has its own calling convention, so it cannot be passed as a
+// UnionFn.
+#if defined(__clang__) && (defined(__x86_64__) || defined(__aarch64__))
+#define HAVE_PRESERVE_MOST 1
+__attribute__((preserve_most, noinline)) static dfsan_label
+UnionPreserveMost(dfsan_label l1, dfsan_label l2, int x1, int x2, uptr id,
+                  uint16_t op, char *location) {
+  return __dfsan_union_pc(l1, l2, x1, x2, id, op, location,
+                          (uptr)__builtin_return_address(0));
+}
+#else
+#define UnionPreserveMost __dfsan_union
+#endif
+
+static volatile uint64_t regs_sink;
+
+// Eight accumulators stay live across every union call, as in an unrolled
+// instrumented loop.  With the C convention they are kept in callee-saved
+// registers or spilled; with preserve_most they stay where they are.
+template <bool PreserveMost>
+static void RunRegisterHeavy(Worker &w, size_t ops, uint16_t op) {
+  uint64_t a0 = 1, a1 = 2, a2 = 3, a3 = 4, a4 = 5, a5 = 6, a6 = 7, a7 = 8;
+  size_t j = w.index * 97;
+  for (size_t i = 0; i < ops; ++i, ++j) {
+    size_t a = j & (kTableSize - 1), b = (j * 7 + 3) & (kTableSize - 1);
+    uint64_t x = value_table[a];
+    a0 += x;
+    a1 ^= a0 * 3;
+    a2 += a1 >> 1;
+    a3 ^= a2 + x;
+    a4 += a3 * 5;
+    a5 ^= a4 >> 3;
+    a6 += a5 + a0;
+    a7 ^= a6 * 7;
+    if (PreserveMost)
+      UnionPreserveMost(label_table[a], label_table[b], (int) x,
+                        (int) (value_table[b] & 7), i, op, kLocation);
+    else
+      __dfsan_union(label_table[a], label_table[b], (int) x,
+                    (int) (value_table[b] & 7), i, op, kLocation);
+  }
+  regs_sink = a0 ^ a1 ^ a2 ^ a3 ^ a4 ^ a5 ^ a6 ^ a7;
+}
+
+// Labels w.bytes bytes per call with the label of the current table slot, so
+// density controls how many calls write a nonzero label.
+static void RunSetLabel(Worker &w, size_t ops, uint16_t) {
+  size_t j = w.index * 97;
+  for (size_t i = 0; i < ops; ++i, ++j)
+    __dfsan_set_label(label_table[j & (kTableSize - 1)], w.dst, w.bytes);
+}
+
+// Copies w.bytes bytes per call from a buffer whose shadow was labeled
+// according to density before the batch.
+static void RunMemcpy(Worker &w, size_t ops, uint16_t) {
+  for (size_t i = 0; i < ops; ++i)
+    __memcpy(w.dst, w.src, w.bytes, 0, 0, 0, kLocation);
+}
+
+#define INT_UNION_KERNELS(Type, TypeName, Fn)                                 \
+  {"union", TypeName, "Add", RunIntUnion<Type, Fn>, kAdd, true, false, 0},   \
+  {"union", TypeName, "Sub", RunIntUnion<Type, Fn>, kSub, true, false, 0},   \
+  {"union", TypeName, "Mul", RunIntUnion<Type, Fn>, kMul, true, false, 0},   \
+  {"union", TypeName, "UDiv", RunIntUnion<Type, Fn>, kUDiv, true, false, 0}, \
+  {"union", TypeName, "SDiv", RunIntUnion<Type, Fn>, kSDiv, true, false, 0}, \
+  {"union", TypeName, "URem", RunIntUnion<Type, Fn>, kURem, true, false, 0}, \
+  {"union", TypeName, "SRem", RunIntUnion<Type, Fn>, kSRem, true, false, 0}, \
+  {"union", TypeName, "Shl", RunIntUnion<Type, Fn>, kShl, true, false, 0},   \
+  {"union", TypeName, "LShr", RunIntUnion<Type, Fn>, kLShr, true, false, 0}, \
+  {"union", TypeName, "AShr", RunIntUnion<Type, Fn>, kAShr, true, false, 0}, \
+  {"union", TypeName, "And", RunIntUnion<Type, Fn>, kAnd, true, false, 0},   \
+  {"union", TypeName, "Or", RunIntUnion<Type, Fn>, kOr, true, false, 0},     \
+  {"union", TypeName, "Xor", RunIntUnion<Type, Fn>, kXor, true, false, 0}
+
+#define FLOAT_UNION_KERNELS(Type, TypeName, Fn)                                \
+  {"union", TypeName, "FAdd", RunFloatUnion<Type, Fn>, kFAdd, true, false, 0}, \
+  {"union", TypeName, "FSub", RunFloatUnion<Type, Fn>, kFSub, true, false, 0}, \
+  {"union", TypeName, "FMul", RunFloatUnion<Type, Fn>, kFMul, true, false, 0}, \
+  {"union", TypeName, "FDiv", RunFloatUnion<Type, Fn>, kFDiv, true, false, 0}, \
+  {"union", TypeName, "FRem", RunFloatUnion<Type, Fn>, kFRem, true, false, 0}
+
+static const Kernel kKernels[] = {
+  INT_UNION_KERNELS(uint8_t, "byte", __dfsan_union_byte),
+  INT_UNION_KERNELS(uint16_t, "short", __dfsan_union_short),
+  INT_UNION_KERNELS(int, "int", __dfsan_union),
+  INT_UNION_KERNELS(long, "long", __dfsan_union_long),
+  FLOAT_UNION_KERNELS(float, "float", __dfsan_union_float),
+  FLOAT_UNION_KERNELS(double, "double", __dfsan_union_double),
+  {"table", "int", "Add", RunLabelTable, kAdd, true, false, 0},
+  {"branch", "int", "ICmp", RunBranchInt, 0, false, true, 0},
+  {"branch", "long", "ICmp", RunBranchLong, 0, false, true, 0},
+  {"branch", "double", "FCmp", RunBranchDouble, 0, false, true, 0},
+  {"set_label", "64", "", RunSetLabel, 0, false, false, 64},
+  {"set_label", "4096", "", RunSetLabel, 0, false, false, 4096},
+  {"set_label", "1048576", "", RunSetLabel, 0, false, false, 1 << 20},
+  {"memcpy", "64", "", RunMemcpy, 0, false, false, 64},
+  {"memcpy", "4096", "", RunMemcpy, 0, false, false, 4096},
+  {"memcpy", "1048576", "", RunMemcpy, 0, false, false, 1 << 20},
+  {"regs", "c", "Mul", RunRegisterHeavy<false>, kMul, true, false, 0},
+#ifdef HAVE_PRESERVE_MOST
+  {"regs", "preserve_most", "Mul", RunRegisterHeavy<true>, kMul, true, false,
+   0},
+#endif
+};
+
+static const size_t kLabelBudget = 60000;
+static const size_t kRecordBudget = 1000000;
+
+static double NowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Flushes the runtime and rebuilds the operand tables so that a fraction
+// density of the slots carry one of a few base labels.
+static void ResetTables(double density, unsigned seed) {
+  dfsan_flush();
+  dfsan_label base[4];
+  for (int i = 0; i < 4; ++i)
+    base[i] = dfsan_create_label("bench");
+  srand(seed);
+  for (size_t i = 0; i < kTableSize; ++i) {
+    label_table[i] = (rand() / (RAND_MAX + 1.0)) < density ? base[i & 3] : 0;
+    value_table[i] = 1 + rand() % 100;
+    fvalue_table[i] = 0.5 + rand() % 1000 / 10.0;
+  }
+}
+
+// Fills spread_table with new labels at the given density.
+static void SpreadLabels(double density) {
+  for (size_t i = 0; i < kSpreadLabels; ++i)
+    spread_table[i] = (rand() / (RAND_MAX + 1.0)) < density
+                          ? dfsan_create_label("bench")
+                          : 0;
+}
+
+// Labels the source buffer of every worker with the density of the table.
+static void LabelSources(std::vector<Worker> &workers, size_t bytes) {
+  for (Worker &w : workers)
+    for (size_t i = 0; i < bytes; i += 64)
+      __dfsan_set_label(label_table[(i / 64) & (kTableSize - 1)], w.src + i,
+                        std::min<size_t>(64, bytes - i));
+}
+
+struct Run {
+  const Kernel *kernel;
+  size_t batch_ops;  // per worker
+  pthread_barrier_t start, done;
+  bool stop;
+  std::vector<Worker> workers;
+};
+
+// Worker 0 is the main thread, which also flushes between batches.
+static void *WorkerMain(void *arg) {
+  Worker *self = (Worker *) arg;
+  Run *run = self->run;
+  for (;;) {
+    pthread_barrier_wait(&run->start);
+    if (run->stop)
+      return nullptr;
+    run->kernel->run(*self, run->batch_ops, run->kernel->opcode);
+    pthread_barrier_wait(&run->done);
+  }
+}
+
+// Runs a kernel for total_ops calls split over threads and batches, reps
+// times, and returns the median and minimum nanoseconds per call.
+static void Measure(const Kernel &k, double density, unsigned threads,
+                    size_t total_ops, unsigned reps, double *median_ns,
+                    double *min_ns) {
+  Run run;
+  run.kernel = &k;
+  run.stop = false;
+  run.workers.resize(threads);
+  for (unsigned i = 0; i < threads; ++i) {
+    Worker &w = run.workers[i];
+    w.run = &run;
+    w.index = i;
+    w.bytes = k.bytes;
+    w.src = w.dst = nullptr;
+    if (k.bytes) {
+      w.src = (char *) malloc(k.bytes);
+      w.dst = (char *) malloc(k.bytes);
+      memset(w.src, 1, k.bytes);
+    }
+  }
+
+  size_t per_thread = std::max<size_t>(1, total_ops / threads);
+  size_t batch = per_thread;
+  size_t label_budget = kLabelBudget;
+  if (k.run == RunLabelTable)
+    label_budget -= kSpreadLabels;
+  if (k.creates_labels)
+    batch = std::min(batch, label_budget / threads);
+  if (k.writes_records)
+    batch = std::min(batch, kRecordBudget / threads);
+  run.batch_ops = batch;
+
+  pthread_barrier_init(&run.start, nullptr, threads);
+  pthread_barrier_init(&run.done, nullptr, threads);
+  for (unsigned i = 1; i < threads; ++i)
+    pthread_create(&run.workers[i].thread, nullptr, WorkerMain,
+                   &run.workers[i]);
+
+  std::vector<double> samples;
+  for (unsigned rep = 0; rep < reps; ++rep) {
+    double elapsed = 0;
+    size_t done = 0;
+    for (; done < per_thread; done += batch) {
+      ResetTables(density, rep + 1);
+      if (k.run == RunMemcpy)
+        LabelSources(run.workers, k.bytes);
+      if (k.run == RunLabelTable)
+        SpreadLabels(density);
+      run.batch_ops = std::min(batch, per_thread - done);
+      double t0 = NowNs();
+      pthread_barrier_wait(&run.start);
+      k.run(run.workers[0], run.batch_ops, k.opcode);
+      pthread_barrier_wait(&run.done);
+      elapsed += NowNs() - t0;
+    }
+    samples.push_back(elapsed / (double) (per_thread * threads));
+  }
+
+  run.stop = true;
+  pthread_barrier_wait(&run.start);
+  for (unsigned i = 1; i < threads; ++i)
+    pthread_join(run.workers[i].thread, nullptr);
+  pthread_barrier_destroy(&run.start);
+  pthread_barrier_destroy(&run.done);
+  for (Worker &w : run.workers) {
+    free(w.src);
+    free(w.dst);
+  }
+
+  std::sort(samples.begin(), samples.end());
+  *median_ns = samples[samples.size() / 2];
+  *min_ns = samples[0];
+}
+
+static std::vector<std::string> SplitList(const char *s) {
+  std::vector<std::string> out;
+  std::string cur;
+  for (; *s; ++s) {
+    if (*s == ',') {
+      out.push_back(cur);
+      cur.clear();
+    } else {
+      cur += *s;
+    }
+  }
+  out.push_back(cur);
+  return out;
+}
+
+static bool Matches(const Kernel &k, const std::vector<std::string> &filters) {
+  std::string id = std::string(k.name) + "/" + k.type + "/" + k.op;
+  for (const std::string &f : filters)
+    if (id.find(f) != std::string::npos)
+      return true;
+  return false;
+}
+
+static void Usage() {
+  fprintf(stderr,
+          "usage: dfsan_bench [--kernels=<substr>,...] [--density=<d>,...]\n"
+          "                   [--threads=<n>,...] [--ops=<n>] [--reps=<n>]\n"
+          "                   [--no-header] [--list]\n"
+          "Kernels are named <kernel>/<type>/<op>, e.g. union/int/Mul.\n"
+          "Runtime flags (samples, branch_barriers, lazy_gradients) come "
+          "from DFSAN_OPTIONS.\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  std::vector<std::string> filters(1, "");
+  std::vector<std::string> densities = SplitList("0.1,1");
+  std::vector<std::string> thread_counts = SplitList("1");
+  size_t ops = 1 << 20;
+  unsigned reps = 5;
+  bool header = true, list = false;
+
+  for (int i = 1; i < argc; ++i) {
+    const char *a = argv[i];
+    if (!strncmp(a, "--kernels=", 10))
+      filters = SplitList(a + 10);
+    else if (!strncmp(a, "--density=", 10))
+      densities = SplitList(a + 10);
+    else if (!strncmp(a, "--threads=", 10))
+      thread_counts = SplitList(a + 10);
+    else if (!strncmp(a, "--ops=", 6))
+      ops = strtoull(a + 6, nullptr, 0);
+    else if (!strncmp(a, "--reps=", 7))
+      reps = atoi(a + 7);
+    else if (!strcmp(a, "--no-header"))
+      header = false;
+    else if (!strcmp(a, "--list"))
+      list = true;
+    else
+      Usage();
+  }
+  if (!ops || !reps)
+    Usage();
+
+  const char *options = getenv("DFSAN_OPTIONS");
+  if (!options)
+    options = "";
+
+  if (header && !list)
+    printf("kernel,type,op,density,threads,options,ops,ns_per_op,"
+           "min_ns_per_op\n");
+  for (const Kernel &k : kKernels) {
+    if (!Matches(k, filters))
+      continue;
+    if (list) {
+      printf("%s/%s/%s\n", k.name, k.type, k.op);
+      continue;
+    }
+    // Large copies are measured in fewer calls.
+    size_t kernel_ops = k.bytes >= 4096 ? std::max<size_t>(ops >> 8, 64) : ops;
+    for (const std::string &d : densities) {
+      for (const std::string &t : thread_counts) {
+        unsigned threads = std::max(1, atoi(t.c_str()));
+        double median_ns, min_ns;
+        Measure(k, atof(d.c_str()), threads, kernel_ops, reps, &median_ns,
+                &min_ns);
+        printf("%s,%s,%s,%s,%u,\"%s\",%zu,%.2f,%.2f\n", k.name, k.type, k.op,
+               d.c_str(), threads, options, kernel_ops, median_ns, min_ns);
+        fflush(stdout);
+      }
+    }
+  }
+  return 0;
+}
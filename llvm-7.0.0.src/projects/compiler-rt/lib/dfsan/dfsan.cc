@@ -24,6 +24,9 @@
 #include <math.h>
 #include <string.h>
 #include <limits.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "sanitizer_common/sanitizer_atomic.h"
 #include "sanitizer_common/sanitizer_common.h"
@@ -31,8 +34,15 @@
 #include "sanitizer_common/sanitizer_flags.h"
 #include "sanitizer_common/sanitizer_flag_parser.h"
 #include "sanitizer_common/sanitizer_libc.h"
+#include "sanitizer_common/sanitizer_mutex.h"
+#include "sanitizer_common/sanitizer_posix.h"
+#include "sanitizer_common/sanitizer_stackdepot.h"
+#include "sanitizer_common/sanitizer_stacktrace.h"
+#include "sanitizer_common/sanitizer_symbolizer.h"
 
 #include "dfsan/dfsan.h"
+#include "dfsan/dfsan_allocator.h"
+#include "dfsan/dfsan_profile.h"
 #include "stdint.h"
 
 
@@ -41,7 +51,10 @@
 #define DEBUG false
 
 #define BRANCH_RECORDS_SIZE 1048576
+#define CMP_RECORDS_SIZE 1048576
+#define OUTPUT_RECORDS_SIZE 1048576
 #define FUNC_ARGS_SIZE 65535
+#define FUNC_ARG_SITES_SIZE 65536
 
 using namespace __dfsan;
 
@@ -56,14 +69,55 @@ static const float LOG2 = 0.69314718056;
 // Note: If you add more structures, please change dfsan_flush()
 //
 static atomic_dfsan_label __dfsan_last_label;
-static dfsan_label_info __dfsan_label_info[kNumLabels];
+static dfsan_label_deriv __dfsan_label_deriv[kNumLabels];
+static dfsan_label_prov __dfsan_label_prov[kNumLabels];
+static const char *__dfsan_label_loc[kNumLabels];
+
+// Public AoS view handed out by dfsan_get_label_info(), mapped at init and
+// only filled (and therefore only backed by memory) for queried labels.
+static dfsan_label_info *__dfsan_label_info_view;
+// Set for labels passed to dfsan_get_label_info(); roots for
+// dump_labels=reachable.
+static u8 __dfsan_label_queried[kNumLabels];
 
 // record:
 static atomic_uint64_t __dfsan_record_index;
-static atomic_uint16_t __dfsan_arg_index;
+static atomic_uint64_t __dfsan_arg_index;
 static branch_record __branch_records[BRANCH_RECORDS_SIZE];
+static atomic_uint64_t __dfsan_cmp_index;
+static cmp_record __cmp_records[CMP_RECORDS_SIZE];
+static atomic_uint64_t __dfsan_output_index;
+static output_record __output_records[OUTPUT_RECORDS_SIZE];
+// Bytes written so far through each descriptor by the output wrappers, used
+// as the output offset of stream writes.
+static const int kMaxOutputFds = 1024;
+static atomic_uint64_t __dfsan_output_offsets[kMaxOutputFds];
+// Raw function argument records are a bounded sample: at most
+// func_arg_samples per site, and at most FUNC_ARGS_SIZE in total.  Every call
+// is still counted in the site's aggregate below.
 static func_arg_record __func_arg_records[FUNC_ARGS_SIZE];
 
+// Aggregate of all record_arg calls for one (file_id, inst_id, arg_ind).
+struct func_arg_site {
+  atomic_uint8_t state;  // kSiteEmpty, kSiteBusy or kSiteReady
+  unsigned long file_id;
+  unsigned int inst_id;
+  unsigned int arg_ind;
+  u32 context;
+  const char *loc;
+  StaticSpinMutex mu;
+  u64 count;
+  u32 samples;
+  dfsan_label label;  // label of the first call
+  float min_v, max_v;
+  float min_ndx, max_ndx;
+  float min_pdx, max_pdx;
+};
+
+static const u8 kSiteEmpty = 0, kSiteBusy = 1, kSiteReady = 2;
+static func_arg_site __func_arg_sites[FUNC_ARG_SITES_SIZE];
+static atomic_uint64_t __dfsan_arg_sites_dropped;
+
 int gr_mode_perf = 0;
 
 Flags __dfsan::flags_data;
@@ -175,14 +229,570 @@ static uptr UnusedAddr() {
 //         + sizeof(dfsan_union_table_t);
 }
 
+// Every instrumented module defines the marker of the ABI it was built with
+// (-dfsan-args-abi or not).  Calls between modules built with different ABIs
+// silently lose or corrupt argument and return labels.
+extern "C" SANITIZER_WEAK_ATTRIBUTE const int __dfsan_abi_tls;
+extern "C" SANITIZER_WEAK_ATTRIBUTE const int __dfsan_abi_args;
+
+static void CheckInstrumentedABI() {
+  if (&__dfsan_abi_tls && &__dfsan_abi_args) {
+    Report("FATAL: DataFlowSanitizer: the program mixes modules instrumented "
+           "with and without -dfsan-args-abi\n");
+    Die();
+  }
+}
+
+// Defined (weak) by modules instrumented with -dfsan-two-level-shadow.
+extern "C" SANITIZER_WEAK_ATTRIBUTE const int __dfsan_shadow_mode;
+static const int kShadowModeTwoLevel = 1;
+
+bool __dfsan::two_level_shadow;
+static atomic_uintptr_t __dfsan_shadow_chunk_next;
+
+// Defined (weak) by modules instrumented with -dfsan-shadow-granularity.
+extern "C" SANITIZER_WEAK_ATTRIBUTE const int __dfsan_shadow_granularity;
+
+uptr __dfsan::shadow_granularity_shift;
+
+// With word-granular shadow a slot holding kMixedShadowLabel stands for a
+// word whose bytes carry different labels; the per-byte labels then live in
+// the side table below, keyed by the word's application address.
+//
+// The table is open addressed and rehashed into a larger mapping when it
+// fills.  An entry is dropped when its word folds back to a uniform label or
+// its memory is released; entries left behind by whole-word stores, which
+// overwrite the slot without calling into the runtime, go at the next rehash.
+// Each word's entry is only touched under the stripe lock its address hashes
+// to; a rehash takes every stripe.
+static const uptr kMixedShadowMinWords = 1 << 12;
+static const uptr kMixedShadowStripes = 64;
+// Marks a dropped entry so that probes continue past it.  Word addresses are
+// at least 4-aligned and never take this value.
+static const uptr kMixedShadowDeleted = 1;
+
+struct mixed_shadow_word {
+  atomic_uintptr_t word;
+  dfsan_label labels[8];
+};
+
+static mixed_shadow_word *__dfsan_mixed_shadow;
+static uptr mixed_shadow_words;
+// Entries that are not empty, dropped ones included.
+static atomic_uintptr_t mixed_shadow_used;
+static StaticSpinMutex mixed_shadow_mu[kMixedShadowStripes];
+
+static u64 MixedShadowHash(uptr word) {
+  return (word >> shadow_granularity_shift) * 0x9E3779B97F4A7C15ULL;
+}
+
+static StaticSpinMutex *MixedShadowStripe(uptr word) {
+  return &mixed_shadow_mu[MixedShadowHash(word) >> 58];
+}
+
+static void LockMixedShadow() {
+  for (uptr i = 0; i != kMixedShadowStripes; ++i)
+    mixed_shadow_mu[i].Lock();
+}
+
+static void UnlockMixedShadow() {
+  for (uptr i = kMixedShadowStripes; i != 0; --i)
+    mixed_shadow_mu[i - 1].Unlock();
+}
+
+static void MapMixedShadow(uptr words) {
+  __dfsan_mixed_shadow = (mixed_shadow_word *)MmapNoReserveOrDie(
+      sizeof(mixed_shadow_word) * words, "dfsan mixed shadow");
+  mixed_shadow_words = words;
+  atomic_store(&mixed_shadow_used, 0, memory_order_relaxed);
+}
+
+// Returns the entry of |word|, or null if it has none.  The caller holds the
+// word's stripe.
+static mixed_shadow_word *FindMixedShadow(uptr word) {
+  uptr mask = mixed_shadow_words - 1;
+  uptr i = MixedShadowHash(word) & mask;
+  for (uptr n = 0; n != mixed_shadow_words; ++n, i = (i + 1) & mask) {
+    mixed_shadow_word *m = &__dfsan_mixed_shadow[i];
+    uptr cur = atomic_load(&m->word, memory_order_acquire);
+    if (cur == word)
+      return m;
+    if (cur == 0)
+      return nullptr;
+  }
+  return nullptr;
+}
+
+// Claims an entry for |word|, which must not have one.  Returns null when
+// the table is three quarters full and needs a rehash first.  Other stripes
+// may be claiming entries at the same time, hence the CAS.
+static mixed_shadow_word *ClaimMixedShadow(uptr word) {
+  if ((atomic_load(&mixed_shadow_used, memory_order_relaxed) + 1) * 4 >
+      mixed_shadow_words * 3)
+    return nullptr;
+  uptr mask = mixed_shadow_words - 1;
+  for (uptr i = MixedShadowHash(word) & mask;; i = (i + 1) & mask) {
+    mixed_shadow_word *m = &__dfsan_mixed_shadow[i];
+    uptr cur = atomic_load(&m->word, memory_order_acquire);
+    if (cur != 0 && cur != kMixedShadowDeleted)
+      continue;
+    if (atomic_compare_exchange_strong(&m->word, &cur, word,
+                                       memory_order_acq_rel)) {
+      if (cur == 0)
+        atomic_fetch_add(&mixed_shadow_used, 1, memory_order_relaxed);
+      return m;
+    }
+  }
+}
+
+static void DropMixedShadow(mixed_shadow_word *m) {
+  atomic_store(&m->word, kMixedShadowDeleted, memory_order_release);
+}
+
+// Moves the entries whose words are still mixed into a fresh table at most a
+// quarter full.  The caller holds every stripe.
+static void RehashMixedShadow() {
+  mixed_shadow_word *old = __dfsan_mixed_shadow;
+  uptr old_words = mixed_shadow_words;
+  uptr live = 0;
+  for (uptr i = 0; i != old_words; ++i) {
+    uptr word = atomic_load(&old[i].word, memory_order_relaxed);
+    if (word > kMixedShadowDeleted &&
+        *shadow_for((void *) word) == kMixedShadowLabel)
+      ++live;
+  }
+  uptr words = kMixedShadowMinWords;
+  while (words < live * 4)
+    words *= 2;
+
+  MapMixedShadow(words);
+  for (uptr i = 0; i != old_words; ++i) {
+    uptr word = atomic_load(&old[i].word, memory_order_relaxed);
+    if (word > kMixedShadowDeleted &&
+        *shadow_for((void *) word) == kMixedShadowLabel)
+      internal_memcpy(ClaimMixedShadow(word)->labels, old[i].labels,
+                      sizeof(old[i].labels));
+  }
+  UnmapOrDie(old, sizeof(mixed_shadow_word) * old_words);
+}
+
+// Labels bytes [off, off+n) of the word at |word| whose slot is |slot|,
+// splitting the slot into per-byte labels as needed and folding it back once
+// all bytes agree again.
+static void SetMixedShadow(dfsan_label *slot, uptr word, uptr off, uptr n,
+                           dfsan_label label) {
+  uptr granularity = 1ULL << shadow_granularity_shift;
+  StaticSpinMutex *mu = MixedShadowStripe(word);
+  mu->Lock();
+  // A uniform slot may still have a stale entry from before a whole-word
+  // store; reuse it rather than claim a second one.
+  mixed_shadow_word *m = FindMixedShadow(word);
+  while (!m && !(m = ClaimMixedShadow(word))) {
+    mu->Unlock();
+    LockMixedShadow();
+    if ((atomic_load(&mixed_shadow_used, memory_order_relaxed) + 1) * 4 >
+        mixed_shadow_words * 3)
+      RehashMixedShadow();
+    UnlockMixedShadow();
+    mu->Lock();
+    m = FindMixedShadow(word);
+  }
+
+  if (*slot != kMixedShadowLabel)
+    for (uptr i = 0; i != granularity; ++i)
+      m->labels[i] = *slot;
+  for (uptr i = off; i != off + n; ++i)
+    m->labels[i] = label;
+
+  bool uniform = true;
+  for (uptr i = 1; i != granularity; ++i)
+    uniform &= m->labels[i] == m->labels[0];
+  if (uniform) {
+    *slot = m->labels[0];
+    DropMixedShadow(m);
+  } else {
+    *slot = kMixedShadowLabel;
+  }
+  mu->Unlock();
+}
+
+static void SetWordShadow(dfsan_label label, uptr addr, uptr size) {
+  uptr granularity = 1ULL << shadow_granularity_shift;
+  for (uptr end = addr + size; addr != end;) {
+    uptr word = addr & ~(granularity - 1);
+    uptr n = Min(end, word + granularity) - addr;
+    dfsan_label *slot = shadow_for((void *) addr);
+    // As with the flat shadow, avoid dirtying pages that already hold the
+    // right label.  A mixed word goes through the table even when it is
+    // overwritten whole, so that its entry is dropped.
+    if (*slot != label) {
+      if (n == granularity && *slot != kMixedShadowLabel)
+        *slot = label;
+      else
+        SetMixedShadow(slot, word, addr - word, n, label);
+    }
+    addr += n;
+  }
+}
+
+static dfsan_label ReadWordShadow(const void *ptr) {
+  dfsan_label label = *shadow_for(ptr);
+  if (label != kMixedShadowLabel)
+    return label;
+  uptr granularity = 1ULL << shadow_granularity_shift;
+  uptr word = (uptr) ptr & ~(granularity - 1);
+  SpinMutexLock l(MixedShadowStripe(word));
+  // The word may have folded back while we waited for the stripe.
+  label = *shadow_for(ptr);
+  if (label != kMixedShadowLabel)
+    return label;
+  mixed_shadow_word *m = FindMixedShadow(word);
+  return m ? m->labels[(uptr) ptr - word] : 0;
+}
+
+// Drops the entries of the words in [beg, end), both word aligned, ahead of
+// their shadow being released.  Walks whichever of the range and the table
+// is smaller.
+static void ReleaseMixedShadow(uptr beg, uptr end) {
+  if (atomic_load(&mixed_shadow_used, memory_order_relaxed) == 0)
+    return;
+  uptr granularity = 1ULL << shadow_granularity_shift;
+  if ((end - beg) >> shadow_granularity_shift <= mixed_shadow_words) {
+    for (uptr word = beg; word != end; word += granularity) {
+      if (*shadow_for((void *) word) != kMixedShadowLabel)
+        continue;
+      SpinMutexLock l(MixedShadowStripe(word));
+      if (mixed_shadow_word *m = FindMixedShadow(word))
+        DropMixedShadow(m);
+    }
+    return;
+  }
+  LockMixedShadow();
+  for (uptr i = 0; i != mixed_shadow_words; ++i) {
+    uptr word = atomic_load(&__dfsan_mixed_shadow[i].word,
+                            memory_order_relaxed);
+    if (word >= beg && word < end)
+      DropMixedShadow(&__dfsan_mixed_shadow[i]);
+  }
+  UnlockMixedShadow();
+}
+
+static void CopyWordShadow(uptr dst, uptr src, uptr size) {
+  uptr granularity = 1ULL << shadow_granularity_shift;
+  while (size != 0) {
+    // Whole, mutually aligned words with a uniform label copy slot to slot.
+    if (size >= granularity && !((dst | src) & (granularity - 1))) {
+      dfsan_label label = *shadow_for((void *) src);
+      if (label != kMixedShadowLabel) {
+        dfsan_label *slot = shadow_for((void *) dst);
+        if (*slot != label)
+          *slot = label;
+        dst += granularity;
+        src += granularity;
+        size -= granularity;
+        continue;
+      }
+    }
+    SetWordShadow(ReadWordShadow((void *) src), dst, 1);
+    ++dst;
+    ++src;
+    --size;
+  }
+}
+
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE
+dfsan_label __dfsan_load_mixed_label(const void *addr) {
+  return ReadWordShadow(addr);
+}
+
+static void InitializeShadowGranularity() {
+  if (!&__dfsan_shadow_granularity || __dfsan_shadow_granularity == 1)
+    return;
+  if (__dfsan_shadow_granularity != 4 && __dfsan_shadow_granularity != 8) {
+    Report("FATAL: DataFlowSanitizer: unsupported shadow granularity %d\n",
+           __dfsan_shadow_granularity);
+    Die();
+  }
+  if (two_level_shadow) {
+    Report("FATAL: DataFlowSanitizer: word-granular shadow requires the flat "
+           "shadow layout\n");
+    Die();
+  }
+  shadow_granularity_shift = __dfsan_shadow_granularity == 4 ? 2 : 3;
+  MapMixedShadow(kMixedShadowMinWords);
+}
+
+static uptr ShadowChunkSpan(uptr addr, uptr size) {
+  return Min(size, kShadowChunkSize - shadow_chunk_offset((void *) addr));
+}
+
+dfsan_label *__dfsan::AllocShadowChunk(uptr index) {
+  atomic_uintptr_t *entry = (atomic_uintptr_t *) &shadow_dir()[index];
+  uptr chunk = atomic_load(entry, memory_order_acquire);
+  if (chunk)
+    return (dfsan_label *) chunk;
+
+  uptr fresh = atomic_fetch_add(&__dfsan_shadow_chunk_next, kShadowChunkBytes,
+                                memory_order_relaxed);
+  if (fresh + kShadowChunkBytes > UnusedAddr()) {
+    Report("FATAL: DataFlowSanitizer: out of shadow chunks\n");
+    Die();
+  }
+  // Another thread may have installed a chunk in the meantime; the fresh one
+  // is then left untouched and never backed by memory.
+  if (!atomic_compare_exchange_strong(entry, &chunk, fresh,
+                                      memory_order_acq_rel))
+    return (dfsan_label *) chunk;
+  return (dfsan_label *) fresh;
+}
+
+dfsan_label __dfsan::ReadShadow(const void *ptr) {
+  if (shadow_granularity_shift)
+    return ReadWordShadow(ptr);
+  if (!two_level_shadow)
+    return *shadow_for(ptr);
+  dfsan_label *chunk = shadow_dir()[shadow_chunk_index(ptr)];
+  return chunk ? chunk[shadow_chunk_offset(ptr)] : 0;
+}
+
+bool __dfsan::shadow_inited;
+
+static void SetShadowRange(dfsan_label label, dfsan_label *labelp, uptr size);
+
+void __dfsan::ReleaseShadow(uptr addr, uptr size) {
+  if (!shadow_inited || size == 0)
+    return;
+  uptr page = GetPageSizeCached();
+  if (two_level_shadow) {
+    // Chunks that are covered whole keep their backing but drop their pages;
+    // partially covered ones are cleared in place.
+    while (size != 0) {
+      uptr n = ShadowChunkSpan(addr, size);
+      dfsan_label *chunk = shadow_dir()[shadow_chunk_index((void *) addr)];
+      if (chunk && n == kShadowChunkSize)
+        ReleaseMemoryPagesToOS((uptr) chunk, (uptr) chunk + kShadowChunkBytes);
+      else if (chunk)
+        SetShadowRange(0, chunk + shadow_chunk_offset((void *) addr), n);
+      addr += n;
+      size -= n;
+    }
+    return;
+  }
+
+  // The flat shadow of the whole words in the range is linear in the
+  // address; release the pages it spans and clear the rest through the
+  // regular path.
+  uptr granularity = 1ULL << shadow_granularity_shift;
+  uptr beg = RoundUpTo(addr, granularity);
+  uptr end = RoundDownTo(addr + size, granularity);
+  if (beg < end) {
+    uptr s_beg = (uptr) shadow_for((void *) beg);
+    uptr s_end = (uptr) shadow_for((void *) (end - 1)) + sizeof(dfsan_label);
+    uptr r_beg = RoundUpTo(s_beg, page);
+    uptr r_end = RoundDownTo(s_end, page);
+    if (r_beg < r_end) {
+      uptr a_beg = beg + (((r_beg - s_beg) / sizeof(dfsan_label))
+                          << shadow_granularity_shift);
+      uptr a_end = beg + (((r_end - s_beg) / sizeof(dfsan_label))
+                          << shadow_granularity_shift);
+      if (shadow_granularity_shift)
+        ReleaseMixedShadow(a_beg, a_end);
+      ReleaseMemoryPagesToOS(r_beg, r_end);
+      dfsan_set_label(0, (void *) addr, a_beg - addr);
+      dfsan_set_label(0, (void *) a_end, addr + size - a_end);
+      return;
+    }
+  }
+  dfsan_set_label(0, (void *) addr, size);
+}
+
+void __dfsan::CopyShadow(void *dst, const void *src, uptr size) {
+  if (shadow_granularity_shift) {
+    CopyWordShadow((uptr) dst, (uptr) src, size);
+    return;
+  }
+  if (!two_level_shadow) {
+    internal_memcpy((void *) shadow_for(dst), (const void *) shadow_for(src),
+                    size * sizeof(dfsan_label));
+    return;
+  }
+
+  uptr d = (uptr) dst, s = (uptr) src;
+  while (size != 0) {
+    uptr n = ShadowChunkSpan(d, ShadowChunkSpan(s, size));
+    dfsan_label *schunk = shadow_dir()[shadow_chunk_index((void *) s)];
+    dfsan_label *dchunk = shadow_dir()[shadow_chunk_index((void *) d)];
+    if (schunk) {
+      if (!dchunk)
+        dchunk = AllocShadowChunk(shadow_chunk_index((void *) d));
+      internal_memcpy(dchunk + shadow_chunk_offset((void *) d),
+                      schunk + shadow_chunk_offset((void *) s),
+                      n * sizeof(dfsan_label));
+    } else if (dchunk) {
+      internal_memset(dchunk + shadow_chunk_offset((void *) d), 0,
+                      n * sizeof(dfsan_label));
+    }
+    d += n;
+    s += n;
+    size -= n;
+  }
+}
+
+static void InitializeShadowChunks() {
+  atomic_store(&__dfsan_shadow_chunk_next, ShadowChunkArenaAddr(),
+               memory_order_relaxed);
+  // Reads of unbacked chunks are redirected here by instrumented code.
+  MprotectReadOnly(ShadowZeroChunkAddr(), kShadowChunkBytes);
+}
+
 // Checks we do not run out of labels.
 static void dfsan_check_label(dfsan_label label) {
-  if (label == kInitializingLabel) {
+  if (label == kInitializingLabel ||
+      (shadow_granularity_shift && label == kMixedShadowLabel)) {
     Report("FATAL: DataFlowSanitizer: out of labels\n");
     Die();
   }
 }
 
+// Lazy gradients.  With lazy_gradients a union only records its operands and
+// returns a new label; the derivatives of that label are computed when they
+// are first read, by a branch visitor, record_arg, dfsan_get_label_info, the
+// memo cache or a label dump.  Most union labels are never read, so their
+// sampling loops are never run.  Reading a pending label evaluates the
+// pending labels it was computed from first, in post order; each label is
+// evaluated at most once.  A branch barrier evaluates the pending labels
+// that may use its operands before it overwrites their derivatives.
+// Divisions and remainders by a labeled value stay eager, since they record
+// their divisor as they go.
+static bool lazy_gradients;
+
+typedef void (*lazy_eval_fn)(dfsan_label into, u64 x1, u64 x2);
+
+struct lazy_union {
+  u64 x1;
+  u64 x2;
+  lazy_eval_fn eval;
+};
+
+static lazy_union __dfsan_lazy_unions[kNumLabels];
+static atomic_uint8_t __dfsan_label_pending[kNumLabels];
+// Evaluation stack: a label is pushed by each pending label that uses it,
+// and at most two labels per level of the DAG are on the stack at once.
+static dfsan_label __dfsan_lazy_stack[2 * kNumLabels];
+static StaticSpinMutex lazy_mu;
+
+static bool LabelPending(dfsan_label label) {
+  return atomic_load(&__dfsan_label_pending[label], memory_order_acquire);
+}
+
+static void EvalLazyLabels(dfsan_label root) {
+  SpinMutexLock l(&lazy_mu);
+  uptr n = 0;
+  __dfsan_lazy_stack[n++] = root;
+  while (n) {
+    dfsan_label label = __dfsan_lazy_stack[n - 1];
+    if (!LabelPending(label)) {
+      --n;
+      continue;
+    }
+    const dfsan_label_prov &prov = __dfsan_label_prov[label];
+    dfsan_label operands[2] = {prov.l1, prov.l2};
+    bool ready = true;
+    for (dfsan_label operand : operands) {
+      if (LabelPending(operand)) {
+        CHECK_LT(n, 2 * kNumLabels);
+        __dfsan_lazy_stack[n++] = operand;
+        ready = false;
+      }
+    }
+    if (!ready)
+      continue;
+    const lazy_union &u = __dfsan_lazy_unions[label];
+    u.eval(label, u.x1, u.x2);
+    atomic_store(&__dfsan_label_pending[label], 0, memory_order_release);
+    --n;
+  }
+}
+
+static inline void ForceLabel(dfsan_label label) {
+  if (UNLIKELY(lazy_gradients) && LabelPending(label))
+    EvalLazyLabels(label);
+}
+
+// No label up to this one is pending.  Only new labels are recorded lazily,
+// so this stays true until dfsan_flush.
+static atomic_dfsan_label __dfsan_lazy_forced;
+
+// Evaluates every pending label that may have been computed from lhs or rhs,
+// before a branch barrier overwrites their derivatives.  Labels are handed
+// out in order, so those are the ones above the lower of the two.
+static void ForceLazyUsers(dfsan_label lhs, dfsan_label rhs) {
+  if (LIKELY(!lazy_gradients))
+    return;
+  dfsan_label low = lhs && rhs ? Min(lhs, rhs) : lhs | rhs;
+  dfsan_label last = atomic_load(&__dfsan_last_label, memory_order_relaxed);
+  dfsan_label forced = atomic_load(&__dfsan_lazy_forced, memory_order_relaxed);
+  for (dfsan_label l = Max(low, forced) + 1; l <= last; ++l)
+    ForceLabel(l);
+  // Labels between the watermark and low were skipped and may still pend.
+  // Move the watermark past those that do not, so that barriers on old
+  // labels (say, input bytes) do not rescan every label after them.
+  dfsan_label l = forced;
+  while (l < last && (l >= low || !LabelPending(l + 1)))
+    ++l;
+  if (l > forced)
+    atomic_store(&__dfsan_lazy_forced, l, memory_order_relaxed);
+}
+
+// Whether label is known, without evaluating it, to have zero derivatives.
+static inline bool LabelKnownZero(dfsan_label label) {
+  if (!label)
+    return true;
+  if (LabelPending(label))
+    return false;
+  const dfsan_label_deriv &d = __dfsan_label_deriv[label];
+  return deriv_to_float(d.neg_dydx) == 0 && deriv_to_float(d.pos_dydx) == 0;
+}
+
+// Records a union for evaluation on first use.  x1 and x2 point to the
+// operand values, of size bytes each.  As with reuse_labels in the eager
+// unions, a union of operands already known to have zero derivatives
+// returns an operand label instead of a new one.
+static dfsan_label RecordLazyUnion(dfsan_label l1, dfsan_label l2,
+                                   const void *x1, const void *x2, uptr size,
+                                   lazy_eval_fn eval, uptr opcode,
+                                   const char *location) {
+  if (flags().reuse_labels && LabelKnownZero(l1) && LabelKnownZero(l2))
+    return l1 ? l1 : l2;
+  dfsan_label label =
+      atomic_fetch_add(&__dfsan_last_label, 1, memory_order_relaxed) + 1;
+  dfsan_check_label(label);
+  __dfsan_label_prov[label] = {l1, l2, (dfsan_label)opcode, 0};
+  __dfsan_label_loc[label] = location;
+  lazy_union &u = __dfsan_lazy_unions[label];
+  u.x1 = u.x2 = 0;
+  internal_memcpy(&u.x1, x1, size);
+  internal_memcpy(&u.x2, x2, size);
+  u.eval = eval;
+  atomic_store(&__dfsan_label_pending[label], 1, memory_order_release);
+  return label;
+}
+
+static inline float label_neg_dydx(dfsan_label label) {
+  ForceLabel(label);
+  return deriv_to_float(__dfsan_label_deriv[label].neg_dydx);
+}
+
+static inline float label_pos_dydx(dfsan_label label) {
+  ForceLabel(label);
+  return deriv_to_float(__dfsan_label_deriv[label].pos_dydx);
+}
+
+static inline void set_label_dydx(dfsan_label label, float neg_dydx,
+                                  float pos_dydx) {
+  __dfsan_label_deriv[label].neg_dydx = float_to_deriv(neg_dydx);
+  __dfsan_label_deriv[label].pos_dydx = float_to_deriv(pos_dydx);
+}
 
 static const char* supportedLabel(bool supported) {
   return supported ? "supported" : "UNSUPPORTED";
@@ -289,7 +899,30 @@ static const char* opcodeNames[] = {"",
   "ShuffleVector",
   "ExtractValue",
   "InsertValue",
-  "LandingPad"
+  "LandingPad",
+  "bswap",
+  "ctpop",
+  "ctlz",
+  "cttz",
+  "fabs",
+  "sqrt",
+  "fma",
+  "minnum",
+  "maxnum",
+  "copysign",
+  "floor",
+  "ceil",
+  "trunc",
+  "rint",
+  "round",
+  "exp",
+  "exp2",
+  "log",
+  "log2",
+  "log10",
+  "pow",
+  "sin",
+  "cos"
 };
 
 /* from include/llvm/IR/Instruction.def */
@@ -366,6 +999,12 @@ enum OpCode {
   LANDINGPAD = 64,
 };
 
+// Unions that pass their divisor to record_arg when it is labeled.
+static bool UnionRecordsDivisor(uptr opcode) {
+  return opcode == SDIV || opcode == FDIV || opcode == UREM ||
+         opcode == SREM || opcode == FREM;
+}
+
 
 void float2str(char * buf, float f, size_t len) {
   snprintf(buf, len, "%f", f);
@@ -388,9 +1027,43 @@ void gr_check_perf_mode() {
   return;
 }
 
+static THREADLOCAL uptr context_stack_top, context_stack_bottom;
+
+// StackDepot id of the call stack of the instrumented code that called a
+// runtime entry point from caller_pc, or 0 when context_depth=0.  The runtime
+// is built with -fomit-frame-pointer, so a frame-pointer walk from in here
+// skips the entry point's frame and never sees caller_pc; the stack is
+// unwound from the unwind tables instead and the runtime frames above
+// caller_pc are dropped.
+static u32 RecordContext(uptr caller_pc) {
+  static const u32 kRuntimeFrames = 8;
+  int depth = flags().context_depth;
+  if (depth <= 0)
+    return 0;
+  if (!context_stack_top)
+    GetThreadStackTopAndBottom(false, &context_stack_top,
+                               &context_stack_bottom);
+
+  BufferedStackTrace stack;
+  stack.Unwind(Min<u32>(depth + kRuntimeFrames, kStackTraceMax),
+               StackTrace::GetCurrentPc(), GET_CURRENT_FRAME(), nullptr,
+               context_stack_top, context_stack_bottom, false);
+  uptr first = 0;
+  while (first < stack.size && stack.trace[first] != caller_pc)
+    ++first;
+  if (first == stack.size)
+    first = 0;
+  uptr size = Min<uptr>(stack.size - first, depth);
+  if (size == 0)
+    return 0;
+  return StackDepotPut(StackTrace(stack.trace + first, size));
+}
+
 void record_branch(unsigned long file_id, unsigned long inst_id, dfsan_label lhs_label, dfsan_label rhs_label,
-        float lhs_v, float rhs_v, bool cond, uint32_t is_ptr, const char* location) {
+        float lhs_v, float rhs_v, bool cond, uint32_t is_ptr, const char* location,
+        uptr caller_pc) {
   /* should have a nonzero label */
+  DFSAN_PROFILE_SCOPE(kProfileRecord);
 
   uint64_t index = atomic_fetch_add(&__dfsan_record_index, 1, memory_order_relaxed);
 
@@ -400,48 +1073,549 @@ void record_branch(unsigned long file_id, unsigned long inst_id, dfsan_label lhs
   }
 
   __branch_records[index] = {file_id, inst_id, lhs_label, rhs_label, lhs_v, rhs_v,
-                             __dfsan_label_info[lhs_label].neg_dydx,
-                             __dfsan_label_info[lhs_label].pos_dydx,
-                             __dfsan_label_info[rhs_label].neg_dydx,
-                             __dfsan_label_info[rhs_label].pos_dydx,
-                             cond, is_ptr, location};
+                             label_neg_dydx(lhs_label),
+                             label_pos_dydx(lhs_label),
+                             label_neg_dydx(rhs_label),
+                             label_pos_dydx(rhs_label),
+                             cond, is_ptr, location,
+                             RecordContext(caller_pc)};
+}
+
+void record_cmp(uptr pc, cmp_kind kind, u8 size, u64 lhs_v, u64 rhs_v,
+                dfsan_label lhs_label, dfsan_label rhs_label) {
+  DFSAN_PROFILE_SCOPE(kProfileRecord);
+  if (gr_mode_perf)
+    return;
+
+  u64 index = atomic_fetch_add(&__dfsan_cmp_index, 1, memory_order_relaxed);
+  if (index >= CMP_RECORDS_SIZE)
+    return;
+
+  __cmp_records[index] = {pc, lhs_v, rhs_v, lhs_label, rhs_label,
+                          label_neg_dydx(lhs_label),
+                          label_pos_dydx(lhs_label),
+                          label_neg_dydx(rhs_label),
+                          label_pos_dydx(rhs_label),
+                          RecordContext(pc), (u8)kind, size};
+}
+
+bool output_sink_enabled() {
+  return !gr_mode_perf && flags().output_logfile[0] != '\0';
+}
+
+static void record_output_byte(int fd, u64 offset, dfsan_label label) {
+  u64 index = atomic_fetch_add(&__dfsan_output_index, 1, memory_order_relaxed);
+  if (index >= OUTPUT_RECORDS_SIZE)
+    return;
+  __output_records[index] = {offset, fd, label, label_neg_dydx(label),
+                             label_pos_dydx(label)};
+}
+
+// Records the labeled bytes among n flat shadow slots.  Output buffers are
+// mostly unlabeled, so 16 slots at a time are or-ed together and skipped
+// when all are zero; the block loop compiles to vector loads.
+static void ScanOutputShadow(int fd, u64 offset, const dfsan_label *shadow,
+                             uptr n) {
+  static const uptr kBlock = 16;
+  uptr i = 0;
+  for (; i < n && ((uptr) (shadow + i) & (sizeof(u64) - 1)); ++i)
+    if (shadow[i])
+      record_output_byte(fd, offset + i, shadow[i]);
+  for (; i + kBlock <= n; i += kBlock) {
+    const u64 *w = (const u64 *) (shadow + i);
+    if (!(w[0] | w[1] | w[2] | w[3]))
+      continue;
+    for (uptr j = i; j != i + kBlock; ++j)
+      if (shadow[j])
+        record_output_byte(fd, offset + j, shadow[j]);
+  }
+  for (; i < n; ++i)
+    if (shadow[i])
+      record_output_byte(fd, offset + i, shadow[i]);
+}
+
+// Records every labeled byte of a buffer written to fd at the given offset,
+// or at the descriptor's running offset when offset is negative.  Unbacked
+// shadow chunks and uniformly unlabeled words are skipped whole, so the cost
+// follows the number of labeled bytes rather than the size of the write.
+void record_output(int fd, const void *buf, uptr size, s64 offset) {
+  DFSAN_PROFILE_SCOPE(kProfileRecord);
+  u64 base = offset;
+  if (offset < 0) {
+    if (fd < 0 || fd >= kMaxOutputFds)
+      return;
+    base = atomic_fetch_add(&__dfsan_output_offsets[fd], size,
+                            memory_order_relaxed);
+  }
+
+  uptr a = (uptr) buf;
+  if (shadow_granularity_shift) {
+    uptr granularity = 1ULL << shadow_granularity_shift;
+    for (uptr i = 0; i < size;) {
+      uptr n = Min(size - i, granularity - ((a + i) & (granularity - 1)));
+      if (*shadow_for((void *) (a + i)) != 0)
+        for (uptr j = i; j != i + n; ++j)
+          if (dfsan_label label = ReadWordShadow((void *) (a + j)))
+            record_output_byte(fd, base + j, label);
+      i += n;
+    }
+    return;
+  }
+  if (!two_level_shadow) {
+    ScanOutputShadow(fd, base, shadow_for(buf), size);
+    return;
+  }
+  for (uptr i = 0; i < size;) {
+    uptr n = ShadowChunkSpan(a + i, size - i);
+    dfsan_label *chunk = shadow_dir()[shadow_chunk_index((void *) (a + i))];
+    if (chunk)
+      ScanOutputShadow(fd, base + i,
+                       chunk + shadow_chunk_offset((void *) (a + i)), n);
+    i += n;
+  }
+}
+
+// Site descriptors.  Each module registers its table of dfsan_site from a
+// constructor, and every site gets a slot into __dfsan_site_state so that
+// per-site state is found without hashing the site's ids.  Slots are never
+// reused; sites past kMaxSites keep slot 0 and fall back to the hash tables.
+struct path_site;
+
+struct site_state {
+  path_site *path;
+  u32 path_generation;
+};
+
+static const uptr kMaxSites = 1 << 20;
+static site_state __dfsan_site_state[kMaxSites];
+static atomic_uint32_t __dfsan_num_sites;  // slot 0 is never assigned
+
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE
+void __dfsan_register_sites(dfsan_site *begin, dfsan_site *end) {
+  uptr n = end - begin;
+  u32 first =
+      atomic_fetch_add(&__dfsan_num_sites, n, memory_order_relaxed) + 1;
+  if (first + n > kMaxSites && first <= kMaxSites)  // warn once
+    Report("WARNING: DataFlowSanitizer: more than %zu instrumented sites, "
+           "per-site state disabled for some\n", kMaxSites - 1);
+  for (uptr i = 0; i < n; ++i)
+    begin[i].slot = first + i < kMaxSites ? first + i : 0;
+}
+
+// Path signature written to path_logfile.  Every branch visit, labeled or
+// not, is folded into a running hash of (site, direction); the hash is saved
+// at the end of each block of path_block visits, so two runs share a block
+// hash exactly as long as their paths agree up to the end of that block.
+// Each site also keeps the index of its first and last visit, and input
+// reads are stamped with the visit count they happened at.  pga_sweep.py
+// compares the signatures of two inputs to decide which per-byte sweeps it
+// can reuse.
+bool path_log_enabled;
+
+struct path_site {
+  u64 file_id;
+  u64 inst_id;
+  u64 first;
+  u64 last;
+  u64 count;
+  bool used;
+};
+
+struct path_read {
+  s64 offset;
+  u64 size;
+  u64 visit;
+};
+
+static const uptr kPathSites = 1 << 16;
+static const uptr kPathBlocks = 1 << 20;
+static const uptr kPathReads = 1 << 16;
+static const u64 kPathHashSeed = 0xcbf29ce484222325ULL;
+
+static path_site __path_sites[kPathSites];
+static u64 __path_blocks[kPathBlocks];
+static path_read __path_reads[kPathReads];
+static StaticSpinMutex path_mu;
+static u64 path_visits, path_hash = kPathHashSeed, path_num_reads;
+static u64 path_sites_dropped;
+// Bumped by ResetPath, which invalidates the path sites cached in
+// __dfsan_site_state without touching it.
+static u32 path_generation = 1;
+
+static path_site *LookupPathSite(u64 file_id, u64 inst_id) {
+  static const uptr kMaxProbes = 64;
+  u64 h = (file_id * 31 + inst_id) * 0x9e3779b97f4a7c15ULL;
+  for (uptr probe = 0; probe < kMaxProbes; ++probe) {
+    path_site *site = &__path_sites[(h + probe) & (kPathSites - 1)];
+    if (!site->used) {
+      *site = {file_id, inst_id, path_visits, 0, 0, true};
+      return site;
+    }
+    if (site->file_id == file_id && site->inst_id == inst_id)
+      return site;
+  }
+  return nullptr;
+}
+
+void record_path(u64 file_id, u64 inst_id, bool cond, u32 slot) {
+  DFSAN_PROFILE_SCOPE(kProfileRecord);
+  SpinMutexLock l(&path_mu);
+  u64 visit = path_visits;
+  path_hash = (path_hash ^ file_id) * 0x100000001b3ULL;
+  path_hash = (path_hash ^ (inst_id << 1 | cond)) * 0x100000001b3ULL;
+  path_site *site = nullptr;
+  site_state *state = slot ? &__dfsan_site_state[slot] : nullptr;
+  if (state && state->path_generation == path_generation)
+    site = state->path;
+  if (!site) {
+    site = LookupPathSite(file_id, inst_id);
+    if (state) {
+      state->path = site;
+      state->path_generation = path_generation;
+    }
+  }
+  if (site) {
+    site->last = visit;
+    ++site->count;
+  } else {
+    ++path_sites_dropped;
+  }
+  ++path_visits;
+  u64 block = visit / flags().path_block;
+  if (path_visits % flags().path_block == 0 && block < kPathBlocks)
+    __path_blocks[block] = path_hash;
+}
+
+void record_input_read(s64 offset, uptr size) {
+  SpinMutexLock l(&path_mu);
+  if (path_num_reads < kPathReads)
+    __path_reads[path_num_reads++] = {offset, size, path_visits};
+}
+
+static void ResetPath() {
+  SpinMutexLock l(&path_mu);
+  internal_memset(__path_sites, 0, sizeof(__path_sites));
+  path_visits = path_num_reads = path_sites_dropped = 0;
+  ++path_generation;
+  path_hash = kPathHashSeed;
+}
+
+// Memoized summaries of functions listed as "memoize" in the ABI list.  The
+// pass calls __dfsan_memo_lookup before running the instrumented body of such
+// a function with labeled arguments; on a hit the uninstrumented clone runs
+// instead and the return label is rebuilt from the cached derivatives.  The
+// key is the derivative pair of every argument label, not the argument
+// values, so a summary is only as exact as the function's derivative is
+// independent of its inputs.
+static const uptr kMemoEntries = 1 << 16;
+static const uptr kMemoFns = 1024;
+static const uptr kMemoMaxArgs = 8;
+// Lookups between two checks of a function's hit rate.
+static const u64 kMemoWindow = 1024;
+
+struct memo_fn {
+  atomic_uint8_t state;  // kSiteEmpty, kSiteBusy or kSiteReady
+  u64 fn_id;
+  const char *name;
+  atomic_uint64_t lookups;
+  atomic_uint64_t hits;
+  atomic_uint8_t disabled;
+};
+
+// Entries are written once, under kSiteBusy, and never change afterwards.
+struct memo_entry {
+  atomic_uint8_t state;
+  u64 fn_id;
+  u32 labeled;  // bit i set when argument i has a nonzero label
+  float sig[2 * kMemoMaxArgs];
+  bool ret_labeled;
+  float ret_ndx, ret_pdx;
+};
+
+static memo_fn __memo_fns[kMemoFns];
+static memo_entry __memo_entries[kMemoEntries];
+static atomic_uint64_t __dfsan_memo_dropped;
+
+static memo_fn *LookupMemoFn(u64 fn_id, const char *name) {
+  u64 h = fn_id * 0x9E3779B97F4A7C15ULL;
+  for (uptr probe = 0; probe < 32; ++probe) {
+    memo_fn *f = &__memo_fns[(h + probe) & (kMemoFns - 1)];
+    u8 state = atomic_load(&f->state, memory_order_acquire);
+    if (state == kSiteEmpty) {
+      if (atomic_compare_exchange_strong(&f->state, &state, kSiteBusy,
+                                         memory_order_acquire)) {
+        f->fn_id = fn_id;
+        f->name = name;
+        atomic_store(&f->state, kSiteReady, memory_order_release);
+        return f;
+      }
+    }
+    while (state == kSiteBusy)
+      state = atomic_load(&f->state, memory_order_acquire);
+    if (f->fn_id == fn_id)
+      return f;
+  }
+  return nullptr;
+}
+
+// Fills the key of a call; unlabeled arguments contribute zero derivatives.
+static u64 MemoKey(u64 fn_id, const dfsan_label *labels, u32 n, u32 *labeled,
+                   float *sig) {
+  internal_memset(sig, 0, sizeof(float) * 2 * kMemoMaxArgs);
+  *labeled = 0;
+  for (u32 i = 0; i < n; ++i) {
+    if (!labels[i])
+      continue;
+    *labeled |= 1U << i;
+    sig[2 * i] = label_neg_dydx(labels[i]);
+    sig[2 * i + 1] = label_pos_dydx(labels[i]);
+  }
+  u64 h = fn_id ^ *labeled;
+  const u32 *words = (const u32 *) sig;
+  for (uptr i = 0; i < 2 * kMemoMaxArgs; ++i)
+    h = (h ^ words[i]) * 0x100000001B3ULL;
+  return h * 0x9E3779B97F4A7C15ULL;
+}
+
+static bool MemoKeyMatches(const memo_entry *e, u64 fn_id, u32 labeled,
+                           const float *sig) {
+  return e->fn_id == fn_id && e->labeled == labeled &&
+         internal_memcmp(e->sig, sig, sizeof(e->sig)) == 0;
+}
+
+static memo_entry *FindMemoEntry(u64 h, u64 fn_id, u32 labeled,
+                                 const float *sig, bool claim) {
+  for (uptr probe = 0; probe < 32; ++probe) {
+    memo_entry *e = &__memo_entries[(h + probe) & (kMemoEntries - 1)];
+    u8 state = atomic_load(&e->state, memory_order_acquire);
+    if (state == kSiteEmpty) {
+      if (!claim)
+        return nullptr;
+      if (atomic_compare_exchange_strong(&e->state, &state, kSiteBusy,
+                                         memory_order_acquire))
+        return e;
+    }
+    if (state == kSiteReady && MemoKeyMatches(e, fn_id, labeled, sig))
+      return claim ? nullptr : e;
+  }
+  if (claim)
+    atomic_fetch_add(&__dfsan_memo_dropped, 1, memory_order_relaxed);
+  return nullptr;
+}
+
+// Functions whose calls rarely repeat a signature stop being looked up, so
+// they pay for the key only until the guard trips.
+static void CheckMemoHitRate(memo_fn *f, u64 lookups) {
+  if (lookups % kMemoWindow)
+    return;
+  u64 hits = atomic_load(&f->hits, memory_order_relaxed);
+  if (hits * 100 < lookups * (u64) flags().memo_min_hit_rate)
+    atomic_store(&f->disabled, 1, memory_order_relaxed);
+}
+
+// Returns the label of the result, or -1 when the caller has to run the
+// instrumented body and report its result with __dfsan_memo_store.
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE
+int __dfsan_memo_lookup(u64 fn_id, const char *name, const dfsan_label *labels,
+                        u32 n) {
+  DFSAN_PROFILE_SCOPE(kProfileRecord);
+  if (!flags().memoize || n > kMemoMaxArgs)
+    return -1;
+  memo_fn *f = LookupMemoFn(fn_id, name);
+  if (!f || atomic_load(&f->disabled, memory_order_relaxed))
+    return -1;
+  u64 lookups = atomic_fetch_add(&f->lookups, 1, memory_order_relaxed) + 1;
+
+  u32 labeled;
+  float sig[2 * kMemoMaxArgs];
+  u64 h = MemoKey(fn_id, labels, n, &labeled, sig);
+  memo_entry *e = FindMemoEntry(h, fn_id, labeled, sig, false);
+  if (!e) {
+    CheckMemoHitRate(f, lookups);
+    return -1;
+  }
+  atomic_fetch_add(&f->hits, 1, memory_order_relaxed);
+  CheckMemoHitRate(f, lookups);
+  if (!e->ret_labeled)
+    return 0;
+
+  // Provenance keeps the first two labeled arguments of this call.
+  dfsan_label l1 = 0, l2 = 0;
+  for (u32 i = 0; i < n && !l2; ++i) {
+    if (!labels[i] || labels[i] == l1)
+      continue;
+    if (l1)
+      l2 = labels[i];
+    else
+      l1 = labels[i];
+  }
+  dfsan_label label =
+      atomic_fetch_add(&__dfsan_last_label, 1, memory_order_relaxed) + 1;
+  dfsan_check_label(label);
+  __dfsan_label_prov[label] = {l1, l2, CALL, 0};
+  __dfsan_label_loc[label] = f->name;
+  set_label_dydx(label, e->ret_ndx, e->ret_pdx);
+  return label;
+}
+
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE
+void __dfsan_memo_store(u64 fn_id, const dfsan_label *labels, u32 n,
+                        dfsan_label ret_label) {
+  DFSAN_PROFILE_SCOPE(kProfileRecord);
+  if (!flags().memoize || n > kMemoMaxArgs)
+    return;
+  memo_fn *f = LookupMemoFn(fn_id, nullptr);
+  if (!f || atomic_load(&f->disabled, memory_order_relaxed))
+    return;
+
+  u32 labeled;
+  float sig[2 * kMemoMaxArgs];
+  u64 h = MemoKey(fn_id, labels, n, &labeled, sig);
+  memo_entry *e = FindMemoEntry(h, fn_id, labeled, sig, true);
+  if (!e)
+    return;
+  e->fn_id = fn_id;
+  e->labeled = labeled;
+  internal_memcpy(e->sig, sig, sizeof(e->sig));
+  e->ret_labeled = ret_label != 0;
+  e->ret_ndx = ret_label ? label_neg_dydx(ret_label) : 0;
+  e->ret_pdx = ret_label ? label_pos_dydx(ret_label) : 0;
+  atomic_store(&e->state, kSiteReady, memory_order_release);
+}
+
+// Finds or claims the aggregate slot for a site; null when the table is full.
+static func_arg_site *LookupArgSite(unsigned long file_id,
+                                    unsigned int inst_id,
+                                    unsigned int arg_ind, u32 context,
+                                    const char *location) {
+  u64 h = (file_id ^ ((u64)inst_id << 20) ^ ((u64)arg_ind << 52) ^
+           ((u64)context << 32)) *
+          0x9E3779B97F4A7C15ULL;
+  for (uptr probe = 0; probe < 128; ++probe) {
+    func_arg_site *s =
+        &__func_arg_sites[(h + probe) & (FUNC_ARG_SITES_SIZE - 1)];
+    u8 state = atomic_load(&s->state, memory_order_acquire);
+    if (state == kSiteEmpty) {
+      if (atomic_compare_exchange_strong(&s->state, &state, kSiteBusy,
+                                         memory_order_acquire)) {
+        s->file_id = file_id;
+        s->inst_id = inst_id;
+        s->arg_ind = arg_ind;
+        s->context = context;
+        s->loc = location;
+        atomic_store(&s->state, kSiteReady, memory_order_release);
+        return s;
+      }
+    }
+    while (state == kSiteBusy)
+      state = atomic_load(&s->state, memory_order_acquire);
+    if (s->file_id == file_id && s->inst_id == inst_id &&
+        s->arg_ind == arg_ind && s->context == context)
+      return s;
+  }
+  return nullptr;
+}
+
+// Adds one call to a site aggregate; true if the call is also to be kept as
+// a raw record.
+static bool AddToArgSite(func_arg_site *site, dfsan_label label, float v,
+                         float ndx, float pdx) {
+  SpinMutexLock l(&site->mu);
+  if (site->count++ == 0) {
+    site->label = label;
+    site->min_v = site->max_v = v;
+    site->min_ndx = site->max_ndx = ndx;
+    site->min_pdx = site->max_pdx = pdx;
+  } else {
+    site->min_v = Min(site->min_v, v);
+    site->max_v = Max(site->max_v, v);
+    site->min_ndx = Min(site->min_ndx, ndx);
+    site->max_ndx = Max(site->max_ndx, ndx);
+    site->min_pdx = Min(site->min_pdx, pdx);
+    site->max_pdx = Max(site->max_pdx, pdx);
+  }
+  bool sample = site->samples < (u32)flags().func_arg_samples;
+  if (sample)
+    ++site->samples;
+  return sample;
 }
 
 void record_arg(unsigned long file_id, unsigned int inst_id, unsigned int arg_ind, dfsan_label label,
         float v, const char* location) {
   /* if this gets called label should be nonzero */
+  DFSAN_PROFILE_SCOPE(kProfileRecord);
 
   if (!gr_mode_perf) {
-    uint16_t index = atomic_fetch_add(&__dfsan_arg_index, 1, memory_order_relaxed);
+    // The context-free aggregate counts every call.  Only the calls it keeps
+    // as raw records pay for unwinding their calling context, and those are
+    // also aggregated per (site, context).
+    func_arg_site *site =
+        LookupArgSite(file_id, inst_id, arg_ind, 0, location);
+    if (!site) {
+      atomic_fetch_add(&__dfsan_arg_sites_dropped, 1, memory_order_relaxed);
+      return;
+    }
 
-    if (index >= FUNC_ARGS_SIZE) {
-      Printf("ERROR: Out of func record space!\n");
-      Die();
+    float ndx = label_neg_dydx(label);
+    float pdx = label_pos_dydx(label);
+    if (!AddToArgSite(site, label, v, ndx, pdx))
+      return;
+
+    // Every caller passes its return address as file_id.
+    u32 context = RecordContext(file_id);
+    if (context) {
+      func_arg_site *csite =
+          LookupArgSite(file_id, inst_id, arg_ind, context, location);
+      if (csite)
+        AddToArgSite(csite, label, v, ndx, pdx);
+      else
+        atomic_fetch_add(&__dfsan_arg_sites_dropped, 1, memory_order_relaxed);
     }
 
+    u64 index = atomic_fetch_add(&__dfsan_arg_index, 1, memory_order_relaxed);
+    if (index >= FUNC_ARGS_SIZE)
+      return;
+
     __func_arg_records[index] = {file_id, inst_id, arg_ind, label, v,
-                                 __dfsan_label_info[label].neg_dydx,
-                                 __dfsan_label_info[label].pos_dydx,
-                                 location};
+                                 ndx, pdx, location, context};
   }
 }
 
 
+static void RecordedMemcpy(void *dest, const void *src, unsigned long n,
+                           dfsan_label dest_label, dfsan_label src_label,
+                           dfsan_label n_label, const char *location,
+                           unsigned long ret_addr) {
+  if (dest_label) record_arg(ret_addr, 6, 0, dest_label, 0, location);
+  if (src_label) record_arg(ret_addr, 6, 1, src_label, 0, location);
+  if (n_label) record_arg(ret_addr, 6, 2, n_label, (float)n, location);
+  dfsan_memcpy(dest, src, n);
+}
+
 extern "C" SANITIZER_INTERFACE_ATTRIBUTE
 void __memcpy(void *dest, const void *src, unsigned long n,
                     dfsan_label dest_label, dfsan_label src_label,
                     dfsan_label n_label,
                     const char* location) {
-  unsigned long ret_addr = (unsigned long)__builtin_return_address(0);
-  if (dest_label) record_arg(ret_addr, 6, 0, dest_label, 0, location);
-  if (src_label) record_arg(ret_addr, 6, 1, src_label, 0, location);
-  if (n_label) record_arg(ret_addr, 6, 2, n_label, (float)n, location);
-  dfsan_memcpy(dest, src, n);
+  DFSAN_PROFILE_SCOPE(kProfileMemcpy);
+  RecordedMemcpy(dest, src, n, dest_label, src_label, n_label, location,
+                 (unsigned long)__builtin_return_address(0));
+}
+
+// Called by the -dfsan-preserve-most stub, with the instrumented call site.
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE
+void __memcpy_pc(void *dest, const void *src, unsigned long n,
+                 dfsan_label dest_label, dfsan_label src_label,
+                 dfsan_label n_label, const char *location, uptr caller_pc) {
+  DFSAN_PROFILE_SCOPE_PC(kProfileMemcpy, caller_pc);
+  RecordedMemcpy(dest, src, n, dest_label, src_label, n_label, location,
+                 caller_pc);
 }
 
 extern "C" SANITIZER_INTERFACE_ATTRIBUTE
 dfsan_label __dfsan_union_unsupported_type(dfsan_label l1, dfsan_label l2, uptr insnID, u16 opcode,
         const char* location) {
+  DFSAN_PROFILE_SCOPE(kProfileUnion);
 
   // if inputs unlabeled can return early
   if (l1 == 0 && l2 == 0) {
@@ -458,12 +1632,9 @@ dfsan_label __dfsan_union_unsupported_type(dfsan_label l1, dfsan_label l2, uptr
 
 
   // update derivative
-  __dfsan_label_info[label].l1 = l1;
-  __dfsan_label_info[label].l2 = l2;
-  __dfsan_label_info[label].opcode = opcode;
-  __dfsan_label_info[label].neg_dydx = neg_dydx;
-  __dfsan_label_info[label].pos_dydx = pos_dydx;
-  __dfsan_label_info[label].loc = location;
+  __dfsan_label_prov[label] = {l1, l2, opcode, 0};
+  __dfsan_label_loc[label] = location;
+  set_label_dydx(label, neg_dydx, pos_dydx);
 
   // print result
   if (DEBUG) {
@@ -496,6 +1667,205 @@ DFSAN_INT_BRANCH(__branch_visitor_int, uint32_t, int32_t, "int")
 DFSAN_INT_BRANCH(__branch_visitor_long, uint64_t, int64_t, "long")
 DFSAN_INT_BRANCH(__branch_visitor_longlong, __uint128_t, __int128_t, "longlong")
 
+// Derivative kernels for the intrinsics the pass hands to the runtime whole
+// (see DerivIntrinsic in DataFlowSanitizer.cpp).  The kinds continue the
+// opcode numbering above, so labels record them as their opcode.
+enum IntrinsicKind {
+  kIntrinsicBswap = 65,
+  kIntrinsicCtpop,
+  kIntrinsicCtlz,
+  kIntrinsicCttz,
+  kIntrinsicFabs,
+  kIntrinsicSqrt,
+  kIntrinsicFma,
+  kIntrinsicMinNum,
+  kIntrinsicMaxNum,
+  kIntrinsicCopySign,
+  kIntrinsicFloor,
+  kIntrinsicCeil,
+  kIntrinsicTrunc,
+  kIntrinsicRint,
+  kIntrinsicRound,
+  kIntrinsicExp,
+  kIntrinsicExp2,
+  kIntrinsicLog,
+  kIntrinsicLog2,
+  kIntrinsicLog10,
+  kIntrinsicPow,
+  kIntrinsicSin,
+  kIntrinsicCos,
+};
+
+static dfsan_label NewIntrinsicLabel(dfsan_label l1, dfsan_label l2, u16 kind,
+                                     int f_val, float neg_dydx,
+                                     float pos_dydx, const char *location) {
+  dfsan_label label =
+      atomic_fetch_add(&__dfsan_last_label, 1, memory_order_relaxed) + 1;
+  dfsan_check_label(label);
+  __dfsan_label_prov[label] = {l1, l2, kind, f_val};
+  __dfsan_label_loc[label] = location;
+  set_label_dydx(label, neg_dydx, pos_dydx);
+  return label;
+}
+
+static u64 EvalIntIntrinsic(u16 kind, u64 x, u32 bits) {
+  u64 mask = bits == 64 ? ~0ULL : (1ULL << bits) - 1;
+  x &= mask;
+  switch (kind) {
+  case kIntrinsicBswap:
+    return __builtin_bswap64(x) >> (64 - bits);
+  case kIntrinsicCtpop:
+    return __builtin_popcountll(x);
+  case kIntrinsicCtlz:
+    return x ? __builtin_clzll(x) - (64 - bits) : bits;
+  case kIntrinsicCttz:
+    return x ? __builtin_ctzll(x) : bits;
+  }
+  return 0;
+}
+
+// Difference of two results of a bits wide intrinsic, read as signed.
+static s64 IntrinsicDelta(u64 a, u64 b, u32 bits) {
+  u64 d = a - b;
+  return bits == 64 ? (s64)d : (s64)(d << (64 - bits)) >> (64 - bits);
+}
+
+// None of the integer intrinsics is smooth, so their derivatives are sampled
+// like those of urem: the first nonzero change of the result over up to
+// samples steps of the operand's derivative.
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE
+dfsan_label __dfsan_intrinsic_int(dfsan_label l, u64 x, u32 bits, u16 kind,
+                                  const char *location) {
+  DFSAN_PROFILE_SCOPE(kProfileUnion);
+  if (l == 0)
+    return 0;
+  float neg_dx = label_neg_dydx(l), pos_dx = label_pos_dydx(l);
+  if (flags().reuse_labels && neg_dx == 0 && pos_dx == 0)
+    return l;
+  u64 y = EvalIntIntrinsic(kind, x, bits);
+  float neg_dydx = 0, pos_dydx = 0;
+  int nsamples = flags().samples;
+  for (int smp = 1; smp <= nsamples; ++smp) {
+    if (neg_dydx == 0)
+      neg_dydx = (float)IntrinsicDelta(
+                     y, EvalIntIntrinsic(kind, x - (s64)(smp * neg_dx), bits),
+                     bits) / smp;
+    if (pos_dydx == 0)
+      pos_dydx = (float)IntrinsicDelta(
+                     EvalIntIntrinsic(kind, x + (s64)(smp * pos_dx), bits), y,
+                     bits) / smp;
+  }
+  return NewIntrinsicLabel(l, 0, kind, (int)y, neg_dydx, pos_dydx, location);
+}
+
+static double EvalFPIntrinsic(u16 kind, double a, double b, double c) {
+  switch (kind) {
+  case kIntrinsicFabs: return fabs(a);
+  case kIntrinsicSqrt: return sqrt(a);
+  case kIntrinsicFma: return a * b + c;
+  case kIntrinsicMinNum: return fmin(a, b);
+  case kIntrinsicMaxNum: return fmax(a, b);
+  case kIntrinsicCopySign: return copysign(a, b);
+  case kIntrinsicFloor: return floor(a);
+  case kIntrinsicCeil: return ceil(a);
+  case kIntrinsicTrunc: return trunc(a);
+  case kIntrinsicRint: return rint(a);
+  case kIntrinsicRound: return round(a);
+  case kIntrinsicExp: return exp(a);
+  case kIntrinsicExp2: return exp2(a);
+  case kIntrinsicLog: return log(a);
+  case kIntrinsicLog2: return log2(a);
+  case kIntrinsicLog10: return log10(a);
+  case kIntrinsicPow: return pow(a, b);
+  case kIntrinsicSin: return sin(a);
+  case kIntrinsicCos: return cos(a);
+  }
+  return 0;
+}
+
+// Partial derivatives of the smooth intrinsics at (a, b, c).  Returns false
+// for the piecewise ones, whose derivatives are sampled instead: a step of
+// the input moves floor() or fabs() by a whole piece, not by its slope at x.
+static bool FPIntrinsicPartials(u16 kind, double a, double b, double *da,
+                                double *db, double *dc) {
+  *da = *db = *dc = 0;
+  switch (kind) {
+  case kIntrinsicSqrt: *da = 0.5 / sqrt(a); return true;
+  case kIntrinsicFma: *da = b; *db = a; *dc = 1; return true;
+  case kIntrinsicExp: *da = exp(a); return true;
+  case kIntrinsicExp2: *da = exp2(a) * M_LN2; return true;
+  case kIntrinsicLog: *da = 1 / a; return true;
+  case kIntrinsicLog2: *da = 1 / (a * M_LN2); return true;
+  case kIntrinsicLog10: *da = 1 / (a * M_LN10); return true;
+  case kIntrinsicPow:
+    *da = b * pow(a, b - 1);
+    *db = a > 0 ? pow(a, b) * log(a) : 0;
+    return true;
+  case kIntrinsicSin: *da = cos(a); return true;
+  case kIntrinsicCos: *da = -sin(a); return true;
+  }
+  return false;
+}
+
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE
+dfsan_label __dfsan_intrinsic_fp(dfsan_label l1, dfsan_label l2,
+                                 dfsan_label l3, double x1, double x2,
+                                 double x3, u16 kind, const char *location) {
+  DFSAN_PROFILE_SCOPE(kProfileUnion);
+  if (l1 == 0 && l2 == 0 && l3 == 0)
+    return 0;
+  dfsan_label ls[3] = {l1, l2, l3};
+  float neg_dx[3] = {0, 0, 0}, pos_dx[3] = {0, 0, 0};
+  bool all_zero = true;
+  for (int i = 0; i < 3; ++i) {
+    if (!ls[i])
+      continue;
+    neg_dx[i] = label_neg_dydx(ls[i]);
+    pos_dx[i] = label_pos_dydx(ls[i]);
+    all_zero &= neg_dx[i] == 0 && pos_dx[i] == 0;
+  }
+  if (flags().reuse_labels && all_zero)
+    return l1 ? l1 : l2 ? l2 : l3;
+
+  double y = EvalFPIntrinsic(kind, x1, x2, x3);
+  double d[3];
+  float neg_dydx, pos_dydx;
+  if (FPIntrinsicPartials(kind, x1, x2, &d[0], &d[1], &d[2])) {
+    neg_dydx = d[0] * neg_dx[0] + d[1] * neg_dx[1] + d[2] * neg_dx[2];
+    pos_dydx = d[0] * pos_dx[0] + d[1] * pos_dx[1] + d[2] * pos_dx[2];
+  } else {
+    // The piecewise intrinsics (floor, ceil, rounding) are flat between
+    // steps, so like the integer ones they take the first nonzero change
+    // over up to samples growing steps of the operands' derivatives.
+    neg_dydx = pos_dydx = 0;
+    int nsamples = flags().samples;
+    for (int smp = 1; smp <= nsamples; ++smp) {
+      if (neg_dydx == 0)
+        neg_dydx = (y - EvalFPIntrinsic(kind, x1 - smp * neg_dx[0],
+                                        x2 - smp * neg_dx[1],
+                                        x3 - smp * neg_dx[2])) /
+                   smp;
+      if (pos_dydx == 0)
+        pos_dydx = (EvalFPIntrinsic(kind, x1 + smp * pos_dx[0],
+                                    x2 + smp * pos_dx[1],
+                                    x3 + smp * pos_dx[2]) -
+                    y) /
+                   smp;
+    }
+  }
+
+  // Provenance holds two labels; fma with three labeled operands gets an
+  // intermediate label so that l3 stays reachable.
+  dfsan_label p1 = l1 ? l1 : l2, p2 = l1 ? l2 : 0;
+  if (l3) {
+    if (p2)
+      p1 = NewIntrinsicLabel(p1, p2, kind, 0, 0, 0, location);
+    p2 = p1 ? l3 : 0;
+    p1 = p1 ? p1 : l3;
+  }
+  return NewIntrinsicLabel(p1, p2, kind, 0, neg_dydx, pos_dydx, location);
+}
+
 extern "C" SANITIZER_INTERFACE_ATTRIBUTE
 dfsan_label __dfsan_union_load(const dfsan_label *ls, uptr n) {
   dfsan_label label = ls[0];
@@ -548,17 +1918,58 @@ dfsan_label dfsan_create_label(const char *desc) {
   dfsan_label label =    
           atomic_fetch_add(&__dfsan_last_label, 1, memory_order_relaxed) + 1;
   dfsan_check_label(label);
-  __dfsan_label_info[label].l1 = __dfsan_label_info[label].l2 = 0;
-  __dfsan_label_info[label].loc = desc;
-  __dfsan_label_info[label].neg_dydx = 1.0;
-  __dfsan_label_info[label].pos_dydx = 1.0;
+  __dfsan_label_prov[label] = {0, 0, 0, 0};
+  __dfsan_label_loc[label] = desc;
+  set_label_dydx(label, 1.0, 1.0);
 
   return label;
 }
 
+// A multi-byte input field is one variable with one base label.  Sampling an
+// integer assembled from the bytes (ZExt/Shl/Or or Mul/Add) would otherwise
+// mix independent per-byte perturbations, so each byte gets its own label
+// derived from the base label, seeded with the exact change in that byte when
+// the field value steps by one in each direction.  Weighted by place value
+// the byte changes sum to one, carries and borrows included.  At the edge of
+// the field's range the step in that direction is zero.
 extern "C" SANITIZER_INTERFACE_ATTRIBUTE
-void __dfsan_set_label(dfsan_label label, void *addr, uptr size) {
-  for (dfsan_label *labelp = shadow_for(addr); size != 0; --size, ++labelp) {
+dfsan_label dfsan_label_field(void *addr, uptr width, int big_endian,
+                              int is_signed, const char *desc) {
+  if (width == 0 || width > sizeof(u64)) {
+    Report("WARNING: DataFlowSanitizer: unsupported field width %zu\n", width);
+    return 0;
+  }
+  u8 *bytes = (u8 *)addr;
+  uptr bits = width * 8;
+  u64 mask = bits == 64 ? ~0ULL : (1ULL << bits) - 1;
+  u64 min = is_signed ? 1ULL << (bits - 1) : 0;
+  u64 max = is_signed ? min - 1 : mask;
+
+  u64 v = 0;
+  for (uptr k = 0; k < width; ++k)
+    v |= (u64)bytes[big_endian ? width - 1 - k : k] << (8 * k);
+  u64 next = v == max ? v : (v + 1) & mask;
+  u64 prev = v == min ? v : (v - 1) & mask;
+
+  dfsan_label base = dfsan_create_label(desc);
+  for (uptr k = 0; k < width; ++k) {
+    int b = (v >> (8 * k)) & 0xff;
+    int b_next = (next >> (8 * k)) & 0xff;
+    int b_prev = (prev >> (8 * k)) & 0xff;
+    dfsan_label label =
+        atomic_fetch_add(&__dfsan_last_label, 1, memory_order_relaxed) + 1;
+    dfsan_check_label(label);
+    __dfsan_label_prov[label] = {base, 0, 0, (int)k};
+    __dfsan_label_loc[label] = desc;
+    set_label_dydx(label, b - b_prev, b_next - b);
+    dfsan_set_label(label, bytes + (big_endian ? width - 1 - k : k), 1);
+  }
+  return base;
+}
+
+static void SetShadowRange(dfsan_label label, dfsan_label *labelp,
+                           uptr size) {
+  for (; size != 0; --size, ++labelp) {
     // Don't write the label if it is already the value we need it to be.
     // In a program where most addresses are not labeled, it is common that
     // a page of shadow memory is entirely zeroed.  The Linux copy-on-write
@@ -574,6 +1985,33 @@ void __dfsan_set_label(dfsan_label label, void *addr, uptr size) {
   }
 }
 
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE
+void __dfsan_set_label(dfsan_label label, void *addr, uptr size) {
+  DFSAN_PROFILE_SCOPE(kProfileSetLabel);
+  if (shadow_granularity_shift) {
+    SetWordShadow(label, (uptr) addr, size);
+    return;
+  }
+  if (!two_level_shadow) {
+    SetShadowRange(label, shadow_for(addr), size);
+    return;
+  }
+
+  // Unlabelling memory whose chunk was never written needs no work at all.
+  uptr a = (uptr) addr;
+  while (size != 0) {
+    uptr n = ShadowChunkSpan(a, size);
+    uptr index = shadow_chunk_index((void *) a);
+    dfsan_label *chunk = shadow_dir()[index];
+    if (!chunk && label != 0)
+      chunk = AllocShadowChunk(index);
+    if (chunk)
+      SetShadowRange(label, chunk + shadow_chunk_offset((void *) a), n);
+    a += n;
+    size -= n;
+  }
+}
+
 SANITIZER_INTERFACE_ATTRIBUTE
 void dfsan_set_label(dfsan_label label, void *addr, uptr size) {
   __dfsan_set_label(label, addr, size);
@@ -581,8 +2019,8 @@ void dfsan_set_label(dfsan_label label, void *addr, uptr size) {
 
 SANITIZER_INTERFACE_ATTRIBUTE
 void dfsan_add_label(dfsan_label label, void *addr, uptr size) {
-  for (dfsan_label *labelp = shadow_for(addr); size != 0; --size, ++labelp)
-    if (*labelp != label) {
+  for (char *p = (char *) addr; size != 0; --size, ++p)
+    if (ReadShadow(p) != label) {
       Printf("ERROR already labeled");
       Die();
     }
@@ -602,21 +2040,44 @@ SANITIZER_INTERFACE_ATTRIBUTE dfsan_label
 dfsan_read_label(const void *addr, uptr size) {
   if (size == 0)
     return 0;
-  return __dfsan_union_load(shadow_for(addr), size);
+  if (!two_level_shadow && !shadow_granularity_shift)
+    return __dfsan_union_load(shadow_for(addr), size);
+
+  const char *p = (const char *) addr;
+  dfsan_label label = ReadShadow(p);
+  for (uptr i = 1; i != size; ++i) {
+    dfsan_label next_label = ReadShadow(p + i);
+    if (label != next_label) {
+      Printf("ERROR Non-instrumented call to dfsan_union via dfsan_read_label\n");
+      Printf("label %d != next_label %d\n", label, next_label);
+      Die();
+    }
+  }
+  return label;
 }
 
 extern "C" SANITIZER_INTERFACE_ATTRIBUTE
 const struct  dfsan_label_info *dfsan_get_label_info(dfsan_label label) {
-  return &__dfsan_label_info[label];
+  __dfsan_label_queried[label] = 1;
+  dfsan_label_info *info = &__dfsan_label_info_view[label];
+  const dfsan_label_prov &prov = __dfsan_label_prov[label];
+  info->l1 = prov.l1;
+  info->l2 = prov.l2;
+  info->loc = __dfsan_label_loc[label];
+  info->neg_dydx = label_neg_dydx(label);
+  info->pos_dydx = label_pos_dydx(label);
+  info->opcode = prov.opcode;
+  info->f_val = prov.f_val;
+  return info;
 }
 
 extern "C" SANITIZER_INTERFACE_ATTRIBUTE int
 dfsan_has_label(dfsan_label label, dfsan_label elem) {
   if (label == elem)
     return true;
-  const dfsan_label_info *info = dfsan_get_label_info(label);
-  if (info->l1 != 0) {
-    return dfsan_has_label(info->l1, elem) || dfsan_has_label(info->l2, elem);
+  const dfsan_label_prov &prov = __dfsan_label_prov[label];
+  if (prov.l1 != 0) {
+    return dfsan_has_label(prov.l1, elem) || dfsan_has_label(prov.l2, elem);
   } else {
     return false;
   }
@@ -624,12 +2085,12 @@ dfsan_has_label(dfsan_label label, dfsan_label elem) {
 
 extern "C" SANITIZER_INTERFACE_ATTRIBUTE dfsan_label
 dfsan_has_label_with_desc(dfsan_label label, const char *desc) {
-  const dfsan_label_info *info = dfsan_get_label_info(label);
-  if (info->l1 != 0) {
-    return dfsan_has_label_with_desc(info->l1, desc) ||
-           dfsan_has_label_with_desc(info->l2, desc);
+  const dfsan_label_prov &prov = __dfsan_label_prov[label];
+  if (prov.l1 != 0) {
+    return dfsan_has_label_with_desc(prov.l1, desc) ||
+           dfsan_has_label_with_desc(prov.l2, desc);
   } else {
-    return internal_strcmp(desc, info->loc) == 0;
+    return internal_strcmp(desc, __dfsan_label_loc[label]) == 0;
   }
 }
 
@@ -641,26 +2102,96 @@ dfsan_get_label_count(void) {
   return static_cast<uptr>(max_label_allocated);
 }
 
+static bool dump_reachable_labels;
+
+static void InitializeDumpLabels() {
+  if (internal_strcmp(flags().dump_labels, "reachable") == 0) {
+    dump_reachable_labels = true;
+  } else if (internal_strcmp(flags().dump_labels, "all") != 0) {
+    Report("WARNING: DataFlowSanitizer: unknown dump_labels=%s, "
+           "dumping all labels\n", flags().dump_labels);
+  }
+}
+
+// Marks the labels that a reachable-mode dump must keep: the operands of
+// recorded branches and function arguments, optionally queried and base
+// labels, and everything those were derived from.  A label's operands always
+// have smaller ids than the label itself, so one descending sweep closes the
+// set.
+static void MarkReachableLabels(u8 *keep, dfsan_label last_label) {
+  u64 branches = atomic_load(&__dfsan_record_index, memory_order_relaxed);
+  for (uptr i = 0; i < branches && i < BRANCH_RECORDS_SIZE; ++i) {
+    keep[__branch_records[i].lhs_label] = 1;
+    keep[__branch_records[i].rhs_label] = 1;
+  }
+  u64 cmps = atomic_load(&__dfsan_cmp_index, memory_order_relaxed);
+  for (uptr i = 0; i < cmps && i < CMP_RECORDS_SIZE; ++i) {
+    keep[__cmp_records[i].lhs_label] = 1;
+    keep[__cmp_records[i].rhs_label] = 1;
+  }
+  u64 outputs = atomic_load(&__dfsan_output_index, memory_order_relaxed);
+  for (uptr i = 0; i < outputs && i < OUTPUT_RECORDS_SIZE; ++i)
+    keep[__output_records[i].label] = 1;
+  u64 args = atomic_load(&__dfsan_arg_index, memory_order_relaxed);
+  for (uptr i = 0; i < args && i < FUNC_ARGS_SIZE; ++i)
+    keep[__func_arg_records[i].label] = 1;
+  for (uptr i = 0; i < FUNC_ARG_SITES_SIZE; ++i)
+    if (atomic_load(&__func_arg_sites[i].state, memory_order_acquire) ==
+        kSiteReady)
+      keep[__func_arg_sites[i].label] = 1;
+  if (flags().dump_queried_labels)
+    for (uptr l = 1; l <= last_label; ++l)
+      keep[l] |= __dfsan_label_queried[l];
+
+  for (uptr l = last_label; l >= 1; --l) {
+    if (!keep[l])
+      continue;
+    keep[__dfsan_label_prov[l].l1] = 1;
+    keep[__dfsan_label_prov[l].l2] = 1;
+  }
+
+  if (flags().dump_base_labels) {
+    for (uptr l = 1; l <= last_label; ++l) {
+      const dfsan_label_prov &prov = __dfsan_label_prov[l];
+      if (prov.l1 == 0 && prov.l2 == 0 && prov.opcode == 0)
+        keep[l] = 1;
+    }
+  }
+}
+
 extern "C" SANITIZER_INTERFACE_ATTRIBUTE void
 dfsan_dump_labels(int fd) {
   dfsan_label last_label =
       atomic_load(&__dfsan_last_label, memory_order_relaxed);
 
-  char buf[512] = "label,ndx,pdx,location,f_val,opcode\n";
+  u8 *keep = nullptr;
+  if (dump_reachable_labels) {
+    keep = (u8 *)MmapOrDie(kNumLabels, "dfsan reachable labels");
+    MarkReachableLabels(keep, last_label);
+  }
+
+  char buf[512] = "label,ndx,pdx,location,f_val,opcode,l1,l2\n";
 
   WriteToFile(fd, buf, internal_strlen(buf));
   // NOTE: Label 0 is unused
   for (uptr l = 1; l <= last_label; ++l) {
+    if (keep && !keep[l])
+      continue;
 
-    struct dfsan_label_info* i_info = &__dfsan_label_info[l];
+    ForceLabel(l);
+    const dfsan_label_prov &prov = __dfsan_label_prov[l];
 
-    const char* opName = opcodeNames[i_info->opcode];
-    snprintf(buf, 512, "%lu,%f,%f,%s,%d,%s", l, i_info->neg_dydx, 
-      i_info->pos_dydx, i_info->loc, i_info->f_val, opName);
+    const char* opName = opcodeNames[prov.opcode];
+    snprintf(buf, 512, "%lu,%f,%f,%s,%d,%s,%u,%u", l, label_neg_dydx(l),
+      label_pos_dydx(l), __dfsan_label_loc[l], prov.f_val, opName,
+      prov.l1, prov.l2);
 
     WriteToFile(fd, buf, internal_strlen(buf));
     WriteToFile(fd, "\n", 1);
   }
+
+  if (keep)
+    UnmapOrDie(keep, kNumLabels);
 }
 
 extern "C" SANITIZER_INTERFACE_ATTRIBUTE void
@@ -668,7 +2199,7 @@ dfsan_dump_branches(int fd) {
   unsigned long last_index =
           atomic_load(&__dfsan_record_index, memory_order_relaxed);
 
-  char buf[512] = "file_id,inst_id,lhs_label,rhs_label,lhs_val,rhs_val,lhs_ndx,lhs_pdx,rhs_ndx,rhs_pdx,cond_val,zero,is_ptr,location\n";
+  char buf[512] = "file_id,inst_id,lhs_label,rhs_label,lhs_val,rhs_val,lhs_ndx,lhs_pdx,rhs_ndx,rhs_pdx,cond_val,zero,is_ptr,location,context\n";
 
   WriteToFile(fd, buf, internal_strlen(buf));
   for (uptr l = 0; l < last_index; ++l) {
@@ -688,10 +2219,12 @@ dfsan_dump_branches(int fd) {
     bool zero = (br.lhs_ndx == 0) && (br.lhs_pdx == 0) &&
                 (br.rhs_ndx == 0) && (br.rhs_pdx == 0);
 
-    internal_snprintf(buf, sizeof(buf), "%zu,%u,%u,%u,%s,%s,%s,%s,%s,%s,%u,%u,%u,%s",
-                      br.file_id, br.inst_id, br.lhs_label, br.rhs_label, lhs_v_s, rhs_v_s,
+    // Branch ids are 64-bit (function hash << 20 | ordinal); printing them
+    // truncated would break joins against the path log's site rows.
+    internal_snprintf(buf, sizeof(buf), "%zu,%llu,%u,%u,%s,%s,%s,%s,%s,%s,%u,%u,%u,%s,%u",
+                      br.file_id, (u64)br.inst_id, br.lhs_label, br.rhs_label, lhs_v_s, rhs_v_s,
                       lhs_ndx_s, lhs_pdx_s, rhs_ndx_s, rhs_pdx_s,
-                      br.cond, zero, br.is_ptr, br.loc);
+                      br.cond, zero, br.is_ptr, br.loc, br.context);
 
 
     WriteToFile(fd, buf, internal_strlen(buf));
@@ -702,10 +2235,13 @@ dfsan_dump_branches(int fd) {
 
 extern "C" SANITIZER_INTERFACE_ATTRIBUTE void
 dfsan_dump_func_args(int fd) {
-  unsigned short last_index =
-          atomic_load(&__dfsan_arg_index, memory_order_relaxed);
+  u64 sampled = atomic_load(&__dfsan_arg_index, memory_order_relaxed);
+  u64 last_index = Min<u64>(sampled, FUNC_ARGS_SIZE);
+  if (sampled > last_index)
+    Report("WARNING: DataFlowSanitizer: %llu sampled function argument "
+           "records did not fit\n", sampled - last_index);
 
-  char buf[512] = "file_id,inst_id,arg_ind,label,val,ndx,pdx,location\n";
+  char buf[512] = "file_id,inst_id,arg_ind,label,val,ndx,pdx,location,context\n";
 
   WriteToFile(fd, buf, internal_strlen(buf));
 
@@ -719,8 +2255,9 @@ dfsan_dump_func_args(int fd) {
 
     float2str(lhs_v_s, br.v, 32);
 
-    internal_snprintf(buf, sizeof(buf), "%zu,%u,%u,%u,%s,%s,%s,%s",
-                      br.file_id, br.inst_id, br.arg_ind, br.label, lhs_v_s, lhs_ndx_s, lhs_pdx_s, br.loc);
+    internal_snprintf(buf, sizeof(buf), "%zu,%u,%u,%u,%s,%s,%s,%s,%u",
+                      br.file_id, br.inst_id, br.arg_ind, br.label, lhs_v_s, lhs_ndx_s, lhs_pdx_s, br.loc,
+                      br.context);
 
 
     WriteToFile(fd, buf, internal_strlen(buf));
@@ -729,6 +2266,209 @@ dfsan_dump_func_args(int fd) {
   }
 }
 
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE void
+dfsan_dump_func_arg_sites(int fd) {
+  char buf[512] = "file_id,inst_id,arg_ind,count,samples,label,min_val,max_val,"
+                  "min_ndx,max_ndx,min_pdx,max_pdx,location,context\n";
+
+  WriteToFile(fd, buf, internal_strlen(buf));
+
+  for (uptr i = 0; i < FUNC_ARG_SITES_SIZE; ++i) {
+    func_arg_site &s = __func_arg_sites[i];
+    if (atomic_load(&s.state, memory_order_acquire) != kSiteReady)
+      continue;
+
+    SpinMutexLock l(&s.mu);
+    char min_v_s[32], max_v_s[32];
+    char min_ndx_s[32], max_ndx_s[32], min_pdx_s[32], max_pdx_s[32];
+    float2str(min_v_s, s.min_v, 32);
+    float2str(max_v_s, s.max_v, 32);
+    float2str(min_ndx_s, s.min_ndx, 32);
+    float2str(max_ndx_s, s.max_ndx, 32);
+    float2str(min_pdx_s, s.min_pdx, 32);
+    float2str(max_pdx_s, s.max_pdx, 32);
+
+    internal_snprintf(buf, sizeof(buf),
+                      "%zu,%u,%u,%llu,%u,%u,%s,%s,%s,%s,%s,%s,%s,%u\n",
+                      s.file_id, s.inst_id, s.arg_ind, s.count, s.samples,
+                      s.label, min_v_s, max_v_s, min_ndx_s, max_ndx_s,
+                      min_pdx_s, max_pdx_s, s.loc, s.context);
+    WriteToFile(fd, buf, internal_strlen(buf));
+  }
+
+  u64 dropped = atomic_load(&__dfsan_arg_sites_dropped, memory_order_relaxed);
+  if (dropped)
+    Report("WARNING: DataFlowSanitizer: %llu function argument records had "
+           "no site slot\n", dropped);
+}
+
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE void
+dfsan_dump_cmps(int fd) {
+  static const char *const kKindNames[] = {"cmp", "const_cmp", "switch"};
+  u64 recorded = atomic_load(&__dfsan_cmp_index, memory_order_relaxed);
+  u64 last_index = Min<u64>(recorded, CMP_RECORDS_SIZE);
+  if (recorded > last_index)
+    Report("WARNING: DataFlowSanitizer: %llu comparison records did not "
+           "fit\n", recorded - last_index);
+
+  char buf[512] = "pc,kind,size,lhs_label,rhs_label,lhs_val,rhs_val,"
+                  "lhs_ndx,lhs_pdx,rhs_ndx,rhs_pdx,context\n";
+  WriteToFile(fd, buf, internal_strlen(buf));
+
+  for (uptr i = 0; i < last_index; ++i) {
+    const cmp_record &r = __cmp_records[i];
+    char lhs_ndx_s[32], lhs_pdx_s[32], rhs_ndx_s[32], rhs_pdx_s[32];
+    float2str(lhs_ndx_s, r.lhs_ndx, 32);
+    float2str(lhs_pdx_s, r.lhs_pdx, 32);
+    float2str(rhs_ndx_s, r.rhs_ndx, 32);
+    float2str(rhs_pdx_s, r.rhs_pdx, 32);
+
+    internal_snprintf(buf, sizeof(buf),
+                      "0x%zx,%s,%u,%u,%u,%llu,%llu,%s,%s,%s,%s,%u\n", r.pc,
+                      kKindNames[r.kind], r.size, r.lhs_label, r.rhs_label,
+                      r.lhs_v, r.rhs_v, lhs_ndx_s, lhs_pdx_s, rhs_ndx_s,
+                      rhs_pdx_s, r.context);
+    WriteToFile(fd, buf, internal_strlen(buf));
+  }
+}
+
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE void
+dfsan_dump_outputs(int fd) {
+  u64 recorded = atomic_load(&__dfsan_output_index, memory_order_relaxed);
+  u64 last_index = Min<u64>(recorded, OUTPUT_RECORDS_SIZE);
+  if (recorded > last_index)
+    Report("WARNING: DataFlowSanitizer: %llu output byte records did not "
+           "fit\n", recorded - last_index);
+
+  char buf[256] = "fd,offset,label,ndx,pdx\n";
+  WriteToFile(fd, buf, internal_strlen(buf));
+
+  for (uptr i = 0; i < last_index; ++i) {
+    const output_record &r = __output_records[i];
+    char ndx_s[32], pdx_s[32];
+    float2str(ndx_s, r.ndx, 32);
+    float2str(pdx_s, r.pdx, 32);
+    internal_snprintf(buf, sizeof(buf), "%d,%llu,%u,%s,%s\n", r.fd, r.offset,
+                      r.label, ndx_s, pdx_s);
+    WriteToFile(fd, buf, internal_strlen(buf));
+  }
+}
+
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE void
+dfsan_dump_memo(int fd) {
+  u64 dropped = atomic_load(&__dfsan_memo_dropped, memory_order_relaxed);
+  if (dropped)
+    Report("WARNING: DataFlowSanitizer: %llu memoized summaries did not "
+           "fit\n", dropped);
+
+  char buf[512] = "function,lookups,hits,disabled\n";
+  WriteToFile(fd, buf, internal_strlen(buf));
+
+  for (uptr i = 0; i < kMemoFns; ++i) {
+    memo_fn &f = __memo_fns[i];
+    if (atomic_load(&f.state, memory_order_acquire) != kSiteReady)
+      continue;
+    internal_snprintf(buf, sizeof(buf), "%s,%llu,%llu,%u\n",
+                      f.name ? f.name : "", atomic_load(&f.lookups,
+                                                        memory_order_relaxed),
+                      atomic_load(&f.hits, memory_order_relaxed),
+                      atomic_load(&f.disabled, memory_order_relaxed));
+    WriteToFile(fd, buf, internal_strlen(buf));
+  }
+}
+
+// Writes the path signature: a "visits,<n>,<block size>" line, then one
+// "block,<index>,<hash>" line per block (the last one may be partial), one
+// "read,<offset>,<size>,<visit>" line per input read and one
+// "site,<file_id>,<inst_id>,<first>,<last>,<count>" line per branch site.
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE void
+dfsan_dump_path(int fd) {
+  SpinMutexLock l(&path_mu);
+  if (path_sites_dropped)
+    Report("WARNING: DataFlowSanitizer: %llu branch visits to sites that did "
+           "not fit in the path signature\n", path_sites_dropped);
+  u64 block_size = flags().path_block;
+  u64 blocks = (path_visits + block_size - 1) / block_size;
+  if (blocks > kPathBlocks) {
+    Report("WARNING: DataFlowSanitizer: path signature truncated to %zu "
+           "blocks\n", kPathBlocks);
+    blocks = kPathBlocks;
+  }
+  if (path_num_reads == kPathReads)
+    Report("WARNING: DataFlowSanitizer: only the first %zu input reads are "
+           "in the path signature\n", kPathReads);
+
+  char buf[512];
+  internal_snprintf(buf, sizeof(buf), "visits,%llu,%llu\n", path_visits,
+                    block_size);
+  WriteToFile(fd, buf, internal_strlen(buf));
+  for (u64 i = 0; i < blocks; ++i) {
+    u64 h = i == path_visits / block_size ? path_hash : __path_blocks[i];
+    internal_snprintf(buf, sizeof(buf), "block,%llu,%llx\n", i, h);
+    WriteToFile(fd, buf, internal_strlen(buf));
+  }
+  for (u64 i = 0; i < path_num_reads; ++i) {
+    const path_read &r = __path_reads[i];
+    internal_snprintf(buf, sizeof(buf), "read,%lld,%llu,%llu\n", r.offset,
+                      r.size, r.visit);
+    WriteToFile(fd, buf, internal_strlen(buf));
+  }
+  for (uptr i = 0; i < kPathSites; ++i) {
+    const path_site &site = __path_sites[i];
+    if (!site.used)
+      continue;
+    internal_snprintf(buf, sizeof(buf), "site,%llu,%llu,%llu,%llu,%llu\n",
+                      site.file_id, site.inst_id, site.first, site.last,
+                      site.count);
+    WriteToFile(fd, buf, internal_strlen(buf));
+  }
+}
+
+// Writes one line per context id used by a record: the id and its frames,
+// innermost first, as function@file:line separated by ';'.
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE void
+dfsan_dump_contexts(int fd) {
+  InternalMmapVector<u32> ids;
+  u64 branches = Min<u64>(
+      atomic_load(&__dfsan_record_index, memory_order_relaxed),
+      BRANCH_RECORDS_SIZE);
+  for (uptr i = 0; i < branches; ++i)
+    ids.push_back(__branch_records[i].context);
+  u64 cmps = Min<u64>(atomic_load(&__dfsan_cmp_index, memory_order_relaxed),
+                      CMP_RECORDS_SIZE);
+  for (uptr i = 0; i < cmps; ++i)
+    ids.push_back(__cmp_records[i].context);
+  for (uptr i = 0; i < FUNC_ARG_SITES_SIZE; ++i)
+    if (atomic_load(&__func_arg_sites[i].state, memory_order_acquire) ==
+        kSiteReady)
+      ids.push_back(__func_arg_sites[i].context);
+  Sort(ids.data(), ids.size());
+
+  const char *header = "context,frames\n";
+  WriteToFile(fd, header, internal_strlen(header));
+
+  Symbolizer *symbolizer = Symbolizer::GetOrInit();
+  InternalScopedString line(4096);
+  for (uptr i = 0; i < ids.size(); ++i) {
+    if (ids[i] == 0 || (i > 0 && ids[i] == ids[i - 1]))
+      continue;
+    StackTrace stack = StackDepotGet(ids[i]);
+    line.clear();
+    line.append("%u,", ids[i]);
+    for (uptr f = 0; f < stack.size; ++f) {
+      uptr pc = StackTrace::GetPreviousInstructionPc(stack.trace[f]);
+      SymbolizedStack *frame = symbolizer->SymbolizePC(pc);
+      line.append("%s%s@%s:%d", f ? ";" : "",
+                  frame->info.function ? frame->info.function : "??",
+                  frame->info.file ? frame->info.file : "??",
+                  frame->info.line);
+      frame->ClearAll();
+    }
+    line.append("\n");
+    WriteToFile(fd, line.data(), line.length());
+  }
+}
+
 void Flags::SetDefaults() {
 #define DFSAN_FLAG(Type, Name, DefaultValue, Description) Name = DefaultValue;
 #include "dfsan_flags.inc"
@@ -771,13 +2511,127 @@ static void InitializePlatformEarly() {
 #endif
 }
 
+// Per-process logs.  A forked child inherits its parent's records and an
+// exec'd descendant starts again with the same DFSAN_OPTIONS, so both would
+// write their parent's log files at exit.  Every process other than the
+// first instrumented one (whose pid is passed down in DFSAN_LOG_ROOT_PID)
+// therefore writes "<path>.<pid>" instead, and a forked child drops the
+// records it inherited.  Labels up to fork_label are the parent's and are
+// kept, since the child's shadow still refers to them.
+static const char kLogRootPidEnv[] = "DFSAN_LOG_ROOT_PID";
+static bool log_pid_suffix;
+static dfsan_label fork_label;
+
+static const char *LogPath(const char *path, char *buf, uptr size) {
+  if (!log_pid_suffix)
+    return path;
+  internal_snprintf(buf, size, "%s.%zu", path, internal_getpid());
+  return buf;
+}
+
+fd_t __dfsan::OpenLogFile(const char *path) {
+  char buf[kMaxPathLength];
+  return OpenFile(LogPath(path, buf, sizeof(buf)), WrOnly);
+}
+
+static void InitializeLogPaths() {
+  char pid[32];
+  internal_snprintf(pid, sizeof(pid), "%zu", internal_getpid());
+  const char *root = GetEnv(kLogRootPidEnv);
+  if (root)
+    log_pid_suffix = internal_strcmp(root, pid) != 0;
+  else
+    SetEnv(kLogRootPidEnv, pid);
+}
+
+// Appends one line per log file this process writes to log_manifest:
+//   <pid>,<parent pid>,<fork label>,<last label>,<flag>,<absolute path>
+// Labels up to <fork label> belong to the parent process.  The lines are
+// written with a single append so that processes exiting together do not
+// interleave them.
+static void WriteLogManifest() {
+  if (internal_strcmp(flags().log_manifest, "") == 0)
+    return;
+  const struct {
+    const char *flag;
+    const char *path;
+  } logs[] = {
+    {"gradient_logfile", flags().gradient_logfile},
+    {"branch_logfile", flags().branch_logfile},
+    {"func_logfile", flags().func_logfile},
+    {"cmp_logfile", flags().cmp_logfile},
+    {"output_logfile", flags().output_logfile},
+    {"memo_logfile", flags().memo_logfile},
+    {"context_logfile", flags().context_logfile},
+    {"func_summary_logfile", flags().func_summary_logfile},
+    {"path_logfile", flags().path_logfile},
+    {"profile_logfile", profile_overhead ? flags().profile_logfile : ""},
+  };
+
+  char cwd[kMaxPathLength];
+  if (!getcwd(cwd, sizeof(cwd)))
+    cwd[0] = '\0';
+  InternalScopedString lines(kMaxPathLength * 4);
+  dfsan_label last = atomic_load(&__dfsan_last_label, memory_order_relaxed);
+  for (const auto &log : logs) {
+    if (log.path[0] == '\0')
+      continue;
+    char buf[kMaxPathLength];
+    const char *path = LogPath(log.path, buf, sizeof(buf));
+    lines.append("%zu,%zu,%u,%u,%s,%s%s%s\n", internal_getpid(),
+                 internal_getppid(), fork_label, last, log.flag,
+                 path[0] == '/' ? "" : cwd, path[0] == '/' ? "" : "/", path);
+  }
+
+  uptr fd = internal_open(flags().log_manifest,
+                          O_WRONLY | O_CREAT | O_APPEND, 0660);
+  if (internal_iserror(fd)) {
+    Report("WARNING: DataFlowSanitizer: unable to open output file %s\n",
+           flags().log_manifest);
+    return;
+  }
+  WriteToFile(fd, lines.data(), lines.length());
+  CloseFile(fd);
+}
+
+// Forgets every branch, argument, comparison and output record and the path
+// signature, keeping labels.
+static void ResetRecords() {
+  atomic_store(&__dfsan_record_index, 0, memory_order_relaxed);
+  atomic_store(&__dfsan_arg_index, 0, memory_order_relaxed);
+  atomic_store(&__dfsan_cmp_index, 0, memory_order_relaxed);
+  atomic_store(&__dfsan_output_index, 0, memory_order_relaxed);
+  internal_memset(__func_arg_sites, 0, sizeof(__func_arg_sites));
+  atomic_store(&__dfsan_arg_sites_dropped, 0, memory_order_relaxed);
+  if (path_log_enabled)
+    ResetPath();
+}
+
+// Runs in the child after fork().
+static void DfsanAtForkChild() {
+  log_pid_suffix = true;
+  fork_label = atomic_load(&__dfsan_last_label, memory_order_relaxed);
+  // Another thread may have held the lock when the parent forked.
+  path_mu.Init();
+  ResetRecords();
+  for (uptr i = 0; i < kMemoFns; ++i) {
+    atomic_store(&__memo_fns[i].lookups, 0, memory_order_relaxed);
+    atomic_store(&__memo_fns[i].hits, 0, memory_order_relaxed);
+  }
+  ResetProfile();
+}
+
 static void dfsan_fini() {
+  DumpProfile();
+
   if (gr_mode_perf) {
     return;
   }
 
+  WriteLogManifest();
+
   if (internal_strcmp(flags().gradient_logfile, "") != 0) {
-    fd_t fd = OpenFile(flags().gradient_logfile, WrOnly);
+    fd_t fd = OpenLogFile(flags().gradient_logfile);
     if (fd == kInvalidFd) {
       Report("WARNING: DataFlowSanitizer: unable to open output file %s\n",
              flags().gradient_logfile);
@@ -794,7 +2648,7 @@ static void dfsan_fini() {
   }
 
   if (internal_strcmp(flags().branch_logfile, "") != 0) {
-    fd_t fd = OpenFile(flags().branch_logfile, WrOnly);
+    fd_t fd = OpenLogFile(flags().branch_logfile);
     if (fd == kInvalidFd) {
       Report("WARNING: DataFlowSanitizer: unable to open output file %s\n",
              flags().branch_logfile);
@@ -811,7 +2665,7 @@ static void dfsan_fini() {
   }
 
   if (internal_strcmp(flags().func_logfile, "") != 0) {
-    fd_t fd = OpenFile(flags().func_logfile, WrOnly);
+    fd_t fd = OpenLogFile(flags().func_logfile);
     if (fd == kInvalidFd) {
       Report("WARNING: DataFlowSanitizer: unable to open output file %s\n",
              flags().func_logfile);
@@ -826,6 +2680,78 @@ static void dfsan_fini() {
     dfsan_dump_func_args(fd);
     CloseFile(fd);
   }
+
+  if (internal_strcmp(flags().cmp_logfile, "") != 0) {
+    fd_t fd = OpenLogFile(flags().cmp_logfile);
+    if (fd == kInvalidFd) {
+      Report("WARNING: DataFlowSanitizer: unable to open output file %s\n",
+             flags().cmp_logfile);
+      return;
+    }
+
+    dfsan_dump_cmps(fd);
+    CloseFile(fd);
+  }
+
+  if (internal_strcmp(flags().output_logfile, "") != 0) {
+    fd_t fd = OpenLogFile(flags().output_logfile);
+    if (fd == kInvalidFd) {
+      Report("WARNING: DataFlowSanitizer: unable to open output file %s\n",
+             flags().output_logfile);
+      return;
+    }
+
+    dfsan_dump_outputs(fd);
+    CloseFile(fd);
+  }
+
+  if (internal_strcmp(flags().memo_logfile, "") != 0) {
+    fd_t fd = OpenLogFile(flags().memo_logfile);
+    if (fd == kInvalidFd) {
+      Report("WARNING: DataFlowSanitizer: unable to open output file %s\n",
+             flags().memo_logfile);
+      return;
+    }
+
+    dfsan_dump_memo(fd);
+    CloseFile(fd);
+  }
+
+  if (path_log_enabled) {
+    fd_t fd = OpenLogFile(flags().path_logfile);
+    if (fd == kInvalidFd) {
+      Report("WARNING: DataFlowSanitizer: unable to open output file %s\n",
+             flags().path_logfile);
+      return;
+    }
+
+    dfsan_dump_path(fd);
+    CloseFile(fd);
+  }
+
+  if (internal_strcmp(flags().context_logfile, "") != 0) {
+    fd_t fd = OpenLogFile(flags().context_logfile);
+    if (fd == kInvalidFd) {
+      Report("WARNING: DataFlowSanitizer: unable to open output file %s\n",
+             flags().context_logfile);
+      return;
+    }
+
+    dfsan_dump_contexts(fd);
+    CloseFile(fd);
+  }
+
+  if (internal_strcmp(flags().func_summary_logfile, "") != 0) {
+    fd_t fd = OpenLogFile(flags().func_summary_logfile);
+    if (fd == kInvalidFd) {
+      Report("WARNING: DataFlowSanitizer: unable to open output file %s\n",
+             flags().func_summary_logfile);
+      return;
+    }
+
+    dfsan_dump_func_arg_sites(fd);
+    CloseFile(fd);
+  }
 }
 
 // Used if you want to reset the shadow memory for in-process fuzzing
@@ -834,13 +2760,29 @@ extern "C" void dfsan_flush() {
   if (!MmapFixedNoReserve(ShadowAddr(), UnusedAddr() - ShadowAddr()))
     Die();
 
-  memset(__dfsan_label_info, 0, sizeof(dfsan_label_info)*kNumLabels);
+  memset(__dfsan_label_deriv, 0, sizeof(dfsan_label_deriv)*kNumLabels);
+  memset(__dfsan_label_prov, 0, sizeof(dfsan_label_prov)*kNumLabels);
+  memset(__dfsan_label_loc, 0, sizeof(const char *)*kNumLabels);
+  memset(__dfsan_label_queried, 0, sizeof(__dfsan_label_queried));
+  memset(__dfsan_label_pending, 0, sizeof(__dfsan_label_pending));
   memset(__branch_records, 0, sizeof(branch_record)*BRANCH_RECORDS_SIZE);
   memset(__func_arg_records, 0, sizeof(func_arg_record)*FUNC_ARGS_SIZE);
+  ResetRecords();
+  // Memoized summaries hold derivatives rather than labels and stay valid.
 
   atomic_store(&__dfsan_last_label, 0, memory_order_relaxed);
-  atomic_store(&__dfsan_arg_index, 0, memory_order_relaxed);
-  atomic_store(&__dfsan_record_index, 0, memory_order_relaxed);
+  atomic_store(&__dfsan_lazy_forced, 0, memory_order_relaxed);
+
+  if (two_level_shadow)
+    InitializeShadowChunks();
+  if (__dfsan_mixed_shadow) {
+    LockMixedShadow();
+    ReleaseMemoryPagesToOS(
+        (uptr)__dfsan_mixed_shadow,
+        (uptr)(__dfsan_mixed_shadow + mixed_shadow_words));
+    atomic_store(&mixed_shadow_used, 0, memory_order_relaxed);
+    UnlockMixedShadow();
+  }
 }
 
 static void dfsan_init(int argc, char **argv, char **envp) {
@@ -848,9 +2790,33 @@ static void dfsan_init(int argc, char **argv, char **envp) {
 
   InitializePlatformEarly();
 
+  InitializeProfile();
+
+  InitializeDumpLabels();
+
+  InitializeLogPaths();
+
+  path_log_enabled = flags().path_logfile[0] != '\0';
+  lazy_gradients = flags().lazy_gradients;
+  if (path_log_enabled && flags().path_block <= 0) {
+    Report("WARNING: DataFlowSanitizer: path_block must be positive, path "
+           "signature disabled\n");
+    path_log_enabled = false;
+  }
+
+  CheckInstrumentedABI();
+
   if (!MmapFixedNoReserve(ShadowAddr(), UnusedAddr() - ShadowAddr()))
     Die();
 
+  two_level_shadow =
+      &__dfsan_shadow_mode && __dfsan_shadow_mode == kShadowModeTwoLevel;
+  if (two_level_shadow)
+    InitializeShadowChunks();
+  InitializeShadowGranularity();
+  shadow_inited = true;
+  DfsanAllocatorInit();
+
   // Protect the region of memory we don't use, to preserve the one-to-one
   // mapping from application to shadow memory. But if ASLR is disabled, Linux
   // will load our executable in the middle of our unused region. This mostly
@@ -866,8 +2832,12 @@ static void dfsan_init(int argc, char **argv, char **envp) {
   // or it is killed by the runtime.
   Atexit(dfsan_fini);
   AddDieCallback(dfsan_fini);
+  pthread_atfork(nullptr, nullptr, DfsanAtForkChild);
+
+  __dfsan_label_info_view = (dfsan_label_info *)MmapNoReserveOrDie(
+      sizeof(dfsan_label_info) * kNumLabels, "dfsan label info");
 
-  __dfsan_label_info[kInitializingLabel].loc = "<init label>";
+  __dfsan_label_loc[kInitializingLabel] = "<init label>";
 }
 
 #if SANITIZER_CAN_USE_PREINIT_ARRAY
@@ -20,6 +20,10 @@
 
 using __sanitizer::uptr;
 using __sanitizer::u16;
+using __sanitizer::u32;
+using __sanitizer::u64;
+using __sanitizer::u8;
+using __sanitizer::s64;
 
 // Copy declarations from public sanitizer/dfsan_interface.h header here.
 typedef u16 dfsan_label;
@@ -34,6 +38,29 @@ struct dfsan_label_info {
   int f_val;
 };
 
+// The runtime keeps the label table as a structure of arrays.  The derivative
+// pair is read by every union and branch visitor, so it lives in its own
+// compact array; provenance and locations are only needed when dumping labels
+// or walking the label graph.  dfsan_label_info above is the public view that
+// dfsan_get_label_info() assembles on request.
+#if DFSAN_HALF_DERIVS
+typedef u16 dfsan_deriv;
+#else
+typedef float dfsan_deriv;
+#endif
+
+struct dfsan_label_deriv {
+  dfsan_deriv neg_dydx;
+  dfsan_deriv pos_dydx;
+};
+
+struct dfsan_label_prov {
+  dfsan_label l1;
+  dfsan_label l2;
+  dfsan_label opcode;
+  int f_val;
+};
+
 struct branch_record {
   unsigned long file_id;
   unsigned long inst_id;
@@ -48,6 +75,7 @@ struct branch_record {
   bool cond;
   unsigned int is_ptr;
   const char* loc;
+  u32 context;
 };
 
 struct func_arg_record {
@@ -59,6 +87,7 @@ struct func_arg_record {
   float ndx;
   float pdx;
   const char* loc;
+  u32 context;
 };
 
 extern int gr_mode_perf;
@@ -66,6 +95,63 @@ extern int gr_mode_perf;
 void record_arg(unsigned long file_id, unsigned int inst_id, unsigned int arg_ind, dfsan_label label, float v,
         const char* location);
 
+// Kinds of comparisons reported by the SanitizerCoverage trace-cmp hooks.
+enum cmp_kind { kCmpTrace = 0, kCmpConst = 1, kCmpSwitch = 2 };
+
+// A comparison seen by a SanitizerCoverage trace-cmp hook, identified by the
+// PC of the hook call rather than by a branch id.
+struct cmp_record {
+  uptr pc;
+  u64 lhs_v;
+  u64 rhs_v;
+  dfsan_label lhs_label;
+  dfsan_label rhs_label;
+  float lhs_ndx;
+  float lhs_pdx;
+  float rhs_ndx;
+  float rhs_pdx;
+  u32 context;
+  u8 kind;
+  u8 size;
+};
+
+void record_cmp(uptr pc, cmp_kind kind, u8 size, u64 lhs_v, u64 rhs_v,
+                dfsan_label lhs_label, dfsan_label rhs_label);
+
+// A labeled byte written to a file descriptor by an output wrapper.
+struct output_record {
+  u64 offset;
+  int fd;
+  dfsan_label label;
+  float ndx;
+  float pdx;
+};
+
+bool output_sink_enabled();
+void record_output(int fd, const void *buf, uptr size, s64 offset);
+
+// Static facts about one instrumented branch or union, emitted by the pass
+// in a per-module table that a module constructor registers with
+// __dfsan_register_sites.  Calls pass a pointer to their descriptor instead
+// of these values.  The layout must match SiteTy in DataFlowSanitizer.cpp.
+struct dfsan_site {
+  u64 file_id;
+  u64 inst_id;           // branch id for branches, 0 for unions
+  const char *location;
+  u32 slot;              // index of the site's runtime state, 0 if none
+  u16 kind;              // kSiteBranch or kSiteUnion
+  u16 op;                // predicate of a branch, opcode of a union
+  u16 flags;             // is_ptr of a branch
+};
+
+enum site_kind { kSiteBranch = 0, kSiteUnion = 1 };
+
+// Path signature hooks, active when path_logfile is set.  slot, when
+// nonzero, caches the branch's entry in the signature.
+extern bool path_log_enabled;
+void record_path(u64 file_id, u64 inst_id, bool cond, u32 slot = 0);
+void record_input_read(s64 offset, uptr size);
+
 
 extern "C" {
 void *dfsan_memcpy(void *dest, const void *src, unsigned long n);
@@ -74,6 +160,8 @@ void dfsan_set_label(dfsan_label label, void *addr, uptr size);
 dfsan_label dfsan_read_label(const void *addr, uptr size);
 dfsan_label dfsan_union(dfsan_label l1, dfsan_label l2);
 dfsan_label dfsan_create_label(const char *desc);
+dfsan_label dfsan_label_field(void *addr, uptr width, int big_endian,
+                              int is_signed, const char *desc);
 }  // extern "C"
 extern int gr_mode_perf;
 
@@ -86,14 +174,116 @@ namespace __dfsan {
 
 void InitializeInterceptors();
 
+// log2 of the number of application bytes sharing one shadow slot.  Set at
+// init when the program was instrumented with -dfsan-shadow-granularity.
+extern uptr shadow_granularity_shift;
+
+// Slot value of a word whose bytes carry different labels under word-granular
+// shadow.  It is never handed out as a label.  The instrumentation compares
+// loaded shadow against it, so kMixedShadowLabel in DataFlowSanitizer.cpp must
+// stay equal to this.
+static const dfsan_label kMixedShadowLabel = 0xFFFE;
+
 inline dfsan_label *shadow_for(void *ptr) {
-  return (dfsan_label *) ((((uptr) ptr) & ShadowMask()) << 1);
+  return (dfsan_label *) (
+      ((((uptr) ptr) & ShadowMask()) >> shadow_granularity_shift) << 1);
 }
 
 inline const dfsan_label *shadow_for(const void *ptr) {
   return shadow_for(const_cast<void *>(ptr));
 }
 
+// Set at init when the program was instrumented with -dfsan-two-level-shadow.
+// In that mode shadow_for() must not be used; go through the chunk directory
+// (or the helpers below, which handle both modes) instead.
+extern bool two_level_shadow;
+
+inline uptr shadow_chunk_index(const void *ptr) {
+  return (((uptr) ptr) & ShadowMask()) >> kShadowChunkShift;
+}
+
+inline uptr shadow_chunk_offset(const void *ptr) {
+  return ((uptr) ptr) & (kShadowChunkSize - 1);
+}
+
+inline dfsan_label **shadow_dir() {
+  return (dfsan_label **) ShadowDirAddr();
+}
+
+dfsan_label *AllocShadowChunk(uptr index);
+dfsan_label ReadShadow(const void *ptr);
+void CopyShadow(void *dst, const void *src, uptr size);
+
+// Zeroes the shadow of [addr, addr+size), returning whole shadow pages to the
+// OS.  A no-op until dfsan_init has mapped the shadow.
+void ReleaseShadow(uptr addr, uptr size);
+extern bool shadow_inited;
+
+// Opens a log file for writing.  Forked children and exec'd descendants
+// write "<path>.<pid>" so that they do not clobber their parent's logs.
+__sanitizer::fd_t OpenLogFile(const char *path);
+
+#if DFSAN_HALF_DERIVS
+// IEEE 754 binary16 conversions (round to nearest even) used when derivatives
+// are stored packed.  Halves the size of the hot derivative array at the cost
+// of precision above 2048 and range above 65504.
+inline dfsan_deriv float_to_deriv(float f) {
+  union { float f; u32 u; } v;
+  v.f = f;
+  u32 sign = (v.u >> 16) & 0x8000;
+  u32 abs = v.u & 0x7fffffff;
+  if (abs > 0x7f800000)
+    return sign | 0x7e00;
+  if (abs >= 0x47800000)
+    return sign | 0x7c00;
+  if (abs < 0x38800000) {
+    if (abs < 0x33000000)
+      return sign;
+    u32 exp = abs >> 23;
+    u32 mant = (abs & 0x7fffff) | 0x800000;
+    u32 shift = 126 - exp;
+    u32 h = mant >> shift;
+    u32 rem = mant & ((1u << shift) - 1);
+    u32 half = 1u << (shift - 1);
+    if (rem > half || (rem == half && (h & 1)))
+      ++h;
+    return sign | h;
+  }
+  u32 h = (abs >> 13) - (112 << 10);
+  u32 rem = abs & 0x1fff;
+  if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+    ++h;
+  return sign | h;
+}
+
+inline float deriv_to_float(dfsan_deriv h) {
+  union { float f; u32 u; } v;
+  u32 sign = (u32)(h & 0x8000) << 16;
+  u32 exp = (h >> 10) & 0x1f;
+  u32 mant = h & 0x3ff;
+  if (exp == 0x1f) {
+    v.u = sign | 0x7f800000 | (mant << 13);
+  } else if (exp == 0) {
+    if (mant == 0) {
+      v.u = sign;
+    } else {
+      exp = 113;
+      while (!(mant & 0x400)) {
+        mant <<= 1;
+        --exp;
+      }
+      v.u = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+    }
+  } else {
+    v.u = sign | ((exp + 112) << 23) | (mant << 13);
+  }
+  return v.f;
+}
+#else
+inline dfsan_deriv float_to_deriv(float f) { return f; }
+inline float deriv_to_float(dfsan_deriv d) { return d; }
+#endif
+
 struct Flags {
 #define DFSAN_FLAG(Type, Name, DefaultValue, Description) Type Name;
 #include "dfsan_flags.inc"
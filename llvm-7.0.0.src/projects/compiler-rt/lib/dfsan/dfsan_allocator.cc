@@ -0,0 +1,274 @@
+//===-- dfsan_allocator.cc ------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of DataFlowSanitizer.
+//
+// DataFlowSanitizer allocator.  Heap chunks are recycled by the
+// sanitizer_common CombinedAllocator, so the runtime knows when memory is
+// reused and can keep its shadow consistent: a recycled chunk has its shadow
+// cleared when it is handed out again, and the shadow of memory the
+// allocator maps or unmaps is released to the OS.
+//===----------------------------------------------------------------------===//
+
+#include "sanitizer_common/sanitizer_allocator.h"
+#include "sanitizer_common/sanitizer_allocator_checks.h"
+#include "sanitizer_common/sanitizer_errno.h"
+#include "sanitizer_common/sanitizer_flags.h"
+#include "dfsan/dfsan.h"
+#include "dfsan/dfsan_allocator.h"
+
+#include <pthread.h>
+
+namespace __dfsan {
+
+struct Metadata {
+  uptr requested_size;
+};
+
+struct DfsanMapUnmapCallback {
+  // Fresh and returned mappings get zero shadow without touching it page by
+  // page; this is what bounds shadow RSS for large allocations.
+  void OnMap(uptr p, uptr size) const { ReleaseShadow(p, size); }
+  void OnUnmap(uptr p, uptr size) const { ReleaseShadow(p, size); }
+};
+
+#if defined(__x86_64__)
+static const uptr kMaxAllowedMallocSize = 8UL << 30;
+
+struct AP64 {  // Allocator64 parameters. Deliberately using a short name.
+  // The space is placed by mmap, which keeps it inside the application range.
+  static const uptr kSpaceBeg = ~(uptr)0;
+  static const uptr kSpaceSize = 0x40000000000; // 4T.
+  static const uptr kMetadataSize = sizeof(Metadata);
+  typedef DefaultSizeClassMap SizeClassMap;
+  typedef DfsanMapUnmapCallback MapUnmapCallback;
+  static const uptr kFlags = 0;
+};
+
+typedef SizeClassAllocator64<AP64> PrimaryAllocator;
+#else
+static const uptr kMaxAllowedMallocSize = 2UL << 30;
+static const uptr kRegionSizeLog = 20;
+static const uptr kNumRegions = SANITIZER_MMAP_RANGE_SIZE >> kRegionSizeLog;
+typedef TwoLevelByteMap<(kNumRegions >> 12), 1 << 12> ByteMap;
+
+struct AP32 {
+  static const uptr kSpaceBeg = 0;
+  static const u64 kSpaceSize = SANITIZER_MMAP_RANGE_SIZE;
+  static const uptr kMetadataSize = sizeof(Metadata);
+  typedef __sanitizer::CompactSizeClassMap SizeClassMap;
+  static const uptr kRegionSizeLog = __dfsan::kRegionSizeLog;
+  typedef __dfsan::ByteMap ByteMap;
+  typedef DfsanMapUnmapCallback MapUnmapCallback;
+  static const uptr kFlags = 0;
+};
+typedef SizeClassAllocator32<AP32> PrimaryAllocator;
+#endif
+typedef SizeClassAllocatorLocalCache<PrimaryAllocator> AllocatorCache;
+typedef LargeMmapAllocator<DfsanMapUnmapCallback> SecondaryAllocator;
+typedef CombinedAllocator<PrimaryAllocator, AllocatorCache,
+                          SecondaryAllocator> Allocator;
+
+static Allocator allocator;
+static bool allocator_inited;
+
+// DFSan has no thread registry, so each thread's cache is mapped on its first
+// allocation and handed back to the allocator by a pthread key destructor.
+static THREADLOCAL AllocatorCache *thread_cache;
+static pthread_key_t thread_cache_key;
+
+static void DestroyThreadCache(void *p) {
+  AllocatorCache *cache = (AllocatorCache *) p;
+  allocator.DestroyCache(cache);
+  if (thread_cache == cache)
+    thread_cache = nullptr;
+  UnmapOrDie(cache, sizeof(AllocatorCache));
+}
+
+// The loader and libc may allocate before dfsan_init runs, so the allocator
+// is set up on first use; DfsanAllocatorInit applies the flags later.
+static void EnsureAllocatorInited() {
+  if (LIKELY(allocator_inited))
+    return;
+  allocator.Init(kReleaseToOSIntervalNever);
+  pthread_key_create(&thread_cache_key, DestroyThreadCache);
+  allocator_inited = true;
+}
+
+static AllocatorCache *GetAllocatorCache() {
+  EnsureAllocatorInited();
+  if (LIKELY(thread_cache))
+    return thread_cache;
+  thread_cache = (AllocatorCache *) MmapOrDie(sizeof(AllocatorCache),
+                                              "dfsan allocator cache");
+  allocator.InitCache(thread_cache);
+  // May allocate, which finds the cache already in place.
+  pthread_setspecific(thread_cache_key, thread_cache);
+  return thread_cache;
+}
+
+void DfsanAllocatorInit() {
+  EnsureAllocatorInited();
+  SetAllocatorMayReturnNull(common_flags()->allocator_may_return_null);
+  allocator.SetReleaseToOSIntervalMs(
+      common_flags()->allocator_release_to_os_interval_ms);
+}
+
+static void *ReportAllocationFailure(const char *what, uptr size) {
+  if (AllocatorMayReturnNull())
+    return nullptr;
+  Report("FATAL: DataFlowSanitizer: %s (0x%zx bytes)\n", what, size);
+  Die();
+}
+
+static void *DfsanAllocate(uptr size, uptr alignment, bool zeroise) {
+  if (size > kMaxAllowedMallocSize)
+    return ReportAllocationFailure("requested allocation size is too big",
+                                   size);
+  AllocatorCache *cache = GetAllocatorCache();
+  void *allocated = allocator.Allocate(cache, size, alignment);
+  if (UNLIKELY(!allocated)) {
+    SetAllocatorOutOfMemory();
+    return ReportAllocationFailure("out of memory", size);
+  }
+  Metadata *meta =
+      reinterpret_cast<Metadata *>(allocator.GetMetaData(allocated));
+  meta->requested_size = size;
+  // Chunks from the primary may be recycled and still carry the labels of a
+  // previous allocation.  Clearing them here rather than on free means only
+  // chunks that are used again pay for it, and SetShadowRange skips shadow
+  // that is already zero.  Secondary chunks are fresh mappings whose shadow
+  // was released in OnMap.  Before dfsan_init maps the shadow it is all zero.
+  if (shadow_inited && allocator.FromPrimary(allocated))
+    dfsan_set_label(0, allocated, size);
+  if (zeroise)
+    internal_memset(allocated, 0, size);
+  return allocated;
+}
+
+void dfsan_free(void *p) {
+  if (!p)
+    return;
+  EnsureAllocatorInited();
+  // Memory from the loader's early allocator is not ours to release.
+  if (!allocator.PointerIsMine(p))
+    return;
+  Metadata *meta = reinterpret_cast<Metadata *>(allocator.GetMetaData(p));
+  meta->requested_size = 0;
+  allocator.Deallocate(GetAllocatorCache(), p);
+}
+
+static void *DfsanReallocate(void *old_p, uptr new_size, uptr alignment) {
+  Metadata *meta = reinterpret_cast<Metadata *>(allocator.GetMetaData(old_p));
+  uptr old_size = meta->requested_size;
+  uptr actually_allocated_size = allocator.GetActuallyAllocatedSize(old_p);
+  if (new_size <= actually_allocated_size) {
+    // We are not reallocating here; the grown tail may hold stale labels.
+    meta->requested_size = new_size;
+    if (new_size > old_size && shadow_inited)
+      dfsan_set_label(0, (char *) old_p + old_size, new_size - old_size);
+    return old_p;
+  }
+  uptr copy_size = Min(new_size, old_size);
+  void *new_p = DfsanAllocate(new_size, alignment, false);
+  if (new_p) {
+    if (shadow_inited)
+      CopyShadow(new_p, old_p, copy_size);
+    internal_memcpy(new_p, old_p, copy_size);
+    dfsan_free(old_p);
+  }
+  return new_p;
+}
+
+void *dfsan_malloc(uptr size) {
+  return SetErrnoOnNull(DfsanAllocate(size, sizeof(u64), false));
+}
+
+void *dfsan_calloc(uptr nmemb, uptr size) {
+  if (UNLIKELY(CheckForCallocOverflow(size, nmemb))) {
+    SetErrnoToENOMEM();
+    return ReportAllocationFailure("calloc parameters overflow", size);
+  }
+  return SetErrnoOnNull(DfsanAllocate(nmemb * size, sizeof(u64), true));
+}
+
+void *dfsan_realloc(void *ptr, uptr size) {
+  EnsureAllocatorInited();
+  if (!ptr)
+    return dfsan_malloc(size);
+  // The size of a block from another allocator is unknown, so its contents
+  // cannot be carried over.
+  if (UNLIKELY(!allocator.PointerIsMine(ptr))) {
+    Report("FATAL: DataFlowSanitizer: realloc of %p, which was not allocated "
+           "by the DataFlowSanitizer allocator\n", ptr);
+    Die();
+  }
+  if (size == 0) {
+    dfsan_free(ptr);
+    return nullptr;
+  }
+  return SetErrnoOnNull(DfsanReallocate(ptr, size, sizeof(u64)));
+}
+
+void *dfsan_valloc(uptr size) {
+  return SetErrnoOnNull(DfsanAllocate(size, GetPageSizeCached(), false));
+}
+
+void *dfsan_pvalloc(uptr size) {
+  uptr PageSize = GetPageSizeCached();
+  if (UNLIKELY(CheckForPvallocOverflow(size, PageSize))) {
+    errno = errno_ENOMEM;
+    return ReportAllocationFailure("pvalloc parameters overflow", size);
+  }
+  // pvalloc(0) should allocate one page.
+  size = size ? RoundUpTo(size, PageSize) : PageSize;
+  return SetErrnoOnNull(DfsanAllocate(size, PageSize, false));
+}
+
+void *dfsan_aligned_alloc(uptr alignment, uptr size) {
+  if (UNLIKELY(!CheckAlignedAllocAlignmentAndSize(alignment, size))) {
+    errno = errno_EINVAL;
+    return ReportAllocationFailure("invalid aligned_alloc alignment", size);
+  }
+  return SetErrnoOnNull(DfsanAllocate(size, alignment, false));
+}
+
+void *dfsan_memalign(uptr alignment, uptr size) {
+  if (UNLIKELY(!IsPowerOfTwo(alignment))) {
+    errno = errno_EINVAL;
+    return ReportAllocationFailure("invalid allocation alignment", size);
+  }
+  return SetErrnoOnNull(DfsanAllocate(size, alignment, false));
+}
+
+int dfsan_posix_memalign(void **memptr, uptr alignment, uptr size) {
+  if (UNLIKELY(!CheckPosixMemalignAlignment(alignment))) {
+    ReportAllocationFailure("invalid posix_memalign alignment", size);
+    return errno_EINVAL;
+  }
+  void *ptr = DfsanAllocate(size, alignment, false);
+  if (UNLIKELY(!ptr))
+    return errno_ENOMEM;
+  CHECK(IsAligned((uptr)ptr, alignment));
+  *memptr = ptr;
+  return 0;
+}
+
+uptr dfsan_malloc_usable_size(const void *p) {
+  if (!p)
+    return 0;
+  EnsureAllocatorInited();
+  const void *beg = allocator.GetBlockBegin(p);
+  if (beg != p)
+    return 0;
+  Metadata *b = (Metadata *)allocator.GetMetaData(p);
+  return b->requested_size;
+}
+
+} // namespace __dfsan
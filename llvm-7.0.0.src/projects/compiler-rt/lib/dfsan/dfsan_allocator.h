@@ -0,0 +1,37 @@
+//===-- dfsan_allocator.h ---------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of DataFlowSanitizer.
+//
+// DataFlowSanitizer allocator.
+//===----------------------------------------------------------------------===//
+
+#ifndef DFSAN_ALLOCATOR_H
+#define DFSAN_ALLOCATOR_H
+
+#include "sanitizer_common/sanitizer_common.h"
+
+namespace __dfsan {
+
+void DfsanAllocatorInit();
+
+void *dfsan_malloc(uptr size);
+void *dfsan_calloc(uptr nmemb, uptr size);
+void *dfsan_realloc(void *ptr, uptr size);
+void *dfsan_memalign(uptr alignment, uptr size);
+void *dfsan_aligned_alloc(uptr alignment, uptr size);
+void *dfsan_valloc(uptr size);
+void *dfsan_pvalloc(uptr size);
+int dfsan_posix_memalign(void **memptr, uptr alignment, uptr size);
+void dfsan_free(void *ptr);
+uptr dfsan_malloc_usable_size(const void *ptr);
+
+} // namespace __dfsan
+
+#endif // DFSAN_ALLOCATOR_H
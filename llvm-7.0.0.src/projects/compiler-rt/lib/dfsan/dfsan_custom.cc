@@ -15,13 +15,17 @@
 #include "sanitizer_common/sanitizer_common.h"
 #include "sanitizer_common/sanitizer_internal_defs.h"
 #include "sanitizer_common/sanitizer_linux.h"
+#include "sanitizer_common/sanitizer_mutex.h"
 
 #include "dfsan/dfsan.h"
+#include "dfsan/dfsan_profile.h"
 
 #include <arpa/inet.h>
 #include <assert.h>
 #include <ctype.h>
 #include <dlfcn.h>
+#include <fcntl.h>
+#include <fnmatch.h>
 #include <link.h>
 #include <poll.h>
 #include <pthread.h>
@@ -230,7 +234,6 @@ SANITIZER_INTERFACE_ATTRIBUTE void *__dfsw_calloc(size_t nmemb, size_t size,
   if (nmemb_label) record_arg(ret_addr, 0, 0, nmemb_label, (float)nmemb, "CUSTOM");
   if (size_label) record_arg(ret_addr, 0, 1, size_label, (float)size, "CUSTOM");
   void *p = calloc(nmemb, size);
-  dfsan_set_label(0, p, nmemb * size);
   *ret_label = 0;
   return p;
 }
@@ -269,6 +272,258 @@ SANITIZER_INTERFACE_ATTRIBUTE void __dfsw_free(void* ptr,
 
 
 static dfsan_label i_label = dfsan_create_label("fread auto");
+
+// Input fields from FREAD_FIELDS=<offset>:<width>[:le|be][:u|s],... are
+// labeled as one variable each when a read returns all of their bytes.
+struct input_field {
+  long offset;
+  uptr width;
+  bool big_endian;
+  bool is_signed;
+  char desc[32];
+};
+
+static const uptr kMaxInputFields = 64;
+static input_field input_fields[kMaxInputFields];
+static uptr num_input_fields;
+
+static void parse_input_fields() {
+  static bool parsed;
+  if (parsed)
+    return;
+  parsed = true;
+  const char *s = getenv("FREAD_FIELDS");
+  while (s && *s) {
+    char *end;
+    long offset = strtol(s, &end, 10);
+    long width = *end == ':' ? strtol(end + 1, &end, 10) : 0;
+    if (width < 1 || width > 8 || offset < 0) {
+      Report("WARNING: DataFlowSanitizer: bad FREAD_FIELDS entry at '%s'\n", s);
+      return;
+    }
+    input_field f = {offset, (uptr)width, false, false, {}};
+    while (*end == ':') {
+      ++end;
+      if (!strncmp(end, "be", 2)) f.big_endian = true;
+      else if (!strncmp(end, "s", 1)) f.is_signed = true;
+      while (*end && *end != ':' && *end != ',') ++end;
+    }
+    internal_snprintf(f.desc, sizeof(f.desc), "field@%ld", offset);
+    if (num_input_fields == kMaxInputFields) {
+      Report("WARNING: DataFlowSanitizer: more than %zu FREAD_FIELDS\n",
+             kMaxInputFields);
+      return;
+    }
+    input_fields[num_input_fields++] = f;
+    s = *end == ',' ? end + 1 : end;
+  }
+}
+
+// Labels the fields that lie entirely within n bytes read from file offset
+// f_ind into buf.
+static void label_input_fields(void *buf, long f_ind, size_t n) {
+  parse_input_fields();
+  for (uptr i = 0; i < num_input_fields; ++i) {
+    const input_field &f = input_fields[i];
+    if (f.offset < f_ind || f.offset + (long)f.width > f_ind + (long)n) {
+      if (f.offset < f_ind + (long)n && f.offset + (long)f.width > f_ind)
+        Report("WARNING: DataFlowSanitizer: %s split across reads, not "
+               "labeled\n", f.desc);
+      continue;
+    }
+    dfsan_label_field((char *)buf + (f.offset - f_ind), f.width, f.big_endian,
+                      f.is_signed, f.desc);
+  }
+}
+// Input sources from FREAD_SOURCE=<pattern>[@<byte>],...  A pattern is a
+// glob matched against the path a file was opened with (against its last
+// component when the pattern has no '/'), fd:<n> for an inherited
+// descriptor, or - for stdin.  When FREAD_SOURCE is set only reads from
+// descriptors of a matching source are labeled.  Each source marks its own
+// byte (the @<byte> suffix, or FREAD_BYTE_IDX) with a base label of its own
+// named "<pattern>@<byte>", so bytes of several inputs can be swept in one
+// run without being mixed up.
+struct input_source {
+  char pattern[256];
+  int fd;     // for fd:<n> and -, otherwise -1
+  long byte;  // marked byte, or -1
+  dfsan_label label;
+  char desc[288];
+};
+
+static const uptr kMaxInputSources = 16;
+static input_source input_sources[kMaxInputSources];
+static uptr num_input_sources;
+static StaticSpinMutex input_sources_mu;
+
+// Source of each descriptor opened through open, openat or fopen, as an
+// index into input_sources plus one, or zero.
+static const int kMaxSourceFds = 4096;
+static u8 fd_sources[kMaxSourceFds];
+
+static long marked_byte() {
+  const char *val = getenv("FREAD_BYTE_IDX");
+  return val ? strtol(val, nullptr, 10) : -1;
+}
+
+static void parse_input_sources() {
+  static bool parsed;
+  if (parsed)
+    return;
+  parsed = true;
+  const char *s = getenv("FREAD_SOURCE");
+  while (s && *s) {
+    const char *end = internal_strchrnul(s, ',');
+    if (num_input_sources == kMaxInputSources) {
+      Report("WARNING: DataFlowSanitizer: more than %zu FREAD_SOURCE "
+             "entries\n", kMaxInputSources);
+      return;
+    }
+    input_source &src = input_sources[num_input_sources];
+    uptr len = Min<uptr>(end - s, sizeof(src.pattern) - 1);
+    internal_memcpy(src.pattern, s, len);
+    src.pattern[len] = '\0';
+    src.byte = marked_byte();
+    if (char *at = internal_strrchr(src.pattern, '@')) {
+      *at = '\0';
+      src.byte = strtol(at + 1, nullptr, 10);
+    }
+    src.fd = -1;
+    if (!internal_strcmp(src.pattern, "-"))
+      src.fd = 0;
+    else if (!internal_strncmp(src.pattern, "fd:", 3))
+      src.fd = strtol(src.pattern + 3, nullptr, 10);
+    internal_snprintf(src.desc, sizeof(src.desc), "%s@%ld", src.pattern,
+                      src.byte);
+    ++num_input_sources;
+    s = *end ? end + 1 : end;
+  }
+}
+
+// Records which source, if any, a newly opened path belongs to.
+static void track_input_fd(int fd, const char *path) {
+  if (fd < 0 || fd >= kMaxSourceFds)
+    return;
+  parse_input_sources();
+  fd_sources[fd] = 0;
+  if (!path)
+    return;
+  const char *base = internal_strrchr(path, '/');
+  base = base ? base + 1 : path;
+  for (uptr i = 0; i < num_input_sources; ++i) {
+    const input_source &src = input_sources[i];
+    if (src.fd >= 0)
+      continue;
+    const char *name = internal_strchr(src.pattern, '/') ? path : base;
+    if (fnmatch(src.pattern, name, 0) == 0) {
+      fd_sources[fd] = i + 1;
+      return;
+    }
+  }
+}
+
+static void untrack_input_fd(int fd) {
+  if (fd >= 0 && fd < kMaxSourceFds)
+    fd_sources[fd] = 0;
+}
+
+static input_source *source_for_fd(int fd) {
+  if (fd >= 0 && fd < kMaxSourceFds && fd_sources[fd])
+    return &input_sources[fd_sources[fd] - 1];
+  for (uptr i = 0; i < num_input_sources; ++i)
+    if (input_sources[i].fd == fd)
+      return &input_sources[i];
+  return nullptr;
+}
+
+// Labels the input read of n bytes from file offset f_ind of fd into buf,
+// whose shadow the caller has cleared: the marked byte, then any
+// FREAD_FIELDS.
+static void label_input(int fd, void *buf, long f_ind, size_t n) {
+  if (path_log_enabled && n > 0)
+    record_input_read(f_ind, n);
+  parse_input_sources();
+  long mark_ind = marked_byte();
+  dfsan_label label = i_label;
+  if (num_input_sources) {
+    input_source *src = source_for_fd(fd);
+    if (!src)
+      return;
+    mark_ind = src->byte;
+    if (f_ind <= mark_ind && mark_ind < f_ind + (long) n) {
+      SpinMutexLock l(&input_sources_mu);
+      if (!src->label)
+        src->label = dfsan_create_label(src->desc);
+      label = src->label;
+    }
+  }
+  if (mark_ind >= 0 && f_ind <= mark_ind && mark_ind < f_ind + (long) n) {
+    Report("dfsan_fread marked byte number %ld\n", mark_ind);
+    dfsan_set_label(label, (char *) buf + (mark_ind - f_ind), 1);
+  }
+  label_input_fields(buf, f_ind, n);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE int
+__dfsw_open(const char *path, int oflags, dfsan_label path_label,
+            dfsan_label flag_label, dfsan_label *va_labels,
+            dfsan_label *ret_label, ...) {
+  // The mode is only passed along with O_CREAT or O_TMPFILE.
+  int mode = 0;
+  if (oflags & (O_CREAT | O_TMPFILE)) {
+    va_list args;
+    va_start(args, ret_label);
+    mode = va_arg(args, int);
+    va_end(args);
+  }
+  int fd = open(path, oflags, mode);
+  track_input_fd(fd, path);
+  *ret_label = 0;
+  return fd;
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE int
+__dfsw_openat(int dirfd, const char *path, int oflags, dfsan_label dirfd_label,
+              dfsan_label path_label, dfsan_label flag_label,
+              dfsan_label *va_labels, dfsan_label *ret_label, ...) {
+  int mode = 0;
+  if (oflags & (O_CREAT | O_TMPFILE)) {
+    va_list args;
+    va_start(args, ret_label);
+    mode = va_arg(args, int);
+    va_end(args);
+  }
+  int fd = openat(dirfd, path, oflags, mode);
+  track_input_fd(fd, path);
+  *ret_label = 0;
+  return fd;
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE FILE *
+__dfsw_fopen(const char *path, const char *mode, dfsan_label path_label,
+             dfsan_label mode_label, dfsan_label *ret_label) {
+  FILE *f = fopen(path, mode);
+  if (f)
+    track_input_fd(fileno(f), path);
+  *ret_label = 0;
+  return f;
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE int __dfsw_close(int fd, dfsan_label fd_label,
+                                               dfsan_label *ret_label) {
+  untrack_input_fd(fd);
+  *ret_label = 0;
+  return close(fd);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE int __dfsw_fclose(FILE *stream,
+                                                dfsan_label stream_label,
+                                                dfsan_label *ret_label) {
+  untrack_input_fd(fileno(stream));
+  *ret_label = 0;
+  return fclose(stream);
+}
+
 SANITIZER_INTERFACE_ATTRIBUTE size_t __dfsw_fread(void * ptr, size_t size, size_t nitems,
                                                FILE * stream,
                                                dfsan_label ptr_label,
@@ -277,22 +532,11 @@ SANITIZER_INTERFACE_ATTRIBUTE size_t __dfsw_fread(void * ptr, size_t size, size_
                                                dfsan_label stream_label,
                                                dfsan_label *ret_label) {
 
-  char * val = getenv("FREAD_BYTE_IDX");
   long f_ind = ftell(stream);
   size_t res = fread(ptr, size, nitems, stream);
 
-  if (!val) {
-      dfsan_set_label(0, ptr, size*nitems);
-  } else { 
-      char *endptr;
-      long mark_ind = strtol(val, &endptr, 10);
-      if (f_ind <= mark_ind && mark_ind < f_ind + (long ) res ) {
-          Report("dfsan_fread marked byte number %d\n", mark_ind);
-          dfsan_set_label(i_label, &(((char *) ptr)[mark_ind - f_ind]), 1);
-      } else {
-          dfsan_set_label(0, ptr, size*nitems);
-      }
-  }
+  dfsan_set_label(0, ptr, size*nitems);
+  label_input(fileno(stream), ptr, f_ind, res * size);
   return res;
 }
 
@@ -352,9 +596,8 @@ __dfsw_strlen(const char *s, dfsan_label s_label, dfsan_label *ret_label) {
 void *dfsan_memcpy(void *dest,
         const void *src,
         unsigned long n) {
-  dfsan_label *sdest = shadow_for(dest);
-  const dfsan_label *ssrc = shadow_for(src);
-  internal_memcpy((void *)sdest, (const void *)ssrc, n * sizeof(dfsan_label));
+  DFSAN_PROFILE_SCOPE(kProfileShadowCopy);
+  CopyShadow(dest, src, n);
   return internal_memcpy(dest, src, n);
 }
 
@@ -439,25 +682,11 @@ __dfsw_read(int fd, void *buf, size_t count,
              dfsan_label count_label,
              dfsan_label *ret_label) {
 
-  char * val = getenv("FREAD_BYTE_IDX");
   long f_ind = (long) lseek(fd, 0, SEEK_CUR);
   ssize_t ret = read(fd, buf, count);
-  if (!val) {
-
-      if (ret > 0) {
-              dfsan_set_label(0, buf, ret);
-      }
-  } else { 
-      if (ret > 0) {
-          char *endptr;
-          long mark_ind = strtol(val, &endptr, 10);
-          if (f_ind <= mark_ind && mark_ind < f_ind + (long ) ret ) {
-              Report("dfsan_fread marked byte number %d\n", mark_ind);
-              dfsan_set_label(i_label, &(((char *) buf )[mark_ind - f_ind]), 1);
-          } else {
-              dfsan_set_label(0, buf, ret);
-          }
-      }
+  if (ret > 0) {
+    dfsan_set_label(0, buf, ret);
+    label_input(fd, buf, f_ind, ret);
   }
 
   *ret_label = 0;
@@ -651,8 +880,7 @@ char *__dfsw_strcpy(char *dest, const char *src, dfsan_label dst_label,
                     dfsan_label src_label, dfsan_label *ret_label) {
   char *ret = strcpy(dest, src);
   if (ret) {
-    internal_memcpy(shadow_for(dest), shadow_for(src),
-                    sizeof(dfsan_label) * (strlen(src) + 1));
+    CopyShadow(dest, src, strlen(src) + 1);
   }
   *ret_label = dst_label;
   return ret;
@@ -1003,7 +1231,46 @@ __dfsw_write(int fd, const void *buf, size_t count,
   }
 
   *ret_label = 0;
-  return write(fd, buf, count);
+  ssize_t ret = write(fd, buf, count);
+  if (ret > 0 && output_sink_enabled())
+    record_output(fd, buf, ret, -1);
+  return ret;
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE ssize_t
+__dfsw_pwrite(int fd, const void *buf, size_t count, off_t offset,
+              dfsan_label fd_label, dfsan_label buf_label,
+              dfsan_label count_label, dfsan_label offset_label,
+              dfsan_label *ret_label) {
+  ssize_t ret = pwrite(fd, buf, count, offset);
+  if (ret > 0 && output_sink_enabled())
+    record_output(fd, buf, ret, offset);
+  *ret_label = 0;
+  return ret;
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE size_t
+__dfsw_fwrite(const void *ptr, size_t size, size_t nitems, FILE *stream,
+              dfsan_label ptr_label, dfsan_label size_label,
+              dfsan_label nitems_label, dfsan_label stream_label,
+              dfsan_label *ret_label) {
+  size_t ret = fwrite(ptr, size, nitems, stream);
+  if (ret > 0 && output_sink_enabled())
+    record_output(fileno(stream), ptr, ret * size, -1);
+  *ret_label = 0;
+  return ret;
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE ssize_t
+__dfsw_send(int sockfd, const void *buf, size_t len, int flags,
+            dfsan_label sockfd_label, dfsan_label buf_label,
+            dfsan_label len_label, dfsan_label flags_label,
+            dfsan_label *ret_label) {
+  ssize_t ret = send(sockfd, buf, len, flags);
+  if (ret > 0 && output_sink_enabled())
+    record_output(sockfd, buf, ret, -1);
+  *ret_label = 0;
+  return ret;
 }
 } // namespace __dfsan
 
@@ -1183,9 +1450,8 @@ static int format_buffer(char *str, size_t size, const char *fmt,
           char *arg = va_arg(ap, char *);
           retval = formatter.format(arg);
           va_labels++;
-          internal_memcpy(shadow_for(formatter.str_cur()), shadow_for(arg),
-                          sizeof(dfsan_label) *
-                              formatter.num_written_bytes(retval));
+          CopyShadow(formatter.str_cur(), arg,
+                     formatter.num_written_bytes(retval));
           end_fmt = true;
           break;
         }
@@ -1269,18 +1535,42 @@ SANITIZER_INTERFACE_WEAK_DEF(void, __sanitizer_cov_trace_pc_guard_init, u32 *,
 SANITIZER_INTERFACE_WEAK_DEF(void, __sanitizer_cov_pcs_init, void) {}
 SANITIZER_INTERFACE_WEAK_DEF(void, __sanitizer_cov_trace_pc_indir, void) {}
 
+// The trace-cmp hooks record each comparison with a labeled operand, keyed
+// by the PC of the hook call.  They stay weak so that a harness can still
+// provide its own.
+#define DFSAN_TRACE_CMP(Name, Kind, Type)                                      \
+  SANITIZER_INTERFACE_WEAK_DEF(void, Name, Type a, Type b, dfsan_label a_label,\
+                               dfsan_label b_label) {                          \
+    if (a_label || b_label)                                                    \
+      record_cmp(GET_CALLER_PC(), Kind, sizeof(Type), a, b, a_label, b_label); \
+  }
+
 SANITIZER_INTERFACE_WEAK_DEF(void, __dfsw___sanitizer_cov_trace_cmp, void) {}
-SANITIZER_INTERFACE_WEAK_DEF(void, __dfsw___sanitizer_cov_trace_cmp1, void) {}
-SANITIZER_INTERFACE_WEAK_DEF(void, __dfsw___sanitizer_cov_trace_cmp2, void) {}
-SANITIZER_INTERFACE_WEAK_DEF(void, __dfsw___sanitizer_cov_trace_cmp4, void) {}
-SANITIZER_INTERFACE_WEAK_DEF(void, __dfsw___sanitizer_cov_trace_cmp8, void) {}
-SANITIZER_INTERFACE_WEAK_DEF(void, __dfsw___sanitizer_cov_trace_const_cmp1,
-                             void) {}
-SANITIZER_INTERFACE_WEAK_DEF(void, __dfsw___sanitizer_cov_trace_const_cmp2,
-                             void) {}
-SANITIZER_INTERFACE_WEAK_DEF(void, __dfsw___sanitizer_cov_trace_const_cmp4,
-                             void) {}
-SANITIZER_INTERFACE_WEAK_DEF(void, __dfsw___sanitizer_cov_trace_const_cmp8,
-                             void) {}
-SANITIZER_INTERFACE_WEAK_DEF(void, __dfsw___sanitizer_cov_trace_switch, void) {}
+DFSAN_TRACE_CMP(__dfsw___sanitizer_cov_trace_cmp1, kCmpTrace, u8)
+DFSAN_TRACE_CMP(__dfsw___sanitizer_cov_trace_cmp2, kCmpTrace, u16)
+DFSAN_TRACE_CMP(__dfsw___sanitizer_cov_trace_cmp4, kCmpTrace, u32)
+DFSAN_TRACE_CMP(__dfsw___sanitizer_cov_trace_cmp8, kCmpTrace, u64)
+DFSAN_TRACE_CMP(__dfsw___sanitizer_cov_trace_const_cmp1, kCmpConst, u8)
+DFSAN_TRACE_CMP(__dfsw___sanitizer_cov_trace_const_cmp2, kCmpConst, u16)
+DFSAN_TRACE_CMP(__dfsw___sanitizer_cov_trace_const_cmp4, kCmpConst, u32)
+DFSAN_TRACE_CMP(__dfsw___sanitizer_cov_trace_const_cmp8, kCmpConst, u64)
+
+// One record per dispatch on a labeled value: Cases is {count, bit width,
+// case values...}, and the value is paired with the nearest case so the
+// record says how far the input is from taking another arm.
+SANITIZER_INTERFACE_WEAK_DEF(void, __dfsw___sanitizer_cov_trace_switch,
+                             u64 val, u64 *cases, dfsan_label val_label,
+                             dfsan_label cases_label) {
+  if (!val_label || cases[0] == 0)
+    return;
+  u64 nearest = cases[2];
+  for (u64 i = 1; i < cases[0]; ++i) {
+    u64 c = cases[2 + i];
+    if ((c > val ? c - val : val - c) < (nearest > val ? nearest - val
+                                                       : val - nearest))
+      nearest = c;
+  }
+  record_cmp(GET_CALLER_PC(), kCmpSwitch, cases[1] / 8, val, nearest,
+             val_label, 0);
+}
 }  // extern "C"
@@ -13,9 +13,11 @@
 //===----------------------------------------------------------------------===//
 
 #include "dfsan/dfsan.h"
+#include "dfsan/dfsan_allocator.h"
 #include "interception/interception.h"
 #include "sanitizer_common/sanitizer_common.h"
 
+using namespace __dfsan;
 using namespace __sanitizer;
 
 INTERCEPTOR(void *, mmap, void *addr, SIZE_T length, int prot, int flags,
@@ -34,6 +36,53 @@ INTERCEPTOR(void *, mmap64, void *addr, SIZE_T length, int prot, int flags,
   return res;
 }
 
+// The heap is served by the dfsan allocator so that recycled chunks do not
+// carry stale labels.  None of these need the real functions, so they are
+// usable before the interceptors are installed.
+INTERCEPTOR(void *, malloc, SIZE_T size) {
+  return dfsan_malloc(size);
+}
+
+INTERCEPTOR(void *, calloc, SIZE_T nmemb, SIZE_T size) {
+  return dfsan_calloc(nmemb, size);
+}
+
+INTERCEPTOR(void *, realloc, void *ptr, SIZE_T size) {
+  return dfsan_realloc(ptr, size);
+}
+
+INTERCEPTOR(void, free, void *ptr) {
+  dfsan_free(ptr);
+}
+
+INTERCEPTOR(void, cfree, void *ptr) {
+  dfsan_free(ptr);
+}
+
+INTERCEPTOR(int, posix_memalign, void **memptr, SIZE_T alignment, SIZE_T size) {
+  return dfsan_posix_memalign(memptr, alignment, size);
+}
+
+INTERCEPTOR(void *, memalign, SIZE_T alignment, SIZE_T size) {
+  return dfsan_memalign(alignment, size);
+}
+
+INTERCEPTOR(void *, aligned_alloc, SIZE_T alignment, SIZE_T size) {
+  return dfsan_aligned_alloc(alignment, size);
+}
+
+INTERCEPTOR(void *, valloc, SIZE_T size) {
+  return dfsan_valloc(size);
+}
+
+INTERCEPTOR(void *, pvalloc, SIZE_T size) {
+  return dfsan_pvalloc(size);
+}
+
+INTERCEPTOR(uptr, malloc_usable_size, void *ptr) {
+  return dfsan_malloc_usable_size(ptr);
+}
+
 namespace __dfsan {
 void InitializeInterceptors() {
   static int inited = 0;
@@ -41,6 +90,17 @@ void InitializeInterceptors() {
 
   INTERCEPT_FUNCTION(mmap);
   INTERCEPT_FUNCTION(mmap64);
+  INTERCEPT_FUNCTION(malloc);
+  INTERCEPT_FUNCTION(calloc);
+  INTERCEPT_FUNCTION(realloc);
+  INTERCEPT_FUNCTION(free);
+  INTERCEPT_FUNCTION(cfree);
+  INTERCEPT_FUNCTION(posix_memalign);
+  INTERCEPT_FUNCTION(memalign);
+  INTERCEPT_FUNCTION(aligned_alloc);
+  INTERCEPT_FUNCTION(valloc);
+  INTERCEPT_FUNCTION(pvalloc);
+  INTERCEPT_FUNCTION(malloc_usable_size);
   inited = 1;
 }
 }  // namespace __dfsan
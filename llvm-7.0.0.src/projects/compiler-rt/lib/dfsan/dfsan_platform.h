@@ -111,6 +111,37 @@ uptr ShadowMask() {
   return MappingArchImpl<MAPPING_SHADOW_MASK>();
 }
 
+// Two-level shadow layout.  Application memory (after masking with
+// ShadowMask()) is split into chunks of kShadowChunkSize bytes.  The start of
+// the shadow region holds a directory with one chunk pointer per application
+// chunk, followed by a shared zero chunk, a scratch chunk and the arena from
+// which dense chunks are allocated.  These constants must match
+// DataFlowSanitizer.cpp.
+static const uptr kShadowChunkShift = 16;
+static const uptr kShadowChunkSize = 1ULL << kShadowChunkShift;
+static const uptr kShadowChunkBytes = kShadowChunkSize * 2;
+static const uptr kShadowDirSize = (1ULL << (44 - kShadowChunkShift)) * 8;
+
+ALWAYS_INLINE
+uptr ShadowDirAddr() {
+  return ShadowAddr();
+}
+
+ALWAYS_INLINE
+uptr ShadowZeroChunkAddr() {
+  return ShadowDirAddr() + kShadowDirSize;
+}
+
+ALWAYS_INLINE
+uptr ShadowScratchChunkAddr() {
+  return ShadowZeroChunkAddr() + kShadowChunkBytes;
+}
+
+ALWAYS_INLINE
+uptr ShadowChunkArenaAddr() {
+  return ShadowScratchChunkAddr() + kShadowChunkBytes;
+}
+
 }  // namespace __dfsan
 
 #endif
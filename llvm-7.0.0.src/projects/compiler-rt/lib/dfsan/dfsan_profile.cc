@@ -0,0 +1,196 @@
+//===-- dfsan_profile.cc --------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of DataFlowSanitizer.
+//
+// Per-caller accounting of cycles spent in runtime entry points.  See
+// dfsan_profile.h.
+//===----------------------------------------------------------------------===//
+
+#include "dfsan/dfsan.h"
+#include "dfsan/dfsan_profile.h"
+
+#include "sanitizer_common/sanitizer_atomic.h"
+#include "sanitizer_common/sanitizer_common.h"
+#include "sanitizer_common/sanitizer_file.h"
+#include "sanitizer_common/sanitizer_libc.h"
+#include "sanitizer_common/sanitizer_symbolizer.h"
+
+using namespace __sanitizer;
+
+namespace __dfsan {
+
+bool profile_overhead;
+THREADLOCAL uptr profile_caller_pc;
+THREADLOCAL u64 profile_child_cycles;
+THREADLOCAL uptr profile_depth;
+
+static const char *const kProfileKindNames[kNumProfileKinds] = {
+  "union", "branch", "memcpy", "shadow_copy", "set_label", "record"
+};
+
+// One slot per distinct caller PC, inserted with a CAS on pc.  Instrumented
+// code has at most a few call sites per instruction, so 64K slots is plenty;
+// calls from sites that do not fit are counted in dropped_calls.
+struct profile_site {
+  atomic_uintptr_t pc;
+  atomic_uint64_t calls[kNumProfileKinds];
+  atomic_uint64_t cycles[kNumProfileKinds];
+};
+
+static const uptr kProfileSites = 1 << 16;
+static profile_site *profile_sites;
+static atomic_uint64_t dropped_calls;
+
+void InitializeProfile() {
+  profile_overhead = flags().profile_overhead;
+  if (!profile_overhead)
+    return;
+  profile_sites = (profile_site *)MmapNoReserveOrDie(
+      sizeof(profile_site) * kProfileSites, "dfsan profile sites");
+}
+
+static profile_site *LookupSite(uptr pc) {
+  uptr h = (pc >> 2) * 0x9E3779B97F4A7C15ULL;
+  for (uptr probe = 0; probe < 64; ++probe) {
+    profile_site *s = &profile_sites[(h + probe) & (kProfileSites - 1)];
+    uptr cur = atomic_load(&s->pc, memory_order_acquire);
+    if (cur == pc)
+      return s;
+    if (cur == 0) {
+      if (atomic_compare_exchange_strong(&s->pc, &cur, pc,
+                                         memory_order_acq_rel))
+        return s;
+      if (cur == pc)
+        return s;
+    }
+  }
+  return nullptr;
+}
+
+void ProfileRecord(ProfileKind kind, uptr pc, u64 cycles) {
+  profile_site *s = LookupSite(pc);
+  if (!s) {
+    atomic_fetch_add(&dropped_calls, 1, memory_order_relaxed);
+    return;
+  }
+  atomic_fetch_add(&s->calls[kind], 1, memory_order_relaxed);
+  atomic_fetch_add(&s->cycles[kind], cycles, memory_order_relaxed);
+}
+
+void ResetProfile() {
+  if (!profile_overhead)
+    return;
+  ReleaseMemoryPagesToOS((uptr)profile_sites,
+                         (uptr)(profile_sites + kProfileSites));
+  atomic_store(&dropped_calls, 0, memory_order_relaxed);
+}
+
+// A caller PC after symbolization.  Sites are grouped by function name, and
+// the hottest site of each function is reported as its location.
+struct profile_row {
+  const char *function;
+  const char *file;
+  int line;
+  u64 calls;
+  u64 cycles[kNumProfileKinds];
+  u64 total;
+};
+
+static void WriteProfile(fd_t fd, InternalMmapVector<profile_row> &rows) {
+  InternalScopedString line(1024);
+  line.append("rank,function,location,calls,cycles");
+  for (uptr k = 0; k < kNumProfileKinds; ++k)
+    line.append(",%s_cycles", kProfileKindNames[k]);
+  line.append("\n");
+  WriteToFile(fd, line.data(), line.length());
+
+  for (uptr i = 0; i < rows.size(); ++i) {
+    const profile_row &r = rows[i];
+    line.clear();
+    line.append("%zu,%s,%s:%d,%llu,%llu", i + 1, r.function, r.file, r.line,
+                r.calls, r.total);
+    for (uptr k = 0; k < kNumProfileKinds; ++k)
+      line.append(",%llu", r.cycles[k]);
+    line.append("\n");
+    WriteToFile(fd, line.data(), line.length());
+  }
+}
+
+void DumpProfile() {
+  if (!profile_overhead || internal_strcmp(flags().profile_logfile, "") == 0)
+    return;
+
+  InternalMmapVector<profile_row> sites;
+  Symbolizer *symbolizer = Symbolizer::GetOrInit();
+  for (uptr i = 0; i < kProfileSites; ++i) {
+    uptr pc = atomic_load(&profile_sites[i].pc, memory_order_relaxed);
+    if (!pc)
+      continue;
+    profile_row r;
+    internal_memset(&r, 0, sizeof(r));
+    for (uptr k = 0; k < kNumProfileKinds; ++k) {
+      r.calls += atomic_load(&profile_sites[i].calls[k], memory_order_relaxed);
+      r.cycles[k] =
+          atomic_load(&profile_sites[i].cycles[k], memory_order_relaxed);
+      r.total += r.cycles[k];
+    }
+    // The return address points after the call; step back into it so the
+    // line is that of the instrumented instruction.
+    SymbolizedStack *frame = symbolizer->SymbolizePC(pc - 1);
+    const AddressInfo &info = frame->info;
+    r.function = internal_strdup(info.function ? info.function : "<unknown>");
+    r.file = internal_strdup(info.file ? info.file : "<unknown>");
+    r.line = info.line;
+    frame->ClearAll();
+    sites.push_back(r);
+  }
+
+  Sort(sites.data(), sites.size(),
+       [](const profile_row &a, const profile_row &b) {
+         int c = internal_strcmp(a.function, b.function);
+         return c < 0 || (c == 0 && a.total > b.total);
+       });
+
+  // Sites of one function are now adjacent with the hottest first.
+  InternalMmapVector<profile_row> rows;
+  for (uptr i = 0; i < sites.size(); ++i) {
+    if (rows.empty() ||
+        internal_strcmp(rows.back().function, sites[i].function) != 0) {
+      rows.push_back(sites[i]);
+      continue;
+    }
+    profile_row &r = rows.back();
+    r.calls += sites[i].calls;
+    r.total += sites[i].total;
+    for (uptr k = 0; k < kNumProfileKinds; ++k)
+      r.cycles[k] += sites[i].cycles[k];
+  }
+
+  Sort(rows.data(), rows.size(),
+       [](const profile_row &a, const profile_row &b) {
+         return a.total > b.total;
+       });
+
+  fd_t fd = OpenLogFile(flags().profile_logfile);
+  if (fd == kInvalidFd) {
+    Report("WARNING: DataFlowSanitizer: unable to open output file %s\n",
+           flags().profile_logfile);
+    return;
+  }
+  WriteProfile(fd, rows);
+  CloseFile(fd);
+
+  u64 dropped = atomic_load(&dropped_calls, memory_order_relaxed);
+  if (dropped)
+    Report("WARNING: DataFlowSanitizer: %llu profiled calls had no site slot\n",
+           dropped);
+}
+
+}  // namespace __dfsan
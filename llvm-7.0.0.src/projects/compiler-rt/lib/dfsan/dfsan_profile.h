@@ -0,0 +1,95 @@
+//===-- dfsan_profile.h -----------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of DataFlowSanitizer.
+//
+// Overhead profiler for the runtime entry points called by instrumented code.
+// Enabled with DFSAN_OPTIONS=profile_overhead=1.  Each entry point opens a
+// ProfileScope that reads the XRay TSC on entry and exit and charges the
+// cycles to the instrumented caller's PC; nested scopes (e.g. record_arg
+// inside a union) are charged to the outermost caller and only their own
+// cycles are counted.  At exit the PCs are symbolized and a per-function
+// report, ranked by cycles, is written to profile_logfile.
+//===----------------------------------------------------------------------===//
+
+#ifndef DFSAN_PROFILE_H
+#define DFSAN_PROFILE_H
+
+#include "sanitizer_common/sanitizer_internal_defs.h"
+
+#include <stdint.h>  // xray_tsc.h uses uint64_t before including it.
+#include "xray/xray_tsc.h"
+
+namespace __dfsan {
+
+enum ProfileKind {
+  kProfileUnion,
+  kProfileBranch,
+  kProfileMemcpy,
+  kProfileShadowCopy,
+  kProfileSetLabel,
+  kProfileRecord,
+  kNumProfileKinds
+};
+
+extern bool profile_overhead;
+extern THREADLOCAL __sanitizer::uptr profile_caller_pc;
+extern THREADLOCAL __sanitizer::u64 profile_child_cycles;
+extern THREADLOCAL __sanitizer::uptr profile_depth;
+
+void InitializeProfile();
+void ProfileRecord(ProfileKind kind, __sanitizer::uptr pc,
+                   __sanitizer::u64 cycles);
+void DumpProfile();
+
+// Drops the counts inherited from the parent in a forked child.
+void ResetProfile();
+
+class ProfileScope {
+ public:
+  ProfileScope(ProfileKind kind, __sanitizer::uptr pc) : active_(false) {
+    if (LIKELY(!profile_overhead))
+      return;
+    active_ = true;
+    kind_ = kind;
+    if (profile_depth++ == 0)
+      profile_caller_pc = pc;
+    saved_child_cycles_ = profile_child_cycles;
+    profile_child_cycles = 0;
+    __sanitizer::u8 cpu;
+    start_ = __xray::readTSC(cpu);
+  }
+
+  ~ProfileScope() {
+    if (LIKELY(!active_))
+      return;
+    __sanitizer::u8 cpu;
+    __sanitizer::u64 total = __xray::readTSC(cpu) - start_;
+    __sanitizer::u64 self = total - profile_child_cycles;
+    profile_child_cycles = saved_child_cycles_ + total;
+    ProfileRecord(kind_, profile_caller_pc, self);
+    --profile_depth;
+  }
+
+ private:
+  bool active_;
+  ProfileKind kind_;
+  __sanitizer::u64 start_;
+  __sanitizer::u64 saved_child_cycles_;
+};
+
+}  // namespace __dfsan
+
+#define DFSAN_PROFILE_SCOPE(kind) DFSAN_PROFILE_SCOPE_PC(kind, GET_CALLER_PC())
+
+// For entry points that are passed their instrumented caller's PC.
+#define DFSAN_PROFILE_SCOPE_PC(kind, pc)                                       \
+  __dfsan::ProfileScope dfsan_profile_scope(__dfsan::kind, pc)
+
+#endif  // DFSAN_PROFILE_H
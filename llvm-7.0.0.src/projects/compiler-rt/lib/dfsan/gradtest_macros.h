@@ -1,16 +1,48 @@
 
 #ifdef GR_MODE_PERF
-#define record_branch(file_id, br_id, lhs, rhs, lhs_v, rhs_v, cond, location)	{;}
+#define record_branch(file_id, br_id, lhs, rhs, lhs_v, rhs_v, cond, is_ptr, location, caller_pc)	{;}
 #define record_arg(file_id, inst_id, arg_ind, label, v, location)       	{;}
 #endif
 
 /* OPCODES defined in include/llvm/IR/Instruction.def */
 
-#define DFSAN_INT_UNION(FunctionName, Type, UnsignedDivType, SignedDivType, BitwiseType)      \
+/* FunctionName takes a union's static facts as arguments, FunctionName##_site
+   from its site descriptor.  The _pc variants are called by the
+   -dfsan-preserve-most stubs, which pass the instrumented call site as
+   caller_pc since the return address of the runtime is then the stub. */
+#define DFSAN_UNION_ENTRIES(FunctionName, Type, OpcodeType) \
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE \
+dfsan_label FunctionName(dfsan_label l1, dfsan_label l2 , Type x1, Type x2, uptr insnID, OpcodeType opcode, char* location) { \
+  DFSAN_PROFILE_SCOPE(kProfileUnion); \
+  return FunctionName##_entry(l1, l2, x1, x2, insnID, opcode, location, \
+                              (unsigned long)__builtin_return_address(0)); \
+} \
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE \
+dfsan_label FunctionName##_site(dfsan_label l1, dfsan_label l2, Type x1, Type x2, const dfsan_site *site) { \
+  DFSAN_PROFILE_SCOPE(kProfileUnion); \
+  return FunctionName##_entry(l1, l2, x1, x2, 0, site->op, site->location, \
+                              (unsigned long)__builtin_return_address(0)); \
+} \
 extern "C" SANITIZER_INTERFACE_ATTRIBUTE \
-dfsan_label FunctionName(dfsan_label l1, dfsan_label l2 , Type x1, Type x2, uptr insnID, u16 opcode, char* location) { \
+dfsan_label FunctionName##_pc(dfsan_label l1, dfsan_label l2 , Type x1, Type x2, uptr insnID, OpcodeType opcode, char* location, uptr caller_pc) { \
+  DFSAN_PROFILE_SCOPE_PC(kProfileUnion, caller_pc); \
+  return FunctionName##_entry(l1, l2, x1, x2, insnID, opcode, location, \
+                              caller_pc); \
+} \
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE \
+dfsan_label FunctionName##_site_pc(dfsan_label l1, dfsan_label l2, Type x1, Type x2, const dfsan_site *site, uptr caller_pc) { \
+  DFSAN_PROFILE_SCOPE_PC(kProfileUnion, caller_pc); \
+  return FunctionName##_entry(l1, l2, x1, x2, 0, site->op, site->location, \
+                              caller_pc); \
+}
+
+/* FunctionName##_eval computes the label of one operation, or with into set
+   the derivatives of a lazy label recorded by FunctionName (see
+   RecordLazyUnion in dfsan.cc).  ret_addr is the instrumented call site. */
+#define DFSAN_INT_UNION(FunctionName, Type, UnsignedDivType, SignedDivType, BitwiseType)      \
+static dfsan_label FunctionName##_eval(dfsan_label l1, dfsan_label l2 , Type x1, Type x2, uptr insnID, u16 opcode, char* location, unsigned long ret_addr, dfsan_label into) { \
   extern int gr_mode_perf; \
-  bool reuse_labels = flags().reuse_labels;\
+  bool reuse_labels = flags().reuse_labels && !into;\
   bool supported = true; \
   int nsamples = 1; \
   int f_val = -1; \
@@ -21,12 +53,12 @@ dfsan_label FunctionName(dfsan_label l1, dfsan_label l2 , Type x1, Type x2, uptr
     return 0; \
   } \
   if (l1 != 0) { \
-    neg_dx1 = __dfsan_label_info[l1].neg_dydx;\
-    pos_dx1 = __dfsan_label_info[l1].pos_dydx;\
+    neg_dx1 = label_neg_dydx(l1);\
+    pos_dx1 = label_pos_dydx(l1);\
   }\
   if (l2 != 0) {\
-    neg_dx2 = __dfsan_label_info[l2].neg_dydx;\
-    pos_dx2 = __dfsan_label_info[l2].pos_dydx;\
+    neg_dx2 = label_neg_dydx(l2);\
+    pos_dx2 = label_pos_dydx(l2);\
   }\
   if (reuse_labels) {\
     if (neg_dx1 == 0 && pos_dx1 == 0 && neg_dx2 == 0 && pos_dx2 == 0) {\
@@ -51,7 +83,6 @@ dfsan_label FunctionName(dfsan_label l1, dfsan_label l2 , Type x1, Type x2, uptr
       break;\
     case SDIV: \
       if (l2) {\
-        unsigned long ret_addr = (unsigned long)__builtin_return_address(0);\
         if (!gr_mode_perf) record_arg(ret_addr, 18, 0, l2, (float)x2, location);\
       }\
       if (x2 != 0) {\
@@ -66,7 +97,6 @@ dfsan_label FunctionName(dfsan_label l1, dfsan_label l2 , Type x1, Type x2, uptr
       break;\
     case UREM: { /*Urem*/\
       if (l2) {\
-        unsigned long ret_addr = (unsigned long)__builtin_return_address(0);\
         if (!gr_mode_perf) record_arg(ret_addr, 20, 0, l2, (float)x2, location);\
       }\
       nsamples = flags().samples;\
@@ -97,7 +127,6 @@ dfsan_label FunctionName(dfsan_label l1, dfsan_label l2 , Type x1, Type x2, uptr
     }\
     case SREM: { \
       if (l2) {\
-        unsigned long ret_addr = (unsigned long)__builtin_return_address(0);\
         if (!gr_mode_perf) record_arg(ret_addr, 21, 0, l2, (float)x2, location);\
       }\
       nsamples = flags().samples;\
@@ -253,22 +282,21 @@ dfsan_label FunctionName(dfsan_label l1, dfsan_label l2 , Type x1, Type x2, uptr
       return l2;\
     }\
   }\
-  dfsan_label label = atomic_fetch_add(&__dfsan_last_label, 1, memory_order_relaxed) + 1; \
-  dfsan_check_label(label); \
-  __dfsan_label_info[label].l1 = l1;\
-  __dfsan_label_info[label].l2 = l2;\
-  __dfsan_label_info[label].opcode = opcode;\
-  __dfsan_label_info[label].neg_dydx = neg_dydx;\
-  __dfsan_label_info[label].pos_dydx = pos_dydx;\
-  __dfsan_label_info[label].loc = location;\
-  __dfsan_label_info[label].f_val = f_val;\
+  dfsan_label label = into; \
+  if (!label) { \
+    label = atomic_fetch_add(&__dfsan_last_label, 1, memory_order_relaxed) + 1; \
+    dfsan_check_label(label); \
+  } \
+  __dfsan_label_prov[label] = {l1, l2, opcode, f_val};\
+  __dfsan_label_loc[label] = location;\
+  set_label_dydx(label, neg_dydx, pos_dydx);\
   if (DEBUG) {\
     char neg_dx1_str[32], neg_dx2_str[32];\
     char pos_dx1_str[32], pos_dx2_str[32];\
     char neg_dydx_str[32];\
     char pos_dydx_str[32];\
-    float2str(neg_dydx_str, __dfsan_label_info[label].neg_dydx, 32);\
-    float2str(pos_dydx_str, __dfsan_label_info[label].pos_dydx, 32);\
+    float2str(neg_dydx_str, label_neg_dydx(label), 32);\
+    float2str(pos_dydx_str, label_pos_dydx(label), 32);\
     float2str(neg_dx1_str, neg_dx1, 32);\
     float2str(pos_dx1_str, pos_dx1, 32);\
     float2str(neg_dx2_str, neg_dx2, 32);\
@@ -279,13 +307,28 @@ dfsan_label FunctionName(dfsan_label l1, dfsan_label l2 , Type x1, Type x2, uptr
   }\
   return label;\
 }\
+static void FunctionName##_lazy(dfsan_label into, u64 x1, u64 x2) { \
+  Type a, b; \
+  internal_memcpy(&a, &x1, sizeof(a)); \
+  internal_memcpy(&b, &x2, sizeof(b)); \
+  const dfsan_label_prov &prov = __dfsan_label_prov[into]; \
+  FunctionName##_eval(prov.l1, prov.l2, a, b, 0, prov.opcode, \
+                      (char *)__dfsan_label_loc[into], 0, into); \
+} \
+static inline dfsan_label FunctionName##_entry(dfsan_label l1, dfsan_label l2, Type x1, Type x2, uptr insnID, u16 opcode, const char* location, unsigned long ret_addr) { \
+  if (lazy_gradients && (l1 || l2) && !(l2 && UnionRecordsDivisor(opcode))) \
+    return RecordLazyUnion(l1, l2, &x1, &x2, sizeof(Type), FunctionName##_lazy, \
+                           opcode, location); \
+  return FunctionName##_eval(l1, l2, x1, x2, insnID, opcode, (char *)location, \
+                             ret_addr, 0); \
+} \
+DFSAN_UNION_ENTRIES(FunctionName, Type, u16)
 
 
 #define DFSAN_FLOAT_UNION(FunctionName, Type) \
-extern "C" SANITIZER_INTERFACE_ATTRIBUTE \
-dfsan_label FunctionName(dfsan_label l1, dfsan_label l2 , Type x1, Type x2, uptr insnID, uptr opcode, char* location) { \
+static dfsan_label FunctionName##_eval(dfsan_label l1, dfsan_label l2 , Type x1, Type x2, uptr insnID, uptr opcode, char* location, unsigned long ret_addr, dfsan_label into) { \
   extern int gr_mode_perf; \
-  bool reuse_labels = flags().reuse_labels;\
+  bool reuse_labels = flags().reuse_labels && !into;\
   const char* opName = opcodeNames[opcode]; \
   bool supported = true; \
   float neg_dx1 = 0, neg_dx2 = 0, pos_dx1 = 0, pos_dx2 = 0;\
@@ -294,12 +337,12 @@ dfsan_label FunctionName(dfsan_label l1, dfsan_label l2 , Type x1, Type x2, uptr
     return 0; \
   } \
   if (l1 != 0) { \
-    neg_dx1 = __dfsan_label_info[l1].neg_dydx; \
-    pos_dx1 = __dfsan_label_info[l1].pos_dydx; \
+    neg_dx1 = label_neg_dydx(l1); \
+    pos_dx1 = label_pos_dydx(l1); \
   } \
   if (l2 != 0) { \
-    neg_dx2 = __dfsan_label_info[l2].neg_dydx; \
-    pos_dx2 = __dfsan_label_info[l2].pos_dydx; \
+    neg_dx2 = label_neg_dydx(l2); \
+    pos_dx2 = label_pos_dydx(l2); \
   } \
   if (reuse_labels) {\
     if (neg_dx1 == 0 && pos_dx1 == 0 && neg_dx2 == 0 && pos_dx2 == 0) {\
@@ -324,7 +367,6 @@ dfsan_label FunctionName(dfsan_label l1, dfsan_label l2 , Type x1, Type x2, uptr
     }\
     case FDIV: { \
       if (l2) {\
-        unsigned long ret_addr = (unsigned long)__builtin_return_address(0);\
         if (!gr_mode_perf) record_arg(ret_addr, 19, 0, l2, (float)x2, location);\
       }\
       if (x2 != 0.0) { \
@@ -338,7 +380,6 @@ dfsan_label FunctionName(dfsan_label l1, dfsan_label l2 , Type x1, Type x2, uptr
     }\
     case FREM: { \
       if (l2) {\
-        unsigned long ret_addr = (unsigned long)__builtin_return_address(0);\
         if (!gr_mode_perf) record_arg(ret_addr, 22, 0, l2, (float)x2, location);\
       }\
       Type y = fmod(x1, x2);\
@@ -365,22 +406,22 @@ dfsan_label FunctionName(dfsan_label l1, dfsan_label l2 , Type x1, Type x2, uptr
       return l2;\
     }\
   }\
-  dfsan_label label = atomic_fetch_add(&__dfsan_last_label, 1, memory_order_relaxed) + 1; \
-  dfsan_check_label(label); \
-  __dfsan_label_info[label].l1 = l1; \
-  __dfsan_label_info[label].l2 = l2; \
-  __dfsan_label_info[label].opcode = opcode;\
-  __dfsan_label_info[label].neg_dydx = neg_dydx;\
-  __dfsan_label_info[label].pos_dydx = pos_dydx;\
-  __dfsan_label_info[label].loc = location;\
+  dfsan_label label = into; \
+  if (!label) { \
+    label = atomic_fetch_add(&__dfsan_last_label, 1, memory_order_relaxed) + 1; \
+    dfsan_check_label(label); \
+  } \
+  __dfsan_label_prov[label] = {l1, l2, (dfsan_label)opcode, 0};\
+  __dfsan_label_loc[label] = location;\
+  set_label_dydx(label, neg_dydx, pos_dydx);\
   if (DEBUG) {\
     char neg_dx1_str[32], neg_dx2_str[32];\
     char pos_dx1_str[32], pos_dx2_str[32];\
     char x1_str[32], x2_str[32];\
     char neg_dydx_str[32];\
     char pos_dydx_str[32];\
-    float2str(neg_dydx_str, __dfsan_label_info[label].neg_dydx, 32);\
-    float2str(pos_dydx_str, __dfsan_label_info[label].pos_dydx, 32);\
+    float2str(neg_dydx_str, label_neg_dydx(label), 32);\
+    float2str(pos_dydx_str, label_pos_dydx(label), 32);\
     float2str(neg_dx1_str, neg_dx1, 32);\
     float2str(pos_dx1_str, pos_dx1, 32);\
     float2str(neg_dx2_str, neg_dx2, 32);\
@@ -393,13 +434,69 @@ dfsan_label FunctionName(dfsan_label l1, dfsan_label l2 , Type x1, Type x2, uptr
   }\
   return label;\
 }\
+static void FunctionName##_lazy(dfsan_label into, u64 x1, u64 x2) { \
+  Type a, b; \
+  internal_memcpy(&a, &x1, sizeof(a)); \
+  internal_memcpy(&b, &x2, sizeof(b)); \
+  const dfsan_label_prov &prov = __dfsan_label_prov[into]; \
+  FunctionName##_eval(prov.l1, prov.l2, a, b, 0, prov.opcode, \
+                      (char *)__dfsan_label_loc[into], 0, into); \
+} \
+static inline dfsan_label FunctionName##_entry(dfsan_label l1, dfsan_label l2, Type x1, Type x2, uptr insnID, uptr opcode, const char* location, unsigned long ret_addr) { \
+  if (lazy_gradients && (l1 || l2) && !(l2 && UnionRecordsDivisor(opcode))) \
+    return RecordLazyUnion(l1, l2, &x1, &x2, sizeof(Type), FunctionName##_lazy, \
+                           opcode, location); \
+  return FunctionName##_eval(l1, l2, x1, x2, insnID, opcode, (char *)location, \
+                             ret_addr, 0); \
+} \
+DFSAN_UNION_ENTRIES(FunctionName, Type, uptr)
 
-#define DFSAN_INT_BRANCH(FunctionName, UType, SType, TypeName)      \
+/* FunctionName##_impl visits one branch.  caller_pc is the instrumented call
+   site and slot the branch's site slot, or 0.  FunctionName takes the
+   branch's static facts as arguments, FunctionName##_site from its site
+   descriptor; the _pc variants are called by the preserve_most stubs, as for
+   the unions. */
+#define DFSAN_BRANCH_ENTRIES(FunctionName, Type) \
 extern "C" SANITIZER_INTERFACE_ATTRIBUTE \
 void FunctionName(dfsan_label lhs, dfsan_label rhs, \
-                          UType lhs_v, UType rhs_v, bool cond, uint32_t pred, uint64_t file_id, uint64_t br_id, \
+                          Type lhs_v, Type rhs_v, bool cond, uint32_t pred, uint64_t file_id, uint64_t br_id, \
                           uint16_t is_ptr, const char* location) { \
+  DFSAN_PROFILE_SCOPE(kProfileBranch); \
+  FunctionName##_impl(lhs, rhs, lhs_v, rhs_v, cond, pred, file_id, br_id, \
+                      is_ptr, location, GET_CALLER_PC(), 0); \
+} \
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE \
+void FunctionName##_site(dfsan_label lhs, dfsan_label rhs, Type lhs_v, \
+                         Type rhs_v, bool cond, const dfsan_site *site) { \
+  DFSAN_PROFILE_SCOPE(kProfileBranch); \
+  FunctionName##_impl(lhs, rhs, lhs_v, rhs_v, cond, site->op, site->file_id, \
+                      site->inst_id, site->flags, site->location, \
+                      GET_CALLER_PC(), site->slot); \
+} \
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE \
+void FunctionName##_pc(dfsan_label lhs, dfsan_label rhs, \
+                          Type lhs_v, Type rhs_v, bool cond, uint32_t pred, uint64_t file_id, uint64_t br_id, \
+                          uint16_t is_ptr, const char* location, uptr caller_pc) { \
+  DFSAN_PROFILE_SCOPE_PC(kProfileBranch, caller_pc); \
+  FunctionName##_impl(lhs, rhs, lhs_v, rhs_v, cond, pred, file_id, br_id, \
+                      is_ptr, location, caller_pc, 0); \
+} \
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE \
+void FunctionName##_site_pc(dfsan_label lhs, dfsan_label rhs, Type lhs_v, \
+                            Type rhs_v, bool cond, const dfsan_site *site, \
+                            uptr caller_pc) { \
+  DFSAN_PROFILE_SCOPE_PC(kProfileBranch, caller_pc); \
+  FunctionName##_impl(lhs, rhs, lhs_v, rhs_v, cond, site->op, site->file_id, \
+                      site->inst_id, site->flags, site->location, \
+                      caller_pc, site->slot); \
+}
+
+#define DFSAN_INT_BRANCH(FunctionName, UType, SType, TypeName)      \
+static void FunctionName##_impl(dfsan_label lhs, dfsan_label rhs, \
+                          UType lhs_v, UType rhs_v, bool cond, uint32_t pred, uint64_t file_id, uint64_t br_id, \
+                          uint16_t is_ptr, const char* location, uptr caller_pc, u32 slot) { \
   extern int gr_mode_perf; \
+  if (path_log_enabled) record_path(file_id, br_id, cond, slot); \
   if (lhs == 0 && rhs == 0) {\
     return; /* exit early if no gradient */\
   }\
@@ -407,26 +504,26 @@ void FunctionName(dfsan_label lhs, dfsan_label rhs, \
   if (!gr_mode_perf) {\
     if (lhs != 0 || rhs != 0) {\
       if (DEBUG) {\
-        float2str(lhs_pos_dydx, __dfsan_label_info[lhs].pos_dydx, 32);\
-        float2str(lhs_neg_dydx, __dfsan_label_info[lhs].neg_dydx, 32);\
-        float2str(rhs_pos_dydx, __dfsan_label_info[rhs].pos_dydx, 32);\
-        float2str(rhs_neg_dydx, __dfsan_label_info[rhs].neg_dydx, 32);\
+        float2str(lhs_pos_dydx, label_pos_dydx(lhs), 32);\
+        float2str(lhs_neg_dydx, label_neg_dydx(lhs), 32);\
+        float2str(rhs_pos_dydx, label_pos_dydx(rhs), 32);\
+        float2str(rhs_neg_dydx, label_neg_dydx(rhs), 32);\
         printf("dfsan int branch: " TypeName " %u, %u -- %u %s, %s : %u %s, %s -- %u pred: %u\n",\
                lhs, rhs, lhs_v, lhs_pos_dydx, lhs_neg_dydx, rhs_v, rhs_pos_dydx, rhs_neg_dydx, cond, pred);\
       }\
-      record_branch(file_id, br_id, lhs, rhs, (float)lhs_v, (float)rhs_v, cond, is_ptr, location);\
+      record_branch(file_id, br_id, lhs, rhs, (float)lhs_v, (float)rhs_v, cond, is_ptr, location, caller_pc);\
     }\
   }\
   /* BRANCH BARRIER FUNCTIONS */\
   if (flags().branch_barriers) {\
     float lhs_neg_dx = 0, lhs_pos_dx = 0, rhs_neg_dx = 0, rhs_pos_dx = 0;\
     if (lhs) {\
-      lhs_neg_dx = __dfsan_label_info[lhs].neg_dydx;\
-      lhs_pos_dx = __dfsan_label_info[lhs].pos_dydx;\
+      lhs_neg_dx = label_neg_dydx(lhs);\
+      lhs_pos_dx = label_pos_dydx(lhs);\
     }\
     if (rhs) {\
-      rhs_neg_dx = __dfsan_label_info[rhs].neg_dydx;\
-      rhs_pos_dx = __dfsan_label_info[rhs].pos_dydx;\
+      rhs_neg_dx = label_neg_dydx(rhs);\
+      rhs_pos_dx = label_pos_dydx(rhs);\
     }\
     switch (pred) {\
       case ICMP_EQ: {  /* equal */\
@@ -587,37 +684,38 @@ void FunctionName(dfsan_label lhs, dfsan_label rhs, \
         break;\
       }\
     }\
-    __dfsan_label_info[lhs].neg_dydx = lhs_neg_dx;\
-    __dfsan_label_info[lhs].pos_dydx = lhs_pos_dx;\
-    __dfsan_label_info[lhs].loc = location;\
-    __dfsan_label_info[rhs].neg_dydx = rhs_neg_dx;\
-    __dfsan_label_info[rhs].pos_dydx = rhs_pos_dx;\
-    __dfsan_label_info[rhs].loc = location;\
+    ForceLazyUsers(lhs, rhs);\
+    set_label_dydx(lhs, lhs_neg_dx, lhs_pos_dx);\
+    __dfsan_label_loc[lhs] = location;\
+    set_label_dydx(rhs, rhs_neg_dx, rhs_pos_dx);\
+    __dfsan_label_loc[rhs] = location;\
   }\
 }\
+DFSAN_BRANCH_ENTRIES(FunctionName, UType)
 
 #define DFSAN_FLOAT_BRANCH(FunctionName, Type, TypeName, HelperFuncName)      \
-extern "C" SANITIZER_INTERFACE_ATTRIBUTE \
-void FunctionName(dfsan_label lhs, dfsan_label rhs, \
+static void FunctionName##_impl(dfsan_label lhs, dfsan_label rhs, \
                           Type lhs_v, Type rhs_v, bool cond, uint32_t pred,\
-                          uint64_t file_id, uint16_t br_id, \
-                          uint16_t is_ptr, const char* location) { \
+                          uint64_t file_id, uint64_t br_id, \
+                          uint16_t is_ptr, const char* location, uptr caller_pc, u32 slot) { \
   extern int gr_mode_perf; \
+  if (path_log_enabled) record_path(file_id, br_id, cond, slot); \
   char lhs_neg_dydx[32], lhs_pos_dydx[32], rhs_neg_dydx[32], rhs_pos_dydx[32], lhs_str[32], rhs_str[32];\
   if (!gr_mode_perf) {\
     if (lhs != 0 || rhs != 0) {\
       if (true) {\
-        float2str(lhs_pos_dydx, __dfsan_label_info[lhs].pos_dydx, 32);\
-        float2str(lhs_neg_dydx, __dfsan_label_info[lhs].neg_dydx, 32);\
-        float2str(rhs_pos_dydx, __dfsan_label_info[rhs].pos_dydx, 32);\
-        float2str(rhs_neg_dydx, __dfsan_label_info[rhs].neg_dydx, 32);\
+        float2str(lhs_pos_dydx, label_pos_dydx(lhs), 32);\
+        float2str(lhs_neg_dydx, label_neg_dydx(lhs), 32);\
+        float2str(rhs_pos_dydx, label_pos_dydx(rhs), 32);\
+        float2str(rhs_neg_dydx, label_neg_dydx(rhs), 32);\
         HelperFuncName(lhs_str, lhs_v, 32);\
         HelperFuncName(rhs_str, rhs_v, 32);\
         printf("dfsan float branch: " TypeName " %u, %u -- %s %s, %s : %s %s, %s -- %u pred: %u %u\n",\
                 lhs, rhs, lhs_str, lhs_pos_dydx, lhs_neg_dydx, rhs_str, rhs_pos_dydx, rhs_neg_dydx, cond, pred, is_ptr);\
       }\
-      record_branch(file_id, br_id, lhs, rhs, (float)lhs_v, (float)rhs_v, cond, is_ptr, location);\
+      record_branch(file_id, br_id, lhs, rhs, (float)lhs_v, (float)rhs_v, cond, is_ptr, location, caller_pc);\
     }\
   }\
 }\
+DFSAN_BRANCH_ENTRIES(FunctionName, Type)
 
@@ -0,0 +1,231 @@
+#!/usr/bin/env python3
+# Per-byte gradient sweep of an instrumented program, with an incremental
+# mode for mutated inputs.
+#
+# A sweep runs the program once per input byte with FREAD_BYTE_IDX set and
+# keeps each run's branch log as branches.<byte>.csv in the output directory.
+# It also runs the program once without a labeled byte and path_logfile set,
+# which writes path.csv: hashes of the branch sequence in blocks of
+# path_block visits, the first and last visit of each branch site, and the
+# visit count at which each input read happened.
+#
+# With --base pointing at the sweep of an earlier input, a byte's branch log
+# is copied from the base instead of being recomputed when:
+#   - the byte has the same value in both inputs,
+#   - it was read before the two paths diverge,
+#   - every branch site its base log reached was last visited before the
+#     divergence, in both runs, and
+#   - none of those sites was also reached by a byte that changed.
+# A byte that reached no labeled branch in the base is assumed to reach none
+# while the path is unchanged.  The cost of the sweep then follows the number
+# of changed bytes and how far the path moved, not the input size.
+# sweep.csv lists each byte with "swept" or "reused" and the reason.
+#
+#   pga_sweep.py --input seed --out sweep.seed -- ./prog -x @@
+#   pga_sweep.py --input mutant --base sweep.seed --out sweep.mutant -- \
+#       ./prog -x @@
+#
+# "@@" in the command is replaced by the input path (the copy in --out); the
+# path is appended when there is none.
+
+import argparse
+import csv
+import os
+import shutil
+import subprocess
+import sys
+from concurrent.futures import ThreadPoolExecutor
+
+INF = float('inf')
+
+
+def site_key(file_id, inst_id):
+  """Key of a branch site, shared by the path log and the branch logs."""
+  return int(file_id), int(inst_id)
+
+
+class Signature(object):
+  def __init__(self, path):
+    self.visits = 0
+    self.block = 0
+    self.blocks = []
+    self.reads = []
+    self.sites = {}
+    with open(path) as f:
+      for row in csv.reader(f):
+        if row[0] == 'visits':
+          self.visits, self.block = int(row[1]), int(row[2])
+        elif row[0] == 'block':
+          self.blocks.append(row[2])
+        elif row[0] == 'read':
+          self.reads.append((int(row[1]), int(row[2]), int(row[3])))
+        elif row[0] == 'site':
+          self.sites[site_key(row[1], row[2])] = int(row[4])
+
+  def read_visit(self, byte):
+    """Visit count at the first read that returned byte, or None."""
+    for offset, size, visit in self.reads:
+      if offset <= byte < offset + size:
+        return visit
+    return None
+
+
+def divergence(old, new):
+  """First branch visit at which the two paths may differ."""
+  if old.block != new.block:
+    return 0
+  for i, (a, b) in enumerate(zip(old.blocks, new.blocks)):
+    if a != b:
+      return i * old.block
+  if old.visits == new.visits:
+    return INF
+  return min(old.visits, new.visits) // old.block * old.block
+
+
+def branch_sites(path):
+  """Branch sites with a labeled operand in a branch log."""
+  sites = set()
+  with open(path) as f:
+    for row in csv.DictReader(f):
+      sites.add(site_key(row['file_id'], row['inst_id']))
+  return sites
+
+
+def command(args, input_path):
+  cmd = [input_path if a == '@@' else a for a in args]
+  if '@@' not in args:
+    cmd.append(input_path)
+  return cmd
+
+
+def run(cmd, env, options, byte=None):
+  env = dict(env)
+  env['DFSAN_OPTIONS'] = ':'.join(filter(None, [env.get('DFSAN_OPTIONS'),
+                                               options]))
+  env.pop('FREAD_BYTE_IDX', None)
+  if byte is not None:
+    env['FREAD_BYTE_IDX'] = str(byte)
+  with open(os.devnull, 'wb') as null:
+    return subprocess.call(cmd, env=env, stdout=null, stderr=null)
+
+
+def read_before(old_sig, new_sig, byte, start):
+  """Whether byte was read before the divergence in both runs, or in none."""
+  visits = (old_sig.read_visit(byte), new_sig.read_visit(byte))
+  if visits == (None, None):
+    return True
+  return all(v is not None and v < start for v in visits)
+
+
+def plan(data, base, old_sig, new_sig, bytes_):
+  """Returns {byte: reason}, where reason is "reused" for cached bytes."""
+  with open(os.path.join(base, 'input'), 'rb') as f:
+    old_data = f.read()
+  start = divergence(old_sig, new_sig)
+  changed = set(b for b in bytes_
+                if b >= len(old_data) or data[b] != old_data[b])
+
+  deps = {}
+  for b in bytes_:
+    log = os.path.join(base, 'branches.%d.csv' % b)
+    if b not in changed and os.path.exists(log):
+      deps[b] = branch_sites(log)
+  touched = set()
+  for b in changed:
+    log = os.path.join(base, 'branches.%d.csv' % b)
+    if b < len(old_data) and os.path.exists(log):
+      touched |= branch_sites(log)
+
+  reasons = {}
+  for b in bytes_:
+    if b in changed:
+      reasons[b] = 'changed'
+    elif b not in deps:
+      reasons[b] = 'uncached'
+    elif not read_before(old_sig, new_sig, b, start):
+      reasons[b] = 'read-after-divergence'
+    elif deps[b] & touched:
+      reasons[b] = 'shares-site'
+    # With identical paths (start is INF) every site is before the divergence.
+    elif start != INF and any(old_sig.sites.get(s, INF) >= start or
+                              new_sig.sites.get(s, INF) >= start
+                              for s in deps[b]):
+      reasons[b] = 'path-changed'
+    else:
+      reasons[b] = 'reused'
+  return reasons
+
+
+def main():
+  parser = argparse.ArgumentParser(
+      description='Per-byte gradient sweep with reuse across mutated inputs.')
+  parser.add_argument('--input', required=True)
+  parser.add_argument('--out', required=True)
+  parser.add_argument('--base', help='sweep directory of an earlier input')
+  parser.add_argument('--bytes', help='START:END range of bytes to sweep')
+  parser.add_argument('--block', type=int, default=4096,
+                      help='branch visits per path hash block')
+  parser.add_argument('-j', type=int, default=os.cpu_count())
+  parser.add_argument('cmd', nargs=argparse.REMAINDER)
+  args = parser.parse_args()
+  if args.cmd and args.cmd[0] == '--':
+    args.cmd = args.cmd[1:]
+  if not args.cmd:
+    parser.error('missing program to run')
+
+  os.makedirs(args.out, exist_ok=True)
+  input_path = os.path.abspath(os.path.join(args.out, 'input'))
+  shutil.copyfile(args.input, input_path)
+  with open(input_path, 'rb') as f:
+    data = f.read()
+  cmd = command(args.cmd, input_path)
+  env = dict(os.environ)
+
+  start, end = 0, len(data)
+  if args.bytes:
+    lo, hi = args.bytes.split(':')
+    start, end = int(lo or 0), min(int(hi or end), end)
+  bytes_ = range(start, end)
+
+  sig_path = os.path.join(args.out, 'path.csv')
+  run(cmd, env, 'gradient_logfile=:path_logfile=%s:path_block=%d' %
+      (sig_path, args.block))
+  new_sig = Signature(sig_path)
+
+  if args.base:
+    reasons = plan(data, args.base, Signature(os.path.join(args.base,
+                                                           'path.csv')),
+                   new_sig, bytes_)
+  else:
+    reasons = dict((b, 'no-base') for b in bytes_)
+
+  todo = []
+  for b in bytes_:
+    log = os.path.join(args.out, 'branches.%d.csv' % b)
+    if reasons[b] == 'reused':
+      shutil.copyfile(os.path.join(args.base, 'branches.%d.csv' % b), log)
+    else:
+      todo.append(b)
+
+  def sweep(b):
+    log = os.path.join(args.out, 'branches.%d.csv' % b)
+    return run(cmd, env, 'gradient_logfile=:branch_logfile=' + log, b)
+
+  with ThreadPoolExecutor(max_workers=max(1, args.j)) as pool:
+    codes = dict(zip(todo, pool.map(sweep, todo)))
+
+  with open(os.path.join(args.out, 'sweep.csv'), 'w', newline='') as f:
+    writer = csv.writer(f)
+    writer.writerow(['byte', 'action', 'reason', 'exit'])
+    for b in bytes_:
+      if b in codes:
+        writer.writerow([b, 'swept', reasons[b], codes[b]])
+      else:
+        writer.writerow([b, 'reused', '', ''])
+
+  print('swept %d of %d bytes, reused %d' %
+        (len(todo), len(bytes_), len(bytes_) - len(todo)), file=sys.stderr)
+
+
+if __name__ == '__main__':
+  main()
@@ -0,0 +1,37 @@
+// RUN: %clang_dfsan %s -o %t && %run %t
+// RUN: %clang_dfsan -mllvm -dfsan-shadow-granularity=8 %s -o %t && %run %t
+// RUN: %clang_dfsan -mllvm -dfsan-two-level-shadow %s -o %t && %run %t
+
+// Tests that heap chunks do not keep the labels of a previous allocation and
+// that realloc moves labels along with the data.
+
+#include <sanitizer/dfsan_interface.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main(void) {
+  dfsan_label l = dfsan_create_label("l");
+
+  char *p = malloc(64);
+  dfsan_set_label(l, p, 64);
+  free(p);
+  char *q = malloc(64);
+  assert(q == p);
+  assert(dfsan_read_label(q, 64) == 0);
+
+  dfsan_set_label(l, q + 8, 1);
+  char *r = realloc(q, 1 << 20);
+  assert(dfsan_read_label(r + 8, 1) == l);
+  assert(dfsan_read_label(r, 8) == 0);
+  assert(dfsan_read_label(r + 9, (1 << 20) - 9) == 0);
+  free(r);
+
+  char *big = malloc(1 << 24);
+  dfsan_set_label(l, big, 1 << 24);
+  free(big);
+  big = malloc(1 << 24);
+  assert(dfsan_read_label(big, 1 << 24) == 0);
+  free(big);
+  return 0;
+}
@@ -0,0 +1,43 @@
+// RUN: %clang_dfsan -g %s -o %t
+// RUN: DFSAN_OPTIONS=context_depth=2:func_logfile=%t.func.csv:func_summary_logfile=%t.sites.csv:context_logfile=%t.ctx.csv %run %t
+// RUN: cat %t.func.csv %t.sites.csv %t.ctx.csv | FileCheck %s
+
+// Tests that a call site reached from two callers gets a context id per
+// caller: the raw function argument records carry them, the site aggregates
+// are split per (site, context) next to the context-free total, and the
+// context log resolves both stacks.
+
+#include <sanitizer/dfsan_interface.h>
+#include <string.h>
+
+static char src[64], dst[64];
+
+__attribute__((noinline)) static void copy(size_t n) {
+  memcpy(dst, src, n);
+}
+
+__attribute__((noinline)) static void caller_a(size_t n) { copy(n); }
+__attribute__((noinline)) static void caller_b(size_t n) { copy(n); }
+
+int main(void) {
+  size_t n = 16;
+  dfsan_set_label(dfsan_create_label("n"), &n, sizeof(n));
+  caller_a(n);
+  caller_b(n);
+  return 0;
+}
+
+// CHECK: file_id,inst_id,arg_ind,label,val,ndx,pdx,location,context
+// CHECK-NEXT: [[SITE:[0-9]+]],6,2,{{[0-9]+}},16.000000,{{.*}},CUSTOM,[[A:[1-9][0-9]*]]
+// CHECK-NEXT: [[SITE]],6,2,{{[0-9]+}},16.000000,{{.*}},CUSTOM,[[B:[1-9][0-9]*]]
+
+// CHECK: file_id,inst_id,arg_ind,count,samples,
+// CHECK-DAG: [[SITE]],6,2,2,2,{{.*}},CUSTOM,0{{$}}
+// CHECK-DAG: [[SITE]],6,2,1,1,{{.*}},CUSTOM,[[A]]
+// CHECK-DAG: [[SITE]],6,2,1,1,{{.*}},CUSTOM,[[B]]
+
+// Each id has one line in the context log, so both matching means the two
+// callers got distinct ids.
+// CHECK: context,frames
+// CHECK-DAG: [[A]],copy@{{.*}}calling_context.c:{{[0-9]+}};caller_a@
+// CHECK-DAG: [[B]],copy@{{.*}}calling_context.c:{{[0-9]+}};caller_b@
@@ -0,0 +1,41 @@
+// RUN: %clang_dfsan -g %s -o %t
+// RUN: DFSAN_OPTIONS=gradient_logfile=%t.all.csv:branch_logfile=%t.br.csv %run %t
+// RUN: FileCheck %s --check-prefixes=CHECK,ALL,BASE < %t.all.csv
+// RUN: DFSAN_OPTIONS=dump_labels=reachable:gradient_logfile=%t.reach.csv:branch_logfile=%t.br.csv %run %t
+// RUN: FileCheck %s --check-prefixes=CHECK,REACH,BASE < %t.reach.csv
+// RUN: DFSAN_OPTIONS=dump_labels=reachable:dump_base_labels=0:gradient_logfile=%t.nobase.csv:branch_logfile=%t.br.csv %run %t
+// RUN: FileCheck %s --check-prefixes=CHECK,REACH,NOBASE < %t.nobase.csv
+
+// Tests that dump_labels=reachable only writes labels that a branch record or
+// a dfsan_get_label_info() call can reach through l1/l2, plus base labels
+// unless dump_base_labels=0.
+
+#include <sanitizer/dfsan_interface.h>
+
+// CHECK: label,ndx,pdx,location,f_val,opcode,l1,l2
+int main(void) {
+  dfsan_create_label("unused");
+  // BASE: ,unused,
+  // NOBASE-NOT: ,unused,
+
+  int x = 3;
+  dfsan_label x_label = dfsan_create_label("x");
+  dfsan_set_label(x_label, &x, sizeof(x));
+  // CHECK: ,x,
+
+  volatile int dead = x * 5;
+  // ALL: dump_labels_reachable.c:[[@LINE-1]],{{.*}},Mul,
+  // REACH-NOT: dump_labels_reachable.c:[[@LINE-2]],
+
+  volatile int taken = 0;
+  int live = x * 7;
+  // CHECK: dump_labels_reachable.c:[[@LINE-1]],{{.*}},Mul,
+  if (live > 10)
+    taken = 1;
+
+  int queried = x * 11;
+  dfsan_get_label_info(dfsan_get_label(queried));
+  // CHECK: dump_labels_reachable.c:[[@LINE-2]],{{.*}},Mul,
+
+  return 0;
+}
@@ -0,0 +1,55 @@
+// RUN: %clang_dfsan %s -o %t
+// RUN: rm -f %t.func.csv* %t.manifest
+// RUN: DFSAN_OPTIONS=gradient_logfile=:func_logfile=%t.func.csv:log_manifest=%t.manifest %run %t > %t.pids
+// RUN: cat %t.pids %t.func.csv %t.func.csv.* %t.manifest | FileCheck %s
+// RUN: rm -f %t.func.csv* %t.manifest
+// RUN: env DFSAN_LOG_ROOT_PID=1 DFSAN_OPTIONS=gradient_logfile=:func_logfile=%t.func.csv:log_manifest=%t.manifest %run %t > %t.pids
+// RUN: test ! -e %t.func.csv
+// RUN: cat %t.pids %t.manifest | FileCheck %s --check-prefix=ROOT
+
+// Tests that a forked child writes its logs to pid-suffixed paths without
+// the records it inherited, and that log_manifest lists both processes.  A
+// process that is not the one named by DFSAN_LOG_ROOT_PID suffixes its logs
+// even if it never forked.
+
+#include <sanitizer/dfsan_interface.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static char src[64], dst[64];
+
+int main(void) {
+  dfsan_label l = dfsan_create_label("n");
+  size_t n = 16;
+  dfsan_set_label(l, &n, sizeof(n));
+  memcpy(dst, src, n);
+
+  fflush(stdout);
+  pid_t child = fork();
+  if (child == 0) {
+    n = 32;
+    dfsan_set_label(l, &n, sizeof(n));
+    memcpy(dst, src, n);
+    exit(0);
+  }
+  waitpid(child, NULL, 0);
+  printf("parent=%d child=%d\n", (int)getpid(), (int)child);
+  return 0;
+}
+
+// The parent's log holds only its own record, and the child's only the one
+// made after the fork.
+// CHECK: parent=[[PARENT:[0-9]+]] child=[[CHILD:[0-9]+]]
+// CHECK-NEXT: file_id,inst_id,arg_ind,label,val,
+// CHECK-NEXT: ,6,2,{{[0-9]+}},16.000000,
+// CHECK-NEXT: file_id,inst_id,arg_ind,label,val,
+// CHECK-NEXT: ,6,2,{{[0-9]+}},32.000000,
+// CHECK-NEXT: [[CHILD]],[[PARENT]],{{[1-9][0-9]*}},{{[0-9]+}},func_logfile,/{{.*}}.func.csv.[[CHILD]]{{$}}
+// CHECK-NEXT: [[PARENT]],{{[0-9]+}},0,{{[0-9]+}},func_logfile,/{{.*}}.func.csv{{$}}
+
+// ROOT: parent=[[PARENT:[0-9]+]] child=[[CHILD:[0-9]+]]
+// ROOT-NEXT: [[CHILD]],[[PARENT]],{{.*}},func_logfile,/{{.*}}.func.csv.[[CHILD]]{{$}}
+// ROOT-NEXT: [[PARENT]],{{.*}},func_logfile,/{{.*}}.func.csv.[[PARENT]]{{$}}
@@ -0,0 +1,38 @@
+// RUN: %clang_dfsan %s -o %t
+// RUN: DFSAN_OPTIONS=func_summary_logfile=%t.summary.csv:func_logfile=%t.func.csv:func_arg_samples=3 %run %t
+// RUN: FileCheck %s --check-prefix=SUMMARY < %t.summary.csv
+// RUN: wc -l < %t.summary.csv | FileCheck %s --check-prefix=SUMMARY-ROWS
+// RUN: FileCheck %s --check-prefix=FUNC < %t.func.csv
+// RUN: wc -l < %t.func.csv | FileCheck %s --check-prefix=FUNC-ROWS
+
+// Tests that func_summary_logfile has one row per site, with every call
+// counted, and that func_logfile keeps at most func_arg_samples raw records
+// per site.
+
+#include <sanitizer/dfsan_interface.h>
+
+int main(void) {
+  int y = 4;
+  dfsan_set_label(dfsan_create_label("y"), &y, sizeof(y));
+
+  // Each division records its labeled divisor at its own site.
+  int q = 0;
+  for (int i = 0; i < 10; ++i)
+    q += 1000 / y;
+  for (int i = 0; i < 2; ++i)
+    q += 1000 % y;
+  return q == 0;
+}
+
+// SUMMARY: file_id,inst_id,arg_ind,count,samples,label,
+// SUMMARY-DAG: {{^[0-9]+}},{{[0-9]+}},0,10,3,
+// SUMMARY-DAG: {{^[0-9]+}},{{[0-9]+}},0,2,2,
+// SUMMARY-ROWS: {{^ *3$}}
+
+// FUNC: file_id,inst_id,arg_ind,label,val,
+// FUNC-NEXT: {{^[0-9]+}},{{[0-9]+}},0,
+// FUNC-NEXT: {{^[0-9]+}},{{[0-9]+}},0,
+// FUNC-NEXT: {{^[0-9]+}},{{[0-9]+}},0,
+// FUNC-NEXT: {{^[0-9]+}},{{[0-9]+}},0,
+// FUNC-NEXT: {{^[0-9]+}},{{[0-9]+}},0,
+// FUNC-ROWS: {{^ *6$}}
@@ -0,0 +1,48 @@
+// RUN: %clang_dfsan %s -o %t && %run %t
+// RUN: %clang_dfsan -mllvm -dfsan-args-abi %s -o %t && %run %t
+
+// Tests that gradients flow through direct and indirect calls, returns,
+// argument lists longer than a few registers and custom wrappers in the same
+// way under the TLS and the argument ABI.
+
+#include <sanitizer/dfsan_interface.h>
+#include <assert.h>
+#include <string.h>
+
+__attribute__((noinline)) static int scale(int x) {
+  return 3 * x;
+}
+
+__attribute__((noinline)) static int last_of_eight(int a, int b, int c, int d,
+                                                   int e, int f, int g, int h) {
+  return a + b + c + d + e + f + g + 2 * h;
+}
+
+static float pos_dydx(dfsan_label label) {
+  return dfsan_get_label_info(label)->pos_dydx;
+}
+
+int main(void) {
+  int x = 2;
+  dfsan_label x_label = dfsan_create_label("x");
+  dfsan_set_label(x_label, &x, sizeof(x));
+
+  int y = scale(x);
+  assert(dfsan_get_label(y) != 0);
+  assert(pos_dydx(dfsan_get_label(y)) == 3.0f);
+
+  int (*volatile fp)(int) = scale;
+  int z = fp(x);
+  assert(dfsan_get_label(z) != 0);
+  assert(pos_dydx(dfsan_get_label(z)) == 3.0f);
+
+  int w = last_of_eight(1, 1, 1, 1, 1, 1, 1, x);
+  assert(dfsan_get_label(w) != 0);
+  assert(pos_dydx(dfsan_get_label(w)) == 2.0f);
+
+  int c;
+  memcpy(&c, &y, sizeof(c));
+  assert(dfsan_read_label(&c, sizeof(c)) == dfsan_get_label(y));
+
+  return 0;
+}
@@ -0,0 +1,53 @@
+// RUN: %clang_dfsan %s -o %t && %run %t
+// RUN: %clang_dfsan -mllvm -dfsan-input-reachability %s -o %t && %run %t
+
+// Tests that functions reached by input keep their labels with
+// -dfsan-input-reachability, and that input-free functions return label 0
+// and clear the labels of the memory they write.  Functions calling a
+// custom-wrapped function are fully instrumented, so the wrapper still runs.
+
+#include <sanitizer/dfsan_interface.h>
+#include <assert.h>
+#include <unistd.h>
+
+static int counter;
+
+__attribute__((noinline)) static int scale(int x) { return x * 3; }
+
+__attribute__((noinline)) static int constant(void) { return 42; }
+
+__attribute__((noinline)) static void count(void) { ++counter; }
+
+__attribute__((noinline)) static void overwrite(int *p) { *p = 7; }
+
+static int writes;
+
+static void on_write(int fd, const void *buf, size_t count) { ++writes; }
+
+__attribute__((noinline)) static void write_nothing(void) { write(1, "", 0); }
+
+int main(void) {
+  int x = 5;
+  dfsan_label x_label = dfsan_create_label("x");
+  dfsan_set_label(x_label, &x, sizeof(x));
+
+  int y = scale(x);
+  assert(y == 15 && dfsan_get_label(y) != 0);
+
+  // The label scale returned must not stick to the next return value.
+  int c = constant();
+  assert(c == 42 && dfsan_get_label(c) == 0);
+
+  count();
+  count();
+  assert(counter == 2);
+
+  overwrite(&x);
+  assert(x == 7 && dfsan_get_label(x) == 0);
+
+  // __dfsw_write calls the write callback.
+  dfsan_set_write_callback(on_write);
+  write_nothing();
+  assert(writes == 1);
+  return 0;
+}
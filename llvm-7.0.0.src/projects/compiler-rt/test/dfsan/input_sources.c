@@ -0,0 +1,54 @@
+// RUN: %clang_dfsan %s -o %t
+// RUN: FREAD_SOURCE='*.in@1,*.other@0' %run %t %t
+
+// Tests that FREAD_SOURCE labels only reads from matching files, and that
+// each source marks its own byte with a base label of its own.
+
+#include <sanitizer/dfsan_interface.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+static void write_file(const char *base, const char *ext) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s%s", base, ext);
+  FILE *f = fopen(path, "w");
+  fputs("abcd", f);
+  fclose(f);
+}
+
+static dfsan_label read_file(const char *base, const char *ext, char *buf) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s%s", base, ext);
+  int fd = open(path, O_RDONLY);
+  assert(read(fd, buf, 4) == 4);
+  close(fd);
+  return dfsan_read_label(buf, 4);
+}
+
+int main(int argc, char **argv) {
+  write_file(argv[1], ".in");
+  write_file(argv[1], ".cfg");
+  write_file(argv[1], ".other");
+
+  char in[4], cfg[4], other[4];
+  read_file(argv[1], ".in", in);
+  assert(dfsan_get_label(in[0]) == 0);
+  dfsan_label in_label = dfsan_get_label(in[1]);
+  assert(in_label != 0);
+  assert(dfsan_has_label_with_desc(in_label, "*.in@1") == in_label);
+
+  assert(read_file(argv[1], ".cfg", cfg) == 0);
+
+  FILE *f;
+  char path[4096];
+  snprintf(path, sizeof(path), "%s.other", argv[1]);
+  f = fopen(path, "r");
+  assert(fread(other, 1, 4, f) == 4);
+  fclose(f);
+  dfsan_label other_label = dfsan_get_label(other[0]);
+  assert(other_label != 0 && other_label != in_label);
+  assert(dfsan_get_label(other[1]) == 0);
+  return 0;
+}
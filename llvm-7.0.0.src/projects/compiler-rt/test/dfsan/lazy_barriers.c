@@ -0,0 +1,30 @@
+// RUN: %clang_dfsan %s -o %t
+// RUN: DFSAN_OPTIONS=lazy_gradients=1:branch_barriers=1 %run %t
+// RUN: DFSAN_OPTIONS=lazy_gradients=0:branch_barriers=1 %run %t
+
+// Tests that a branch barrier between recording a lazy union and reading it
+// does not leak into the union: b keeps the derivative it had when it was
+// computed, even though the barrier on a clears a's positive derivative.
+
+#include <sanitizer/dfsan_interface.h>
+#include <assert.h>
+
+int main(void) {
+  int x = 4;
+  dfsan_label x_label = dfsan_create_label("x");
+  dfsan_set_label(x_label, &x, sizeof(x));
+
+  int a = x * 2;
+  int b = a + 1;
+  int n = 0;
+  if (a < 10)  // a + 2 crosses the branch, so the barrier clears a's pos_dydx.
+    ++n;
+  if (b > 3)
+    ++n;
+
+  assert(n == 2);
+  assert(dfsan_get_label_info(dfsan_get_label(a))->pos_dydx == 0);
+  assert(dfsan_get_label_info(dfsan_get_label(b))->pos_dydx == 2);
+  assert(dfsan_get_label_info(dfsan_get_label(b))->neg_dydx == 2);
+  return 0;
+}
@@ -0,0 +1,39 @@
+// RUN: %clang_dfsan %s -o %t
+// RUN: DFSAN_OPTIONS=lazy_gradients=1 %run %t
+// RUN: DFSAN_OPTIONS=lazy_gradients=0 %run %t
+// RUN: %clang_dfsan -mllvm -dfsan-shadow-granularity=8 %s -o %t && %run %t
+
+// Tests that lazily recorded unions get the same derivatives as eager ones
+// once they are read, including through chains of pending labels, and that
+// unions of labels known to have zero derivatives reuse them.
+
+#include <sanitizer/dfsan_interface.h>
+#include <assert.h>
+
+int main(void) {
+  int x = 5;
+  dfsan_label x_label = dfsan_create_label("x");
+  dfsan_set_label(x_label, &x, sizeof(x));
+
+  int y = x * 3;
+  int z = y + (x << 2);
+  for (int i = 0; i < 10; ++i)
+    z = z + x;
+  dfsan_label z_label = dfsan_get_label(z);
+  assert(dfsan_get_label_info(z_label)->pos_dydx == 17);
+  assert(dfsan_get_label_info(z_label)->neg_dydx == 17);
+  assert(dfsan_has_label(z_label, x_label));
+
+  double d = x;
+  double e = d * d - 2.0 * d;
+  assert(dfsan_get_label_info(dfsan_get_label(e))->pos_dydx == 8);
+
+  // x == 5 holds for neither x - 1 nor x + 1, so the branch barrier zeroes
+  // both derivatives of x.
+  int w = 0;
+  if (x == 5)
+    w = x + 1;
+  assert(dfsan_get_label_info(x_label)->pos_dydx == 0);
+  assert(dfsan_get_label(w) == x_label);
+  return 0;
+}
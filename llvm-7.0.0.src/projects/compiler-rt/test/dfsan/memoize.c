@@ -0,0 +1,31 @@
+// RUN: %clang_dfsan %s -fsanitize-blacklist=%S/Inputs/memoize_abilist.txt -o %t
+// RUN: DFSAN_OPTIONS=memo_logfile=%t.csv %run %t | FileCheck %s
+// RUN: FileCheck %s --check-prefix=LOG < %t.csv
+// RUN: DFSAN_OPTIONS=memoize=0 %run %t | FileCheck %s
+
+// Tests that calls to a function listed as memoize with the same argument
+// derivatives are answered from the summary cache with the derivative the
+// instrumented body computed, and that unlabeled calls skip the lookup.
+
+#include <sanitizer/dfsan_interface.h>
+#include <stdio.h>
+
+int mix(int a, int b) { return a * 3 + b; }
+
+int main(void) {
+  int x = 5;
+  dfsan_set_label(dfsan_create_label("x"), &x, sizeof(x));
+
+  int r = 0;
+  for (int i = 0; i < 100; ++i)
+    r = mix(x + i, i);
+  r += mix(1, 2);
+
+  const struct dfsan_label_info *info = dfsan_get_label_info(dfsan_get_label(r));
+  printf("%f %f\n", info->neg_dydx, info->pos_dydx);
+  // CHECK: 3.000000 3.000000
+  return 0;
+}
+
+// LOG: function,lookups,hits,disabled
+// LOG-NEXT: mix,100,99,0
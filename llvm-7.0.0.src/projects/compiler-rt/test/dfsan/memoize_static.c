@@ -0,0 +1,36 @@
+// RUN: cp %s %t.second.c
+// RUN: %clang_dfsan -c %t.second.c -DSECOND -fsanitize-blacklist=%S/Inputs/memoize_abilist.txt -o %t.second.o
+// RUN: %clang_dfsan %s %t.second.o -fsanitize-blacklist=%S/Inputs/memoize_abilist.txt -o %t
+// RUN: %run %t | FileCheck %s
+
+// Tests that memoized static functions with the same name in two modules get
+// separate summaries.
+
+#include <sanitizer/dfsan_interface.h>
+#include <stdio.h>
+
+#ifdef SECOND
+static int mix(int a, int b) { return a * 5 + b; }
+
+int second(int x) { return mix(x, 1); }
+#else
+static int mix(int a, int b) { return a * 3 + b; }
+
+int second(int x);
+
+static float dydx(int v) {
+  return dfsan_get_label_info(dfsan_get_label(v))->pos_dydx;
+}
+
+int main(void) {
+  int x = 5;
+  dfsan_set_label(dfsan_create_label("x"), &x, sizeof(x));
+
+  // Each call stores or looks up a summary for the same argument labels.
+  int a = mix(x, 1), b = second(x);
+  int c = mix(x, 1), d = second(x);
+  printf("%.0f %.0f %.0f %.0f\n", dydx(a), dydx(b), dydx(c), dydx(d));
+  // CHECK: 3 5 3 5
+  return 0;
+}
+#endif
@@ -0,0 +1,29 @@
+// RUN: %clang_dfsan %s -o %t
+// RUN: DFSAN_OPTIONS=output_logfile=%t.csv %run %t > %t.out
+// RUN: FileCheck %s < %t.csv
+
+// Tests that output_logfile records each labeled byte written by write() and
+// fwrite() with its offset in the output stream, and nothing else.
+
+#include <sanitizer/dfsan_interface.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+int main(void) {
+  char buf[100];
+  memset(buf, 'a', sizeof(buf));
+  int x = 'b';
+  dfsan_set_label(dfsan_create_label("x"), &x, sizeof(x));
+  buf[70] = x;
+  buf[3] = x + 1;
+
+  // CHECK: fd,offset,label,ndx,pdx
+  write(1, buf, sizeof(buf));
+  // CHECK-NEXT: 1,3,{{[0-9]+}},1.000000,1.000000
+  // CHECK-NEXT: 1,70,{{[0-9]+}},1.000000,1.000000
+  fwrite(buf + 60, 1, 20, stdout);
+  // CHECK-NEXT: 1,110,{{[0-9]+}},1.000000,1.000000
+  // CHECK-NOT: {{.}}
+  return 0;
+}
@@ -0,0 +1,29 @@
+// RUN: %clang_dfsan %s -o %t
+// RUN: DFSAN_OPTIONS=path_logfile=%t.csv:path_block=4 %run %t %s
+// RUN: FileCheck %s < %t.csv
+
+// Tests that path_logfile records the branch visit count, one hash per block
+// of path_block visits, the input read and the visits of each branch site.
+
+#include <stdio.h>
+
+int main(int argc, char **argv) {
+  char buf[16];
+  FILE *f = fopen(argv[1], "r");
+  fread(buf, 1, sizeof(buf), f);
+  fclose(f);
+
+  int slashes = 0;
+  for (int i = 0; i < 10; ++i)
+    if (buf[i] == '/')
+      ++slashes;
+  printf("%d\n", slashes);
+  return 0;
+}
+
+// CHECK: visits,{{[1-9][0-9]*}},4
+// CHECK-NEXT: block,0,{{[0-9a-f]+}}
+// CHECK-NEXT: block,1,{{[0-9a-f]+}}
+// CHECK: read,0,16,{{[0-9]+}}
+// CHECK-DAG: site,{{[0-9]+}},{{[0-9]+}},{{[0-9]+}},{{[0-9]+}},10{{$}}
+// CHECK-DAG: site,{{[0-9]+}},{{[0-9]+}},{{[0-9]+}},{{[0-9]+}},11{{$}}
@@ -0,0 +1,41 @@
+// RUN: %clang_dfsan %s -o %t
+// RUN: rm -rf %t.seed %t.mutant
+// RUN: printf 'ab/cdefy' > %t.seed.in
+// RUN: printf 'ab/cdefz' > %t.mutant.in
+// RUN: %pga_sweep --input %t.seed.in --out %t.seed --block 1 -j 1 -- %run %t @@
+// RUN: %pga_sweep --input %t.mutant.in --base %t.seed --out %t.mutant --block 1 -j 1 -- %run %t @@
+// RUN: FileCheck %s < %t.mutant/sweep.csv
+
+// Tests that pga_sweep.py joins the branch logs of a base sweep with its path
+// log: the mutant only changes byte 7, whose branch comes after the loop over
+// bytes 0-3, so their logs are reused even though the paths diverge.
+
+#include <stdio.h>
+
+int main(int argc, char **argv) {
+  char buf[8];
+  FILE *f = fopen(argv[1], "r");
+  fread(buf, 1, sizeof(buf), f);
+  fclose(f);
+
+  int slashes = 0;
+  for (int i = 0; i < 4; ++i)
+    if (buf[i] == '/')
+      ++slashes;
+  if (buf[7] == 'z')
+    for (int i = 0; i < 3; ++i)
+      if (argc > i)
+        ++slashes;
+  printf("%d\n", slashes);
+  return 0;
+}
+
+// CHECK: byte,action,reason,exit
+// CHECK-NEXT: 0,reused
+// CHECK-NEXT: 1,reused
+// CHECK-NEXT: 2,reused
+// CHECK-NEXT: 3,reused
+// CHECK-NEXT: 4,reused
+// CHECK-NEXT: 5,reused
+// CHECK-NEXT: 6,reused
+// CHECK-NEXT: 7,swept,changed
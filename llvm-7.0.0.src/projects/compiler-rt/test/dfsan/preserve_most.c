@@ -0,0 +1,63 @@
+// RUN: %clang_dfsan -O2 -mllvm -dfsan-preserve-most %s -o %t && %run %t
+// RUN: DFSAN_OPTIONS=profile_overhead=1:profile_logfile=%t.prof %run %t
+// RUN: FileCheck %s --check-prefix=PROF < %t.prof
+// REQUIRES: x86_64-target-arch
+
+// Tests that unions and memcpy called through preserve_most stubs keep the
+// caller's live values and compute the same derivatives, and that the
+// runtime charges them to the instrumented caller rather than to the stub.
+
+#include <sanitizer/dfsan_interface.h>
+#include <assert.h>
+#include <string.h>
+
+__attribute__((noinline)) static long kernel(const long *in, int n,
+                                             long *out) {
+  long a0 = 1, a1 = 2, a2 = 3, a3 = 4, a4 = 5, a5 = 6, a6 = 7, a7 = 8;
+  for (int i = 0; i < n; ++i) {
+    a0 += in[i];
+    a1 += a0 * 3;
+    a2 += a1 ^ i;
+    a3 += a2 * 5;
+    a4 += a3 - a0;
+    a5 += a4 * 7;
+    a6 += a5 ^ a1;
+    a7 += a6 + a2;
+  }
+  memcpy(out, &a0, sizeof(a0));
+  return a0 ^ a1 ^ a2 ^ a3 ^ a4 ^ a5 ^ a6 ^ a7;
+}
+
+int main(void) {
+  long in[4] = {1, 2, 3, 4};
+  dfsan_label x_label = dfsan_create_label("x");
+  dfsan_set_label(x_label, &in[0], sizeof(in[0]));
+
+  long a0;
+  long r = kernel(in, 4, &a0);
+  // The same loop, computed inline.
+  long b0 = 1, b1 = 2, b2 = 3, b3 = 4, b4 = 5, b5 = 6, b6 = 7, b7 = 8;
+  for (int i = 0; i < 4; ++i) {
+    b0 += in[i];
+    b1 += b0 * 3;
+    b2 += b1 ^ i;
+    b3 += b2 * 5;
+    b4 += b3 - b0;
+    b5 += b4 * 7;
+    b6 += b5 ^ b1;
+    b7 += b6 + b2;
+  }
+  assert(r == (b0 ^ b1 ^ b2 ^ b3 ^ b4 ^ b5 ^ b6 ^ b7));
+  assert(a0 == b0);
+
+  // a0 = 1 + x + 2 + 3 + 4.
+  const struct dfsan_label_info *info =
+      dfsan_get_label_info(dfsan_get_label(a0));
+  assert(info->pos_dydx == 1 && info->neg_dydx == 1);
+  return 0;
+}
+
+// PROF: rank,function
+// PROF-NOT: dfsan.pm.
+// PROF: ,kernel,
+// PROF-NOT: dfsan.pm.
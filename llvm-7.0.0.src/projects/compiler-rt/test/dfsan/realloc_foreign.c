@@ -0,0 +1,16 @@
+// RUN: %clang_dfsan %s -o %t && not %run %t 2>&1 | FileCheck %s
+
+// Tests that realloc of memory the allocator does not own is reported rather
+// than answered with a fresh block that drops the old contents.
+
+#include <stdlib.h>
+
+static char buf[64];
+
+int main(void) {
+  char *volatile p = buf;
+  p = realloc(p, 128);
+  return p != 0;
+}
+
+// CHECK: FATAL: DataFlowSanitizer: realloc of {{.*}}, which was not allocated by the DataFlowSanitizer allocator
@@ -0,0 +1,65 @@
+// RUN: %clang_dfsan -mllvm -dfsan-shadow-granularity=4 %s -o %t && %run %t
+// RUN: %clang_dfsan -mllvm -dfsan-shadow-granularity=8 %s -o %t && %run %t
+
+// Tests that word-granular shadow keeps per-byte labels for a word whose
+// bytes are stored with different labels, folds the word back once they agree
+// again, and carries the split through memcpy and the allocator.
+
+#include <sanitizer/dfsan_interface.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char buf[16] __attribute__((aligned(8)));
+static char copy[17] __attribute__((aligned(8)));
+
+int main(void) {
+  dfsan_label a = dfsan_create_label("a");
+  dfsan_label b = dfsan_create_label("b");
+  char ca = 1, cb = 2;
+  dfsan_set_label(a, &ca, 1);
+  dfsan_set_label(b, &cb, 1);
+
+  // Two sub-word stores with different labels split the word.
+  buf[1] = ca;
+  buf[2] = cb;
+  assert(dfsan_get_label(buf[0]) == 0);
+  assert(dfsan_get_label(buf[1]) == a);
+  assert(dfsan_get_label(buf[2]) == b);
+  assert(dfsan_get_label(buf[3]) == 0);
+  assert(dfsan_read_label(&buf[1], 1) == a);
+
+  // The split survives a copy, aligned or not.
+  memcpy(copy, buf, sizeof(buf));
+  assert(dfsan_get_label(copy[1]) == a);
+  assert(dfsan_get_label(copy[2]) == b);
+  memcpy(copy + 1, buf, sizeof(buf));
+  assert(dfsan_get_label(copy[1]) == 0);
+  assert(dfsan_get_label(copy[2]) == a);
+  assert(dfsan_get_label(copy[3]) == b);
+
+  // Storing unlabeled bytes back folds the word to a uniform label, which
+  // dfsan_read_label requires of the whole range.
+  char zero = 0;
+  buf[1] = zero;
+  buf[2] = zero;
+  assert(dfsan_read_label(buf, sizeof(buf)) == 0);
+
+  // So does labelling every byte of the word alike.
+  buf[5] = ca;
+  buf[6] = cb;
+  dfsan_set_label(a, buf, sizeof(buf));
+  assert(dfsan_read_label(buf, sizeof(buf)) == a);
+  dfsan_set_label(0, buf, sizeof(buf));
+
+  // A chunk handed out again does not keep the split of its last use.
+  char *p = malloc(64);
+  p[3] = ca;
+  p[4] = cb;
+  free(p);
+  char *q = malloc(64);
+  assert(q == p);
+  assert(dfsan_read_label(q, 64) == 0);
+  free(q);
+  return 0;
+}
@@ -0,0 +1,34 @@
+// RUN: %clang_dfsan %s -o %t
+// RUN: %clang_dfsan -mllvm -dfsan-site-tables=0 %s -o %t.args
+// RUN: DFSAN_OPTIONS=path_logfile=%t.csv:path_block=4 %run %t %s
+// RUN: DFSAN_OPTIONS=path_logfile=%t.args.csv:path_block=4 %run %t.args %s
+// RUN: diff %t.csv %t.args.csv
+// RUN: FileCheck %s < %t.csv
+
+// Tests that branches passing a site descriptor record the same path
+// signature as branches passing their ids, and that the per-site path slots
+// follow the path across loop iterations.
+
+#include <stdio.h>
+
+int main(int argc, char **argv) {
+  char buf[16];
+  FILE *f = fopen(argv[1], "r");
+  fread(buf, 1, sizeof(buf), f);
+  fclose(f);
+
+  int slashes = 0, spaces = 0;
+  for (int i = 0; i < 10; ++i) {
+    if (buf[i] == '/')
+      ++slashes;
+    if (buf[i] == ' ')
+      ++spaces;
+  }
+  printf("%d %d\n", slashes, spaces);
+  return 0;
+}
+
+// CHECK: visits,{{[1-9][0-9]*}},4
+// CHECK: read,0,16,{{[0-9]+}}
+// CHECK-DAG: site,{{[0-9]+}},{{[0-9]+}},{{[0-9]+}},{{[0-9]+}},10{{$}}
+// CHECK-DAG: site,{{[0-9]+}},{{[0-9]+}},{{[0-9]+}},{{[0-9]+}},11{{$}}
@@ -0,0 +1,39 @@
+// RUN: %clang_dfsan -fsanitize-coverage=trace-cmp %s -o %t
+// RUN: DFSAN_OPTIONS=cmp_logfile=%t.csv %run %t > %t.out
+// RUN: cat %t.out %t.csv | FileCheck %s
+
+// Tests that the default trace-cmp hooks record comparisons and switches on
+// labeled values, and skip those on unlabeled values.
+
+#include <sanitizer/dfsan_interface.h>
+#include <stdio.h>
+
+volatile int sink;
+
+int main(void) {
+  int x = 9, y = 4;
+  // The runtime creates labels of its own at startup, so the label of x is
+  // printed rather than assumed.
+  dfsan_label x_label = dfsan_create_label("x");
+  dfsan_set_label(x_label, &x, sizeof(x));
+  printf("x_label=%u\n", x_label);
+  fflush(stdout);
+
+  // CHECK: x_label=[[X:[0-9]+]]
+  // CHECK: pc,kind,size,lhs_label,rhs_label,lhs_val,rhs_val,lhs_ndx,lhs_pdx,rhs_ndx,rhs_pdx,context
+  // CHECK: ,{{(const_)?}}cmp,4,[[X]],0,9,4,
+  if (x > y)
+    sink = 1;
+
+  // CHECK-NOT: ,4,4,
+  if (y > 4)
+    sink = 2;
+
+  // CHECK: ,switch,4,[[X]],0,9,10,
+  switch (x) {
+  case 1: sink = 3; break;
+  case 10: sink = 4; break;
+  case 20: sink = 5; break;
+  }
+  return 0;
+}
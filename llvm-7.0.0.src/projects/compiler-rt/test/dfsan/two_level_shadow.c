@@ -0,0 +1,77 @@
+// RUN: %clang_dfsan -mllvm -dfsan-two-level-shadow %s -o %t && %run %t
+
+// Tests the two-level shadow: labels, copies and unions of data straddling
+// two shadow chunks, reads from chunks that were never backed, and that the
+// shadow of freed memory goes back to the OS.
+
+#include <sanitizer/dfsan_interface.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Must match kShadowChunkShift in dfsan_platform.h.
+#define CHUNK (1 << 16)
+
+static char region[4 * CHUNK] __attribute__((aligned(CHUNK)));
+static char untouched[2 * CHUNK] __attribute__((aligned(CHUNK)));
+
+static long rss_kb(void) {
+  long pages = 0, resident = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  assert(f && fscanf(f, "%ld %ld", &pages, &resident) == 2);
+  fclose(f);
+  return resident * 4;
+}
+
+int main(void) {
+  dfsan_label a = dfsan_create_label("a");
+  dfsan_label b = dfsan_create_label("b");
+
+  // Eight bytes across the boundary of the first and second chunk.
+  char *p = region + CHUNK - 4;
+  dfsan_set_label(a, p, 8);
+  assert(dfsan_read_label(p, 8) == a);
+  assert(dfsan_read_label(p - 1, 1) == 0);
+  assert(dfsan_read_label(p + 8, 1) == 0);
+
+  long v;
+  memcpy(&v, p, sizeof(v));
+  assert(dfsan_get_label(v) == a);
+
+  // An inline store across the boundary is split by the runtime.
+  long w = 7;
+  dfsan_set_label(b, &w, sizeof(w));
+  char *q = region + 2 * CHUNK - 4;
+  *(long *)q = w;
+  assert(dfsan_read_label(q, 8) == b);
+  assert(dfsan_get_label(*(long *)q) == b);
+
+  // memcpy between straddling ranges, into a chunk not yet backed.
+  char *r = region + 3 * CHUNK - 4;
+  memcpy(r, p, 8);
+  assert(dfsan_read_label(r, 8) == a);
+
+  // A union of values loaded across chunk boundaries.
+  long sum = *(long *)p + *(long *)q;
+  dfsan_label u = dfsan_get_label(sum);
+  assert(dfsan_has_label(u, a) && dfsan_has_label(u, b));
+
+  // Chunks that were never written read as unlabeled without being backed.
+  assert(dfsan_read_label(untouched, sizeof(untouched)) == 0);
+  assert(dfsan_get_label(untouched[CHUNK + 5]) == 0);
+
+  // Freeing a large, labeled block returns its shadow to the OS, and a new
+  // block in its place starts out unlabeled.
+  size_t size = 64 << 20;
+  long before = rss_kb();
+  char *big = malloc(size);
+  dfsan_set_label(a, big, size);
+  assert(rss_kb() - before >= 2 * (size >> 10) - (16 << 10));
+  free(big);
+  assert(rss_kb() - before < (16 << 10));
+  big = malloc(size);
+  assert(dfsan_read_label(big, size) == 0);
+  free(big);
+  return 0;
+}
@@ -0,0 +1,32 @@
+; RUN: opt < %s -dfsan -dfsan-preserve-most -S | FileCheck %s --check-prefixes=CHECK,SITE
+; RUN: opt < %s -dfsan -dfsan-preserve-most -dfsan-site-tables=0 -S | FileCheck %s --check-prefixes=CHECK,NOSITE
+; RUN: opt < %s -dfsan -S | FileCheck %s --check-prefix=OFF
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+; Check that with -dfsan-preserve-most unions are called through a
+; preserve_most stub, and that the stub passes its return address, the
+; instrumented call site, to the _pc entry point.
+
+; CHECK-LABEL: @"dfs$add"
+; SITE: call preserve_mostcc zeroext i16 @dfsan.pm.__dfsan_union_site(
+; NOSITE: call preserve_mostcc zeroext i16 @dfsan.pm.__dfsan_union(
+; OFF-LABEL: @"dfs$add"
+; OFF-NOT: preserve_mostcc
+; OFF-NOT: dfsan.pm.
+define i32 @add(i32 %x, i32 %y) {
+  %s = add i32 %x, %y
+  ret i32 %s
+}
+
+; SITE: declare zeroext i16 @__dfsan_union_site_pc(i16 zeroext, i16 zeroext, i32, i32, {{.*}}, i64)
+; NOSITE: declare zeroext i16 @__dfsan_union_pc(i16 zeroext, i16 zeroext, i32, i32, {{.*}}, i64)
+
+; SITE: define linkonce_odr hidden preserve_mostcc zeroext i16 @dfsan.pm.__dfsan_union_site({{.*}}) {{.*}}comdat
+; NOSITE: define linkonce_odr hidden preserve_mostcc zeroext i16 @dfsan.pm.__dfsan_union({{.*}}) {{.*}}comdat
+; CHECK-NEXT: entry:
+; CHECK-NEXT: [[RA:%.*]] = call i8* @llvm.returnaddress(i32 0)
+; CHECK-NEXT: [[PC:%.*]] = ptrtoint i8* [[RA]] to i64
+; SITE-NEXT: [[L:%.*]] = call zeroext i16 @__dfsan_union_site_pc({{.*}}, i64 [[PC]])
+; NOSITE-NEXT: [[L:%.*]] = call zeroext i16 @__dfsan_union_pc({{.*}}, i64 [[PC]])
+; CHECK-NEXT: ret i16 [[L]]
@@ -0,0 +1,48 @@
+; RUN: opt < %s -dfsan -dfsan-site-tables=0 -S | FileCheck %s --check-prefixes=CHECK,A
+; RUN: opt < %s -passes=dfsan -dfsan-site-tables=0 -S | FileCheck %s --check-prefixes=CHECK,A
+; RUN: sed -e 's/"a.c"/"b.c"/' %s | opt -dfsan -dfsan-site-tables=0 -S | FileCheck %s --check-prefixes=CHECK,B
+; RUN: opt < %S/Inputs/site-ids-promoted.ll -dfsan -dfsan-site-tables=0 -S | FileCheck %s --check-prefix=PROMOTED
+
+; Branch IDs are (MD5 of the function key << 20) | ordinal.  An external
+; function is keyed on its name alone; a local one on its name and the
+; module's source file, so that same-named locals in different files get
+; different IDs.  Inputs/site-ids-promoted.ll holds @helper as ThinLTO
+; promotes it, which must keep the ID it has here.
+
+source_filename = "a.c"
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+; MD5("dfs$helper\0a.c") and MD5("dfs$helper\0b.c")
+; CHECK-LABEL: define internal i32 @"dfs$helper"
+; A: call void @__branch_visitor_int({{.*}}, i64 1999781242709475328, i16 0,
+; B: call void @__branch_visitor_int({{.*}}, i64 7925182778304364544, i16 0,
+; PROMOTED-LABEL: define hidden i32 @"dfs$helper.llvm.4242"
+; PROMOTED: call void @__branch_visitor_int({{.*}}, i64 1999781242709475328, i16 0,
+define internal i32 @helper(i32 %x, i32 %y) {
+entry:
+  %c = icmp slt i32 %x, %y
+  br i1 %c, label %t, label %f
+t:
+  ret i32 1
+f:
+  ret i32 0
+}
+
+; MD5("dfs$pub"), whatever the source file; the second branch has ordinal 1.
+; CHECK-LABEL: define i32 @"dfs$pub"
+; CHECK: call void @__branch_visitor_int({{.*}}, i64 -3160128250070433792, i16 0,
+; CHECK: call void @__branch_visitor_int({{.*}}, i64 -3160128250070433791, i16 0,
+define i32 @pub(i32 %x, i32 %y) {
+entry:
+  %c = icmp slt i32 %x, %y
+  br i1 %c, label %t, label %f
+t:
+  %d = icmp eq i32 %x, 0
+  br i1 %d, label %f, label %r
+f:
+  ret i32 0
+r:
+  %h = call i32 @helper(i32 %x, i32 %y)
+  ret i32 %h
+}
@@ -0,0 +1,980 @@
+//===- llvm-pga-query.cpp - Indexed queries over PGA gradient logs --------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This tool ingests the gradient.csv and branches.csv files written by the
+// DataFlowSanitizer gradient runtime into a columnar index, and answers
+// queries against it:
+//
+//   llvm-pga-query ingest -o run.pgaidx -gradient gradient.csv
+//       branches.0.csv@0 branches.1.csv@1 ...
+//   llvm-pga-query top   -index run.pgaidx -k 20
+//   llvm-pga-query byte  -index run.pgaidx -input-byte 100
+//   llvm-pga-query chain -index run.pgaidx -label 42
+//   llvm-pga-query flip  -index run.pgaidx -k 20
+//
+// A branch log may be suffixed with @<byte> to record which input byte was
+// marked (FREAD_BYTE_IDX) when it was produced.  The logs of a program that
+// forks or execs can be ingested together from the runtime's log_manifest
+// with -manifest, which gives every process's labels their own ids.  CSV
+// files are split into line-aligned chunks that are parsed in parallel.  The
+// index is a header followed by one 8-byte aligned array per column and a
+// string table; it is memory mapped on open, so queries start without parsing
+// anything.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+#include <vector>
+
+using namespace llvm;
+
+static cl::SubCommand IngestSub("ingest", "Build an index from PGA logs");
+static cl::SubCommand TopSub("top", "Branch sites ranked by |gradient|");
+static cl::SubCommand ByteSub("byte", "Branch sites reached by an input byte");
+static cl::SubCommand ChainSub("chain", "Provenance chain of a label");
+static cl::SubCommand FlipSub("flip", "Branch sites ranked by flip distance");
+
+static cl::list<std::string> BranchLogs(cl::Positional, cl::ZeroOrMore,
+                                        cl::desc("<branches.csv[@byte]>..."),
+                                        cl::sub(IngestSub));
+static cl::opt<std::string> GradientLog("gradient",
+                                        cl::desc("gradient.csv to ingest"),
+                                        cl::sub(IngestSub));
+static cl::opt<std::string>
+    Manifest("manifest",
+             cl::desc("log_manifest of a run whose per-process logs to merge"),
+             cl::sub(IngestSub));
+static cl::opt<std::string> OutputIndex("o", cl::Required,
+                                        cl::desc("Output index file"),
+                                        cl::sub(IngestSub));
+static cl::opt<int>
+    DefaultByte("byte", cl::init(-1),
+                cl::desc("Input byte for branch logs without an @ suffix"),
+                cl::sub(IngestSub));
+static cl::opt<unsigned>
+    Threads("j", cl::init(0),
+            cl::desc("Ingestion threads (0 = hardware concurrency)"),
+            cl::sub(IngestSub));
+
+static cl::opt<std::string> IndexFile("index", cl::Required,
+                                      cl::desc("Index built by 'ingest'"),
+                                      cl::sub(TopSub), cl::sub(ByteSub),
+                                      cl::sub(ChainSub), cl::sub(FlipSub));
+static cl::opt<unsigned> TopK("k", cl::init(20),
+                              cl::desc("Number of sites to print"),
+                              cl::sub(TopSub), cl::sub(FlipSub));
+static cl::opt<int> InputByte("input-byte", cl::Required,
+                             cl::desc("Marked input byte"),
+                             cl::sub(ByteSub));
+static cl::opt<uint32_t> ChainLabel("label", cl::Required,
+                                    cl::desc("Label to expand"),
+                                    cl::sub(ChainSub));
+
+static ExitOnError ExitOnErr;
+
+//===----------------------------------------------------------------------===//
+// Index layout
+//===----------------------------------------------------------------------===//
+
+#define PGA_BRANCH_COLUMNS(X)                                                  \
+  X(uint64_t, FileId)                                                          \
+  X(uint64_t, InstId)                                                          \
+  X(int64_t, InputByte)                                                        \
+  X(uint32_t, LhsLabel)                                                        \
+  X(uint32_t, RhsLabel)                                                        \
+  X(uint32_t, Loc)                                                             \
+  X(float, LhsVal)                                                             \
+  X(float, RhsVal)                                                             \
+  X(float, LhsNdx)                                                             \
+  X(float, LhsPdx)                                                             \
+  X(float, RhsNdx)                                                             \
+  X(float, RhsPdx)                                                             \
+  X(uint32_t, Context)                                                         \
+  X(uint8_t, Cond)                                                             \
+  X(uint8_t, IsPtr)
+
+#define PGA_LABEL_COLUMNS(X)                                                   \
+  X(uint32_t, Label)                                                           \
+  X(uint32_t, L1)                                                              \
+  X(uint32_t, L2)                                                              \
+  X(uint32_t, Loc)                                                             \
+  X(uint32_t, Opcode)                                                          \
+  X(int32_t, FVal)                                                             \
+  X(float, Ndx)                                                                \
+  X(float, Pdx)
+
+#define PGA_COUNT_COLUMN(Type, Name) +1
+static const unsigned NumBranchColumns = 0 PGA_BRANCH_COLUMNS(PGA_COUNT_COLUMN);
+static const unsigned NumLabelColumns = 0 PGA_LABEL_COLUMNS(PGA_COUNT_COLUMN);
+#undef PGA_COUNT_COLUMN
+
+static const char IndexMagic[8] = {'P', 'G', 'A', 'I', 'D', 'X', '2', '\0'};
+
+namespace {
+
+struct IndexHeader {
+  char Magic[8];
+  uint64_t NumBranches;
+  uint64_t NumLabels;
+  uint64_t NumStrings;
+  uint64_t BranchColumns[NumBranchColumns];
+  uint64_t LabelColumns[NumLabelColumns];
+  // NumStrings + 1 offsets into StringData.
+  uint64_t StringOffsets;
+  uint64_t StringData;
+};
+
+#define PGA_VECTOR_COLUMN(Type, Name) std::vector<Type> Name;
+struct BranchTable {
+  PGA_BRANCH_COLUMNS(PGA_VECTOR_COLUMN)
+};
+struct LabelTable {
+  PGA_LABEL_COLUMNS(PGA_VECTOR_COLUMN)
+};
+#undef PGA_VECTOR_COLUMN
+
+/// Assigns dense IDs to strings.  Each ingestion chunk has its own; the
+/// chunk IDs are remapped into the index-wide table when chunks are merged.
+class StringInterner {
+  StringMap<uint32_t> IDs;
+  std::vector<StringRef> Strings;
+
+public:
+  uint32_t intern(StringRef S) {
+    auto It = IDs.insert(std::make_pair(S, (uint32_t)Strings.size()));
+    if (It.second)
+      Strings.push_back(It.first->getKey());
+    return It.first->second;
+  }
+  ArrayRef<StringRef> strings() const { return Strings; }
+};
+
+//===----------------------------------------------------------------------===//
+// CSV ingestion
+//===----------------------------------------------------------------------===//
+
+/// Maps the columns named in a CSV header to field positions.
+struct CSVHeader {
+  StringMap<unsigned> Columns;
+  unsigned NumFields = 0;
+
+  explicit CSVHeader(StringRef Line) {
+    SmallVector<StringRef, 16> Fields;
+    Line.split(Fields, ',');
+    for (unsigned I = 0; I != Fields.size(); ++I)
+      Columns[Fields[I].trim()] = I;
+    NumFields = Fields.size();
+  }
+
+  int find(StringRef Name) const {
+    auto It = Columns.find(Name);
+    return It == Columns.end() ? -1 : (int)It->second;
+  }
+};
+
+/// Splits a row into the header's fields.  Locations are free-form label
+/// descriptions and may contain commas; extra fields are folded back into the
+/// location column.
+static bool splitRow(StringRef Line, const CSVHeader &H, int LocColumn,
+                     SmallVectorImpl<StringRef> &Fields) {
+  Fields.clear();
+  Line.split(Fields, ',');
+  if (Fields.size() < H.NumFields)
+    return false;
+  unsigned Extra = Fields.size() - H.NumFields;
+  if (Extra && LocColumn >= 0) {
+    StringRef &Loc = Fields[LocColumn];
+    const char *End = Fields[LocColumn + Extra].end();
+    Loc = StringRef(Loc.begin(), End - Loc.begin());
+    Fields.erase(Fields.begin() + LocColumn + 1,
+                 Fields.begin() + LocColumn + 1 + Extra);
+  }
+  return true;
+}
+
+static uint64_t parseUInt(StringRef S) {
+  uint64_t V = 0;
+  if (S.trim().getAsInteger(10, V))
+    return 0;
+  return V;
+}
+
+static int64_t parseInt(StringRef S) {
+  int64_t V = 0;
+  if (S.trim().getAsInteger(10, V))
+    return 0;
+  return V;
+}
+
+static float parseFloat(StringRef S) {
+  char Buf[64];
+  size_t N = std::min(S.size(), sizeof(Buf) - 1);
+  memcpy(Buf, S.data(), N);
+  Buf[N] = '\0';
+  return strtof(Buf, nullptr);
+}
+
+static StringRef field(ArrayRef<StringRef> Fields, int Column) {
+  return Column < 0 ? StringRef() : Fields[Column];
+}
+
+/// Splits Body into about N line-aligned pieces.
+static std::vector<StringRef> splitChunks(StringRef Body, unsigned N) {
+  std::vector<StringRef> Chunks;
+  size_t Target = std::max<size_t>(Body.size() / std::max(N, 1u), 1 << 20);
+  while (!Body.empty()) {
+    size_t Cut = Body.size();
+    if (Body.size() > Target) {
+      Cut = Body.find('\n', Target);
+      Cut = Cut == StringRef::npos ? Body.size() : Cut + 1;
+    }
+    Chunks.push_back(Body.substr(0, Cut));
+    Body = Body.substr(Cut);
+  }
+  return Chunks;
+}
+
+struct BranchChunk {
+  BranchTable Rows;
+  StringInterner Strings;
+};
+
+struct LabelChunk {
+  LabelTable Rows;
+  StringInterner Strings;
+};
+
+static void parseBranchChunk(StringRef Text, const CSVHeader &H,
+                             int64_t Byte, BranchChunk &Out) {
+  int FileId = H.find("file_id"), InstId = H.find("inst_id");
+  int LhsLabel = H.find("lhs_label"), RhsLabel = H.find("rhs_label");
+  int LhsVal = H.find("lhs_val"), RhsVal = H.find("rhs_val");
+  int LhsNdx = H.find("lhs_ndx"), LhsPdx = H.find("lhs_pdx");
+  int RhsNdx = H.find("rhs_ndx"), RhsPdx = H.find("rhs_pdx");
+  int Cond = H.find("cond_val"), IsPtr = H.find("is_ptr");
+  int Loc = H.find("location"), Context = H.find("context");
+
+  BranchTable &R = Out.Rows;
+  SmallVector<StringRef, 16> F;
+  while (!Text.empty()) {
+    StringRef Line;
+    std::tie(Line, Text) = Text.split('\n');
+    Line = Line.rtrim("\r");
+    if (Line.empty() || !splitRow(Line, H, Loc, F))
+      continue;
+    R.FileId.push_back(parseUInt(field(F, FileId)));
+    R.InstId.push_back(parseUInt(field(F, InstId)));
+    R.InputByte.push_back(Byte);
+    R.LhsLabel.push_back(parseUInt(field(F, LhsLabel)));
+    R.RhsLabel.push_back(parseUInt(field(F, RhsLabel)));
+    R.Loc.push_back(Out.Strings.intern(field(F, Loc)));
+    R.LhsVal.push_back(parseFloat(field(F, LhsVal)));
+    R.RhsVal.push_back(parseFloat(field(F, RhsVal)));
+    R.LhsNdx.push_back(parseFloat(field(F, LhsNdx)));
+    R.LhsPdx.push_back(parseFloat(field(F, LhsPdx)));
+    R.RhsNdx.push_back(parseFloat(field(F, RhsNdx)));
+    R.RhsPdx.push_back(parseFloat(field(F, RhsPdx)));
+    R.Context.push_back(parseUInt(field(F, Context)));
+    R.Cond.push_back(parseUInt(field(F, Cond)) != 0);
+    R.IsPtr.push_back(parseUInt(field(F, IsPtr)) != 0);
+  }
+}
+
+static void parseLabelChunk(StringRef Text, const CSVHeader &H,
+                            LabelChunk &Out) {
+  int Label = H.find("label"), L1 = H.find("l1"), L2 = H.find("l2");
+  int Ndx = H.find("ndx"), Pdx = H.find("pdx"), FVal = H.find("f_val");
+  int Opcode = H.find("opcode"), Loc = H.find("location");
+
+  LabelTable &R = Out.Rows;
+  SmallVector<StringRef, 16> F;
+  while (!Text.empty()) {
+    StringRef Line;
+    std::tie(Line, Text) = Text.split('\n');
+    Line = Line.rtrim("\r");
+    if (Line.empty() || !splitRow(Line, H, Loc, F))
+      continue;
+    R.Label.push_back(parseUInt(field(F, Label)));
+    R.L1.push_back(parseUInt(field(F, L1)));
+    R.L2.push_back(parseUInt(field(F, L2)));
+    R.Loc.push_back(Out.Strings.intern(field(F, Loc)));
+    R.Opcode.push_back(Out.Strings.intern(field(F, Opcode)));
+    R.FVal.push_back(parseInt(field(F, FVal)));
+    R.Ndx.push_back(parseFloat(field(F, Ndx)));
+    R.Pdx.push_back(parseFloat(field(F, Pdx)));
+  }
+}
+
+template <typename T>
+static void append(std::vector<T> &Dst, const std::vector<T> &Src) {
+  Dst.insert(Dst.end(), Src.begin(), Src.end());
+}
+
+static std::vector<uint32_t> remapStrings(const StringInterner &From,
+                                          StringInterner &To) {
+  std::vector<uint32_t> Map;
+  for (StringRef S : From.strings())
+    Map.push_back(To.intern(S));
+  return Map;
+}
+
+static void mergeBranches(BranchTable &Dst, const BranchChunk &C,
+                          StringInterner &Strings) {
+  std::vector<uint32_t> Map = remapStrings(C.Strings, Strings);
+#define PGA_APPEND_COLUMN(Type, Name) append(Dst.Name, C.Rows.Name);
+  PGA_BRANCH_COLUMNS(PGA_APPEND_COLUMN)
+#undef PGA_APPEND_COLUMN
+  size_t Base = Dst.Loc.size() - C.Rows.Loc.size();
+  for (size_t I = Base, E = Dst.Loc.size(); I != E; ++I)
+    Dst.Loc[I] = Map[Dst.Loc[I]];
+}
+
+static void mergeLabels(LabelTable &Dst, const LabelChunk &C,
+                        StringInterner &Strings) {
+  std::vector<uint32_t> Map = remapStrings(C.Strings, Strings);
+#define PGA_APPEND_COLUMN(Type, Name) append(Dst.Name, C.Rows.Name);
+  PGA_LABEL_COLUMNS(PGA_APPEND_COLUMN)
+#undef PGA_APPEND_COLUMN
+  size_t Base = Dst.Loc.size() - C.Rows.Loc.size();
+  for (size_t I = Base, E = Dst.Loc.size(); I != E; ++I) {
+    Dst.Loc[I] = Map[Dst.Loc[I]];
+    Dst.Opcode[I] = Map[Dst.Opcode[I]];
+  }
+}
+
+/// Reads one CSV file and parses its chunks on Pool.  The returned buffer
+/// owns the text the chunks' interned strings point into.
+template <typename ChunkT, typename ParseFn>
+static std::unique_ptr<MemoryBuffer>
+parseCSV(StringRef Path, ThreadPool &Pool, unsigned NumThreads,
+         std::vector<ChunkT> &Chunks, std::unique_ptr<CSVHeader> &Header,
+         ParseFn Parse) {
+  auto BufOrErr = MemoryBuffer::getFile(Path, /*FileSize=*/-1,
+                                        /*RequiresNullTerminator=*/false);
+  if (!BufOrErr)
+    ExitOnErr(errorCodeToError(BufOrErr.getError()));
+  std::unique_ptr<MemoryBuffer> Buf = std::move(*BufOrErr);
+
+  StringRef HeaderLine, Body;
+  std::tie(HeaderLine, Body) = Buf->getBuffer().split('\n');
+  Header = llvm::make_unique<CSVHeader>(HeaderLine.rtrim("\r"));
+
+  std::vector<StringRef> Pieces = splitChunks(Body, NumThreads);
+  Chunks.resize(Pieces.size());
+  const CSVHeader *H = Header.get();
+  for (size_t I = 0; I != Pieces.size(); ++I) {
+    StringRef Piece = Pieces[I];
+    ChunkT *Chunk = &Chunks[I];
+    Pool.async([=] { Parse(Piece, *H, *Chunk); });
+  }
+  return Buf;
+}
+
+/// Sorts label rows by label, as Index::findLabel expects, and drops repeated
+/// labels, which a forked process shares with its parent.
+static void sortLabels(LabelTable &L) {
+  std::vector<size_t> Order(L.Label.size());
+  std::iota(Order.begin(), Order.end(), 0);
+  std::stable_sort(Order.begin(), Order.end(), [&](size_t A, size_t B) {
+    return L.Label[A] < L.Label[B];
+  });
+  Order.erase(std::unique(Order.begin(), Order.end(),
+                          [&](size_t A, size_t B) {
+                            return L.Label[A] == L.Label[B];
+                          }),
+              Order.end());
+  LabelTable Sorted;
+#define PGA_PERMUTE_COLUMN(Type, Name)                                         \
+  for (size_t I : Order)                                                       \
+    Sorted.Name.push_back(L.Name[I]);
+  PGA_LABEL_COLUMNS(PGA_PERMUTE_COLUMN)
+#undef PGA_PERMUTE_COLUMN
+  L = std::move(Sorted);
+}
+
+//===----------------------------------------------------------------------===//
+// Per-process logs
+//===----------------------------------------------------------------------===//
+
+/// One instrumented process of a run, from the runtime's log_manifest.
+struct ManifestProcess {
+  uint64_t Pid = 0;
+  uint64_t ParentPid = 0;
+  uint32_t ForkLabel = 0;
+  uint32_t LastLabel = 0;
+  uint32_t LabelBase = 0;
+  /// Position of the parent in the manifest, or of the process itself.
+  unsigned Parent = 0;
+  std::string GradientLog;
+  std::string BranchLog;
+};
+
+/// The processes of a run and how their labels map to index-wide ids.  A
+/// forked child shares labels up to its ForkLabel with its parent; its later
+/// labels, and all labels of a process with no parent in the manifest, get
+/// ids of their own.
+class ProcessMap {
+  std::vector<ManifestProcess> Procs;
+
+public:
+  static Expected<ProcessMap> read(StringRef Path);
+
+  ArrayRef<ManifestProcess> processes() const { return Procs; }
+
+  uint32_t mapLabel(unsigned Proc, uint32_t Label) const {
+    if (!Label)
+      return 0;
+    for (size_t Hops = 0;
+         Label <= Procs[Proc].ForkLabel && Hops != Procs.size(); ++Hops)
+      Proc = Procs[Proc].Parent;
+    return Procs[Proc].LabelBase + Label - Procs[Proc].ForkLabel;
+  }
+};
+
+/// Reads lines of "pid,parent pid,fork label,last label,flag,path".  Relative
+/// paths are taken relative to the manifest.
+Expected<ProcessMap> ProcessMap::read(StringRef Path) {
+  auto BufOrErr = MemoryBuffer::getFile(Path);
+  if (!BufOrErr)
+    return errorCodeToError(BufOrErr.getError());
+  StringRef Dir = sys::path::parent_path(Path);
+
+  ProcessMap M;
+  DenseMap<uint64_t, unsigned> ByPid;
+  SmallVector<StringRef, 6> F;
+  StringRef Text = (*BufOrErr)->getBuffer();
+  while (!Text.empty()) {
+    StringRef Line;
+    std::tie(Line, Text) = Text.split('\n');
+    Line = Line.rtrim("\r");
+    if (Line.empty())
+      continue;
+    F.clear();
+    Line.split(F, ',', /*MaxSplit=*/5);
+    if (F.size() != 6)
+      return make_error<StringError>(Path + ": bad manifest line '" + Line +
+                                         "'",
+                                     inconvertibleErrorCode());
+    uint64_t Pid = parseUInt(F[0]);
+    auto It = ByPid.insert(std::make_pair(Pid, (unsigned)M.Procs.size()));
+    if (It.second) {
+      M.Procs.emplace_back();
+      M.Procs.back().Pid = Pid;
+    }
+    ManifestProcess &P = M.Procs[It.first->second];
+    P.ParentPid = parseUInt(F[1]);
+    P.ForkLabel = parseUInt(F[2]);
+    P.LastLabel = std::max<uint32_t>(parseUInt(F[3]), P.ForkLabel);
+    SmallString<256> LogPath(F[5]);
+    if (sys::path::is_relative(LogPath)) {
+      LogPath = Dir;
+      sys::path::append(LogPath, F[5]);
+    }
+    if (F[4] == "gradient_logfile")
+      P.GradientLog = LogPath.str();
+    else if (F[4] == "branch_logfile")
+      P.BranchLog = LogPath.str();
+  }
+
+  for (unsigned I = 0; I != M.Procs.size(); ++I) {
+    ManifestProcess &P = M.Procs[I];
+    auto It = ByPid.find(P.ParentPid);
+    if (It == ByPid.end() || It->second == I ||
+        M.Procs[It->second].LastLabel < P.ForkLabel)
+      P.ForkLabel = 0;
+    P.Parent = P.ForkLabel ? It->second : I;
+  }
+  // Processes that own all their labels come first, so that a run without
+  // children keeps its label ids.
+  uint32_t Next = 0;
+  for (bool Forked : {false, true})
+    for (ManifestProcess &P : M.Procs)
+      if ((P.ForkLabel != 0) == Forked) {
+        P.LabelBase = Next;
+        Next += P.LastLabel - P.ForkLabel;
+      }
+  return std::move(M);
+}
+
+//===----------------------------------------------------------------------===//
+// Writing and mapping the index
+//===----------------------------------------------------------------------===//
+
+template <typename T>
+static uint64_t layoutColumn(uint64_t &Offset, size_t N) {
+  uint64_t Start = Offset;
+  Offset += alignTo(N * sizeof(T), 8);
+  return Start;
+}
+
+template <typename T>
+static void writeColumn(raw_ostream &OS, const std::vector<T> &V) {
+  size_t Bytes = V.size() * sizeof(T);
+  OS.write(reinterpret_cast<const char *>(V.data()), Bytes);
+  OS.write_zeros(alignTo(Bytes, 8) - Bytes);
+}
+
+static void writeIndex(StringRef Path, const BranchTable &B,
+                       const LabelTable &L, const StringInterner &Strings) {
+  IndexHeader H;
+  memset(&H, 0, sizeof(H));
+  memcpy(H.Magic, IndexMagic, sizeof(IndexMagic));
+  H.NumBranches = B.FileId.size();
+  H.NumLabels = L.Label.size();
+  H.NumStrings = Strings.strings().size();
+
+  std::vector<uint64_t> StringOffsets;
+  uint64_t StringBytes = 0;
+  for (StringRef S : Strings.strings()) {
+    StringOffsets.push_back(StringBytes);
+    StringBytes += S.size() + 1;
+  }
+  StringOffsets.push_back(StringBytes);
+
+  uint64_t Offset = alignTo(sizeof(IndexHeader), 8);
+  unsigned Col = 0;
+#define PGA_LAYOUT_COLUMN(Type, Name)                                          \
+  H.BranchColumns[Col++] = layoutColumn<Type>(Offset, H.NumBranches);
+  PGA_BRANCH_COLUMNS(PGA_LAYOUT_COLUMN)
+#undef PGA_LAYOUT_COLUMN
+  Col = 0;
+#define PGA_LAYOUT_COLUMN(Type, Name)                                          \
+  H.LabelColumns[Col++] = layoutColumn<Type>(Offset, H.NumLabels);
+  PGA_LABEL_COLUMNS(PGA_LAYOUT_COLUMN)
+#undef PGA_LAYOUT_COLUMN
+  H.StringOffsets = layoutColumn<uint64_t>(Offset, StringOffsets.size());
+  H.StringData = Offset;
+
+  std::error_code EC;
+  raw_fd_ostream OS(Path, EC, sys::fs::F_None);
+  if (EC)
+    ExitOnErr(errorCodeToError(EC));
+  OS.write(reinterpret_cast<const char *>(&H), sizeof(H));
+  OS.write_zeros(alignTo(sizeof(IndexHeader), 8) - sizeof(H));
+#define PGA_WRITE_COLUMN(Type, Name) writeColumn(OS, B.Name);
+  PGA_BRANCH_COLUMNS(PGA_WRITE_COLUMN)
+#undef PGA_WRITE_COLUMN
+#define PGA_WRITE_COLUMN(Type, Name) writeColumn(OS, L.Name);
+  PGA_LABEL_COLUMNS(PGA_WRITE_COLUMN)
+#undef PGA_WRITE_COLUMN
+  writeColumn(OS, StringOffsets);
+  for (StringRef S : Strings.strings()) {
+    OS << S;
+    OS.write('\0');
+  }
+}
+
+/// Whether Rows values of Width bytes starting at Offset, which must be
+/// aligned to Align, lie inside a buffer of Size bytes.
+static bool columnFits(uint64_t Size, uint64_t Offset, uint64_t Rows,
+                       uint64_t Width, uint64_t Align) {
+  return Offset % Align == 0 && Offset <= Size &&
+         Rows <= (Size - Offset) / Width;
+}
+
+/// Read-only view of a mapped index.  Columns point straight into the file.
+class Index {
+  std::unique_ptr<MemoryBuffer> Buf;
+  const IndexHeader *H = nullptr;
+  const uint64_t *StringOffsets = nullptr;
+  const char *StringData = nullptr;
+
+public:
+#define PGA_POINTER_COLUMN(Type, Name) const Type *Name = nullptr;
+  struct {
+    PGA_BRANCH_COLUMNS(PGA_POINTER_COLUMN)
+  } Branches;
+  struct {
+    PGA_LABEL_COLUMNS(PGA_POINTER_COLUMN)
+  } Labels;
+#undef PGA_POINTER_COLUMN
+
+  static Expected<std::unique_ptr<Index>> open(StringRef Path);
+
+  uint64_t numBranches() const { return H->NumBranches; }
+  uint64_t numLabels() const { return H->NumLabels; }
+  StringRef string(uint32_t ID) const {
+    if (ID >= H->NumStrings)
+      return "";
+    return StringRef(StringData + StringOffsets[ID],
+                     StringOffsets[ID + 1] - StringOffsets[ID] - 1);
+  }
+  /// Row of Label in the label columns, or -1.  Rows are sorted by label.
+  int64_t findLabel(uint32_t Label) const {
+    const uint32_t *End = Labels.Label + H->NumLabels;
+    const uint32_t *It = std::lower_bound(Labels.Label, End, Label);
+    return It != End && *It == Label ? It - Labels.Label : -1;
+  }
+};
+
+Expected<std::unique_ptr<Index>> Index::open(StringRef Path) {
+  auto BufOrErr = MemoryBuffer::getFile(Path, /*FileSize=*/-1,
+                                        /*RequiresNullTerminator=*/false);
+  if (!BufOrErr)
+    return errorCodeToError(BufOrErr.getError());
+
+  std::unique_ptr<Index> Idx(new Index());
+  Idx->Buf = std::move(*BufOrErr);
+  StringRef Data = Idx->Buf->getBuffer();
+  auto Corrupt = [&]() {
+    return make_error<StringError>(Path + ": not a PGA index",
+                                   inconvertibleErrorCode());
+  };
+  if (Data.size() < sizeof(IndexHeader) ||
+      memcmp(Data.data(), IndexMagic, sizeof(IndexMagic)) != 0)
+    return Corrupt();
+
+  const IndexHeader *H = reinterpret_cast<const IndexHeader *>(Data.data());
+  auto Truncated = [&](StringRef Column) {
+    return make_error<StringError>(
+        Path + ": truncated index, column " + Column + " ends past the file",
+        inconvertibleErrorCode());
+  };
+  if (H->NumStrings == UINT64_MAX ||
+      !columnFits(Data.size(), H->StringOffsets, H->NumStrings + 1,
+                  sizeof(uint64_t), alignof(uint64_t)))
+    return Truncated("string_offsets");
+  Idx->H = H;
+  Idx->StringOffsets =
+      reinterpret_cast<const uint64_t *>(Data.data() + H->StringOffsets);
+  Idx->StringData = Data.data() + H->StringData;
+  if (!columnFits(Data.size(), H->StringData,
+                  Idx->StringOffsets[H->NumStrings], 1, 1))
+    return Truncated("string_data");
+
+  unsigned Col = 0;
+#define PGA_MAP_COLUMN(Type, Name)                                             \
+  if (!columnFits(Data.size(), H->BranchColumns[Col], H->NumBranches,          \
+                  sizeof(Type), alignof(Type)))                                \
+    return Truncated(#Name);                                                   \
+  Idx->Branches.Name =                                                         \
+      reinterpret_cast<const Type *>(Data.data() + H->BranchColumns[Col++]);
+  PGA_BRANCH_COLUMNS(PGA_MAP_COLUMN)
+#undef PGA_MAP_COLUMN
+  Col = 0;
+#define PGA_MAP_COLUMN(Type, Name)                                             \
+  if (!columnFits(Data.size(), H->LabelColumns[Col], H->NumLabels,             \
+                  sizeof(Type), alignof(Type)))                                \
+    return Truncated(#Name);                                                   \
+  Idx->Labels.Name =                                                           \
+      reinterpret_cast<const Type *>(Data.data() + H->LabelColumns[Col++]);
+  PGA_LABEL_COLUMNS(PGA_MAP_COLUMN)
+#undef PGA_MAP_COLUMN
+  return std::move(Idx);
+}
+
+} // end anonymous namespace
+
+//===----------------------------------------------------------------------===//
+// Subcommands
+//===----------------------------------------------------------------------===//
+
+/// A log to ingest, and the manifest process whose labels it holds (or -1).
+struct LogFile {
+  std::string Path;
+  int64_t Byte;
+  int Proc;
+};
+
+static int ingest() {
+  unsigned NumThreads = Threads ? Threads : hardware_concurrency();
+  ThreadPool Pool(NumThreads);
+
+  std::vector<LogFile> BranchFiles, GradientFiles;
+  std::unique_ptr<ProcessMap> Procs;
+  if (!Manifest.empty()) {
+    Procs = llvm::make_unique<ProcessMap>(
+        ExitOnErr(ProcessMap::read(Manifest)));
+    for (unsigned I = 0; I != Procs->processes().size(); ++I) {
+      const ManifestProcess &P = Procs->processes()[I];
+      if (!P.BranchLog.empty() && sys::fs::exists(P.BranchLog))
+        BranchFiles.push_back({P.BranchLog, DefaultByte, (int)I});
+      if (!P.GradientLog.empty() && sys::fs::exists(P.GradientLog))
+        GradientFiles.push_back({P.GradientLog, DefaultByte, (int)I});
+    }
+  }
+  for (StringRef Path : BranchLogs) {
+    int64_t Byte = DefaultByte;
+    size_t At = Path.rfind('@');
+    if (At != StringRef::npos && !Path.substr(At + 1).getAsInteger(10, Byte))
+      Path = Path.substr(0, At);
+    else
+      Byte = DefaultByte;
+    BranchFiles.push_back({Path, Byte, -1});
+  }
+  if (!GradientLog.empty())
+    GradientFiles.push_back({GradientLog, DefaultByte, -1});
+  if (BranchFiles.empty() && GradientFiles.empty()) {
+    WithColor::error() << "no logs to ingest\n";
+    return 1;
+  }
+
+  std::vector<std::unique_ptr<MemoryBuffer>> Buffers;
+  std::vector<std::unique_ptr<CSVHeader>> Headers;
+  std::vector<std::vector<BranchChunk>> BranchChunks(BranchFiles.size());
+  for (size_t I = 0; I != BranchFiles.size(); ++I) {
+    int64_t Byte = BranchFiles[I].Byte;
+    Headers.emplace_back();
+    Buffers.push_back(parseCSV(
+        BranchFiles[I].Path, Pool, NumThreads, BranchChunks[I],
+        Headers.back(),
+        [Byte](StringRef Text, const CSVHeader &H, BranchChunk &C) {
+          parseBranchChunk(Text, H, Byte, C);
+        }));
+  }
+
+  std::vector<std::vector<LabelChunk>> LabelChunks(GradientFiles.size());
+  for (size_t I = 0; I != GradientFiles.size(); ++I) {
+    Headers.emplace_back();
+    Buffers.push_back(parseCSV(GradientFiles[I].Path, Pool, NumThreads,
+                               LabelChunks[I], Headers.back(),
+                               parseLabelChunk));
+  }
+  Pool.wait();
+
+  StringInterner Strings;
+  BranchTable Branches;
+  for (size_t I = 0; I != BranchFiles.size(); ++I) {
+    size_t Begin = Branches.FileId.size();
+    for (auto &C : BranchChunks[I])
+      mergeBranches(Branches, C, Strings);
+    int Proc = BranchFiles[I].Proc;
+    for (size_t R = Begin, E = Branches.FileId.size(); Proc >= 0 && R != E;
+         ++R) {
+      Branches.LhsLabel[R] = Procs->mapLabel(Proc, Branches.LhsLabel[R]);
+      Branches.RhsLabel[R] = Procs->mapLabel(Proc, Branches.RhsLabel[R]);
+    }
+  }
+  LabelTable Labels;
+  for (size_t I = 0; I != GradientFiles.size(); ++I) {
+    size_t Begin = Labels.Label.size();
+    for (auto &C : LabelChunks[I])
+      mergeLabels(Labels, C, Strings);
+    int Proc = GradientFiles[I].Proc;
+    for (size_t R = Begin, E = Labels.Label.size(); Proc >= 0 && R != E;
+         ++R) {
+      Labels.Label[R] = Procs->mapLabel(Proc, Labels.Label[R]);
+      Labels.L1[R] = Procs->mapLabel(Proc, Labels.L1[R]);
+      Labels.L2[R] = Procs->mapLabel(Proc, Labels.L2[R]);
+    }
+  }
+  // Without a manifest there is nothing to dedupe, but a gradient log that
+  // is out of label order would still break findLabel's binary search.
+  sortLabels(Labels);
+
+  writeIndex(OutputIndex, Branches, Labels, Strings);
+  outs() << "indexed " << Branches.FileId.size() << " branch records and "
+         << Labels.Label.size() << " labels";
+  if (Procs)
+    outs() << " from " << Procs->processes().size() << " processes";
+  outs() << "\n";
+  return 0;
+}
+
+namespace {
+/// A branch site in one calling context (0 when contexts were not recorded).
+struct SiteKey {
+  uint64_t FileId;
+  uint64_t InstId;
+  uint32_t Context;
+  bool operator==(const SiteKey &O) const {
+    return FileId == O.FileId && InstId == O.InstId && Context == O.Context;
+  }
+};
+
+struct SiteStats {
+  SiteKey Key;
+  uint32_t Loc;
+  uint64_t Count;
+  float Value;
+};
+} // end anonymous namespace
+
+namespace llvm {
+template <> struct DenseMapInfo<SiteKey> {
+  static SiteKey getEmptyKey() { return {~0ULL, ~0ULL, 0}; }
+  static SiteKey getTombstoneKey() { return {~0ULL - 1, ~0ULL, 0}; }
+  static unsigned getHashValue(const SiteKey &K) {
+    return DenseMapInfo<std::pair<uint64_t, uint64_t>>::getHashValue(
+        std::make_pair(K.FileId, K.InstId ^ ((uint64_t)K.Context << 32)));
+  }
+  static bool isEqual(const SiteKey &A, const SiteKey &B) { return A == B; }
+};
+} // end namespace llvm
+
+static float absGradient(const Index &Idx, uint64_t Row) {
+  const auto &B = Idx.Branches;
+  float G = 0;
+  for (float D : {B.LhsNdx[Row], B.LhsPdx[Row], B.RhsNdx[Row], B.RhsPdx[Row]})
+    if (std::fabs(D) > G)
+      G = std::fabs(D);
+  return G;
+}
+
+/// Estimated change of the input needed to flip the branch at Row: the gap
+/// between the operands over the steepest directional derivative of their
+/// difference.  Returns a negative value when the operands do not move.
+static float flipDistance(const Index &Idx, uint64_t Row) {
+  const auto &B = Idx.Branches;
+  float Gap = std::fabs(B.LhsVal[Row] - B.RhsVal[Row]);
+  float Slope = std::max(std::fabs(B.LhsPdx[Row] - B.RhsPdx[Row]),
+                         std::fabs(B.LhsNdx[Row] - B.RhsNdx[Row]));
+  if (!(Slope > 0) || std::isnan(Gap))
+    return -1;
+  return Gap / Slope;
+}
+
+/// Groups rows accepted by Filter by site, keeping per site the largest
+/// (or smallest) Value.
+template <typename FilterFn, typename ValueFn>
+static std::vector<SiteStats> collectSites(const Index &Idx, bool KeepMax,
+                                           FilterFn Filter, ValueFn Value) {
+  DenseMap<SiteKey, unsigned> Slots;
+  std::vector<SiteStats> Sites;
+  const auto &B = Idx.Branches;
+  for (uint64_t Row = 0, E = Idx.numBranches(); Row != E; ++Row) {
+    if (!Filter(Row))
+      continue;
+    float V = Value(Row);
+    SiteKey K = {B.FileId[Row], B.InstId[Row], B.Context[Row]};
+    auto It = Slots.insert(std::make_pair(K, (unsigned)Sites.size()));
+    if (It.second) {
+      Sites.push_back({K, B.Loc[Row], 1, V});
+      continue;
+    }
+    SiteStats &S = Sites[It.first->second];
+    ++S.Count;
+    if (KeepMax ? V > S.Value : V < S.Value)
+      S.Value = V;
+  }
+  return Sites;
+}
+
+static void printSites(const Index &Idx, ArrayRef<SiteStats> Sites,
+                       StringRef ValueName, size_t Limit) {
+  outs() << "file_id,inst_id,context,location,count," << ValueName << "\n";
+  for (size_t I = 0, E = std::min(Limit, Sites.size()); I != E; ++I) {
+    const SiteStats &S = Sites[I];
+    outs() << S.Key.FileId << "," << S.Key.InstId << "," << S.Key.Context
+           << "," << Idx.string(S.Loc) << "," << S.Count << ","
+           << format("%g", S.Value) << "\n";
+  }
+}
+
+static int top(const Index &Idx) {
+  auto Sites = collectSites(
+      Idx, /*KeepMax=*/true, [](uint64_t) { return true; },
+      [&](uint64_t Row) { return absGradient(Idx, Row); });
+  std::sort(Sites.begin(), Sites.end(),
+            [](const SiteStats &A, const SiteStats &B) {
+              return A.Value > B.Value;
+            });
+  printSites(Idx, Sites, "max_abs_grad", TopK);
+  return 0;
+}
+
+static int byte(const Index &Idx) {
+  const int64_t *Bytes = Idx.Branches.InputByte;
+  auto Sites = collectSites(
+      Idx, /*KeepMax=*/true,
+      [&](uint64_t Row) { return Bytes[Row] == InputByte; },
+      [&](uint64_t Row) { return absGradient(Idx, Row); });
+  printSites(Idx, Sites, "max_abs_grad", Sites.size());
+  return 0;
+}
+
+static int flip(const Index &Idx) {
+  auto Sites = collectSites(
+      Idx, /*KeepMax=*/false,
+      [&](uint64_t Row) { return flipDistance(Idx, Row) >= 0; },
+      [&](uint64_t Row) { return flipDistance(Idx, Row); });
+  std::sort(Sites.begin(), Sites.end(),
+            [](const SiteStats &A, const SiteStats &B) {
+              return A.Value < B.Value;
+            });
+  printSites(Idx, Sites, "min_flip_distance", TopK);
+  return 0;
+}
+
+static void printChain(const Index &Idx, uint32_t Label, unsigned Depth,
+                       DenseMap<uint32_t, bool> &Seen) {
+  outs().indent(Depth * 2) << Label;
+  int64_t Row = Label ? Idx.findLabel(Label) : -1;
+  if (Row < 0) {
+    outs() << (Label ? " <not in index>\n" : "\n");
+    return;
+  }
+  const auto &L = Idx.Labels;
+  outs() << " " << Idx.string(L.Opcode[Row]) << " "
+         << Idx.string(L.Loc[Row]) << format(" ndx=%g pdx=%g", L.Ndx[Row],
+                                             L.Pdx[Row]);
+  if (!Seen.insert(std::make_pair(Label, true)).second) {
+    outs() << " (see above)\n";
+    return;
+  }
+  outs() << "\n";
+  if (L.L1[Row])
+    printChain(Idx, L.L1[Row], Depth + 1, Seen);
+  if (L.L2[Row])
+    printChain(Idx, L.L2[Row], Depth + 1, Seen);
+}
+
+static int chain(const Index &Idx) {
+  if (Idx.numLabels() == 0) {
+    WithColor::error() << IndexFile << ": index has no labels; ingest with "
+                       << "-gradient\n";
+    return 1;
+  }
+  DenseMap<uint32_t, bool> Seen;
+  printChain(Idx, ChainLabel, 0, Seen);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  ExitOnErr.setBanner(std::string(argv[0]) + ": ");
+  cl::ParseCommandLineOptions(argc, argv, "PGA gradient log query tool\n");
+
+  if (IngestSub)
+    return ingest();
+
+  std::unique_ptr<Index> Idx = ExitOnErr(Index::open(IndexFile));
+  if (TopSub)
+    return top(*Idx);
+  if (ByteSub)
+    return byte(*Idx);
+  if (ChainSub)
+    return chain(*Idx);
+  if (FlipSub)
+    return flip(*Idx);
+
+  cl::PrintHelpMessage();
+  return 1;
+}